@@ -0,0 +1,264 @@
+/*
+ * fakemy: minimal mysql backend for benchmark
+ *
+ * usage: fakemy port
+ *
+ * Accepts any login, answers COM_QUERY with one row of one column and other
+ * commands with OK, so the proxy is the only thing that costs cpu.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "../mysql_com.h"
+
+#define FAKE_MAX_FD 65536
+#define FAKE_CAPS (CLIENT_LONG_PASSWORD | CLIENT_PROTOCOL_41 | CLIENT_TRANSACTIONS | \
+                    CLIENT_SECURE_CONNECTION | CLIENT_MULTI_STATEMENTS | CLIENT_MULTI_RESULTS)
+
+typedef struct{
+    int authed;
+    uint32_t len;
+    uint8_t in[65536];
+} fake_conn_t;
+
+static fake_conn_t *conns[FAKE_MAX_FD];
+static uint8_t out[1 << 20];
+
+/*
+ * fun: append one packet
+ * arg: output, sequence number, payload, payload length
+ * ret: bytes appended
+ *
+ */
+
+static int put_pkt(uint8_t *o, int seq, const uint8_t *p, int n)
+{
+    o[0] = n & 0xff;
+    o[1] = (n >> 8) & 0xff;
+    o[2] = (n >> 16) & 0xff;
+    o[3] = seq;
+    memcpy(o + 4, p, n);
+
+    return n + 4;
+}
+
+/*
+ * fun: append length encoded string
+ * arg: output, string
+ * ret: bytes appended
+ *
+ */
+
+static int put_str(uint8_t *o, const char *s)
+{
+    int n = strlen(s);
+
+    o[0] = n;
+    memcpy(o + 1, s, n);
+
+    return n + 1;
+}
+
+static int put_ok(uint8_t *o, int seq)
+{
+    uint8_t p[] = {0, 0, 0, SERVER_STATUS_AUTOCOMMIT, 0, 0, 0};
+
+    return put_pkt(o, seq, p, sizeof(p));
+}
+
+static int put_eof(uint8_t *o, int seq)
+{
+    uint8_t p[] = {0xfe, 0, 0, SERVER_STATUS_AUTOCOMMIT, 0};
+
+    return put_pkt(o, seq, p, sizeof(p));
+}
+
+/*
+ * fun: append result set of one row "28800"
+ * arg: output
+ * ret: bytes appended
+ *
+ */
+
+static int put_result(uint8_t *o)
+{
+    int n = 0, k = 0;
+    uint8_t p[256];
+    uint8_t def[] = {0x0c, 33, 0, 0, 4, 0, 0, MYSQL_TYPE_VAR_STRING, 0, 0, 0, 0, 0};
+
+    p[0] = 1;
+    n += put_pkt(o + n, 1, p, 1);
+
+    k += put_str(p + k, "def");
+    k += put_str(p + k, "");
+    k += put_str(p + k, "t");
+    k += put_str(p + k, "t");
+    k += put_str(p + k, "v");
+    k += put_str(p + k, "v");
+    memcpy(p + k, def, sizeof(def));
+    k += sizeof(def);
+    n += put_pkt(o + n, 2, p, k);
+
+    n += put_eof(o + n, 3);
+    n += put_pkt(o + n, 4, p, put_str(p, "28800"));
+    n += put_eof(o + n, 5);
+
+    return n;
+}
+
+/*
+ * fun: send greeting
+ * arg: fd
+ * ret: void
+ *
+ */
+
+static void greet(int fd)
+{
+    int k = 0;
+    uint8_t p[256], o[300];
+
+    p[k++] = 10;
+    memcpy(p + k, "5.6.99-fake", 12);
+    k += 12;
+    memset(p + k, 1, 4);//线程id
+    k += 4;
+    memcpy(p + k, "abcdefgh", 8);
+    k += 8;
+    p[k++] = 0;
+    p[k++] = FAKE_CAPS & 0xff;
+    p[k++] = (FAKE_CAPS >> 8) & 0xff;
+    p[k++] = 33;
+    p[k++] = SERVER_STATUS_AUTOCOMMIT;
+    p[k++] = 0;
+    p[k++] = (FAKE_CAPS >> 16) & 0xff;
+    p[k++] = (FAKE_CAPS >> 24) & 0xff;
+    p[k++] = 21;
+    memset(p + k, 0, 10);
+    k += 10;
+    memcpy(p + k, "ijklmnopqrst", 12);
+    k += 12;
+    p[k++] = 0;
+    memcpy(p + k, "mysql_native_password", 22);
+    k += 22;
+
+    if(write(fd, o, put_pkt(o, 0, p, k)) < 0){
+        perror("write greeting");
+    }
+}
+
+/*
+ * fun: read and answer all complete packets on fd
+ * arg: fd
+ * ret: keep 0, close -1
+ *
+ */
+
+static int serve(int fd)
+{
+    int n, o = 0;
+    uint32_t pos = 0, pktlen;
+    uint8_t *p;
+    fake_conn_t *c = conns[fd];
+
+    if( (n = read(fd, c->in + c->len, sizeof(c->in) - c->len)) <= 0 ){
+        return -1;
+    }
+    c->len += n;
+
+    while(c->len - pos >= 4){
+        pktlen = c->in[pos] | (c->in[pos + 1] << 8) | (c->in[pos + 2] << 16);
+        if(c->len - pos < 4 + pktlen){
+            break;
+        }
+        p = c->in + pos + 4;
+
+        if(!c->authed){//什么密码都认
+            o += put_ok(out + o, c->in[pos + 3] + 1);
+            c->authed = 1;
+        } else if(p[0] == COM_QUIT){
+            return -1;
+        } else if(p[0] == COM_QUERY){
+            o += put_result(out + o);
+        } else {
+            o += put_ok(out + o, 1);
+        }
+        pos += 4 + pktlen;
+    }
+
+    memmove(c->in, c->in + pos, c->len - pos);
+    c->len -= pos;
+
+    if( (o > 0) && (write(fd, out, o) != o) ){
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int i, n, fd, lfd, epfd, on = 1;
+    struct sockaddr_in addr;
+    struct epoll_event ev, events[256];
+
+    if(argc < 2){
+        fprintf(stderr, "usage: %s port\n", argv[0]);
+        return 2;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(argv[1]));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    lfd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if( (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) || (listen(lfd, 1024) < 0) ){
+        perror("bind");
+        return 1;
+    }
+
+    epfd = epoll_create1(0);
+    ev.events = EPOLLIN;
+    ev.data.fd = lfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev);
+
+    while(1){
+        n = epoll_wait(epfd, events, 256, -1);
+        for(i = 0; i < n; i++){
+            fd = events[i].data.fd;
+            if(fd == lfd){
+                if( ((fd = accept(lfd, NULL, NULL)) < 0) || (fd >= FAKE_MAX_FD) ){
+                    if(fd >= 0){
+                        close(fd);
+                    }
+                    continue;
+                }
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                conns[fd] = calloc(1, sizeof(fake_conn_t));
+                greet(fd);
+                ev.events = EPOLLIN;
+                ev.data.fd = fd;
+                epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+                continue;
+            }
+
+            if(serve(fd) < 0){
+                close(fd);
+                free(conns[fd]);
+                conns[fd] = NULL;
+            }
+        }
+    }
+
+    return 0;
+}
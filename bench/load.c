@@ -0,0 +1,229 @@
+/*
+ * load: closed loop query load for benchmark
+ *
+ * usage: load host port user passwd conns secs
+ *
+ * Every connection sends "select 1", waits for the whole result and sends
+ * the next one. The clock starts when all connections have logged in.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "../passwd.h"
+#include "../mysql_com.h"
+
+#define LOAD_SQL "select 1"
+
+enum{
+    LOAD_GREETING,
+    LOAD_AUTH,
+    LOAD_IDLE,
+    LOAD_QUERY,
+};
+
+typedef struct{
+    int fd;
+    int state;
+    int eofs;//结果集里已读的EOF数，-1还没读到第一个包
+    uint32_t len;
+    uint8_t in[65536];
+} load_conn_t;
+
+static const char *user;
+static const char *pass;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * fun: send one mysql packet
+ * arg: fd, sequence number, payload, payload length
+ * ret: success 0, error -1
+ *
+ */
+
+static int send_pkt(int fd, int seq, const uint8_t *ptr, uint32_t len)
+{
+    uint8_t out[512];
+
+    out[0] = len & 0xff;
+    out[1] = (len >> 8) & 0xff;
+    out[2] = (len >> 16) & 0xff;
+    out[3] = seq;
+    memcpy(out + 4, ptr, len);
+
+    return (write(fd, out, len + 4) == (ssize_t)(len + 4)) ? 0 : -1;
+}
+
+static int send_query(load_conn_t *c)
+{
+    uint8_t out[64];
+
+    out[0] = COM_QUERY;
+    memcpy(out + 1, LOAD_SQL, sizeof(LOAD_SQL) - 1);
+    c->state = LOAD_QUERY;
+    c->eofs = -1;
+
+    return send_pkt(c->fd, 0, out, sizeof(LOAD_SQL));
+}
+
+/*
+ * fun: answer greeting with mysql_native_password login
+ * arg: connection, greeting payload
+ * ret: success 0, error -1
+ *
+ */
+
+static int send_auth(load_conn_t *c, uint8_t *p)
+{
+    int m;
+    uint32_t cap, maxpkt = 1 << 24;
+    uint8_t out[256];
+    char salt[21], token[20];
+
+    //握手包: 协议版本、版本字符串、线程id、盐的前8字节、...、盐的后12字节
+    p += strlen((char *)p + 1) + 2;
+    memcpy(salt, p + 4, 8);
+    memcpy(salt + 8, p + 4 + 8 + 1 + 2 + 1 + 2 + 2 + 1 + 10, 12);
+    salt[20] = '\0';
+
+    cap = CLIENT_LONG_PASSWORD | CLIENT_PROTOCOL_41 | CLIENT_TRANSACTIONS | CLIENT_SECURE_CONNECTION;
+    memcpy(out, &cap, 4);
+    memcpy(out + 4, &maxpkt, 4);
+    out[8] = 33;
+    memset(out + 9, 0, 23);
+    m = 32;
+    strcpy((char *)out + m, user);
+    m += strlen(user) + 1;
+    if(pass[0] != '\0'){
+        scramble(token, salt, pass);
+        out[m++] = 20;
+        memcpy(out + m, token, 20);
+        m += 20;
+    } else {
+        out[m++] = 0;
+    }
+    c->state = LOAD_AUTH;
+
+    return send_pkt(c->fd, 1, out, m);
+}
+
+int main(int argc, char **argv)
+{
+    int i, j, n, nev, epfd, on = 1, ready = 0;
+    long done = 0, errs = 0;
+    double secs, start = 0, end = 1e18;
+    uint32_t pos, pktlen;
+    ssize_t r;
+    uint8_t *p;
+    load_conn_t *conns, *c;
+    struct sockaddr_in addr;
+    struct epoll_event ev, events[256];
+
+    if(argc < 7){
+        fprintf(stderr, "usage: %s host port user passwd conns secs\n", argv[0]);
+        return 2;
+    }
+    user = argv[3];
+    pass = argv[4];
+    n = atoi(argv[5]);
+    secs = atof(argv[6]);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(argv[2]));
+    if(inet_pton(AF_INET, argv[1], &addr.sin_addr) != 1){
+        fprintf(stderr, "bad host %s\n", argv[1]);
+        return 2;
+    }
+
+    epfd = epoll_create1(0);
+    conns = calloc(n, sizeof(load_conn_t));
+    for(i = 0; i < n; i++){
+        c = &conns[i];
+        c->fd = socket(AF_INET, SOCK_STREAM, 0);
+        setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        if(connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+            perror("connect");
+            return 1;
+        }
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+    }
+
+    while(now() < end){
+        nev = epoll_wait(epfd, events, 256, 1000);
+        for(i = 0; i < nev; i++){
+            c = events[i].data.ptr;
+            if( (r = read(c->fd, c->in + c->len, sizeof(c->in) - c->len)) <= 0 ){
+                fprintf(stderr, "connection closed\n");
+                return 1;
+            }
+            c->len += r;
+
+            for(pos = 0; c->len - pos >= 4; pos += 4 + pktlen){
+                pktlen = c->in[pos] | (c->in[pos + 1] << 8) | (c->in[pos + 2] << 16);
+                if(c->len - pos < 4 + pktlen){
+                    break;
+                }
+                p = c->in + pos + 4;
+
+                if(c->state == LOAD_GREETING){
+                    if(send_auth(c, p) < 0){
+                        return 1;
+                    }
+                } else if(c->state == LOAD_AUTH){
+                    if(p[0] != 0){
+                        fprintf(stderr, "login error\n");
+                        return 1;
+                    }
+                    c->state = LOAD_IDLE;
+                    if(++ready == n){//都登录好了再开始计时
+                        start = now();
+                        end = start + secs;
+                        for(j = 0; j < n; j++){
+                            send_query(&conns[j]);
+                        }
+                    }
+                } else if(c->state == LOAD_QUERY){
+                    if(c->eofs < 0){//第一个包是OK/ERR就结束，否则是结果集
+                        if( (p[0] == 0) || (p[0] == 0xff) ){
+                            errs += (p[0] == 0xff);
+                            done++;
+                            send_query(c);
+                        } else {
+                            c->eofs = 0;
+                        }
+                    } else if( (p[0] == 0xfe) && (pktlen < 9) && (++c->eofs == 2) ){
+                        done++;
+                        send_query(c);
+                    }
+                }
+            }
+
+            memmove(c->in, c->in + pos, c->len - pos);
+            c->len -= pos;
+        }
+    }
+
+    printf("conns %d queries %ld errors %ld qps %.0f\n", n, done, errs, done / (now() - start));
+
+    return errs ? 1 : 0;
+}
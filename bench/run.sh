@@ -0,0 +1,71 @@
+#!/bin/bash
+#
+# compare event backends: queries per proxy cpu second against fakemy
+#
+# usage: bench/run.sh [secs] [conns...]
+#
+# One worker thread, transaction pool mode, every client runs "select 1" in
+# a closed loop. The proxy cpu time comes from /proc, so the number is QPS
+# per core the proxy actually used, not wall clock QPS.
+#
+
+cd "$(dirname "$0")/.."
+
+SECS=${1:-5}
+shift
+CONNS=${@:-32 256}
+PROXY_PORT=${PROXY_PORT:-13306}
+MYSQL_PORT=${MYSQL_PORT:-23306}
+TMP=$(mktemp -d)
+TCK=$(getconf CLK_TCK)
+
+trap 'kill $FAKE $PROXY 2>/dev/null; rm -rf $TMP' EXIT
+
+echo "master 127.0.0.1 $MYSQL_PORT user passwd 8 64" > $TMP/mysql.conf
+./bench/fakemy $MYSQL_PORT &
+FAKE=$!
+
+cpu_ticks()
+{
+    # utime + stime of master and worker children
+    local pid ticks=0
+
+    for pid in $1 $(pgrep -P $1); do
+        set -- $(cut -d' ' -f14,15 /proc/$pid/stat)
+        ticks=$((ticks + $1 + $2))
+    done
+    echo $ticks
+}
+
+for backend in epoll io_uring; do
+    cat > $TMP/myrelay.conf <<EOF
+daemon                  0
+worker                  1
+max_connections         4000
+ip                      127.0.0.1
+port                    $PROXY_PORT
+user                    bench
+passwd                  bench
+mysql_conf              $TMP/mysql.conf
+log                     $TMP/$backend.log
+loglevel                log
+sqllog                  /dev/null
+pool_mode               transaction
+event_backend           $backend
+EOF
+    ./myrelay $TMP/myrelay.conf > /dev/null 2>&1 &
+    PROXY=$!
+    sleep 1
+
+    for conns in $CONNS; do
+        c0=$(cpu_ticks $PROXY)
+        out=$(./bench/load 127.0.0.1 $PROXY_PORT bench bench $conns $SECS) || exit 1
+        c1=$(cpu_ticks $PROXY)
+        queries=$(echo "$out" | sed 's/.* queries \([0-9]*\) .*/\1/')
+        echo "$backend $out cpu $(((c1 - c0) * 1000 / TCK))ms qps/core $((queries * TCK / (c1 - c0 + 1)))"
+    done
+
+    grep -h "handler init success\|fall back" $TMP/$backend.log | sed "s/.* - //"
+    kill $PROXY
+    wait $PROXY 2>/dev/null
+done
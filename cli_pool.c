@@ -20,7 +20,9 @@
 
 extern log_t *g_log;
 
-static genpool_handler_t *cli_pool;
+static __thread genpool_handler_t *cli_pool;
+static __thread unsigned long cli_cur = 0;//当前客户端连接数
+static __thread unsigned long cli_total = 0;//累计客户端连接数
 
 /*
  * fun: init client connection pool
@@ -40,6 +42,21 @@ int cli_pool_init(int count)
     return 0;
 }
 
+/*
+ * fun: get client connection counters
+ * arg: current connection number, total connection number
+ * ret: always return 0
+ *
+ */
+
+int cli_pool_stat(unsigned long *cur, unsigned long *total)
+{
+    *cur = cli_cur;
+    *total = cli_total;
+
+    return 0;
+}
+
 int cli_pool_destroy( )
 {
 	if( cli_pool != NULL){
@@ -111,6 +128,8 @@ int cli_conn_open(conn_t *conn, int fd, uint32_t ip, uint16_t port)
     }
 
     conn->cli = c;//对应这个连接结构的客户端连接
+    cli_cur++;
+    cli_total++;
 
     return 0;
 }
@@ -135,6 +154,7 @@ static int cli_conn_release(cli_conn_t *conn)
     conn->port = 0;
     list_del_init(&(conn->link));
     conn->conn = NULL;
+    cli_cur--;
 
     if( (res = buf_reset(&(conn->buf))) < 0 ){
         return -1;
@@ -159,10 +179,9 @@ int cli_conn_close(cli_conn_t *conn)
     }
 
     if(conn->fd >= 0){
-        if( (res = del_handler(conn->fd)) < 0 ){
-            log(g_log, "del_handler error\n");
+        if( (res = close_handler(conn->fd)) < 0 ){
+            log(g_log, "close_handler error\n");
         }
-        close(conn->fd);
     }
 
     return cli_conn_release(conn);
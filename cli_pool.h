@@ -19,6 +19,7 @@ typedef struct{
 } cli_conn_t;
 
 int cli_pool_init(int count);
+int cli_pool_stat(unsigned long *cur, unsigned long *total);
 int cli_conn_open(conn_t *conn, int fd, uint32_t ip, uint16_t port);
 int cli_conn_close(cli_conn_t *conn);
 
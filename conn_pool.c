@@ -18,37 +18,35 @@
 #include <log.h>
 #include <list.h>
 #include <timer.h>
+#include <clock.h>
 #include "conn_pool.h"
 #include "my_pool.h"
 #include "cli_pool.h"
 #include "my_buf.h"
 #include "mysql_com.h"
 #include "my_conf.h"
+#include "my_ops.h"
 
 extern log_t *g_log;
 extern struct conf_t g_conf;
 
-static genpool_handler_t *conn_pool;
-static uint32_t connid;
+static __thread genpool_handler_t *conn_pool;
+static __thread uint32_t connid;
 
 static int conn_init(conn_t *c);
 static conn_t *conn_alloc(void);
 static int conn_release(conn_t *c);
 
-static int read_client_timeout_timer(unsigned long arg);
-static int write_mysql_timeout_timer(unsigned long arg);
-static int read_mysql_write_client_timeout_timer(unsigned long arg);
-static int prepare_mysql_timeout_timer(unsigned long arg);
-static int idle_timeout_timer(unsigned long arg);
+static int conn_timeout_timer(unsigned long arg);
 
-static struct list_head read_client_head;
-static struct list_head write_mysql_head;
-static struct list_head read_mysql_write_client_head;
-static struct list_head prepare_mysql_head;
-static struct list_head idle_head;//接到一个客户端 连接后，将其放到这里
+static __thread struct list_head read_client_head;
+static __thread struct list_head write_mysql_head;
+static __thread struct list_head read_mysql_write_client_head;
+static __thread struct list_head prepare_mysql_head;
+static __thread struct list_head idle_head;//接到一个客户端 连接后，将其放到这里
 
 /*
- * fun: init connection pool and timer
+ * fun: init connection pool
  * arg: max connection number
  * ret: success 0, error -1
  *
@@ -76,36 +74,6 @@ int conn_pool_init(size_t count)
 
     srand(pid * time(NULL));
     connid = rand();
-//注册各种事件的超时函数
-    if( (res = timer_register(read_client_timeout_timer, 30, \
-                                "read_client_timeout_timer", 1) < 0) ){
-        log(g_log, "read_client_timeout_timer register error\n");
-        return res;
-    }
-
-    if( (res = timer_register(write_mysql_timeout_timer, 30, \
-                                "write_mysql_timeout_timer", 1) < 0) ){
-        log(g_log, "write_mysql_timeout_timer register error\n");
-        return res;
-    }
-
-    if( (res = timer_register(read_mysql_write_client_timeout_timer, 30, \
-                        "read_mysql_write_client_timeout_timer", 1) < 0) ){
-        log(g_log, "read_mysql_write_client_timeout_timer register error\n");
-        return res;
-    }
-
-    if( (res = timer_register(prepare_mysql_timeout_timer, 30, \
-                        "prepare_mysql_timeout_timer", 1) < 0) ){
-        log(g_log, "prepare_mysql_timeout_timer register error\n");
-        return res;
-    }
-
-    if( (res = timer_register(idle_timeout_timer, 30, \
-                                        "idle_timeout_timer", 1) < 0) ){
-        log(g_log, "idle_timeout_timer register error\n");
-        return res;
-    }
 
     return res;
 }
@@ -128,15 +96,36 @@ static int conn_init(conn_t *c)
     c->cli = NULL;
     c->my = NULL;
     c->state = STATE_UNAVAIL;
-    c->state_time = time(NULL);
+    c->state_time = clock_sec();
     bzero(c->curdb, sizeof(c->curdb));
     c->comno = 0;
     bzero(c->arg, sizeof(c->arg));
 
-    gettimeofday(&(c->tv_start), NULL);
-    gettimeofday(&(c->tv_end), NULL);
+    c->us_start = clock_us();
+    c->us_end = c->us_start;
 
     INIT_LIST_HEAD(&(c->link));
+    timer_node_init(&(c->timer), conn_timeout_timer, (unsigned long)c);
+    c->wait_node = NULL;
+    c->wait_start = 0;
+    c->wait_phase = WAIT_NONE;
+    c->pin = 0;
+    c->role = MY_ROLE_SLAVE;
+    c->borrow = 0;
+    c->hold = NULL;
+    sess_init(&(c->sess));
+    resp_init(&(c->resp), SERVER_STATUS_AUTOCOMMIT, &(c->sess));//还没发过命令，关连接的时候不能拿上一个客户端的回复状态
+    c->sess_op = SESS_OP_NONE;
+    c->write = 0;
+    c->write_time = 0;
+    c->gtid[0] = '\0';
+    c->group = 0;
+    c->begin = 0;
+    c->scatter = NULL;
+    c->pipe_n = 0;
+    c->pipe_i = 0;
+    c->pipe_err = 0;
+    c->pipe_keep = 0;
 
     return buf_init(&(c->buf));
 }
@@ -224,15 +213,26 @@ int conn_close(conn_t *c)
 {
     int res = 0;
 
+    my_conn_wait_cancel(c, 0);
     list_del_init(&(c->link));
+    timer_del(&(c->timer));
+    cli_scatter_end(c, 0);
 
     if(c->my){
+        if( (!c->pin) && (c->resp.state == RESP_DONE) ){//会话级复用时my->status不跟回复走，还回去之前补上，事务没结束的连接要关掉
+            c->my->status = c->resp.status;
+        }
         if( (res = my_conn_put(c->my, 1)) < 0 ){
             log(g_log, "put my conn error\n");
         }
         c->my = NULL;
     }
 
+    if(c->hold){//借slave读的时候客户端断了，自己占着的连接是干净的
+        my_conn_put(c->hold, 1);
+        c->hold = NULL;
+    }
+
     if( (res = cli_conn_close(c->cli)) < 0 ){
         log(g_log, "cli conn close error\n");
     }
@@ -258,7 +258,10 @@ int conn_close_with_my(conn_t *c)
 {//这个操作很重，会干掉mysql的连接，已经客户端连接等所有数据!!!!
     int res = 0;
 
+    my_conn_wait_cancel(c, 0);
     list_del_init(&(c->link));
+    timer_del(&(c->timer));
+    cli_scatter_end(c, 1);
 
     if(c->my){
         if( (res = my_conn_close(c->my)) < 0 ){
@@ -267,6 +270,11 @@ int conn_close_with_my(conn_t *c)
         c->my = NULL;
     }
 
+    if(c->hold){//出错的是借来读的slave，自己占着的连接没事，还回去
+        my_conn_put(c->hold, 1);
+        c->hold = NULL;
+    }
+
     if( (res = cli_conn_close(c->cli)) < 0 ){
         log(g_log, "cli conn close error\n");
     }
@@ -299,7 +307,7 @@ int conn_alloc_my_conn(conn_t *c)
         return 0;
     }
 
-	if( (my = my_slave_conn_get(c, cli->ip, cli->port)) == NULL ){
+	if( (my = my_conn_get(c, c->role, cli->ip, cli->port)) == NULL ){
 		return -1;
 	} else {
 		c->my = my;
@@ -326,9 +334,10 @@ int conn_state_set_reading_client(conn_t *c)
     }
 
     c->state = STATE_READING_CLIENT;
-    c->state_time = time(NULL);
+    c->state_time = clock_sec();
 
     list_move_tail(&(c->link), &read_client_head);
+    timer_add(&(c->timer), g_conf.read_client_timeout);
 
     debug(g_log, "conn:%d reading client\n", c->connid);
 
@@ -349,9 +358,10 @@ int conn_state_set_writing_mysql(conn_t *c)
     }
 
     c->state = STATE_WRITING_MYSQL;
-    c->state_time = time(NULL);
+    c->state_time = clock_sec();
 
     list_move_tail(&(c->link), &write_mysql_head);
+    timer_add(&(c->timer), g_conf.write_mysql_timeout);
 
 	debug(g_log, "conn:%d writing mysql\n", c->connid);
 
@@ -372,9 +382,10 @@ int conn_state_set_read_mysql_write_client(conn_t *c)
     }
 
     c->state = STATE_READ_MYSQL_WRITE_CLIENT;
-    c->state_time = time(NULL);
+    c->state_time = clock_sec();
 
     list_move_tail(&(c->link), &read_mysql_write_client_head);
+    timer_add(&(c->timer), g_conf.read_mysql_write_client_timeout);
 
     debug(g_log, "conn:%d read mysql write client\n", c->connid);
 
@@ -395,9 +406,10 @@ int conn_state_set_prepare_mysql(conn_t *c)
     }
 
     c->state = STATE_PREPARE_MYSQL;
-    c->state_time = time(NULL);
+    c->state_time = clock_sec();
 
     list_move_tail(&(c->link), &prepare_mysql_head);
+    timer_add(&(c->timer), g_conf.prepare_mysql_timeout);
 
     debug(g_log, "conn:%d prepare to write mysql\n", c->connid);
 
@@ -418,9 +430,10 @@ int conn_state_set_idle(conn_t *c)
     }
 
     c->state = STATE_IDLE;
-    c->state_time = time(NULL);
+    c->state_time = clock_sec();
 
     list_move_tail(&(c->link), &idle_head);
+    timer_add(&(c->timer), g_conf.idle_timeout);
 
     debug(g_log, "conn:%d connection idle\n", c->connid);
 
@@ -428,121 +441,138 @@ int conn_state_set_idle(conn_t *c)
 }
 
 /*
- * fun: connection timeout timer
- * arg: max connection, connection timer head, 
- * arg: timeout seconds, extend message
+ * fun: set connection state: wait mysql
+ * arg: connection struct pointer, wait queue of mysql node
  * ret: success 0, error -1
  *
  */
 
-static int
-_conn_state_timeout_timer(unsigned long arg, \
-                            struct list_head *head, \
-                            int timeout, const char *msg)
-{
-    int count = 0;
-    struct list_head *pos, *n;
-    conn_t *c;
-    time_t now = time(NULL);
+int conn_state_set_wait_mysql(conn_t *c, struct list_head *head)
+{//排队的连接挂在mysql节点的等待队列上，而不是这里的状态链表
+    if(c == NULL){
+        return -1;
+    }
 
-    list_for_each_safe(pos, n, head){
-        if(count++ >= arg){
-            break;
-        }
+    c->state = STATE_WAIT_MYSQL;
+    c->state_time = clock_sec();
 
-        c = list_entry(pos, conn_t, link);
+    list_move_tail(&(c->link), head);
+    timer_add(&(c->timer), g_conf.wait_mysql_timeout);
 
-        if(now - c->state_time > timeout){
-            log(g_log, "conn:%u %s\n", c->connid, msg);
-            list_del_init(pos);
-            conn_close(c);
-        } else {
-            break;
-        }
-    }
+    debug(g_log, "conn:%d wait mysql\n", c->connid);
 
     return 0;
 }
 
 /*
- * fun: connection timeout timer: read client
- * arg: max connection to be processed
+ * fun: set connection state: auth success
+ * arg: connection struct pointer
  * ret: success 0, error -1
  *
  */
 
-static int read_client_timeout_timer(unsigned long arg)
+int conn_state_set_auth_success(conn_t *c)
 {
-    struct list_head *head;
+    if(c == NULL){
+        return -1;
+    }
 
-    head = &read_client_head;
-    return _conn_state_timeout_timer(arg, head, g_conf.read_client_timeout, "read_client_timeout");
-}
+    c->state = STATE_AUTH_SUCCESS;
+    c->state_time = clock_sec();
 
-/*
- * fun: connection timeout timer: write mysql
- * arg: max connection to be processed
- * ret: success 0, error -1
- *
- */
+    list_del_init(&(c->link));
+    timer_del(&(c->timer));
 
-static int write_mysql_timeout_timer(unsigned long arg)
-{
-    struct list_head *head;
+    debug(g_log, "conn:%d auth success\n", c->connid);
 
-    head = &write_mysql_head;
-    return _conn_state_timeout_timer(arg, head, \
-                    g_conf.write_mysql_timeout, "write_mysql_timeout");
+    return 0;
 }
 
 /*
- * fun: connection timeout timer: read mysql and write client
- * arg: max connection to be processed
+ * fun: set connection state: unavail, before auth
+ * arg: connection struct pointer
  * ret: success 0, error -1
  *
  */
 
-static int read_mysql_write_client_timeout_timer(unsigned long arg)
+int conn_state_set_unavail(conn_t *c)
 {
-    struct list_head *head;
+    if(c == NULL){
+        return -1;
+    }
+
+    c->state = STATE_UNAVAIL;
+    c->state_time = clock_sec();
+
+    list_del_init(&(c->link));
+    timer_del(&(c->timer));
 
-    head = &read_mysql_write_client_head;
-    return _conn_state_timeout_timer(arg, head, \
-                    g_conf.read_mysql_write_client_timeout, \
-                    "read_mysql_write_client_timeout");
+    return 0;
 }
 
 /*
- * fun: connection timeout timer: prepare mysql
- * arg: max connection to be processed
+ * fun: set connection state: auth fail
+ * arg: connection struct pointer
  * ret: success 0, error -1
  *
  */
 
-static int prepare_mysql_timeout_timer(unsigned long arg)
+int conn_state_set_auth_fail(conn_t *c)
 {
-    struct list_head *head;
+    if(c == NULL){
+        return -1;
+    }
 
-    head = &prepare_mysql_head;
-    return _conn_state_timeout_timer(arg, head, \
-                    g_conf.prepare_mysql_timeout, \
-                    "prepare_mysql_timeout");
+    c->state = STATE_AUTH_FAIL;
+    c->state_time = clock_sec();
+
+    list_del_init(&(c->link));
+    timer_del(&(c->timer));
+
+    debug(g_log, "conn:%d auth fail\n", c->connid);
+
+    return 0;
 }
 
 /*
- * fun: connection timeout timer: idle
- * arg: max connection to be processed
- * ret: success 0, error -1
+ * fun: connection timeout timer, close connection
+ * arg: connection struct pointer
+ * ret: always return 0
  *
  */
 
-static int idle_timeout_timer(unsigned long arg)
-{
-    struct list_head *head;
+static int conn_timeout_timer(unsigned long arg)
+{//每个连接一个定时器，切换状态的时候重新设置到期时间，到期了就说明在这个状态待太久了
+    conn_t *c = (conn_t *)arg;
+    const char *msg;
+
+    switch(c->state){
+        case STATE_READING_CLIENT:
+            msg = "read_client_timeout";
+            break;
+        case STATE_WRITING_MYSQL:
+            msg = "write_mysql_timeout";
+            break;
+        case STATE_READ_MYSQL_WRITE_CLIENT:
+            msg = "read_mysql_write_client_timeout";
+            break;
+        case STATE_PREPARE_MYSQL:
+            msg = "prepare_mysql_timeout";
+            break;
+        case STATE_IDLE:
+            msg = "idle_timeout";
+            break;
+        case STATE_WAIT_MYSQL:
+            log(g_log, "conn:%u wait_mysql_timeout\n", c->connid);
+            cli_wait_fail(c);//排队超时回复客户端错误，而不是直接关掉
+            return 0;
+        default:
+            msg = "timeout";
+            break;
+    }
 
-    head = &idle_head;
-    return _conn_state_timeout_timer(arg, head, \
-                    g_conf.idle_timeout, "idle_timeout");
+    log(g_log, "conn:%u %s\n", c->connid, msg);
+    conn_close(c);
 
     return 0;
 }
@@ -3,8 +3,10 @@
 
 #include <stdint.h>
 #include <sys/time.h>
+#include <timer.h>
 #include "my_pool.h"
 #include "my_buf.h"
+#include "my_protocol.h"
 
 enum{
     STATE_UNAVAIL = 0,
@@ -14,7 +16,30 @@ enum{
     STATE_PREPARE_MYSQL,
     STATE_WRITING_MYSQL,
     STATE_READ_MYSQL_WRITE_CLIENT,
-    STATE_IDLE
+    STATE_IDLE,
+    STATE_WAIT_MYSQL
+};
+
+//排队等mysql连接是为了什么
+enum{
+    WAIT_NONE = 0,//没在排队
+    WAIT_GREETING,//还没连上过mysql，等连接发握手包
+    WAIT_QUERY//没占mysql连接的客户端来了命令，等连接执行命令
+};
+
+//当前命令是不是SET语句，要不要改会话状态
+enum{
+    SESS_OP_NONE = 0,//不是SET
+    SESS_OP_SET,//能记下来的SET，mysql回复OK以后记到会话状态里
+    SESS_OP_SKIP,//要设的值会话里已经是这样了，直接回复OK
+    SESS_OP_LOST//记不下来的SET，比如值是表达式
+};
+
+//流水线里排在语句前面一起发出去的命令
+enum{
+    PIPE_OP_USE_DB = 1,
+    PIPE_OP_SESS,
+    PIPE_OP_BEGIN
 };
 
 typedef struct{
@@ -27,9 +52,31 @@ typedef struct{
     char curdb[64];
     uint8_t comno;
     char arg[1024];
-    struct timeval tv_start;
-    struct timeval tv_end;
+    uint64_t us_start;//请求开始时间，微秒
+    uint64_t us_end;//请求转发完的时间，微秒
     struct list_head link;
+    timer_node_t timer;//当前状态的超时
+    void *wait_node;//在哪个mysql节点上排队等连接
+    uint64_t wait_start;//开始排队的时间，毫秒
+    int wait_phase;//WAIT_NONE、WAIT_GREETING或者WAIT_QUERY
+    int pin;//事务级复用时改过会话状态，mysql连接一直占到断开
+    int role;//这个命令借连接要借master的还是slave的，MY_ROLE_*
+    int borrow;//会话级复用时这条读语句用的是临时借来的slave连接，回复完就还
+    my_conn_t *hold;//借slave的时候客户端自己占着的连接先放这，还了slave再换回来
+    my_resp_t resp;//事务级复用时解析mysql的回复，看事务是不是结束了
+    sess_state_t sess;//客户端SET过的会话变量，换了mysql连接要先在新连接上重放
+    int sess_op;//SESS_OP_NONE、SESS_OP_SET、SESS_OP_SKIP或者SESS_OP_LOST
+    int write;//当前命令是写，回复成功了要记下写的时间或者GTID
+    uint64_t write_time;//上次写成功的时间，毫秒，read_after_write之内的读发master
+    char gtid[MY_GTID_LEN];//上次写提交的GTID，读只发执行过它的slave，空表示没有
+    int group;//这个命令借哪个组的连接，分片的时候按语句算
+    int begin;//BEGIN还没发，等事务第一条语句算出组再发
+    void *scatter;//发到所有组的SELECT合并到哪了，scatter_t，没有是NULL
+    uint8_t pipe_op[3];//跟语句一起发出去的前置命令，PIPE_OP_*，回复按顺序先到
+    int pipe_n;//前置命令个数，回复都读完了清零
+    int pipe_i;//读到第几个前置命令的回复了
+    int pipe_err;//有前置命令失败了，语句的结果读完扔掉，回客户端前置命令的ERR
+    size_t pipe_keep;//c->buf开头留给客户端的ERR包长度
 } conn_t;
 
 int conn_pool_init(size_t count);
@@ -43,6 +90,8 @@ int conn_state_set_writing_mysql(conn_t *c);
 int conn_state_set_read_mysql_write_client(conn_t *c);
 int conn_state_set_prepare_mysql(conn_t *c);
 int conn_state_set_idle(conn_t *c);
+int conn_state_set_wait_mysql(conn_t *c, struct list_head *head);
+int conn_state_set_unavail(conn_t *c);
 int conn_state_set_auth_fail(conn_t *c);
 int conn_state_set_auth_success(conn_t *c);
 
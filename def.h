@@ -8,9 +8,14 @@
 #define MAX_USER_LEN 64
 #define MAX_PASS_LEN 64
 #define MAX_SLAVE_NODE 64
-#define MAX_MASTER_NODE 1
+#define MAX_MASTER_NODE 1//每个组的master数
+#define MAX_MY_GROUP 16//分片的组数，没配组的时候只有一个组
+#define MAX_MY_NODE (MAX_SLAVE_NODE + MAX_MASTER_NODE * MAX_MY_GROUP)
 
-extern int g_cursecond ;
+#define MY_WAIT_TIMEOUT_DEF 28800//查不到wait_timeout时按mysql的默认值
+
+#define MY_GTID_LEN 128//一个GTID，uuid:序号
+#define MY_GTID_SET_LEN 4096//slave执行过的GTID集合，超长截断，截掉的按没执行过算
 
 #endif
 
@@ -8,31 +8,57 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <errno.h>
 #include <arpa/inet.h>
 #include <stdint.h>
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/prctl.h>
+#include <pthread.h>
 #include <log.h>
+#include <sock.h>
 #include <handler.h>
 #include "cli_pool.h"
 #include "my_pool.h"
 #include "conn_pool.h"
 #include "my_conf.h"
+#include "stats.h"
 
 #define VERSION "0.3.2"
 
-int g_usr1_reload = 0;
+#define MAX_THREADS 256
+#define MAX_WORKERS 64
+
+volatile int g_usr1_reload = 0;//每收到一次USR1加一，各个线程对比自己处理过的值来决定是否reload
 log_t *g_log = NULL;
-int g_cursecond = 0 ;//用来缓存time(null)的结果，避免大量调用time()
 
 extern struct conf_t g_conf;
 
-int g_run ;
+volatile int g_run ;
+int g_worker_index = 0;//当前进程是第几个worker
+
+typedef struct{
+    int fd;
+    int index;
+    pthread_t tid;
+} work_thread_t;
+
+static work_thread_t threads[MAX_THREADS];
+static pid_t workers[MAX_WORKERS];
+
+int work(int fd, int index);
 
 static int signal_init(void);
 static void signal_usr1(int signal);
+static int log_start(void);
+static int listen_start(int reuseport);
+static int listen_prepare(int reuseport);
+static pid_t worker_fork(int index);
+static int worker_run(int index);
+static void *work_thread(void *arg);
 
 #define USAGE(){ \
     fprintf(stderr, "Version: %s\n", VERSION); \
@@ -44,7 +70,7 @@ static void signal_usr1(int signal);
 
 int main(int argc, char *argv[])
 {
-    int i, listenfd;
+    int i, nthread, nworker, status, usr1_gen;
     pid_t pid;
 
 	g_run = 1 ;
@@ -64,17 +90,31 @@ int main(int argc, char *argv[])
         log(g_log, "conf[%s] init success\n", argv[1]);
     }
 
-    // make listen
-    while(1){
-        listenfd = make_listen_nonblock(g_conf.ip, g_conf.port);
-        if(listenfd < 0){
-            log_err(g_log, "%s:%s listen socket error\n", g_conf.ip, g_conf.port);
-        } else {
-            log(g_log, "make listen socket success\n");
-            break;
-        }
+    // log init, before any thread start
+    if(log_start() < 0){
+        fprintf(stderr, "log init error\n");
+        exit(-1);
+    }
 
-        sleep(5);
+    nthread = g_conf.threads;
+    if(nthread < 1){
+        nthread = 1;
+    } else if(nthread > MAX_THREADS){
+        nthread = MAX_THREADS;
+    }
+    g_conf.threads = nthread;
+
+    nworker = g_conf.worker;
+    if(nworker < 1){
+        nworker = 1;
+    } else if(nworker > MAX_WORKERS){
+        nworker = MAX_WORKERS;
+    }
+    g_conf.worker = nworker;
+
+    // single process make listen before daemon, workers make their own after fork
+    if(nworker == 1){
+        listen_prepare(nthread > 1);
     }
 
     // signal init
@@ -89,47 +129,227 @@ int main(int argc, char *argv[])
         daemon(1, 1);
     }
 
-	work(listenfd);
+    // mysql info saved last time, must before fork
+    if( (g_conf.info_file[0] != '\0') && (my_info_load(g_conf.info_file) < 0) ){
+        log(g_log, "no saved mysql info, clients wait for mysql greeting\n");
+    }
 
-	my_conf_destroy() ;
+    // shared stats, must before fork
+    if(stats_init(g_conf.stats_file, nworker, nthread) < 0){
+        log(g_log, "stats init error, stats file %s\n", g_conf.stats_file);
+    }
+
+    if(nworker == 1){
+        stats_worker_start(0, getpid());
+        worker_run(0);
+        my_conf_destroy() ;
+        return 0;
+    }
 
-return 0 ;//暂时不用下面的功能
     // fork children
-    for(i = 0; i < g_conf.worker; i++){
-        while( (pid = fork()) < 0 ){
-            log_err(g_log, "fork error\n");
-            sleep(3);
+    for(i = 0; i < nworker; i++){
+        worker_fork(i);
+    }
+
+    // wait for children exit and restart it, only the crashed one's clients are affected
+    usr1_gen = g_usr1_reload;
+    while(g_run){
+        while( (pid = waitpid(-1, &status, WNOHANG)) > 0 ){
+            for(i = 0; i < nworker; i++){
+                if(workers[i] == pid){
+                    workers[i] = 0;
+                    break;
+                }
+            }
+            log(g_log, "worker %d exit, pid = %d, status = %d\n", i, pid, status);
         }
 
-        if(pid == 0){
-            work(listenfd);
-            exit(-1);
+        if(usr1_gen != g_usr1_reload){//reload转发给所有子进程
+            usr1_gen = g_usr1_reload;
+            for(i = 0; i < nworker; i++){
+                if(workers[i] > 0){
+                    kill(workers[i], SIGUSR1);
+                }
+            }
         }
+
+        for(i = 0; (i < nworker) && g_run; i++){
+            if(workers[i] == 0){
+                worker_fork(i);
+            }
+        }
+
+        sleep(1);//信号会打断sleep
     }
 
-    // wait for children exit and restart it
-    while(1){
-        while( (pid = waitpid(-1, NULL, 0)) < 0 ){
-            sleep(3);
+    for(i = 0; i < nworker; i++){
+        if(workers[i] > 0){
+            kill(workers[i], SIGTERM);
         }
+    }
+    while(waitpid(-1, NULL, 0) > 0);
+
+	my_conf_destroy() ;
+
+    return 0;
+}
+
+/*
+ * fun: make listen sockets of all threads
+ * arg: whether set SO_REUSEPORT
+ * ret: always return 0
+ *
+ */
+
+static int listen_prepare(int reuseport)
+{
+    int i;
 
-        log(g_log, "process exit, pid = %d\n", pid);
+    for(i = 0; i < g_conf.threads; i++){
+        threads[i].fd = listen_start(reuseport);
+        threads[i].index = i;
+    }
+
+    return 0;
+}
+
+/*
+ * fun: fork a worker process
+ * arg: worker index
+ * ret: child pid
+ *
+ */
+
+static pid_t worker_fork(int index)
+{
+    pid_t pid;
+
+    while( (pid = fork()) < 0 ){
+        log_err(g_log, "fork error\n");
         sleep(3);
+    }
 
-        while( (pid = fork()) < 0 ){
-            log_err(g_log, "fork error\n");
+    if(pid == 0){
+        prctl(PR_SET_PDEATHSIG, SIGTERM);//父进程没了子进程跟着退出
+        listen_prepare(1);
+        worker_run(index);
+        exit(0);
+    }
+
+    workers[index] = pid;
+    stats_worker_start(index, pid);
+    log(g_log, "worker %d start, pid = %d\n", index, pid);
+
+    return pid;
+}
+
+/*
+ * fun: run all event loop threads of a worker
+ * arg: worker index
+ * ret: return when all threads exit
+ *
+ */
+
+static int worker_run(int index)
+{
+    int i;
+
+    g_worker_index = index;
+
+    //0号线程就是当前线程自己
+    for(i = 1; i < g_conf.threads; i++){
+        while(pthread_create(&(threads[i].tid), NULL, work_thread, &(threads[i])) != 0){
+            log_err(g_log, "pthread_create error\n");
             sleep(3);
         }
+    }
 
-        if(pid == 0){
-            work(listenfd);
-            exit(-1);
-        }
+    work(threads[0].fd, 0);
+
+    for(i = 1; i < g_conf.threads; i++){
+        pthread_join(threads[i].tid, NULL);
     }
 
     return 0;
 }
 
+/*
+ * fun: init global log
+ * arg:
+ * ret: success 0, error -1
+ *
+ */
+
+static int log_start(void)
+{//所有线程共用一个日志，写日志是一次write，O_APPEND下不会交错
+    int level;
+
+    if(!strcmp(g_conf.loglevel, "none")){
+        level = LOG_NONE;
+    } else if(!strcmp(g_conf.loglevel, "log")) {
+        level = LOG_LEVEL_LOG;
+    } else if(!strcmp(g_conf.loglevel, "debug")) {
+        level = LOG_LEVEL_DEBUG;
+    } else if(!strcmp(g_conf.loglevel, "info")) {
+        level = LOG_LEVEL_INFO;
+    } else {
+        level = LOG_LEVEL_LOG;
+    }
+
+    if( (g_log = log_init(g_conf.log, level)) == NULL ){
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * fun: make listen socket, retry until success
+ * arg: whether set SO_REUSEPORT
+ * ret: listen fd
+ *
+ */
+
+static int listen_start(int reuseport)
+{
+    int listenfd;
+
+    while(1){
+        if(reuseport){
+            listenfd = make_listen_nonblock_reuseport(g_conf.ip, g_conf.port);
+        } else {
+            listenfd = make_listen_nonblock(g_conf.ip, g_conf.port);
+        }
+        if(listenfd < 0){
+            log_err(g_log, "%s:%s listen socket error\n", g_conf.ip, g_conf.port);
+        } else {
+            log(g_log, "make listen socket success\n");
+            break;
+        }
+
+        sleep(5);
+    }
+
+    return listenfd;
+}
+
+/*
+ * fun: event loop thread
+ * arg: thread info
+ * ret: not used
+ *
+ */
+
+static void *work_thread(void *arg)
+{
+    work_thread_t *t;
+
+    t = (work_thread_t *)arg;
+    work(t->fd, t->index);
+
+    return NULL;
+}
+
 void handle_sigint(int signal) {
 	log_err(g_log, "handle_sigint called, exiting") ;
 	g_run = 0 ;
@@ -170,7 +390,7 @@ static int signal_init(void)
 
 static void signal_usr1(int signal)
 {
-    g_usr1_reload = 1;
+    g_usr1_reload++;
 
     return;
 }
@@ -7,7 +7,9 @@
  */                                                                       
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <conf.h>
 #include <log.h>
 #include "my_conf.h"
@@ -16,6 +18,8 @@
             do{g_conf.arg = get_conf_str(#arg, conf_def_ ## arg);}while(0)
 #define CONF_FILL_INT(arg) \
             do{g_conf.arg = get_conf_int(#arg, conf_def_ ## arg);}while(0)
+#define CONF_FILL_MSEC(arg) \
+            do{g_conf.arg = get_conf_msec(#arg, conf_def_ ## arg);}while(0)
 
 struct conf_t g_conf;
 
@@ -38,15 +42,38 @@ int my_conf_init(const char *log)
 
     CONF_FILL_INT(daemon);
     CONF_FILL_INT(worker);
+    CONF_FILL_INT(threads);
     CONF_FILL_INT(max_connections);
     CONF_FILL_STR(ip);
     CONF_FILL_STR(port);
-    CONF_FILL_INT(read_client_timeout);
-    CONF_FILL_INT(write_mysql_timeout);
-    CONF_FILL_INT(read_mysql_write_client_timeout);
-    CONF_FILL_INT(prepare_mysql_timeout);
-    CONF_FILL_INT(idle_timeout);
+    CONF_FILL_MSEC(read_client_timeout);
+    CONF_FILL_MSEC(write_mysql_timeout);
+    CONF_FILL_MSEC(read_mysql_write_client_timeout);
+    CONF_FILL_MSEC(prepare_mysql_timeout);
+    CONF_FILL_MSEC(idle_timeout);
     CONF_FILL_INT(mysql_ping_timeout);
+    CONF_FILL_INT(wait_queue_size);
+    CONF_FILL_MSEC(wait_mysql_timeout);
+    CONF_FILL_STR(pool_mode);
+    CONF_FILL_INT(max_connecting);
+    CONF_FILL_INT(pool_headroom);
+    CONF_FILL_MSEC(pool_shrink_delay);
+    CONF_FILL_INT(connect_rate);
+    CONF_FILL_INT(resolve_ttl);
+    CONF_FILL_INT(breaker_threshold);
+    CONF_FILL_MSEC(breaker_backoff_min);
+    CONF_FILL_MSEC(breaker_backoff_max);
+    CONF_FILL_INT(lag_check_interval);
+    CONF_FILL_STR(lag_heartbeat);
+    CONF_FILL_INT(lag_max);
+    CONF_FILL_INT(lag_recover);
+    CONF_FILL_MSEC(read_after_write);
+    CONF_FILL_INT(read_after_write_gtid);
+    CONF_FILL_STR(event_backend);
+    CONF_FILL_INT(epoll_et);
+    CONF_FILL_INT(io_budget);
+    CONF_FILL_STR(stats_file);
+    CONF_FILL_STR(info_file);
     CONF_FILL_STR(user);
     CONF_FILL_STR(passwd);
     CONF_FILL_STR(mysql_conf);
@@ -54,6 +81,33 @@ int my_conf_init(const char *log)
     CONF_FILL_STR(loglevel);
     CONF_FILL_STR(sqllog);
 
+    g_conf.pool_txn = !strcmp(g_conf.pool_mode, "transaction");
+    if(g_conf.max_connecting < 1){
+        g_conf.max_connecting = 1;
+    }
+    if(g_conf.pool_headroom < 0){
+        g_conf.pool_headroom = 0;
+    }
+    if(g_conf.resolve_ttl < 0){
+        g_conf.resolve_ttl = 0;
+    }
+    if(g_conf.breaker_threshold < 1){
+        g_conf.breaker_threshold = 1;
+    }
+    if(g_conf.breaker_backoff_min < 1){
+        g_conf.breaker_backoff_min = 1;
+    }
+    if(g_conf.breaker_backoff_max < g_conf.breaker_backoff_min){
+        g_conf.breaker_backoff_max = g_conf.breaker_backoff_min;
+    }
+    if(g_conf.lag_recover > g_conf.lag_max){
+        g_conf.lag_recover = g_conf.lag_max;
+    }
+    if( g_conf.read_after_write_gtid && (g_conf.lag_check_interval <= 0) ){//slave执行到哪了是查延迟的时候顺便拿的
+        log(g_log, "read_after_write_gtid needs lag_check_interval, use read_after_write only\n");
+        g_conf.read_after_write_gtid = 0;
+    }
+
     return 0;
 }
 
@@ -64,6 +118,103 @@ int my_conf_destroy()
 }
 #define MAX_LINE_LEN 1024
 
+/*
+ * fun: find or add group by name
+ * arg: mysql config struct, group name, add if not found
+ * ret: group index, not found or too many groups -1
+ *
+ */
+
+static int mysql_conf_group(my_conf_t *myconf, const char *name, int add)
+{
+    int i;
+
+    for(i = 0; i < myconf->gcount; i++){
+        if(!strcmp(myconf->group[i], name)){
+            return i;
+        }
+    }
+
+    if( (!add) || (myconf->gcount >= MAX_MY_GROUP) ){
+        return -1;
+    }
+
+    strncpy(myconf->group[myconf->gcount], name, SHARD_NAME_LEN - 1);
+
+    return myconf->gcount++;
+}
+
+/*
+ * fun: parse shard rule line
+ * arg: mysql config struct, shard line, line number
+ * ret: success 0, error -1
+ *
+ */
+
+static int mysql_conf_shard(my_conf_t *myconf, const char *buf, int line)
+{//shard 表 hash 列 组1,组2...  shard 表 range 列 上界1:组1,上界2:组2,*:组3  shard 表 suffix 组1,组2...
+    int res, n = 0;
+    char table[SHARD_NAME_LEN], type[16], column[SHARD_NAME_LEN], parts[MAX_LINE_LEN], *part, *save, *colon;
+    my_shard_conf_t *shard;
+
+    if(myconf->shard_count >= MAX_SHARD_RULE){
+        log(g_log, "line[%d] error, shard num limit\n", line);
+        return -1;
+    }
+    shard = &(myconf->shard[myconf->shard_count]);
+
+    res = sscanf(buf, "%*s %63s %15s %63s %1023s", table, type, column, parts);
+    if( (res == 3) && (!strcmp(type, "suffix")) ){
+        shard->type = SHARD_SUFFIX;
+        strcpy(parts, column);
+        column[0] = '\0';
+    } else if( (res == 4) && (!strcmp(type, "hash")) ){
+        shard->type = SHARD_HASH;
+    } else if( (res == 4) && (!strcmp(type, "range")) ){
+        shard->type = SHARD_RANGE;
+    } else {
+        log(g_log, "line[%d] error, bad shard rule\n", line);
+        return -1;
+    }
+
+    for(part = strtok_r(parts, ",", &save); part != NULL; part = strtok_r(NULL, ",", &save)){
+        if(n >= MAX_SHARD_PART){
+            log(g_log, "line[%d] error, shard part num limit\n", line);
+            return -1;
+        }
+        if(shard->type == SHARD_RANGE){
+            if( (colon = strchr(part, ':')) == NULL ){
+                log(g_log, "line[%d] error, range part %s\n", line, part);
+                return -1;
+            }
+            *colon = '\0';
+            shard->bound[n] = strcmp(part, "*") ? strtoll(part, NULL, 10) : LLONG_MAX;
+            if( (n > 0) && (shard->bound[n] <= shard->bound[n - 1]) ){
+                log(g_log, "line[%d] error, range bound %s not ascending\n", line, part);
+                return -1;
+            }
+            part = colon + 1;
+        }
+        if( (shard->group[n] = mysql_conf_group(myconf, part, 0)) < 0 ){//组要先配
+            log(g_log, "line[%d] error, unknown group %s\n", line, part);
+            return -1;
+        }
+        n++;
+    }
+
+    if(n == 0){
+        log(g_log, "line[%d] error, no shard part\n", line);
+        return -1;
+    }
+
+    strcpy(shard->table, table);
+    strcpy(shard->column, column);
+    shard->count = n;
+    myconf->shard_count++;
+
+    return 0;
+}
+
 /*
  * fun: parse and fill mysql config
  * arg: mysql config path, mysql config struct
@@ -72,28 +223,19 @@ int my_conf_destroy()
  */
 
 int mysql_conf_parse(const char *conf, my_conf_t *myconf)
-{
-    int i, res, line = 0;
+{//group行后面的master、slave属于这个组，第一个group行前面的属于default组
+    int i, res, line = 0, group = -1;
     FILE *fp;
     char buf[MAX_LINE_LEN];
     char type[64], host[128], port[128], user[64], pass[64];
-    int  cnum, maxnum;
-    int  scount = 0;
+    int  cnum, maxnum, weight;
+    int  scount = 0, mcount = 0;
 
     my_node_conf_t *mynode;
 
-    myconf->scount = 0;
-
-    for(i = 0; i < 64; i++){
-        mynode = myconf->slave + i;
-        bzero(mynode->host, sizeof(mynode->host));
-        bzero(mynode->port, sizeof(mynode->port));
-        bzero(mynode->user, sizeof(mynode->user));
-        bzero(mynode->pass, sizeof(mynode->pass));
-
-        mynode->cnum = 0;
-        mynode->maxnum = 0;
-    }
+    bzero(myconf, sizeof(*myconf));
+    strncpy(myconf->policy, conf_def_mysql_policy, sizeof(myconf->policy) - 1);
+    myconf->shard_fallback = SHARD_FALLBACK_ERROR;
 
     if( (fp = fopen(conf, "r")) == NULL ){
         log(g_log, "fopen error\n");
@@ -105,14 +247,60 @@ int mysql_conf_parse(const char *conf, my_conf_t *myconf)
         line++;
         trim(buf);
         if( (*buf != '#') && (*buf != '\0') ){
-            res = sscanf(buf, "%s %s %s %s %s %d %d", type, host, port, user, pass, &cnum, &maxnum);
-            if(res == 7){
+            weight = conf_def_mysql_weight;
+            res = sscanf(buf, "%63s %127s %127s %63s %63s %d %d %d", type, host, port, user, pass, &cnum, &maxnum, &weight);
+            if( (res == 2) && (!strcmp(type, "policy")) ){
+                if( strcmp(host, "hash") && strcmp(host, "least") && \
+                        strcmp(host, "ewma") && strcmp(host, "p2c") && strcmp(host, "wrr") ){
+                    log(g_log, "line[%d] error, unknown policy %s\n", line, host);
+                    return -1;
+                }
+                bzero(myconf->policy, sizeof(myconf->policy));
+                strncpy(myconf->policy, host, sizeof(myconf->policy) - 1);
+            } else if( (res == 2) && (!strcmp(type, "group")) ){
+                if( (group = mysql_conf_group(myconf, host, 1)) < 0 ){
+                    log(g_log, "line[%d] error, group num limit\n", line);
+                    return -1;
+                }
+            } else if( (res == 2) && (!strcmp(type, "shard_fallback")) ){
+                if(!strcmp(host, "error")){
+                    myconf->shard_fallback = SHARD_FALLBACK_ERROR;
+                } else if(!strcmp(host, "scatter")){
+                    myconf->shard_fallback = SHARD_FALLBACK_SCATTER;
+                } else if( (myconf->shard_fallback = mysql_conf_group(myconf, host, 0)) < 0 ){
+                    log(g_log, "line[%d] error, unknown group %s\n", line, host);
+                    return -1;
+                }
+            } else if( (res >= 2) && (!strcmp(type, "shard")) ){
+                if(mysql_conf_shard(myconf, buf, line) < 0){
+                    return -1;
+                }
+            } else if( (res == 7) || (res == 8) ){
+                if(weight < 0){
+                    log(g_log, "line[%d] error, weight %d\n", line, weight);
+                    return -1;
+                }
+                if( (group < 0) && ((group = mysql_conf_group(myconf, conf_def_mysql_group, 1)) < 0) ){
+                    log(g_log, "line[%d] error, group num limit\n", line);
+                    return -1;
+                }
                 if(!strcmp(type, "slave")) {
-                    if(scount >= 64){
+                    if(scount >= MAX_SLAVE_NODE){
                         log(g_log, "line[%d] error, slave num limit\n", line);
                         return -1;
                     }
                     mynode = &(myconf->slave[scount++]);
+                } else if(!strcmp(type, "master")) {
+                    for(i = 0; i < mcount; i++){
+                        if(myconf->master[i].group == group){
+                            break;
+                        }
+                    }
+                    if(i < mcount){
+                        log(g_log, "line[%d] error, master num limit of group %s\n", line, myconf->group[group]);
+                        return -1;
+                    }
+                    mynode = &(myconf->master[mcount++]);
                 } else {
                     log(g_log, "line[%d] error, unknown mysql type\n", line);
                     return -1;
@@ -124,6 +312,8 @@ int mysql_conf_parse(const char *conf, my_conf_t *myconf)
                 strncpy(mynode->pass, pass, sizeof(mynode->pass) - 1);
                 mynode->cnum = cnum;
                 mynode->maxnum = maxnum;
+                mynode->weight = weight;
+                mynode->group = group;
             } else {
                 log(g_log, "line[%d] error\n", line);
                 return -1;
@@ -134,6 +324,7 @@ int mysql_conf_parse(const char *conf, my_conf_t *myconf)
 
     fclose(fp);
     myconf->scount = scount;
+    myconf->mcount = mcount;
 
     return 0;
 }
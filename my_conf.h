@@ -1,24 +1,61 @@
 #ifndef _MY_CONF_H_
 #define _MY_CONF_H_
 
+#include "def.h"
+
 #define conf_def_daemon 1
 #define conf_def_worker 2
+#define conf_def_threads 1
 #define conf_def_max_connections 100000
 
 #define conf_def_ip "0.0.0.0"
 #define conf_def_port "13306"
 
-#define conf_def_read_client_timeout 60
-#define conf_def_write_mysql_timeout 60
-#define conf_def_read_mysql_write_client_timeout 300
-#define conf_def_prepare_mysql_timeout 15
-#define conf_def_idle_timeout 60
+//客户端连接的超时都是毫秒
+#define conf_def_read_client_timeout 60000
+#define conf_def_write_mysql_timeout 60000
+#define conf_def_read_mysql_write_client_timeout 300000
+#define conf_def_prepare_mysql_timeout 15000
+#define conf_def_idle_timeout 60000
 #define conf_def_mysql_ping_timeout 10
 
+#define conf_def_wait_queue_size 1024
+#define conf_def_wait_mysql_timeout 5000
+#define conf_def_pool_mode "session"
+#define conf_def_max_connecting 10
+#define conf_def_pool_headroom 50
+#define conf_def_pool_shrink_delay 30000
+#define conf_def_connect_rate 200
+#define conf_def_resolve_ttl 60
+#define conf_def_breaker_threshold 5
+#define conf_def_breaker_backoff_min 1000
+#define conf_def_breaker_backoff_max 60000
+#define conf_def_lag_check_interval 0
+#define conf_def_lag_heartbeat ""
+#define conf_def_lag_max 30
+#define conf_def_lag_recover 10
+#define conf_def_read_after_write 0
+#define conf_def_read_after_write_gtid 0
+
+#define conf_def_event_backend "epoll"
+#define conf_def_epoll_et 0
+#define conf_def_io_budget 262144
+#define conf_def_stats_file ""
+#define conf_def_info_file ""
+
 #define conf_def_user ""
 #define conf_def_passwd ""
 
 #define conf_def_mysql_conf "./conf/mysql.conf"
+#define conf_def_mysql_policy "hash"
+#define conf_def_mysql_weight 1
+#define conf_def_mysql_group "default"
+
+#define MAX_SHARD_RULE 32
+#define MAX_SHARD_PART 64
+#define SHARD_NAME_LEN 64
+#define SHARD_FALLBACK_ERROR -1//找不到分片键的语句报错
+#define SHARD_FALLBACK_SCATTER -2//找不到分片键的SELECT发到所有组，结果合并
 
 #define conf_def_log "./myproxy.log"
 #define conf_def_loglevel "log"
@@ -31,27 +68,74 @@ typedef struct{
     char pass[64];
     int  cnum;
     int  maxnum;//连接的最大数目
+    int  weight;//权重，可以不写，默认1
+    int  group;//属于第几个组
 }my_node_conf_t;
 
+enum{//分片规则
+    SHARD_HASH = 0,//整数取模，字符串哈希以后取模
+    SHARD_RANGE,//整数小于第几个上界就在第几片
+    SHARD_SUFFIX,//表名后缀的数字取模，比如orders_3
+};
+
+typedef struct{
+    char table[SHARD_NAME_LEN];
+    char column[SHARD_NAME_LEN];//分片键，suffix不用
+    int type;//SHARD_*
+    int count;//分了几片
+    int group[MAX_SHARD_PART];//每片在哪个组
+    long long bound[MAX_SHARD_PART];//range每片的上界，不含，*是LLONG_MAX
+}my_shard_conf_t;
+
 typedef struct{
-//    int mcount;
-//    my_node_conf_t master[1];
+    int mcount;
+    my_node_conf_t master[MAX_MY_GROUP];//写和事务都发到master，每个组一个
     int scount;
-    my_node_conf_t slave[64];//slave的机器数目
+    my_node_conf_t slave[MAX_SLAVE_NODE];//slave的机器数目
+    char policy[16];//选slave的策略，hash/least/ewma/p2c/wrr
+    int gcount;
+    char group[MAX_MY_GROUP][SHARD_NAME_LEN];//组名，第一个组放不分片的表
+    int shard_count;
+    my_shard_conf_t shard[MAX_SHARD_RULE];
+    int shard_fallback;//分片表的语句找不到分片键时发到哪个组，或者SHARD_FALLBACK_*
 }my_conf_t;
 
 struct conf_t{
     int daemon;
     int worker;
+    int threads;//事件循环线程数
     int max_connections;
     char *ip;
     char *port;
-    int read_client_timeout;
+    int read_client_timeout;//下面五个都是毫秒
     int write_mysql_timeout;
     int read_mysql_write_client_timeout;
     int prepare_mysql_timeout;
     int idle_timeout;
     int mysql_ping_timeout;
+    int wait_queue_size;//每个线程每个mysql节点最多排队的客户端数
+    int wait_mysql_timeout;//排队等mysql连接的超时，毫秒
+    char *pool_mode;//session: 客户端一直占着mysql连接，transaction: 事务结束就还回去
+    int pool_txn;//pool_mode是transaction
+    int max_connecting;//每个线程每个mysql节点最多同时建多少个连接
+    int pool_headroom;//连接池目标大小在估算的需求上再多留百分之几
+    int pool_shrink_delay;//需求降下来持续这么久才关多余的连接，毫秒
+    int connect_rate;//每秒最多新建多少个mysql连接，所有线程一起分，0不限
+    int resolve_ttl;//mysql的域名多少秒后台重新解析一次，0只在reload和熔断的时候解析
+    int breaker_threshold;//一个节点连续失败这么多次就熔断
+    int breaker_backoff_min;//熔断和重连的退避时间，从min开始翻倍到max，毫秒
+    int breaker_backoff_max;
+    int lag_check_interval;//多少秒查一次slave的复制延迟，0不查
+    char *lag_heartbeat;//心跳表，空表示用SHOW SLAVE STATUS
+    int lag_max;//延迟超过这么多秒就不分新的读
+    int lag_recover;//摘掉的slave延迟降到这么多秒以内才加回来
+    int read_after_write;//客户端写完以后这么久之内的读都发master，毫秒，0不管
+    int read_after_write_gtid;//1: 记下写的GTID，读只发执行过它的slave
+    char *event_backend;//epoll或者io_uring
+    int epoll_et;//1使用边缘触发
+    int io_budget;//边缘触发时每次回调最多读写的字节数
+    char *stats_file;//共享内存统计文件，空表示只用匿名内存
+    char *info_file;//保存mysql握手信息的文件，重启以后不用等连上mysql就能给客户端发握手包，空表示不保存
     char *user;
     char *passwd;
     char *mysql_conf;
@@ -9,6 +9,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include <list.h>
 #include <time.h>
 #include <stdint.h>
@@ -18,6 +20,8 @@
 #include <errno.h>
 #include <log.h>
 #include <handler.h>
+#include <sock.h>
+#include <clock.h>
 #include "my_ops.h"
 #include "my_buf.h"
 #include "conn_pool.h"
@@ -28,6 +32,7 @@
 #include "sqldump.h"
 #include "passwd.h"
 #include "my_conf.h"
+#include "my_shard.h"
 
 extern log_t *g_log;
 extern struct conf_t g_conf;
@@ -45,15 +50,84 @@ static int cli_com_unsupported(conn_t *c);
 static int my_use_db_prepare(conn_t *c);
 static int my_use_db_resp_cb(int fd, void *arg);
 static int my_use_db_req_cb(int fd, void *arg);
+static int my_use_db_fail(conn_t *c);
+static int my_ctx_sync_next(conn_t *c);
+
+static int my_sess_prepare(conn_t *c);
+static int my_sess_req_cb(int fd, void *arg);
+static int my_sess_resp_cb(int fd, void *arg);
+
+static int my_begin_prepare(conn_t *c);
+static int my_begin_req_cb(int fd, void *arg);
+static int my_begin_resp_cb(int fd, void *arg);
+
+static int cli_com_pipe(conn_t *c);
+static int my_pipe_prepare(conn_t *c);
+static int my_pipe_append(buf_t *buf, uint8_t comno, const char *arg, int len);
+static int my_pipe_req_cb(int fd, void *arg);
+static int my_pipe_sent(conn_t *c);
+static int my_pipe_resp(conn_t *c);
 
 static int my_ping_req_cb(int fd, void *arg);
 static int my_ping_resp_cb(int fd, void *arg);
+static int my_lag_req_cb(int fd, void *arg);
+static int my_lag_resp_cb(int fd, void *arg);
 
 static int cli_hs_auth_fail_cb(int fd, void *arg);
-
+static int cli_hs_wait_done(conn_t *c);
+static int cli_hs_wait_fail(conn_t *c);
+static int cli_query_wait_done(conn_t *c);
+static int cli_query_wait_fail(conn_t *c);
+static int cli_query_error(conn_t *c, int err, const char *sqlstate, const char *msg);
+
+static int cli_com_dispatch(conn_t *c);
+static int cli_com_need_mysql(uint8_t comno);
+static int cli_com_bind_my(conn_t *c);
+static int cli_com_pin(conn_t *c);
+static int cli_pin_my_conn(conn_t *c);
+static int cli_release_my_conn(conn_t *c);
+static int cli_sql_is_stateful(const char *sql);
+static int cli_sql_keeps_state(const char *sql);
+static int cli_com_sess(conn_t *c, int truncated);
+static int cli_com_route(conn_t *c, int truncated);
+static int cli_com_split(conn_t *c);
+static int cli_sql_is_read(const char *sql);
+static int cli_sess_commit(conn_t *c);
+static void cli_write_done(conn_t *c);
+static int cli_com_shard(conn_t *c, uint32_t pktlen);
+static int cli_sql_is(const char *sql, char **words);
+static int cli_com_scatter(conn_t *c, int len);
+static int cli_scatter_flush(conn_t *c);
+static int cli_scatter_write_cb(int fd, void *arg);
+static int cli_scatter_done(conn_t *c);
+static void cli_scatter_pause(conn_t *c);
+static void cli_scatter_resume(conn_t *c);
+static int my_scatter_prepare(conn_t *c, int index);
+static int my_scatter_req_cb(int fd, void *arg);
+static int my_scatter_resp_cb(int fd, void *arg);
+
+//mysql的回复要一个包一个包的解析才知道事务有没有结束，不要CLIENT_DEPRECATE_EOF，结果集都以EOF结束
 static uint32_t cap_umask = CLIENT_FOUND_ROWS | CLIENT_NO_SCHEMA | \
                             CLIENT_ODBC | CLIENT_COMPRESS | CLIENT_SSL_VERIFY_SERVER_CERT | CLIENT_LOCAL_FILES | \
-							CLIENT_IGNORE_SPACE | CLIENT_IGNORE_SIGPIPE | CLIENT_RESERVED | CLIENT_CONNECT_WITH_DB ;
+							CLIENT_IGNORE_SPACE | CLIENT_IGNORE_SIGPIPE | CLIENT_RESERVED | CLIENT_CONNECT_WITH_DB | \
+                            CLIENT_DEPRECATE_EOF ;
+
+//事务级复用时，这些语句会改会话状态，执行以后客户端一直占着mysql连接，SET语句记在会话状态里，换连接时重放
+static char *stateful_sql[] = {"USE ", "LOCK ", "PREPARE ", "CREATE TEMPORARY ", "HANDLER ", NULL};
+
+//分片的时候BEGIN先不发，等事务第一条语句算出组；整条语句只能是这些
+static char *begin_sql[] = {"BEGIN", "BEGIN WORK", "START TRANSACTION", NULL};
+static char *end_sql[] = {"COMMIT", "COMMIT WORK", "ROLLBACK", "ROLLBACK WORK", NULL};
+
+#define IS_SQL_WORD(ch) (isalnum((unsigned char)(ch)) || ((ch) == '_') || ((ch) == '$'))
+
+//SELECT里出现这些词就不是普通的读：加锁读、SELECT INTO、锁函数、跟上一条语句在同一个连接上才有意义的函数
+static char *write_sql_word[] = {"UPDATE", "SHARE", "INTO", "GET_LOCK", "RELEASE_LOCK", "RELEASE_ALL_LOCKS", \
+                            "IS_FREE_LOCK", "IS_USED_LOCK", "LAST_INSERT_ID", "FOUND_ROWS", "SQL_CALC_FOUND_ROWS", \
+                            "ROW_COUNT", NULL};
+
+//语句里出现这些词会在mysql连接上留下状态：命名锁要在同一个连接上释放，SQL_CALC_FOUND_ROWS留给下一条FOUND_ROWS()
+static char *pin_sql_word[] = {"GET_LOCK", "SQL_CALC_FOUND_ROWS", NULL};
 
 /*
  * fun: mysql handshake stage1 callback
@@ -71,7 +145,6 @@ int my_hs_stage1_cb(int fd, void *arg)
     my_node_t *node;
     my_auth_init_t init;
     cli_auth_login_t login;
-    my_info_t *info;
 
     my = (my_conn_t *)arg;
     node = my->node;
@@ -79,7 +152,6 @@ int my_hs_stage1_cb(int fd, void *arg)
 
     user = node->user;
     pass = node->pass;
-    info = node->info;
 
 
     if( (res = my_real_read(fd, buf, &done)) < 0 ){
@@ -88,14 +160,9 @@ int my_hs_stage1_cb(int fd, void *arg)
     }
 
     if(done){
-        if( (res = del_handler(fd)) < 0 ) {
-            log(g_log, "del_handler fd[%d] error\n", fd);
-            goto end;
-        }
-
-        res = add_handler(fd, EPOLLOUT, my_hs_stage2_cb, arg);
+        res = mod_handler(fd, MY_EPOLLOUT, my_hs_stage2_cb, arg);
         if(res < 0){
-            log(g_log, "add_handler fd[%d] error\n", fd);
+            log(g_log, "mod_handler fd[%d] error\n", fd);
             goto end;
         }
 
@@ -167,13 +234,9 @@ int my_hs_stage2_cb(int fd, void *arg)
     }
 
     if(done){
-        if( (res = del_handler(fd)) < 0 ){
-            log(g_log, "del_handler fd[%d] error\n", fd);
-            goto end;
-        }
 		//认证数据发送完成后，下一步进行结果验证，登陆结果
-        if( (res = add_handler(fd, EPOLLIN, my_hs_stage3_cb, arg)) < 0 ){
-            log(g_log, "add_handler fd[%d] error\n", fd);
+        if( (res = mod_handler(fd, MY_EPOLLIN, my_hs_stage3_cb, arg)) < 0 ){
+            log(g_log, "mod_handler fd[%d] error\n", fd);
             goto end;
         }
 
@@ -202,6 +265,7 @@ int my_hs_stage3_cb(int fd, void *arg)
     my_conn_t *my;
     buf_t *buf;
     my_auth_result_t result;
+    cli_com_t com;
 
     my = (my_conn_t *)arg;
     buf = &(my->buf);
@@ -227,12 +291,167 @@ int my_hs_stage3_cb(int fd, void *arg)
 
         if(result.result == 0){
             debug(g_log, "mysql authorized success\n");
-            res = my_conn_set_avail(my, 1);//跟mysql直接的验证成功了，下面标记这个连接为可用的,放入node的avail_head上面
         } else {
             log(g_log, "mysql authorized error, errmsg:[%s]\n", result.errmsg);
             goto end;
         }
-		-- ((my_node_t*)my->node)->cur_connecting_cnt ;//减少正在连接的连接数 
+
+        //查一下wait_timeout，空闲快到这个时间了才ping，查完了才算连上
+        com.pktno = 0;
+        com.comno = COM_QUERY;
+        com.len = snprintf(com.arg, sizeof(com.arg), "SELECT @@wait_timeout");
+        make_com(buf, &com);
+        buf_rewind(buf);
+
+        if( (res = mod_handler(fd, MY_EPOLLOUT, my_hs_stage4_cb, arg)) < 0 ){
+            log(g_log, "mod_handler fd[%d] error\n", fd);
+            goto end;
+        }
+    }
+
+    return res;
+
+end:
+	-- ((my_node_t*)my->node)->cur_connecting_cnt ;
+    my_conn_close_on_fail(my);
+
+    return res;
+}
+
+/*
+ * fun: mysql handshake stage4 callback, send SELECT @@wait_timeout
+ * arg: fd, mysql connection
+ * ret: success 0, error -1
+ *
+ */
+
+int my_hs_stage4_cb(int fd, void *arg)
+{
+    int done, res = 0;
+    my_conn_t *my;
+    buf_t *buf;
+
+    my = (my_conn_t *)arg;
+    buf = &(my->buf);
+
+    if( (res = my_real_write(fd, buf, &done)) < 0 ){
+        log_err(g_log, "my_real_write error[%d]\n", res);
+        goto end;
+    }
+
+    if(done){
+        if( (res = mod_handler(fd, MY_EPOLLIN, my_hs_stage5_cb, arg)) < 0 ){
+            log(g_log, "mod_handler fd[%d] error\n", fd);
+            goto end;
+        }
+
+        buf_reset(buf);
+    }
+
+    return res;
+
+end:
+	-- ((my_node_t*)my->node)->cur_connecting_cnt ;
+    my_conn_close_on_fail(my);
+
+    return res;
+}
+
+/*
+ * fun: mysql handshake stage5 callback, read wait_timeout
+ * arg: fd, mysql connection
+ * ret: success 0, error -1
+ *
+ */
+
+int my_hs_stage5_cb(int fd, void *arg)
+{//查不出来就按默认值，连接还是能用的
+    int res = 0, timeout;
+    my_conn_t *my;
+    buf_t *buf;
+    char val[32];
+    cli_com_t com;
+
+    my = (my_conn_t *)arg;
+    buf = &(my->buf);
+
+    if( (res = my_real_read_result_set(fd, buf)) < 0 ){
+        log_err(g_log, "my_real_read_result_set error[%d]\n", res);
+        goto end;
+    }
+
+    if( (res = parse_var_result(buf, NULL, val, sizeof(val))) == 0 ){
+        return 0;
+    }
+
+    timeout = (res == 1) ? atoi(val) : 0;
+    if(timeout <= 0){
+        log(g_log, "wait_timeout of mysql unknown, use %d\n", MY_WAIT_TIMEOUT_DEF);
+        timeout = MY_WAIT_TIMEOUT_DEF;
+    }
+    my->wait_timeout = timeout;
+
+    if( (res = del_handler(fd)) < 0 ){
+        log(g_log, "del_handler fd[%d]\n", fd);
+        goto end;
+    }
+
+    buf_reset(buf);
+
+    if( g_conf.read_after_write_gtid && (((my_node_t *)my->node)->role == MY_ROLE_MASTER) ){//master的连接让提交的OK包带上GTID
+        com.pktno = 0;
+        com.comno = COM_QUERY;
+        com.len = snprintf(com.arg, sizeof(com.arg), "SET session_track_gtids=OWN_GTID");
+        make_com(buf, &com);
+        buf_rewind(buf);
+
+        if( (res = mod_handler(fd, MY_EPOLLOUT, my_hs_stage6_cb, arg)) < 0 ){
+            log(g_log, "mod_handler fd[%d] error\n", fd);
+            goto end;
+        }
+
+        return 0;
+    }
+
+	-- ((my_node_t*)my->node)->cur_connecting_cnt ;//减少正在连接的连接数 
+    my_conn_node_ok(my);
+    return my_conn_set_avail(my, 1);//跟mysql直接的验证成功了，下面标记这个连接为可用的,放入node的avail_head上面
+
+end:
+	-- ((my_node_t*)my->node)->cur_connecting_cnt ;
+    my_conn_close_on_fail(my);
+
+    return res;
+}
+
+/*
+ * fun: mysql handshake stage6 callback, send SET session_track_gtids
+ * arg: fd, mysql connection
+ * ret: success 0, error -1
+ *
+ */
+
+int my_hs_stage6_cb(int fd, void *arg)
+{
+    int done, res = 0;
+    my_conn_t *my;
+    buf_t *buf;
+
+    my = (my_conn_t *)arg;
+    buf = &(my->buf);
+
+    if( (res = my_real_write(fd, buf, &done)) < 0 ){
+        log_err(g_log, "my_real_write error[%d]\n", res);
+        goto end;
+    }
+
+    if(done){
+        if( (res = mod_handler(fd, MY_EPOLLIN, my_hs_stage7_cb, arg)) < 0 ){
+            log(g_log, "mod_handler fd[%d] error\n", fd);
+            goto end;
+        }
+
+        buf_reset(buf);
     }
 
     return res;
@@ -244,6 +463,56 @@ end:
     return res;
 }
 
+/*
+ * fun: mysql handshake stage7 callback, read result of SET session_track_gtids
+ * arg: fd, mysql connection
+ * ret: success 0, error -1
+ *
+ */
+
+int my_hs_stage7_cb(int fd, void *arg)
+{//5.7以前的mysql没有这个变量，报错了连接照样能用，只是写完以后按read_after_write的时间算
+    int done, res = 0;
+    my_conn_t *my;
+    my_node_t *node;
+    buf_t *buf;
+    my_auth_result_t result;
+
+    my = (my_conn_t *)arg;
+    node = my->node;
+    buf = &(my->buf);
+
+    if( (res = my_real_read(fd, buf, &done)) < 0 ){
+        log_err(g_log, "my_real_read[%d]\n", res);
+        goto end;
+    }
+
+    if(!done){
+        return 0;
+    }
+
+    if( (res = del_handler(fd)) < 0 ){
+        log(g_log, "del_handler fd[%d]\n", fd);
+        goto end;
+    }
+
+    if( (parse_auth_result(buf, &result) < 0) || (result.result != 0) ){
+        log(g_log, "master %s:%s set session_track_gtids error, track write by time\n", node->host, node->srv);
+    }
+
+    buf_reset(buf);
+
+	-- node->cur_connecting_cnt ;
+    my_conn_node_ok(my);
+    return my_conn_set_avail(my, 1);
+
+end:
+	-- ((my_node_t*)my->node)->cur_connecting_cnt ;
+    my_conn_close_on_fail(my);
+
+    return res;
+}
+
 /*
  * fun: prepare for client connection stage1
  * arg: connection
@@ -258,19 +527,19 @@ int cli_hs_stage1_prepare(conn_t *c)
     buf_t *buf;
     my_auth_init_t init;
     my_info_t *info;
-    my_node_t *node;
-    my_conn_t *my;
 
 
     cli = c->cli;
 
-    if( (res = conn_alloc_my_conn(c)) < 0 ){
-        log(g_log, "conn:%u conn_alloc_my_conn error\n", c->connid);
-        return -1;
+    if( (info = my_info_get()) == NULL ){//握手包只需要mysql的版本信息，还没连上过mysql就排队等一个连接
+        c->wait_phase = WAIT_GREETING;
+        if(my_conn_wait(c, MY_ROLE_SLAVE, cli->ip, cli->port) < 0){
+            log(g_log, "conn:%u no mysql info yet\n", c->connid);
+            return -1;
+        }
+
+        return 0;
     }
-    my = c->my;
-    node = my->node;
-    info = node->info;
 
     buf = &(cli->buf);
 
@@ -281,7 +550,7 @@ int cli_hs_stage1_prepare(conn_t *c)
     init.srv_ver[sizeof(init.srv_ver) - 1] = '\0';
     init.tid = c->connid;
     memcpy(init.scram, cli->scram, 8);
-    init.cap = info->cap;
+    init.cap = info->cap & (~CLIENT_DEPRECATE_EOF);//跟mysql连接的能力一致，客户端也按EOF包解析结果集
     init.lang = 8;//info->lang;
     init.status = info->status;
     strncpy(init.plug, cli->scram + 8, 12);
@@ -293,7 +562,7 @@ int cli_hs_stage1_prepare(conn_t *c)
         return res;
     }
 
-    res = add_handler(cli->fd, EPOLLOUT, cli_hs_stage1_cb, cli);
+    res = add_handler(cli->fd, MY_EPOLLOUT, cli_hs_stage1_cb, cli);
     if(res < 0){
         log(g_log, "conn:%u add_handler fail\n", c->connid);
         return -1;
@@ -327,14 +596,9 @@ int cli_hs_stage1_cb(int fd, void *arg)
     }
 
     if(done){
-        if( (res = del_handler(fd)) < 0 ){
-            log(g_log, "conn:%u del_handler fd[%d] error\n", c->connid, fd);
-            goto end;
-        }
-
-        res = add_handler(fd, EPOLLIN, cli_hs_stage2_cb, arg);
+        res = mod_handler(fd, MY_EPOLLIN, cli_hs_stage2_cb, arg);
         if(res < 0){
-            log(g_log, "conn:%u add_handler fd[%d] error\n", c->connid, fd);
+            log(g_log, "conn:%u mod_handler fd[%d] error\n", c->connid, fd);
             goto end;
         }
 
@@ -378,11 +642,6 @@ int cli_hs_stage2_cb(int fd, void *arg)
     }
 
     if(done){
-        if( (res = del_handler(fd)) < 0 ){
-            log(g_log, "conn:%u del_handler error\n", c->connid);
-            goto end;
-        }
-
         if( (res = parse_login(buf, &login)) < 0 ){
             log(g_log, "conn:%u parse login error\n", c->connid);
             goto end;
@@ -399,9 +658,10 @@ int cli_hs_stage2_cb(int fd, void *arg)
                     goto end;
                 }
 
-                res = add_handler(fd, EPOLLOUT, cli_hs_stage3_cb, arg);
+                //登录不占mysql连接，第一个要用mysql的命令来了再借
+                res = mod_handler(fd, MY_EPOLLOUT, cli_hs_stage3_cb, arg);
                 if(res < 0){
-                    log(g_log, "conn:%u add_handler error\n", c->connid);
+                    log(g_log, "conn:%u mod_handler error\n", c->connid);
                     goto end;
                 }
 
@@ -421,9 +681,9 @@ int cli_hs_stage2_cb(int fd, void *arg)
 
         make_result_error(buf, &error);
 
-        res = add_handler(fd, EPOLLOUT, cli_hs_auth_fail_cb, arg);
+        res = mod_handler(fd, MY_EPOLLOUT, cli_hs_auth_fail_cb, arg);
         if(res < 0){
-            log(g_log, "conn:%u add_handler error\n", c->connid);
+            log(g_log, "conn:%u mod_handler error\n", c->connid);
             goto end;
         }
     }
@@ -437,89 +697,263 @@ end:
 }
 
 /*
- * fun: client handshake stage3 callback
- * arg: fd, client connection
+ * fun: waiting connection got mysql connection
+ * arg: connection
  * ret: success 0, error -1
  *
  */
 
-int cli_hs_stage3_cb(int fd, void *arg)
-{
-    int done, res = 0;
-    cli_conn_t *cli;
-    conn_t *c;
-    buf_t *buf;
-
-    cli = (cli_conn_t *)arg;
-    buf = &(cli->buf);
-    c = cli->conn;
-
-
-    if( (res = my_real_write(fd, buf, &done)) < 0 ){
-        log_err(g_log, "conn:%u my_real_write error\n", c->connid);
-        goto end;
+int cli_wait_done(conn_t *c)
+{//等握手包的接着握手，执行命令的时候排队的接着执行命令
+    if(c->wait_phase == WAIT_QUERY){
+        return cli_query_wait_done(c);
     }
 
-    if(done){
-        if( (res = del_handler(fd)) < 0 ){
-            log(g_log, "conn:%u del_handler error\n", c->connid);
-            goto end;
-        }
-
-        res = add_handler(fd, EPOLLIN, cli_query_cb, arg);
-        if(res < 0){
-            log(g_log, "conn:%u add_handler error\n", c->connid);
-            goto end;
-        }
+    return cli_hs_wait_done(c);
+}
 
-        buf_reset(buf);
-        buf_reset(&(c->buf));
+/*
+ * fun: waiting connection got no mysql connection
+ * arg: connection
+ * ret: success 0, error -1
+ *
+ */
 
-        conn_state_set_idle(c);
+int cli_wait_fail(conn_t *c)
+{
+    if(c->wait_phase == WAIT_QUERY){
+        return cli_query_wait_fail(c);
     }
 
-    return res;
-
-end:
-    //fix me
-    conn_close(c);
-
-    return res;
+    return cli_hs_wait_fail(c);
 }
 
 /*
- * fun: client handshake fail callback
- * arg: fd, client connection
+ * fun: waiting connection got mysql connection, send greeting
+ * arg: connection
  * ret: success 0, error -1
  *
  */
 
-static int cli_hs_auth_fail_cb(int fd, void *arg)
-{
-    int done, res = 0;
-    cli_conn_t *cli;
-    conn_t *c;
-    buf_t *buf;
-
-    cli = (cli_conn_t *)arg;
-    buf = &(cli->buf);
-    c = cli->conn;
-
+static int cli_hs_wait_done(conn_t *c)
+{//连上mysql了可以发握手包，拿到的mysql连接登录成功以后还回去
+    int res = 0;
 
-    if( (res = my_real_write(fd, buf, &done)) < 0 ){
-        log_err(g_log, "conn:%u my_real_write error\n", c->connid);
-        goto end;
-    }
+    c->wait_phase = WAIT_NONE;
+    conn_state_set_unavail(c);
 
-    if(done){
+    if( (res = cli_hs_stage1_prepare(c)) < 0 ){
+        log(g_log, "conn:%u cli_hs_stage1_prepare error\n", c->connid);
         conn_close(c);
     }
 
     return res;
-
-end:
-    conn_close(c);
-    return res;
+}
+
+/*
+ * fun: no mysql connection for client, send too many connections error
+ * arg: connection
+ * ret: success 0, error -1
+ *
+ */
+
+static int cli_hs_wait_fail(conn_t *c)
+{//排队超时、队列满或者节点下线，回复1040后关闭
+    int res = 0;
+    cli_conn_t *cli = c->cli;
+    buf_t *buf = &(cli->buf);
+    my_result_error_t error;
+
+    my_conn_wait_cancel(c, c->state == STATE_WAIT_MYSQL);
+    conn_state_set_auth_fail(c);
+
+    error.pktno = 0;//握手包还没发，错误包代替握手包
+    error.field_count = 0xff;
+    error.err = 1040;
+    error.marker = '#';
+    memcpy(error.sqlstate, "08004", 5);
+    strncpy(error.msg, "Too many connections", sizeof(error.msg) - 1);
+    error.msg[sizeof(error.msg) - 1] = '\0';
+
+    buf_reset(buf);
+    make_result_error(buf, &error);
+
+    res = add_handler(cli->fd, MY_EPOLLOUT, cli_hs_auth_fail_cb, cli);
+    if(res < 0){
+        log(g_log, "conn:%u add_handler error\n", c->connid);
+        conn_close(c);
+        return res;
+    }
+
+    return res;
+}
+
+/*
+ * fun: waiting command got mysql connection, go on with the command
+ * arg: connection
+ * ret: success 0, error -1
+ *
+ */
+
+static int cli_query_wait_done(conn_t *c)
+{//命令包还在c->buf里，接着处理
+    int res = 0;
+    cli_conn_t *cli = c->cli;
+
+    c->wait_phase = WAIT_NONE;
+    conn_state_set_reading_client(c);
+
+    res = add_handler(cli->fd, MY_EPOLLIN, cli_query_cb, cli);
+    if(res < 0){
+        log(g_log, "conn:%u add_handler error\n", c->connid);
+        conn_close(c);
+        return res;
+    }
+
+    if( (res = cli_com_dispatch(c)) < 0 ){
+        conn_close(c);
+    }
+
+    return res;
+}
+
+/*
+ * fun: no mysql connection for command, send too many connections error
+ * arg: connection
+ * ret: success 0, error -1
+ *
+ */
+
+static int cli_query_wait_fail(conn_t *c)
+{//只有这个命令失败，客户端连接留着
+    my_conn_wait_cancel(c, c->state == STATE_WAIT_MYSQL);
+    c->wait_phase = WAIT_NONE;
+    conn_state_set_reading_client(c);
+
+    return cli_query_error(c, 1040, "08004", "Too many connections");
+}
+
+/*
+ * fun: answer client command with error packet, mysql not involved
+ * arg: connection, error number, sqlstate, message
+ * ret: success 0, error -1
+ *
+ */
+
+static int cli_query_error(conn_t *c, int err, const char *sqlstate, const char *msg)
+{
+    int res = 0;
+    cli_conn_t *cli = c->cli;
+    buf_t *buf = &(c->buf);
+    my_result_error_t error;
+
+    error.pktno = 1;
+    error.field_count = 0xff;
+    error.err = err;
+    error.marker = '#';
+    memcpy(error.sqlstate, sqlstate, 5);
+    strncpy(error.msg, msg, sizeof(error.msg) - 1);
+    error.msg[sizeof(error.msg) - 1] = '\0';
+
+    buf_reset(buf);
+    make_result_error(buf, &error);
+
+    res = add_handler(cli->fd, MY_EPOLLOUT, cli_com_ok_write_cb, cli);
+    if(res < 0){
+        log(g_log, "conn:%u add_handler error\n", c->connid);
+        conn_close(c);
+        return res;
+    }
+
+    return res;
+}
+
+/*
+ * fun: client handshake stage3 callback
+ * arg: fd, client connection
+ * ret: success 0, error -1
+ *
+ */
+
+int cli_hs_stage3_cb(int fd, void *arg)
+{
+    int done, res = 0;
+    cli_conn_t *cli;
+    conn_t *c;
+    buf_t *buf;
+    my_conn_t *my;
+
+    cli = (cli_conn_t *)arg;
+    buf = &(cli->buf);
+    c = cli->conn;
+
+
+    if( (res = my_real_write(fd, buf, &done)) < 0 ){
+        log_err(g_log, "conn:%u my_real_write error\n", c->connid);
+        goto end;
+    }
+
+    if(done){
+        res = mod_handler(fd, MY_EPOLLIN, cli_query_cb, arg);
+        if(res < 0){
+            log(g_log, "conn:%u mod_handler error\n", c->connid);
+            goto end;
+        }
+
+        buf_reset(buf);
+        buf_reset(&(c->buf));
+
+        conn_state_set_idle(c);
+
+        if(c->my != NULL){//等握手包的时候拿到的mysql连接先还回去，执行命令的时候再借
+            my = c->my;
+            c->my = NULL;
+            my_conn_put(my, 1);
+        }
+    }
+
+    return res;
+
+end:
+    //fix me
+    conn_close(c);
+
+    return res;
+}
+
+/*
+ * fun: client handshake fail callback
+ * arg: fd, client connection
+ * ret: success 0, error -1
+ *
+ */
+
+static int cli_hs_auth_fail_cb(int fd, void *arg)
+{
+    int done, res = 0;
+    cli_conn_t *cli;
+    conn_t *c;
+    buf_t *buf;
+
+    cli = (cli_conn_t *)arg;
+    buf = &(cli->buf);
+    c = cli->conn;
+
+
+    if( (res = my_real_write(fd, buf, &done)) < 0 ){
+        log_err(g_log, "conn:%u my_real_write error\n", c->connid);
+        goto end;
+    }
+
+    if(done){
+        conn_close(c);
+    }
+
+    return res;
+
+end:
+    conn_close(c);
+    return res;
 }
 
 /*
@@ -546,20 +980,20 @@ int cli_query_cb(int fd, void *arg)
 
     if(c->state == STATE_IDLE){
         conn_state_set_reading_client(c);
-        gettimeofday(&(c->tv_start), NULL);
+        c->us_start = clock_us();
     } else if( (c->state == STATE_PREPARE_MYSQL) || (c->state == STATE_WRITING_MYSQL) ){
         log(g_log, "conn:%u client can be read when preparing or writing mysql\n", c->connid);
         goto end;
     } else if(c->state == STATE_READ_MYSQL_WRITE_CLIENT) {//从mysql获取了结果，准备发送给client，所以记录sql数据 
         conn_state_set_reading_client(c);
         sqldump(c);
-        gettimeofday(&(c->tv_start), NULL);
+        c->us_start = clock_us();
 
         if( (res = del_handler(my->fd)) < 0 ){
             log(g_log, "conn:%u del_handler error\n", c->connid);
         }
     } else {
-        gettimeofday(&(c->tv_end), NULL);
+        c->us_end = clock_us();
     }
 
     if( (res = my_real_read(fd, buf, &done)) < 0 ){
@@ -575,104 +1009,161 @@ int cli_query_cb(int fd, void *arg)
         c->comno = com.comno;
         strncpy(c->arg, com.arg, sizeof(c->arg) - 1);
         c->arg[sizeof(c->arg) - 1] = '\0';
+        cli_com_sess(c, (com.pktlen - 1) >= sizeof(c->arg));
+        c->role = cli_com_route(c, (com.pktlen - 1) >= sizeof(c->arg));
+        if( (res = cli_com_shard(c, com.pktlen)) < 0 ){
+            goto end;
+        } else if(res > 0){//本地回了OK或者错误
+            return 0;
+        }
+        cli_com_split(c);
 
-        switch(c->comno)
-        {
-            // command ignored and quit
-            case COM_QUIT:
-            case COM_SHUTDOWN:
-                debug(g_log, "command quit/shutdown\n");
-                res = cli_com_ignored(c);
-                goto end;//挂掉这个连接
-
-            // command ignored
-            case COM_REFRESH:
-                log(g_log, "refresh\n");
-            case COM_PROCESS_KILL:
-                log(g_log, "kill\n");
-            case COM_DEBUG:
-                res = cli_com_ignored(c);
-                break;
+        if( (c->my == NULL) && cli_com_need_mysql(c->comno) && (c->sess_op != SESS_OP_SKIP) ){//还没占着mysql连接，先借一个
+            if( (res = cli_com_bind_my(c)) < 0 ){
+                goto end;
+            } else if(res > 0){//排队等mysql连接，拿到以后再接着处理这个命令
+                return 0;
+            }
+        }
+
+        if( (res = cli_com_dispatch(c)) < 0 ){
+            goto end;
+        }
+    }
+
+    return res;
+
+end:
+    //conn_close_with_my(c);
+	conn_close(c) ;
+
+    return res;
+}
 
-            case COM_INIT_DB:
-                debug(g_log, "init db, ignore frist.\n");
+/*
+ * fun: handle client command already read into buffer
+ * arg: connection
+ * ret: success 0, error -1 and connection should be closed
+ *
+ */
+
+static int cli_com_dispatch(conn_t *c)
+{
+    int res = 0;
+    my_conn_t *my = c->my;
+
+    cli_com_pin(c);
+
+    switch(c->comno)
+    {
+        // command ignored and quit
+        case COM_QUIT:
+        case COM_SHUTDOWN:
+            debug(g_log, "command quit/shutdown\n");
+            res = cli_com_ignored(c);
+            return -1;//挂掉这个连接
+
+        // command ignored
+        case COM_REFRESH:
+            log(g_log, "refresh\n");
+        case COM_PROCESS_KILL:
+            log(g_log, "kill\n");
+        case COM_DEBUG:
+            res = cli_com_ignored(c);
+            break;
+
+        case COM_INIT_DB:
+            debug(g_log, "init db, ignore frist.\n");
 				res = cli_com_ignored(c);//先忽略这个数据库初始化请求，待会query的时候再看数据库是否一样。这样能避免重复use db
-                strncpy(c->curdb, c->arg, sizeof(c->curdb) - 1);
+            strncpy(c->curdb, c->arg, sizeof(c->curdb) - 1);
 				/*
-                if( (res = cli_com_forward(c)) < 0 ){
-                    log(g_log, "conn:%u cli_com_forward error\n", c->connid);
-                    goto end;
-                } else {
-                    debug(g_log, "conn:%u cli_com_forward success\n", c->connid);
-                }
+            if( (res = cli_com_forward(c)) < 0 ){
+                log(g_log, "conn:%u cli_com_forward error\n", c->connid);
+                return -1;
+            } else {
+                debug(g_log, "conn:%u cli_com_forward success\n", c->connid);
+            }
 
-                strncpy(my->ctx.curdb, c->curdb, sizeof(my->ctx.curdb) - 1);
-                my->ctx.curdb[sizeof(my->ctx.curdb) - 1] = '\0';
+            strncpy(my->ctx.curdb, c->curdb, sizeof(my->ctx.curdb) - 1);
+            my->ctx.curdb[sizeof(my->ctx.curdb) - 1] = '\0';
 
-                conn_state_set_writing_mysql(c);
+            conn_state_set_writing_mysql(c);
 				*/
+            break;
+
+        // command unsupported
+        case COM_BINLOG_DUMP:
+            log(g_log, "binlog dump\n");
+        case COM_TABLE_DUMP:
+            log(g_log, "table dump\n");
+        case COM_REGISTER_SLAVE:
+            log(g_log, "register slave\n");
+        case COM_CHANGE_USER:
+            log(g_log, "change user\n");
+            res = cli_com_unsupported(c);
+            log(g_log, "conn:%u client command unsupported\n", c->connid);
+            return -1;
+
+        case COM_CREATE_DB:
+            log(g_log, "create db\n");
+        case COM_DROP_DB:
+            log(g_log, "drop db\n");
+        case COM_QUERY:
+            if(c->sess_op == SESS_OP_SKIP){//SET的值会话里已经有了，不用发给mysql
+                res = cli_com_ignored(c);
                 break;
-
-            // command unsupported
-            case COM_BINLOG_DUMP:
-                log(g_log, "binlog dump\n");
-            case COM_TABLE_DUMP:
-                log(g_log, "table dump\n");
-            case COM_REGISTER_SLAVE:
-                log(g_log, "register slave\n");
-            case COM_CHANGE_USER:
-                log(g_log, "change user\n");
-                res = cli_com_unsupported(c);
-                log(g_log, "conn:%u client command unsupported\n", c->connid);
-                goto end;
-
-            case COM_CREATE_DB:
-                log(g_log, "create db\n");
-            case COM_DROP_DB:
-                log(g_log, "drop db\n");
-            case COM_QUERY:
+            }
 				//下面为了选一个合适的连接，虽然当前分配了，但可能需要切换主从
-                /*if( (res = conn_alloc_my_conn(c)) < 0 ){ 
-                    log(g_log, "conn:%u alloc mysql conn error\n", c->connid);
-                    goto end;
-                }*/
-                my = c->my;
+            /*if( (res = conn_alloc_my_conn(c)) < 0 ){ 
+                log(g_log, "conn:%u alloc mysql conn error\n", c->connid);
+                return -1;
+            }*/
+            my = c->my;
+            if(cli_com_pipe(c)){//读语句把换库、重放和语句一次写过去，省掉中间的来回
+                if( (res = my_pipe_prepare(c)) < 0 ){
+                    log(g_log, "conn:%u my_pipe_prepare error\n", c->connid);
+                    return -1;
+                }
+
+                break;
+            }
 				//判断数据库是否相等
-                if(c->curdb != NULL && strcmp(my->ctx.curdb, c->curdb)){//还需要给服务器发送切换数据库的命令 
-                    if( (res = my_use_db_prepare(c)) < 0 ){
-                        log(g_log, "conn:%u my_use_db_prepare error\n", c->connid);
-                        goto end;
-                    }
+            if( (c->curdb[0] != '\0') && strcmp(my->ctx.curdb, c->curdb) ){//还需要给服务器发送切换数据库的命令 
+                if( (res = my_use_db_prepare(c)) < 0 ){
+                    log(g_log, "conn:%u my_use_db_prepare error\n", c->connid);
+                    return -1;
+                }
 
-                    conn_state_set_prepare_mysql(c);//标记为这个在等待切换数据库，完成后才能做后面的事情，
+                conn_state_set_prepare_mysql(c);//标记为这个在等待切换数据库，完成后才能做后面的事情，
 					//就是真正处理命令转发my_use_db_prepare里面会放回调的
 
-                    break;
+                break;
+            }
+            if( sess_diff(&(c->sess), &(my->ctx.sess), NULL, 0) > 0 ){//连接上的会话变量跟客户端的不一样，先重放
+                if( (res = my_sess_prepare(c)) < 0 ){
+                    log(g_log, "conn:%u my_sess_prepare error\n", c->connid);
+                    return -1;
                 }
-				//如果这条指令是"SET NAMES utf8",判断当前连接使用的字符集是否相同，不相同就需要转发这条指令，否则ignore就行了
-				if( strncmp( c->arg, "SET NAMES ", 10) == 0 ){
-					if( strncmp( c->arg, my->setnamesql, 64 ) == 0 ){
-						res = cli_com_ignored(c);
-						break ;//属于SETNAMES
-					}
-					strncpy( my->setnamesql, c->arg, 64) ;
-				}
 
-            default:
-                if( (res = cli_com_forward(c)) < 0 ){
-                    log(g_log, "conn:%u cli_com_forward error\n", c->connid);
-                    goto end;
+                conn_state_set_prepare_mysql(c);
+                break;
+            }
+            if(c->begin){//推迟的BEGIN，组定了，在这个连接上补发
+                if( (res = my_begin_prepare(c)) < 0 ){
+                    log(g_log, "conn:%u my_begin_prepare error\n", c->connid);
+                    return -1;
                 }
 
-                conn_state_set_writing_mysql(c);
-        }
-    }
-
-    return res;
+                conn_state_set_prepare_mysql(c);
+                break;
+            }
 
-end:
-    //conn_close_with_my(c);
-	conn_close(c) ;
+        default:
+            if( (res = cli_com_forward(c)) < 0 ){
+                log(g_log, "conn:%u cli_com_forward error\n", c->connid);
+                return -1;
+            }
+    }
 
     return res;
 }
@@ -702,14 +1193,9 @@ int my_query_cb(int fd, void *arg)
     }
 
     if(done){
-        if( (res = del_handler(fd)) < 0 ){
-            log(g_log, "conn:%u del_handler error\n", c->connid);
-            goto end;
-        }
-
-        res = add_handler(fd, EPOLLIN, my_answer_cb, my);
+        res = mod_handler(fd, MY_EPOLLIN, my_answer_cb, my);
         if(res < 0){
-            log(g_log, "conn:%u add_handler error\n", c->connid);
+            log(g_log, "conn:%u mod_handler error\n", c->connid);
             goto end;
         }
 
@@ -736,7 +1222,8 @@ end:
 
 int my_answer_cb(int fd, void *arg)
 {
-    int res = 0;
+    int done, res = 0;
+    size_t used;
     my_conn_t *my;
     cli_conn_t *cli;
     conn_t *c;
@@ -748,29 +1235,80 @@ int my_answer_cb(int fd, void *arg)
     cli = c->cli;
 
 
+    used = buf->used;
     if( (res = my_real_read_result_set(fd, buf)) < 0 ){
         log_err(g_log, "conn:%u my_real_read_result_set error\n", c->connid);
+        my_conn_node_fail(my);
         goto end;
     }
 
-    if( (res = del_handler(fd)) < 0 ){
-        log(g_log, "conn:%u del_handler error\n", c->connid);
+    if(buf->used == 0){
+        return res;
+    }
+
+    if(c->pipe_i < c->pipe_n){//流水线里前置命令的回复先到，一个一个拿掉
+        my_pipe_resp(c);
+        if(c->pipe_i < c->pipe_n){
+            return 0;
+        }
+        used = c->pipe_keep;
+        if(buf->used == used){
+            return 0;
+        }
+    }
+
+    if(c->pipe_err){//前置命令失败了，语句是在不对的库或者会话上执行的，结果读完扔掉，回客户端前置命令的ERR
+        if( (res = resp_parse(&(c->resp), buf->ptr + used, buf->used - used)) < 0 ){
+            log(g_log, "conn:%u unexpected data after mysql response\n", c->connid);
+            goto end;
+        }
+        buf->used = used;
+        if(res == 0){
+            return 0;
+        }
+        c->pipe_err = 0;
+        c->pipe_keep = 0;
+        res = 0;
+    } else if(!c->pin){//要知道回复什么时候结束，结束时在不在事务里，SET有没有成功
+        if( (res = resp_parse(&(c->resp), buf->ptr + used, buf->used - used)) < 0 ){
+            log(g_log, "conn:%u unexpected data after mysql response, pin mysql conn\n", c->connid);
+            cli_pin_my_conn(c);
+        } else if(res > 0){
+            cli_sess_commit(c);
+            cli_write_done(c);
+        }
+        res = 0;
+    }
+
+    if( c->pin || (c->resp.state == RESP_DONE) ){//钉住的不解析回复，收到第一批数据就算回了
+        my_conn_req_end(my, 1);
+    }
+
+    buf_rewind(buf);
+
+    //客户端一般是可写的，先直接写，写完了两边的事件都不用动
+    if( (res = my_real_write(cli->fd, buf, &done)) < 0 ){
+        log_err(g_log, "conn:%u my_real_write error\n", c->connid);
         goto end;
     }
 
-    if( (res = del_handler(cli->fd)) < 0 ){
+    if(done){
+        buf_reset(buf);
+        cli_release_my_conn(c);
+        return res;
+    }
+
+    if( (res = del_handler(fd)) < 0 ){
         log(g_log, "conn:%u del_handler error\n", c->connid);
         goto end;
     }
 
-    res = add_handler(cli->fd, EPOLLOUT, cli_answer_cb, cli);
+    res = mod_handler(cli->fd, MY_EPOLLOUT, cli_answer_cb, cli);
     if(res < 0){
-        log(g_log, "conn:%u add_handler error\n", c->connid);
+        log(g_log, "conn:%u mod_handler error\n", c->connid);
         goto end;
     }
 
-    buf_rewind(buf);
-
     return res;
 
 end:
@@ -806,27 +1344,23 @@ int cli_answer_cb(int fd, void *arg)
     }
 
     if(done){
-        if( (res = del_handler(fd)) < 0 ){
-            log(g_log, "conn:%u del_handler error\n", c->connid);
-            goto end;
-        }
-
-        res = add_handler(fd, EPOLLIN, cli_query_cb, cli);
+        res = mod_handler(fd, MY_EPOLLIN, cli_query_cb, cli);
         if(res < 0){
-            log(g_log, "conn:%u add_handler error\n", c->connid);
+            log(g_log, "conn:%u mod_handler error\n", c->connid);
             goto end;
         }
 
-        res = add_handler(my->fd, EPOLLIN, my_answer_cb, my);
+        res = mod_handler(my->fd, MY_EPOLLIN, my_answer_cb, my);
         if(res < 0){
-            log(g_log, "conn:%u add_handler error\n", c->connid);
+            log(g_log, "conn:%u mod_handler error\n", c->connid);
             goto end;
         }
 
-        gettimeofday(&(c->tv_end), NULL);
+        c->us_end = clock_us();
 
         buf_reset(buf);
 
+        cli_release_my_conn(c);
     }
 
     return res;
@@ -846,22 +1380,22 @@ end:
 
 static int my_real_read(int fd, buf_t *buf, int *done)
 {
-    int left, n;
+    int left, n, total = 0;
     uint32_t pktlen;
     char *ptr;
 
     ptr = buf->ptr;
     *done = 0;
 
+AGAIN:
     left = buf->size - buf->used;
     ptr = buf->ptr + buf->used;
 
-AGAIN:
-    if( (n = read(fd, ptr, left)) < 0 ){
+    if( (n = handler_read(fd, ptr, left)) < 0 ){
         if(errno == EINTR){
             goto AGAIN;
 		} else if( errno == EAGAIN || errno == EWOULDBLOCK){
-			return 0 ;
+			return total ;
         } else {
             return n;
         }
@@ -871,6 +1405,7 @@ AGAIN:
     } else {
         buf->used += n;
         buf->pos += n;
+        total += n;
 
         if(buf->used >= HEADER_SIZE){
 			//如果已经读取到了4个字节的固定长度，那么就可以拿到数据包有多大了，也就是这次应该读取的长度是多少大
@@ -886,7 +1421,14 @@ AGAIN:
                 *done = 1;
             }
         }
-		return n;
+        if(g_conf.epoll_et && !(*done)){//边缘触发必须读到EAGAIN，预算用完就挂到下一轮再读
+            if(total >= g_conf.io_budget){
+                handler_pend(fd);
+                return total;
+            }
+            goto AGAIN;
+        }
+		return total;
 	}
 	return 0 ;
 }
@@ -900,28 +1442,37 @@ AGAIN:
 
 static int my_real_read_result_set(int fd, buf_t *buf)
 {
-    int left, n;
+    int left, n, total = 0;
     char *ptr;
 
+AGAIN:
     left = buf->size - buf->used;
     ptr = buf->ptr + buf->used;
 
-AGAIN:
-    if( (n = read(fd, ptr, left)) < 0 ){
+    if( (n = handler_read(fd, ptr, left)) < 0 ){
         if(errno == EINTR){
             goto AGAIN;
 		}else if( errno == EAGAIN || errno == EWOULDBLOCK){
-			return 0 ;
+			return total ;
         } else {
             return n;
         }
-    } else if(n == 0) {
-        return n;
+    } else if(n == 0) {//mysql关闭了连接
+        return -1;
     } else {
         buf->used += n;
         buf->pos += n;
+        total += n;
 
-        return n;
+        if(g_conf.epoll_et){//边缘触发读到EAGAIN为止，缓冲满了或者预算用完就挂到下一轮
+            if( (buf->used >= buf->size) || (total >= g_conf.io_budget) ){
+                handler_pend(fd);
+                return total;
+            }
+            goto AGAIN;
+        }
+
+        return total;
     }
 }
 
@@ -934,16 +1485,16 @@ AGAIN:
 
 static int my_real_write(int fd, buf_t *buf, int *done)
 {
-    int left, n;
+    int left, n, total = 0;
     char *ptr;
 
     *done = 0;
 
+AGAIN:
     left = buf->used - buf->pos;
     ptr = buf->ptr + buf->pos;
 
-AGAIN:
-    if( (n = write(fd, ptr, left)) < 0 ){
+    if( (n = handler_write(fd, ptr, left)) < 0 ){
 		//返回小于0，可能有问题
         if(errno == EINTR){
             goto AGAIN;
@@ -956,169 +1507,1778 @@ AGAIN:
         return n;
     } else {
         buf->pos += n;
+        total += n;
         if(buf->pos >= buf->used){
             *done = 1;
+        } else if(g_conf.epoll_et){//边缘触发写到EAGAIN为止，预算用完挂到下一轮
+            if(total >= g_conf.io_budget){
+                handler_pend(fd);
+                return total;
+            }
+            goto AGAIN;
+        }
+
+        return total;
+    }
+	return 0 ;
+}
+
+/*
+ * fun: ignore some client command
+ * arg: connection
+ * ret: success 0, error -1
+ *
+ */
+
+static int cli_com_ignored(conn_t *c)
+{
+#define CLI_COM_IGNORE_OK_PKT_SIZE 7
+
+    int res = 0, fd;
+    uint32_t pktlen;
+    uint8_t pktno;
+
+    buf_t *buf;
+    cli_conn_t *cli;
+    char *ptr;
+
+
+    pktlen = 0;
+    pktno = 1;
+    buf = &(c->buf);
+    cli = c->cli;
+    fd = cli->fd;
+
+    buf_reset(buf);
+    ptr = buf->ptr;
+
+    bzero(ptr + 4, CLI_COM_IGNORE_OK_PKT_SIZE);
+    pktlen = CLI_COM_IGNORE_OK_PKT_SIZE;
+    memcpy(ptr, &pktlen, 3);
+    memcpy(ptr + 3, &pktno, 1);
+
+    buf->used += (CLI_COM_IGNORE_OK_PKT_SIZE + 4);
+    buf->pos += (CLI_COM_IGNORE_OK_PKT_SIZE + 4);
+    buf_rewind(buf);
+
+    res = mod_handler(fd, MY_EPOLLOUT, cli_com_ok_write_cb, cli);
+    if(res < 0){
+        log(g_log, "conn:%u mod_handler error\n", c->connid);
+        return res;
+    }
+
+    return 0;
+}
+
+/*
+ * fun: write ok packet to client callback
+ * arg: fd, client connection
+ * ret: success 0, error -1
+ *
+ */
+
+static int cli_com_ok_write_cb(int fd, void *arg)
+{
+    int done, res = 0;
+    cli_conn_t *cli;
+    buf_t *buf;
+    my_conn_t *my;
+    conn_t *c;
+
+    cli = (cli_conn_t *)arg;
+    c = cli->conn;
+    buf = &(c->buf);
+    my = c->my;
+
+
+    if( (res = my_real_write(fd, buf, &done)) < 0 ){
+        log_err(g_log, "conn:%u my_real_write error\n", c->connid);
+        goto end;
+    }
+
+    if(done){
+        res = mod_handler(fd, MY_EPOLLIN, cli_query_cb, cli);
+        if(res < 0){
+            log(g_log, "conn:%u mod_handler error\n", c->connid);
+            goto end;
+        }
+
+        buf_reset(buf);
+
+        conn_state_set_reading_client(c);
+    }
+
+    return res;
+
+end:
+    conn_close(c);
+
+    return res;
+}
+
+/*
+ * fun: forward client command to mysql
+ * arg: connection
+ * ret: success 0, error -1
+ *
+ */
+
+static int cli_com_forward(conn_t *c)
+{
+    int done, res = 0, fd;
+    my_conn_t *my;
+    buf_t *buf;
+    cli_conn_t *cli;
+    my_node_t *node;
+
+    my = c->my;
+    fd = my->fd;
+    buf = &(c->buf);
+    cli = c->cli;
+    node = my->node;
+
+    log(g_log, "conn:%u mysql[%s:%s], sql:%s\n", c->connid, node->host, node->srv, c->arg );
+
+    resp_init(&(c->resp), my->status, &(c->sess));
+    buf_rewind(buf);
+    conn_state_set_writing_mysql(c);
+    my_conn_req_start(my);
+
+    //mysql连接一般是可写的，先直接写，写不完再等EPOLLOUT
+    if( (res = my_real_write(fd, buf, &done)) < 0 ){
+        log_err(g_log, "conn:%u my_real_write error\n", c->connid);
+        my_conn_node_fail(my);
+        my_conn_ctx_set_dirty(my);//连接已经不可用，归还的时候直接关掉
+        return res;
+    }
+
+    if(done){
+        res = mod_handler(fd, MY_EPOLLIN, my_answer_cb, my);
+        if(res < 0){
+            log(g_log, "conn:%u mod_handler error\n", c->connid);
+            return res;
+        }
+
+        buf_reset(buf);
+        conn_state_set_read_mysql_write_client(c);
+
+        return res;
+    }
+
+    res = mod_handler(fd, MY_EPOLLOUT, my_query_cb, my);
+    if(res < 0){
+        log(g_log, "conn:%u mod_handler error\n", c->connid);
+        return res;
+    }
+
+    return res;
+}
+
+/*
+ * fun: unsupported client command, do nothing
+ * arg: onnection
+ * ret: always return 0
+ *
+ */
+
+static int cli_com_unsupported(conn_t *c)
+{
+    return 0;
+}
+
+/*
+ * fun: does client command need mysql connection
+ * arg: command number
+ * ret: need 1, not need 0
+ *
+ */
+
+static int cli_com_need_mysql(uint8_t comno)
+{//忽略的、不支持的和直接关连接的命令不用mysql连接
+    switch(comno)
+    {
+        case COM_QUIT:
+        case COM_SHUTDOWN:
+        case COM_REFRESH:
+        case COM_PROCESS_KILL:
+        case COM_DEBUG:
+        case COM_INIT_DB:
+        case COM_BINLOG_DUMP:
+        case COM_TABLE_DUMP:
+        case COM_REGISTER_SLAVE:
+        case COM_CHANGE_USER:
+            return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * fun: borrow mysql connection for client command, wait if none
+ * arg: connection
+ * ret: got mysql connection 0, command deferred 1, error -1
+ *
+ */
+
+static int cli_com_bind_my(conn_t *c)
+{
+    cli_conn_t *cli = c->cli;
+
+    if(conn_alloc_my_conn(c) == 0){
+        return 0;
+    }
+
+    c->wait_phase = WAIT_QUERY;
+    if(my_conn_wait(c, c->role, cli->ip, cli->port) < 0){//这个命令回复错误
+        log(g_log, "conn:%u wait mysql conn error\n", c->connid);
+        return (cli_wait_fail(c) < 0) ? -1 : 1;
+    }
+
+    if(del_handler(cli->fd) < 0){//排队的时候不读客户端
+        log(g_log, "conn:%u del_handler error\n", c->connid);
+        return -1;
+    }
+
+    return 1;
+}
+
+/*
+ * fun: is sql changing session state
+ * arg: sql
+ * ret: yes 1, no 0
+ *
+ */
+
+static int cli_sql_is_stateful(const char *sql)
+{//只看开头的关键字，不区分大小写
+    int i;
+
+    while(isspace((unsigned char)*sql)){
+        sql++;
+    }
+
+    for(i = 0; stateful_sql[i] != NULL; i++){
+        if(!strncasecmp(sql, stateful_sql[i], strlen(stateful_sql[i]))){
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * fun: does sql leave state on mysql connection anywhere in statement
+ * arg: sql
+ * ret: yes 1, no 0
+ *
+ */
+
+static int cli_sql_keeps_state(const char *sql)
+{//命名锁、SQL_CALC_FOUND_ROWS，还有:=和INTO @给用户变量赋值；词在字符串里也算，多绑定一次没关系
+    int i, len;
+    const char *p, *q;
+
+    if(strstr(sql, ":=") != NULL){
+        return 1;
+    }
+
+    for(p = sql; *p != '\0'; p++){
+        if( (!IS_SQL_WORD(*p)) || ((p > sql) && IS_SQL_WORD(p[-1])) ){
+            continue;
+        }
+
+        if( (!strncasecmp(p, "INTO", 4)) && (!IS_SQL_WORD(p[4])) ){
+            for(q = p + 4; isspace((unsigned char)*q); q++);
+            if(*q == '@'){
+                return 1;
+            }
+        }
+
+        for(i = 0; pin_sql_word[i] != NULL; i++){
+            len = strlen(pin_sql_word[i]);
+            if( (!strncasecmp(p, pin_sql_word[i], len)) && (!IS_SQL_WORD(p[len])) ){
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * fun: is sql a plain read that can go to slave
+ * arg: sql
+ * ret: yes 1, no 0
+ *
+ */
+
+static int cli_sql_is_read(const char *sql)
+{//开头跳过空白、注释和括号，是SELECT而且后面没有加锁之类的词，多条语句的不算；词在字符串里也算，多发master没关系
+    int i, len;
+    const char *p;
+
+    while(1){
+        while( isspace((unsigned char)*sql) || (*sql == '(') ){
+            sql++;
+        }
+        if( (sql[0] == '/') && (sql[1] == '*') ){
+            if( (p = strstr(sql + 2, "*/")) == NULL ){
+                return 0;
+            }
+            sql = p + 2;
+        } else if( (*sql == '#') || ((sql[0] == '-') && (sql[1] == '-') && isspace((unsigned char)sql[2])) ){
+            if( (p = strchr(sql, '\n')) == NULL ){
+                return 0;
+            }
+            sql = p + 1;
+        } else {
+            break;
+        }
+    }
+
+    if( strncasecmp(sql, "SELECT", 6) || IS_SQL_WORD(sql[6]) ){
+        return 0;
+    }
+
+    if( strstr(sql, ":=") != NULL ){//给用户变量赋值
+        return 0;
+    }
+
+    for(p = strchr(sql, '@'); p != NULL; p = strchr(p + 1, '@')){//读用户变量，值只在赋值的master连接上有；@@系统变量可以读slave
+        if(p[1] != '@'){
+            return 0;
+        }
+        p++;
+    }
+
+    if( ((p = strchr(sql, ';')) != NULL) ){
+        for(p++; isspace((unsigned char)*p); p++);
+        if(*p != '\0'){
+            return 0;
+        }
+    }
+
+    for(p = sql + 6; *p != '\0'; p++){
+        if( IS_SQL_WORD(*p) && (!IS_SQL_WORD(p[-1])) ){
+            for(i = 0; write_sql_word[i] != NULL; i++){
+                len = strlen(write_sql_word[i]);
+                if( (!strncasecmp(p, write_sql_word[i], len)) && (!IS_SQL_WORD(p[len])) ){
+                    return 0;
+                }
+            }
         }
+    }
+
+    return 1;
+}
+
+/*
+ * fun: choose master or slave for command that borrows mysql connection
+ * arg: connection, sql is truncated
+ * ret: MY_ROLE_MASTER or MY_ROLE_SLAVE
+ *
+ */
+
+static int cli_com_route(conn_t *c, int truncated)
+{//事务级复用一条语句借一次连接，只有事务外的普通SELECT和ping发slave；BEGIN发master，事务里一直占着这个连接，不会再选
+    c->write = 0;
+
+    if(c->comno == COM_PING){
+        return MY_ROLE_SLAVE;
+    }
+
+    if( c->begin && (c->comno == COM_QUERY) ){//推迟的BEGIN跟着这条语句发，事务都在master上
+        c->write = 1;
+        return MY_ROLE_MASTER;
+    }
+
+    if( (c->comno == COM_QUERY) && (!truncated) && cli_sql_is_read(c->arg) ){//截断的看不到后面有没有FOR UPDATE
+        if( c->write_time && (clock_ms() - c->write_time < (uint64_t)g_conf.read_after_write) ){//刚写过，slave可能还没同步到
+            return MY_ROLE_MASTER;
+        }
+        return MY_ROLE_SLAVE;
+    }
+
+    if(cli_com_need_mysql(c->comno)){//不是读就当写，BEGIN、SET也算，宁可多发master
+        c->write = 1;
+    }
+
+    return MY_ROLE_MASTER;
+}
+
+/*
+ * fun: borrow slave connection for read in session pool mode
+ * arg: connection
+ * ret: borrowed 1, use own connection 0
+ *
+ */
+
+static int cli_com_split(conn_t *c)
+{//会话级复用客户端自己一直占着master的连接，事务外的读临时借一个空闲的slave连接，回完就还；借不到不排队，还在自己的连接上读
+    int role = c->role;
+    my_conn_t *my = c->my;
+    cli_conn_t *cli = c->cli;
+
+    if(g_conf.pool_txn){
+        return 0;
+    }
+
+    c->role = MY_ROLE_MASTER;//自己占着的连接借master的
+    if( (role != MY_ROLE_SLAVE) || (c->comno != COM_QUERY) || c->pin || (c->sess_op != SESS_OP_NONE) ){
+        return 0;
+    }
+
+    if( (!my_pool_has_role(c->group, MY_ROLE_MASTER)) || (!my_pool_has_role(c->group, MY_ROLE_SLAVE)) ){
+        return 0;
+    }
+
+    if( (my != NULL) && ((my->status & SERVER_STATUS_IN_TRANS) || (!(my->status & SERVER_STATUS_AUTOCOMMIT))) ){
+        return 0;
+    }
+
+    if( (my = my_conn_get(c, MY_ROLE_SLAVE, cli->ip, cli->port)) == NULL ){
+        return 0;
+    }
+
+    if(((my_node_t *)my->node)->role != MY_ROLE_SLAVE){//slave都落后了，拿到的是master的，不如用自己的
+        my_conn_put(my, 0);
+        return 0;
+    }
+
+    c->hold = c->my;
+    c->my = my;
+    c->borrow = 1;
+
+    return 1;
+}
+
+/*
+ * fun: pin mysql connection to client if command changes session state
+ * arg: connection
+ * ret: pinned 1, not pinned 0
+ *
+ */
+
+static int cli_com_pin(conn_t *c)
+{//除了普通的query、ping和建删库，其他命令(比如预处理语句)都跟mysql连接绑定，记不下来的SET不管哪种模式都绑定
+    //会话级复用本来就一直占着连接，只有USE、LOCK、GET_LOCK、给用户变量赋值这些改会话状态的语句要绑定，slave上没有这些状态，不能再借slave读
+    if( c->pin || (!cli_com_need_mysql(c->comno)) ){
+        return 0;
+    }
+
+    if( (c->comno == COM_QUERY) && (c->sess_op == SESS_OP_LOST) ){
+        return cli_pin_my_conn(c);
+    }
+
+    if( (c->comno == COM_PING) || (c->comno == COM_CREATE_DB) || (c->comno == COM_DROP_DB) ){
+        return 0;
+    }
+
+    if(c->comno == COM_QUERY){//SET记在会话状态里换连接重放，不用看里面的:=
+        if( cli_sql_is_stateful(c->arg) || ((c->sess_op == SESS_OP_NONE) && cli_sql_keeps_state(c->arg)) ){
+            return cli_pin_my_conn(c);
+        }
+        return 0;
+    }
+
+    if(!g_conf.pool_txn){
+        return 0;
+    }
+
+    return cli_pin_my_conn(c);
+}
+
+/*
+ * fun: pin mysql connection to client, close it when client is gone
+ * arg: connection
+ * ret: always return 1
+ *
+ */
+
+static int cli_pin_my_conn(conn_t *c)
+{//连接上的会话状态已经不知道了，不能再给别的客户端用
+    c->pin = 1;
+    if(c->my != NULL){
+        my_conn_ctx_set_dirty(c->my);
+    }
+
+    debug(g_log, "conn:%u pinned to mysql conn, com:%d sql:%s\n", c->connid, c->comno, c->arg);
+
+    return 1;
+}
+
+/*
+ * fun: check whether client command is SET statement
+ * arg: connection, sql is truncated
+ * ret: SESS_OP_NONE, SESS_OP_SET, SESS_OP_SKIP or SESS_OP_LOST
+ *
+ */
+
+static int cli_com_sess(conn_t *c, int truncated)
+{//借mysql连接之前就看，要设的值会话里都有了就不用借了；绑定以后会话状态不再跟踪，都转发
+    int res, nsend;
+
+    c->sess_op = SESS_OP_NONE;
+    if( (c->comno != COM_QUERY) || c->pin ){
+        return c->sess_op;
+    }
+
+    if( (res = sess_set_sql(&(c->sess), c->arg, 0, &nsend)) == 0 ){
+        return c->sess_op;
+    }
+
+    if( (res < 0) || truncated ){
+        c->sess_op = SESS_OP_LOST;
+        log(g_log, "conn:%u SET can not be tracked, sql:%s\n", c->connid, c->arg);
+    } else if(nsend == 0){
+        c->sess_op = SESS_OP_SKIP;
+    } else {
+        c->sess_op = SESS_OP_SET;
+    }
+
+    return c->sess_op;
+}
+
+/*
+ * fun: record session state changes when mysql response is over
+ * arg: connection
+ * ret: success 0, state lost -1
+ *
+ */
+
+static int cli_sess_commit(conn_t *c)
+{//SET成功了，或者OK包里带了系统变量的变化，都记到会话里，mysql连接上的状态跟会话一样
+    int nsend = 0;
+    my_conn_t *my = c->my;
+
+    if( (c->sess_op == SESS_OP_SET) && (!c->resp.err) ){
+        if(sess_set_sql(&(c->sess), c->arg, 1, &nsend) < 0){
+            c->resp.untracked = 1;
+        }
+    }
+    c->sess_op = SESS_OP_NONE;
+
+    if(c->resp.untracked){
+        log(g_log, "conn:%u session state lost, pin mysql conn\n", c->connid);
+        cli_pin_my_conn(c);
+        return -1;
+    }
+
+    if( (nsend > 0) || (c->resp.track > 0) ){
+        sess_copy(&(my->ctx.sess), &(c->sess));
+    }
+
+    return 0;
+}
+
+/*
+ * fun: remember client write for read after write consistency
+ * arg: connection
+ * ret: void
+ *
+ */
+
+static void cli_write_done(conn_t *c)
+{//有GTID就只认GTID，slave执行过就能读；没有GTID(没开gtid_mode，或者事务还没提交)按时间窗口
+    if( c->write && (!c->resp.err) ){
+        if( g_conf.read_after_write_gtid && (c->resp.gtid[0] != '\0') ){
+            strcpy(c->gtid, c->resp.gtid);
+            c->write_time = 0;
+        } else if(g_conf.read_after_write > 0){
+            c->write_time = clock_ms();
+        }
+    }
+    c->write = 0;
+}
+
+/*
+ * fun: choose shard group for client command
+ * arg: connection, command packet length
+ * ret: go on with command 0, answered locally 1, error -1
+ *
+ */
+
+static int cli_com_shard(conn_t *c, uint32_t pktlen)
+{//事务级复用才分片；占着连接的时候只能用这个连接的组，分片表的语句算到别的组就报错
+    int group, len;
+    my_conn_t *my = c->my;
+
+    if( (!g_conf.pool_txn) || (!shard_enabled()) ){
+        c->group = 0;
+        return 0;
+    }
+
+    if(my == NULL){
+        c->group = 0;
+    } else {
+        c->group = ((my_node_t *)(my->node))->group;
+    }
+
+    if( (c->comno != COM_QUERY) || c->pin || (c->sess_op == SESS_OP_SKIP) ){
+        return 0;
+    }
+
+    if(my == NULL){
+        if(cli_sql_is(c->arg, begin_sql)){//事务要发到哪个组看第一条语句
+            debug(g_log, "conn:%u defer begin\n", c->connid);
+            c->begin = 1;
+            return (cli_com_ignored(c) < 0) ? -1 : 1;
+        } else if( c->begin && cli_sql_is(c->arg, end_sql) ){//空事务
+            c->begin = 0;
+            return (cli_com_ignored(c) < 0) ? -1 : 1;
+        }
+    }
+
+    len = (int)c->buf.used - HEADER_SIZE - 1;
+    if( (pktlen > 0) && ((int)pktlen - 1 < len) ){
+        len = pktlen - 1;
+    }
+    if( (len <= 0) || (!shard_route(c->buf.ptr + HEADER_SIZE + 1, len, &group)) ){
+        return 0;
+    }
+
+    if( (pktlen == 0xffffff) && (my == NULL) ){//分成多个包的语句只看到了开头
+        group = shard_fallback();
+        if(group == SHARD_FALLBACK_SCATTER){
+            group = SHARD_FALLBACK_ERROR;
+        }
+    }
+
+    if(group == SHARD_FALLBACK_SCATTER){//发到所有组再合并，只做事务外的读
+        if( (my == NULL) && (!c->begin) && cli_sql_is_read(c->arg) ){
+            return cli_com_scatter(c, len);
+        }
+        log(g_log, "conn:%u can not scatter statement, sql:%s\n", c->connid, c->arg);
+        return (cli_query_error(c, 1105, "HY000", "myrelay: only SELECT outside transaction can be sent to all shard groups") < 0) ? -1 : 1;
+    }
+
+    if(group < 0){
+        log(g_log, "conn:%u can not find shard group, sql:%s\n", c->connid, c->arg);
+        return (cli_query_error(c, 1105, "HY000", "myrelay: can not find shard group of statement") < 0) ? -1 : 1;
+    }
+
+    if( (my != NULL) && (group != c->group) ){
+        log(g_log, "conn:%u statement of group %d in transaction of group %d, sql:%s\n", c->connid, group, c->group, c->arg);
+        return (cli_query_error(c, 1105, "HY000", "myrelay: statement crosses shard group in transaction") < 0) ? -1 : 1;
+    }
+
+    c->group = group;
+
+    return 0;
+}
+
+/*
+ * fun: send statement to all shard groups and merge results for client
+ * arg: connection, sql length
+ * ret: answered 1, error -1 and connection should be closed
+ *
+ */
+
+static int cli_com_scatter(conn_t *c, int len)
+{//每组借一个连接同时发；有一组借不到就不等了，已经借到的还回去
+    int i, n;
+    my_conn_t *my;
+    scatter_t *sc;
+    scatter_plan_t plan;
+    cli_conn_t *cli = c->cli;
+
+    if(shard_plan(c->buf.ptr + HEADER_SIZE + 1, len, &plan) < 0){
+        log(g_log, "conn:%u statement can not be merged, sql:%s\n", c->connid, c->arg);
+        return (cli_query_error(c, 1105, "HY000", "myrelay: statement can not be merged across shard groups") < 0) ? -1 : 1;
+    }
+
+    n = shard_groups();
+    if( (sc = scatter_new(&plan, n)) == NULL ){
+        log_err(g_log, "conn:%u scatter_new error\n", c->connid);
+        return -1;
+    }
+
+    if(scatter_query(sc, c->buf.ptr + HEADER_SIZE + 1, len) < 0){
+        log(g_log, "conn:%u scatter statement too long\n", c->connid);
+        scatter_free(sc);
+        return -1;
+    }
+
+    c->scatter = sc;
+    for(i = 0; i < n; i++){
+        c->group = i;
+        if( (my = my_conn_get(c, c->role, cli->ip, cli->port)) == NULL ){
+            break;
+        }
+        sc->leg[i].my = my;
+        sc->leg[i].buf = &(my->buf);
+    }
+    c->group = 0;
+    c->my = NULL;
+
+    if(i < n){
+        log(g_log, "conn:%u no mysql conn of group %d to scatter\n", c->connid, i);
+        cli_scatter_end(c, 0);
+        return (cli_query_error(c, 1040, "08004", "Too many connections") < 0) ? -1 : 1;
+    }
+
+    log(g_log, "conn:%u scatter to %d groups, sql:%s\n", c->connid, n, c->arg);
+
+    if(del_handler(cli->fd) < 0){//合并完之前不读客户端
+        log(g_log, "conn:%u del_handler error\n", c->connid);
+        return -1;
+    }
+
+    buf_reset(&(c->buf));//给客户端的结果攒在这里
+    conn_state_set_read_mysql_write_client(c);
+
+    for(i = 0; i < n; i++){
+        if(my_scatter_prepare(c, i) < 0){
+            return -1;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * fun: end scatter, give mysql connections back
+ * arg: connection, close all mysql connections or not
+ * ret: success 0
+ *
+ */
+
+int cli_scatter_end(conn_t *c, int close)
+{//还有回复没读完的连接不能还，只能关掉
+    int i;
+    my_conn_t *my;
+    scatter_t *sc = c->scatter;
+
+    if(sc == NULL){
+        return 0;
+    }
+
+    for(i = 0; i < sc->nleg; i++){
+        if( (my = sc->leg[i].my) == NULL ){
+            continue;
+        }
+
+        if( close || (my->req_start != 0) ){
+            my_conn_close(my);
+        } else {
+            my_conn_put(my, 1);
+        }
+    }
+
+    scatter_free(sc);
+    c->scatter = NULL;
+
+    return 0;
+}
+
+/*
+ * fun: write merged result to client
+ * arg: connection
+ * ret: success 0, error -1 and connection should be closed
+ *
+ */
+
+static int cli_scatter_flush(conn_t *c)
+{//写不完就等EPOLLOUT，攒得太多先停掉所有组的读
+    int done = 1, writing;
+    cli_conn_t *cli = c->cli;
+    buf_t *buf = &(c->buf);
+    scatter_t *sc = c->scatter;
+
+    writing = sc->writing;
+    if(sc->running == 0){
+        cli_scatter_end(c, 0);
+        sc = NULL;
+    }
+
+    if(writing){//写回调接着写，合并完了也由它收尾
+        return 0;
+    }
+
+    if( (buf->used > buf->pos) && (my_real_write(cli->fd, buf, &done) < 0) ){
+        log_err(g_log, "conn:%u my_real_write error with client\n", c->connid);
+        return -1;
+    }
+
+    if(done){
+        buf_reset(buf);
+        if(sc == NULL){
+            return cli_scatter_done(c);
+        }
+        cli_scatter_resume(c);
+
+        return 0;
+    }
+
+    if(sc != NULL){
+        sc->writing = 1;
+        if(buf->used - buf->pos > SCATTER_CLI_BUF){
+            cli_scatter_pause(c);
+        }
+    }
+
+    if(add_handler(cli->fd, MY_EPOLLOUT, cli_scatter_write_cb, cli) < 0){
+        log(g_log, "conn:%u add_handler error\n", c->connid);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * fun: write merged result to client callback
+ * arg: fd, client connection
+ * ret: success 0, error -1
+ *
+ */
+
+static int cli_scatter_write_cb(int fd, void *arg)
+{
+    int res = 0, done;
+    cli_conn_t *cli = (cli_conn_t *)arg;
+    conn_t *c = cli->conn;
+    buf_t *buf = &(c->buf);
+    scatter_t *sc = c->scatter;
+
+    if( (res = my_real_write(fd, buf, &done)) < 0 ){
+        log_err(g_log, "conn:%u my_real_write error with client\n", c->connid);
+        goto end;
+    }
+
+    if(done){
+        buf_reset(buf);
+        if(sc == NULL){
+            if( (res = cli_scatter_done(c)) < 0 ){
+                goto end;
+            }
+            return 0;
+        }
+
+        sc->writing = 0;
+        if( (res = del_handler(fd)) < 0 ){
+            log(g_log, "conn:%u del_handler error\n", c->connid);
+            goto end;
+        }
+        cli_scatter_resume(c);
+    } else if( (sc != NULL) && (buf->used - buf->pos > SCATTER_CLI_BUF) ){
+        cli_scatter_pause(c);
+    }
+
+    return 0;
+
+end:
+    conn_close(c);
+
+    return res;
+}
+
+/*
+ * fun: merged result all written, wait next command of client
+ * arg: connection
+ * ret: success 0, error -1
+ *
+ */
+
+static int cli_scatter_done(conn_t *c)
+{
+    cli_conn_t *cli = c->cli;
+
+    c->us_end = clock_us();
+    conn_state_set_idle(c);
+
+    if(add_handler(cli->fd, MY_EPOLLIN, cli_query_cb, cli) < 0){
+        log(g_log, "conn:%u add_handler error\n", c->connid);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * fun: stop reading all groups
+ * arg: connection
+ * ret: void
+ *
+ */
+
+static void cli_scatter_pause(conn_t *c)
+{
+    int i;
+    scatter_leg_t *leg;
+    scatter_t *sc = c->scatter;
+
+    for(i = 0; i < sc->nleg; i++){
+        leg = &(sc->leg[i]);
+        if( (leg->step == SCATTER_STEP_QUERY) && (!leg->paused) ){
+            del_handler(((my_conn_t *)leg->my)->fd);
+            leg->paused = 1;
+        }
+    }
+}
+
+/*
+ * fun: read paused groups again
+ * arg: connection
+ * ret: void
+ *
+ */
+
+static void cli_scatter_resume(conn_t *c)
+{//排队的行还太多的那一路接着停
+    int i;
+    my_conn_t *my;
+    scatter_leg_t *leg;
+    scatter_t *sc = c->scatter;
+
+    for(i = 0; i < sc->nleg; i++){
+        leg = &(sc->leg[i]);
+        if( leg->paused && (!scatter_leg_full(sc, i)) ){
+            my = leg->my;
+            if(add_handler(my->fd, MY_EPOLLIN, my_scatter_resp_cb, my) < 0){
+                log(g_log, "conn:%u add_handler error\n", c->connid);
+                continue;
+            }
+            leg->paused = 0;
+        }
+    }
+}
+
+/*
+ * fun: prepare next command of one group: use db, session replay or the statement
+ * arg: connection, group index
+ * ret: success 0, error -1
+ *
+ */
+
+static int my_scatter_prepare(conn_t *c, int index)
+{//和单个连接一样，先换库、再重放会话变量，最后发语句
+    int len, res = 0;
+    buf_t *buf;
+    my_conn_t *my;
+    cli_com_t com;
+    scatter_t *sc = c->scatter;
+    scatter_leg_t *leg = &(sc->leg[index]);
+
+    my = leg->my;
+    buf = &(my->buf);
+    com.pktno = 0;
+
+    if( (c->curdb[0] != '\0') && strcmp(c->curdb, my->ctx.curdb) ){
+        leg->step = SCATTER_STEP_USE_DB;
+        com.comno = COM_INIT_DB;
+        len = strlen(c->curdb);
+        memcpy(com.arg, c->curdb, len);
+        com.len = len;
+        make_com(buf, &com);
+    } else if( sess_diff(&(c->sess), &(my->ctx.sess), NULL, 0) > 0 ){
+        leg->step = SCATTER_STEP_SESS;
+        if(sess_diff(&(c->sess), &(my->ctx.sess), com.arg, sizeof(com.arg)) < 0){
+            log(g_log, "conn:%u session replay too long\n", c->connid);
+            return -1;
+        }
+        com.comno = COM_QUERY;
+        com.len = strlen(com.arg);
+        make_com(buf, &com);
+    } else {
+        leg->step = SCATTER_STEP_QUERY;
+        buf_reset(buf);
+        if(buf_realloc(buf, sc->query.used) == NULL){
+            log_err(g_log, "conn:%u buf_realloc error\n", c->connid);
+            return -1;
+        }
+        memcpy(buf->ptr, sc->query.ptr, sc->query.used);
+        buf->used = sc->query.used;
+        buf_rewind(buf);
+    }
+
+    my_conn_req_start(my);
+    if( (res = mod_handler(my->fd, MY_EPOLLOUT, my_scatter_req_cb, my)) < 0 ){
+        log(g_log, "conn:%u mod_handler fd[%d] error\n", c->connid, my->fd);
+    }
+
+    return res;
+}
+
+/*
+ * fun: send command to one group callback
+ * arg: fd, mysql connection
+ * ret: success 0, error -1
+ *
+ */
+
+static int my_scatter_req_cb(int fd, void *arg)
+{
+    int res = 0, done;
+    my_conn_t *my;
+    conn_t *c;
+    buf_t *buf;
+
+    my = (my_conn_t *)arg;
+    c = my->conn;
+    buf = &(my->buf);
+
+    if( (res = my_real_write(fd, buf, &done)) < 0 ){
+        log_err(g_log, "conn:%u my_real_write error\n", c->connid);
+        goto end;
+    }
+
+    if(done){
+        res = mod_handler(fd, MY_EPOLLIN, my_scatter_resp_cb, arg);
+        if(res < 0){
+            log(g_log, "conn:%u mod_handler fd[%d] error\n", c->connid, fd);
+            goto end;
+        }
+
+        buf_reset(buf);
+    }
+
+    return res;
+
+end:
+    conn_close_with_my(c);
+
+    return res;
+}
+
+/*
+ * fun: read one group resp callback
+ * arg: fd, mysql connection
+ * ret: success 0, error -1
+ *
+ */
+
+static int my_scatter_resp_cb(int fd, void *arg)
+{//换库、重放失败了两边一起关；结果集交给scatter_input合并，合出来的马上写给客户端
+    int i, res = 0, done;
+    my_conn_t *my;
+    conn_t *c;
+    buf_t *buf;
+    scatter_t *sc;
+    scatter_leg_t *leg;
+
+    my = (my_conn_t *)arg;
+    c = my->conn;
+    sc = c->scatter;
+    buf = &(my->buf);
+
+    for(i = 0; (i < sc->nleg) && (sc->leg[i].my != my); i++);
+    leg = &(sc->leg[i]);
+
+    if(leg->step != SCATTER_STEP_QUERY){
+        if( (res = my_real_read(fd, buf, &done)) < 0 ){
+            log_err(g_log, "conn:%u my_real_read error\n", c->connid);
+            goto end;
+        }
+        if(!done){
+            return 0;
+        }
+
+        if( (buf->used > HEADER_SIZE) && ((uint8_t)buf->ptr[HEADER_SIZE] == 0xff) ){
+            log_err(g_log, "conn:%u scatter group %d context sync failed\n", c->connid, i);
+            res = -1;
+            goto end;
+        }
+
+        if(leg->step == SCATTER_STEP_USE_DB){
+            strncpy(my->ctx.curdb, c->curdb, sizeof(my->ctx.curdb) - 1);
+            my->ctx.curdb[sizeof(my->ctx.curdb) - 1] = '\0';
+        } else {
+            sess_copy(&(my->ctx.sess), &(c->sess));
+        }
+        buf_reset(buf);
+
+        if( (res = my_scatter_prepare(c, i)) < 0 ){
+            goto end;
+        }
+
+        return 0;
+    }
+
+    if( (buf->used >= buf->size) && (buf_realloc(buf, buf->size * 2) == NULL) ){
+        log_err(g_log, "conn:%u buf_realloc error\n", c->connid);
+        res = -1;
+        goto end;
+    }
+
+    if( (res = my_real_read_result_set(fd, buf)) < 0 ){
+        log_err(g_log, "conn:%u my_real_read_result_set error\n", c->connid);
+        my_conn_node_fail(my);
+        goto end;
+    }
+
+    if( (res = scatter_input(sc, i, &(c->buf))) < 0 ){
+        log(g_log, "conn:%u scatter group %d bad result\n", c->connid, i);
+        goto end;
+    }
+
+    if(leg->step == SCATTER_STEP_DONE){
+        my_conn_req_end(my, 1);
+        del_handler(fd);
+    } else if(scatter_leg_full(sc, i)){//别的组还没跟上，这一路先不读
+        del_handler(fd);
+        leg->paused = 1;
+    }
+
+    if( (res = cli_scatter_flush(c)) < 0 ){
+        conn_close(c);
+    }
+
+    return res;
+
+end:
+    conn_close_with_my(c);
+
+    return res;
+}
+
+/*
+ * fun: is whole sql one of the statements
+ * arg: sql, statements in upper case
+ * ret: yes 1, no 0
+ *
+ */
+
+static int cli_sql_is(const char *sql, char **words)
+{//前后的空白和结尾的分号不算
+    int i, len;
+    const char *p;
+
+    while(isspace((unsigned char)*sql)){
+        sql++;
+    }
+
+    for(i = 0; words[i] != NULL; i++){
+        len = strlen(words[i]);
+        if(strncasecmp(sql, words[i], len)){
+            continue;
+        }
+        for(p = sql + len; isspace((unsigned char)*p) || (*p == ';'); p++);
+        if(*p == '\0'){
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * fun: put mysql connection back to pool when transaction is over
+ * arg: connection
+ * ret: released 1, kept 0
+ *
+ */
+
+static int cli_release_my_conn(conn_t *c)
+{//回复已经全部发给客户端，mysql说不在事务里而且是自动提交的，就把mysql连接还回去；会话级复用只还借来读的slave
+    my_conn_t *my = c->my;
+
+    if( (my == NULL) || (c->resp.state != RESP_DONE) || (c->pin && (!c->borrow)) ){
+        return 0;
+    }
+
+    my->status = c->resp.status;//会话级复用也记下来，借slave之前要看自己的连接在不在事务里
+    if( (!c->borrow) && ((!g_conf.pool_txn) || (my->status & SERVER_STATUS_IN_TRANS) || \
+                (!(my->status & SERVER_STATUS_AUTOCOMMIT))) ){
+        return 0;
+    }
+
+    c->us_end = clock_us();
+    sqldump(c);
+    conn_state_set_idle(c);
+
+    c->my = c->hold;
+    c->hold = NULL;
+    c->borrow = 0;
+    my_conn_put(my, 1);//可能直接交给排队的客户端
+
+    return 1;
+}
+
+/*
+ * fun: prepare send "use db" command to mysql
+ * arg: connection
+ * ret: success 0, error -1
+ *
+ */
+
+static int my_use_db_prepare(conn_t *c)
+{
+    int fd, len, res = 0;
+    buf_t *buf;
+    my_conn_t *my;
+    cli_com_t com;
+
+    my = c->my;
+    fd = my->fd;
+    buf = &(my->buf);
+
+    com.pktno = 0;
+    com.comno = COM_INIT_DB;
+    len = strlen(c->curdb);
+    memcpy(com.arg, c->curdb, len);
+    com.len = len;
+
+    make_com(buf, &com);
+    my_conn_req_start(my);
+    res = mod_handler(fd, MY_EPOLLOUT, my_use_db_req_cb, my);
+    if(res < 0){
+        log(g_log, "conn:%u mod_handler error\n", c->connid);
+    }
+
+    buf_rewind(buf);
+
+    return res;
+}
+
+/*
+ * fun: send "use db" command to mysql callback
+ * arg: fd, mysql connection 
+ * ret: success 0, error -1
+ *
+ */
+
+static int my_use_db_req_cb(int fd, void *arg)
+{
+    int res = 0, done;
+    my_conn_t *my;
+    conn_t *c;
+    buf_t *buf;
+
+    my = (my_conn_t *)arg;
+    c = my->conn;
+    buf = &(my->buf);
+
+    if( (res = my_real_write(fd, buf, &done)) < 0 ){
+        log_err(g_log, "conn:%u my_real_write error\n", c->connid);
+        goto end;
+    }
+
+    if(done){
+        res = mod_handler(fd, MY_EPOLLIN,my_use_db_resp_cb,arg);
+        if(res < 0){
+            log(g_log, "conn:%u mod_handler fd[%d] error\n", c->connid, fd);
+            goto end;
+        }
+
+        buf_reset(buf);
+    }
+
+    return res;
+
+end:
+    conn_close_with_my(c);
+
+    return res;
+}
+
+/*
+ * fun: read mysql resp callback after sending "use db"
+ * arg: fd, mysql connection 
+ * ret: success 0, error -1
+ *
+ */
+
+static int my_use_db_resp_cb(int fd, void *arg)
+{
+    int res = 0, done;
+    my_conn_t *my;
+    conn_t *c;
+    buf_t *buf;
+
+    my = (my_conn_t *)arg;
+    c = my->conn;
+    buf = &(my->buf);
+
+    if( (res = my_real_read(fd, buf, &done)) < 0 ){
+        log_err(g_log, "conn:%u my_real_read error\n", c->connid);
+        goto end;
+    }
+
+    if(done){
+        if( (buf->used > HEADER_SIZE) && ((uint8_t)buf->ptr[HEADER_SIZE] == 0xff) ){
+            if( (res = my_use_db_fail(c)) < 0 ){
+                goto end;
+            }
+
+            return res;
+        }
+
+        strncpy(my->ctx.curdb, c->curdb, sizeof(my->ctx.curdb) - 1);
+        my->ctx.curdb[sizeof(my->ctx.curdb) - 1] = '\0';
+
+        buf_reset(buf);
+
+        if( (res = my_ctx_sync_next(c)) < 0 ){
+            goto end;
+        }
+    }
+
+    return res;
+
+end:
+    conn_close_with_my(c);
+
+    return res;
+}
+
+/*
+ * fun: "use db" failed, answer client with mysql's error
+ * arg: connection
+ * ret: success 0, error -1
+ *
+ */
+
+static int my_use_db_fail(conn_t *c)
+{//库不存在或者没权限，mysql连接还在原来的库上，ctx.curdb不能改；命令不发了，ERR包的序号本来就是1，原样回给客户端
+    int res = 0;
+    my_conn_t *my = c->my;
+    cli_conn_t *cli = c->cli;
+    buf_t *buf = &(my->buf);
+
+    log(g_log, "conn:%u use db %s failed\n", c->connid, c->curdb);
+
+    if( (res = del_handler(my->fd)) < 0 ){
+        log(g_log, "conn:%u del_handler error\n", c->connid);
+        return res;
+    }
+
+    buf_reset(&(c->buf));
+    if(buf_realloc(&(c->buf), buf->used) == NULL){
+        log_err(g_log, "conn:%u buf_realloc error\n", c->connid);
+        return -1;
+    }
+    memcpy(c->buf.ptr, buf->ptr, buf->used);
+    c->buf.used = buf->used;
+    buf_reset(buf);
+
+    my_conn_req_end(my, 1);//mysql回了，连接是好的
+    resp_init(&(c->resp), my->status, &(c->sess));
+    c->resp.state = RESP_DONE;
+    c->resp.err = 1;
+    cli_release_my_conn(c);//事务级复用或者借来读的slave跟正常回完一样还回去
+
+    if( (res = add_handler(cli->fd, MY_EPOLLOUT, cli_com_ok_write_cb, cli)) < 0 ){
+        log(g_log, "conn:%u add_handler error\n", c->connid);
+        return res;
+    }
+
+    return res;
+}
+
+/*
+ * fun: next step after mysql context switched: replay session or send query
+ * arg: connection
+ * ret: success 0, error -1
+ *
+ */
+
+static int my_ctx_sync_next(conn_t *c)
+{
+    int res = 0;
+    my_conn_t *my = c->my;
+
+    if( sess_diff(&(c->sess), &(my->ctx.sess), NULL, 0) > 0 ){
+        return my_sess_prepare(c);
+    }
+
+    if(c->begin){
+        return my_begin_prepare(c);
+    }
+
+    resp_init(&(c->resp), my->status, &(c->sess));
+    res = mod_handler(my->fd, MY_EPOLLOUT, my_query_cb, my);
+    if(res < 0){
+        log(g_log, "conn:%u mod_handler fd[%d] error\n", c->connid, my->fd);
+        return res;
+    }
+
+    conn_state_set_writing_mysql(c);
+
+    return res;
+}
+
+/*
+ * fun: prepare send SET statement replaying client session to mysql
+ * arg: connection
+ * ret: success 0, error -1
+ *
+ */
+
+static int my_sess_prepare(conn_t *c)
+{//只发不一样的变量，一条SET语句发完
+    int fd, len, res = 0;
+    buf_t *buf;
+    my_conn_t *my;
+    cli_com_t com;
+
+    my = c->my;
+    fd = my->fd;
+    buf = &(my->buf);
+
+    if( (len = sess_diff(&(c->sess), &(my->ctx.sess), com.arg, sizeof(com.arg))) < 0 ){
+        log(g_log, "conn:%u session replay too long\n", c->connid);
+        return -1;
+    }
+
+    com.pktno = 0;
+    com.comno = COM_QUERY;
+    com.len = strlen(com.arg);
+
+    debug(g_log, "conn:%u replay %d session vars: %s\n", c->connid, len, com.arg);
+
+    make_com(buf, &com);
+    my_conn_req_start(my);
+    res = mod_handler(fd, MY_EPOLLOUT, my_sess_req_cb, my);
+    if(res < 0){
+        log(g_log, "conn:%u mod_handler error\n", c->connid);
+    }
+
+    buf_rewind(buf);
+
+    return res;
+}
+
+/*
+ * fun: send session replay to mysql callback
+ * arg: fd, mysql connection
+ * ret: success 0, error -1
+ *
+ */
+
+static int my_sess_req_cb(int fd, void *arg)
+{
+    int res = 0, done;
+    my_conn_t *my;
+    conn_t *c;
+    buf_t *buf;
+
+    my = (my_conn_t *)arg;
+    c = my->conn;
+    buf = &(my->buf);
+
+    if( (res = my_real_write(fd, buf, &done)) < 0 ){
+        log_err(g_log, "conn:%u my_real_write error\n", c->connid);
+        goto end;
+    }
+
+    if(done){
+        res = mod_handler(fd, MY_EPOLLIN, my_sess_resp_cb, arg);
+        if(res < 0){
+            log(g_log, "conn:%u mod_handler fd[%d] error\n", c->connid, fd);
+            goto end;
+        }
+
+        buf_reset(buf);
+    }
+
+    return res;
+
+end:
+    conn_close_with_my(c);
+
+    return res;
+}
+
+/*
+ * fun: read mysql resp callback after session replay
+ * arg: fd, mysql connection
+ * ret: success 0, error -1
+ *
+ */
+
+static int my_sess_resp_cb(int fd, void *arg)
+{//重放失败了连接和客户端的状态都不对了，两边一起关掉
+    int res = 0, done;
+    my_conn_t *my;
+    conn_t *c;
+    buf_t *buf;
+
+    my = (my_conn_t *)arg;
+    c = my->conn;
+    buf = &(my->buf);
+
+    if( (res = my_real_read(fd, buf, &done)) < 0 ){
+        log_err(g_log, "conn:%u my_real_read error\n", c->connid);
+        goto end;
+    }
+
+    if(done){
+        if( (buf->used > HEADER_SIZE) && ((uint8_t)buf->ptr[HEADER_SIZE] == 0xff) ){
+            log_err(g_log, "conn:%u session replay failed\n", c->connid);
+            res = -1;
+            goto end;
+        }
+
+        sess_copy(&(my->ctx.sess), &(c->sess));
+        buf_reset(buf);
+
+        if( (res = my_ctx_sync_next(c)) < 0 ){
+            goto end;
+        }
+    }
+
+    return res;
+
+end:
+    conn_close_with_my(c);
+
+    return res;
+}
+
+/*
+ * fun: can statement be pipelined after use db, session replay and deferred BEGIN
+ * arg: connection
+ * ret: yes 1, no 0
+ *
+ */
+
+static int cli_com_pipe(conn_t *c)
+{//前置命令失败了mysql照样执行后面的语句，只有读的结果能扔掉当没发生，写还是一步一步来
+    my_conn_t *my = c->my;
+
+    if( c->pin || (c->buf.used - HEADER_SIZE - 1 >= sizeof(c->arg) - 1) || (!cli_sql_is_read(c->arg)) ){
+        return 0;
+    }
+
+    return ( (c->curdb[0] != '\0') && strcmp(my->ctx.curdb, c->curdb) ) || \
+            (sess_diff(&(c->sess), &(my->ctx.sess), NULL, 0) > 0) || c->begin;
+}
+
+/*
+ * fun: send use db, session replay, deferred BEGIN and statement to mysql in one write
+ * arg: connection
+ * ret: success 0, error -1
+ *
+ */
+
+static int my_pipe_prepare(conn_t *c)
+{//mysql按顺序执行，每个命令单独一个包，序号都从0开始
+    int fd, done, res = 0;
+    char sql[sizeof(((cli_com_t *)0)->arg)];
+    buf_t *buf;
+    my_conn_t *my;
+    my_node_t *node;
+
+    my = c->my;
+    fd = my->fd;
+    buf = &(my->buf);
+    node = my->node;
+
+    buf_reset(buf);
+    c->pipe_n = c->pipe_i = c->pipe_err = 0;
+    c->pipe_keep = 0;
+
+    if( (c->curdb[0] != '\0') && strcmp(my->ctx.curdb, c->curdb) ){
+        if(my_pipe_append(buf, COM_INIT_DB, c->curdb, strlen(c->curdb)) < 0){
+            return -1;
+        }
+        c->pipe_op[c->pipe_n++] = PIPE_OP_USE_DB;
+    }
+
+    if( sess_diff(&(c->sess), &(my->ctx.sess), NULL, 0) > 0 ){
+        if(sess_diff(&(c->sess), &(my->ctx.sess), sql, sizeof(sql)) < 0){
+            log(g_log, "conn:%u session replay too long\n", c->connid);
+            return -1;
+        }
+        if(my_pipe_append(buf, COM_QUERY, sql, strlen(sql)) < 0){
+            return -1;
+        }
+        c->pipe_op[c->pipe_n++] = PIPE_OP_SESS;
+    }
 
-        return n;
+    if(c->begin){
+        if(my_pipe_append(buf, COM_QUERY, "BEGIN", 5) < 0){
+            return -1;
+        }
+        c->pipe_op[c->pipe_n++] = PIPE_OP_BEGIN;
     }
-	return 0 ;
-}
 
-/*
- * fun: ignore some client command
- * arg: connection
- * ret: success 0, error -1
- *
- */
+    if(buf_realloc(buf, buf->used + c->buf.used) == NULL){
+        log_err(g_log, "conn:%u buf_realloc error\n", c->connid);
+        return -1;
+    }
+    memcpy(buf->ptr + buf->used, c->buf.ptr, c->buf.used);
+    buf->used += c->buf.used;
+    buf_reset(&(c->buf));//mysql的回复读到这里
 
-static int cli_com_ignored(conn_t *c)
-{
-#define CLI_COM_IGNORE_OK_PKT_SIZE 7
+    log(g_log, "conn:%u mysql[%s:%s] pipelined %d, sql:%s\n", c->connid, node->host, node->srv, c->pipe_n, c->arg);
 
-    int res = 0, fd;
-    uint32_t pktlen;
-    uint8_t pktno;
+    resp_init(&(c->resp), my->status, &(c->sess));
+    buf_rewind(buf);
+    conn_state_set_writing_mysql(c);
+    my_conn_req_start(my);
 
-    buf_t *buf;
-    cli_conn_t *cli;
-    char *ptr;
+    if( (res = my_real_write(fd, buf, &done)) < 0 ){
+        log_err(g_log, "conn:%u my_real_write error\n", c->connid);
+        my_conn_node_fail(my);
+        my_conn_ctx_set_dirty(my);
+        return res;
+    }
 
+    if(done){
+        return my_pipe_sent(c);
+    }
 
-    pktlen = 0;
-    pktno = 1;
-    buf = &(c->buf);
-    cli = c->cli;
-    fd = cli->fd;
+    res = mod_handler(fd, MY_EPOLLOUT, my_pipe_req_cb, my);
+    if(res < 0){
+        log(g_log, "conn:%u mod_handler error\n", c->connid);
+    }
 
-    buf_reset(buf);
-    ptr = buf->ptr;
+    return res;
+}
 
-    bzero(ptr + 4, CLI_COM_IGNORE_OK_PKT_SIZE);
-    pktlen = CLI_COM_IGNORE_OK_PKT_SIZE;
-    memcpy(ptr, &pktlen, 3);
-    memcpy(ptr + 3, &pktno, 1);
+/*
+ * fun: append one command packet to buffer
+ * arg: buffer, command, argument, argument length
+ * ret: success 0, error -1
+ *
+ */
 
-    buf->used += (CLI_COM_IGNORE_OK_PKT_SIZE + 4);
-    buf->pos += (CLI_COM_IGNORE_OK_PKT_SIZE + 4);
-    buf_rewind(buf);
+static int my_pipe_append(buf_t *buf, uint8_t comno, const char *arg, int len)
+{
+    uint8_t *p;
 
-    res = add_handler(fd, EPOLLOUT, cli_com_ok_write_cb, cli);
-    if(res < 0){
-        log(g_log, "conn:%u add_handler error\n", c->connid);
-        return res;
+    if(buf_realloc(buf, buf->used + HEADER_SIZE + 1 + len) == NULL){
+        return -1;
     }
 
+    p = (uint8_t *)buf->ptr + buf->used;
+    p[0] = (len + 1) & 0xff;
+    p[1] = ((len + 1) >> 8) & 0xff;
+    p[2] = ((len + 1) >> 16) & 0xff;
+    p[3] = 0;
+    p[HEADER_SIZE] = comno;
+    memcpy(p + HEADER_SIZE + 1, arg, len);
+    buf->used += HEADER_SIZE + 1 + len;
+
     return 0;
 }
 
 /*
- * fun: write ok packet to client callback
- * arg: fd, client connection
+ * fun: send pipelined commands to mysql callback
+ * arg: fd, mysql connection
  * ret: success 0, error -1
  *
  */
 
-static int cli_com_ok_write_cb(int fd, void *arg)
+static int my_pipe_req_cb(int fd, void *arg)
 {
-    int done, res = 0;
-    cli_conn_t *cli;
-    buf_t *buf;
+    int res = 0, done;
     my_conn_t *my;
     conn_t *c;
 
-    cli = (cli_conn_t *)arg;
-    c = cli->conn;
-    buf = &(c->buf);
-    my = c->my;
-
+    my = (my_conn_t *)arg;
+    c = my->conn;
 
-    if( (res = my_real_write(fd, buf, &done)) < 0 ){
+    if( (res = my_real_write(fd, &(my->buf), &done)) < 0 ){
         log_err(g_log, "conn:%u my_real_write error\n", c->connid);
         goto end;
     }
 
-    if(done){
-        if( (res = del_handler(fd)) < 0 ){
-            log(g_log, "conn:%u del_handler error\n", c->connid);
-            goto end;
-        }
-
-        res = add_handler(fd, EPOLLIN, cli_query_cb, cli);
-        if(res < 0){
-            log(g_log, "conn:%u add_handler error\n", c->connid);
-            goto end;
-        }
-
-        buf_reset(buf);
-
-        conn_state_set_reading_client(c);
+    if( done && ((res = my_pipe_sent(c)) < 0) ){
+        goto end;
     }
 
     return res;
 
 end:
-    conn_close(c);
+    conn_close_with_my(c);
 
     return res;
 }
 
 /*
- * fun: forward client command to mysql
+ * fun: pipelined commands all sent, wait for mysql resp
  * arg: connection
  * ret: success 0, error -1
  *
  */
 
-static int cli_com_forward(conn_t *c)
+static int my_pipe_sent(conn_t *c)
 {
-    int res = 0, fd;
-    my_conn_t *my;
-    buf_t *buf;
-    cli_conn_t *cli;
-    my_node_t *node;
-
-    my = c->my;
-    fd = my->fd;
-    buf = &(c->buf);
-    cli = c->cli;
-    node = my->node;
+    int res;
+    my_conn_t *my = c->my;
 
-    log(g_log, "conn:%u mysql[%s:%s], sql:%s\n", c->connid, node->host, node->srv, c->arg );
+    buf_reset(&(my->buf));
 
-    res = add_handler(fd, EPOLLOUT, my_query_cb, my);
+    res = mod_handler(my->fd, MY_EPOLLIN, my_answer_cb, my);
     if(res < 0){
-        log(g_log, "conn:%u add_handler error\n", c->connid);
+        log(g_log, "conn:%u mod_handler error\n", c->connid);
         return res;
     }
 
-    buf_rewind(buf);
+    conn_state_set_read_mysql_write_client(c);
 
     return res;
 }
 
 /*
- * fun: unsupported client command, do nothing
- * arg: onnection
+ * fun: take resp of pipelined commands off the head of data read
+ * arg: connection
  * ret: always return 0
  *
  */
 
-static int cli_com_unsupported(conn_t *c)
-{
+static int my_pipe_resp(conn_t *c)
+{//c->buf开头是留给客户端的ERR，后面是还没看过的回复；前置命令的回复都只有一个OK或者ERR包
+    size_t pos, left;
+    uint32_t len;
+    uint8_t *p;
+    buf_t *buf = &(c->buf);
+    my_conn_t *my = c->my;
+
+    for(pos = c->pipe_keep; c->pipe_i < c->pipe_n; c->pipe_i++){
+        left = buf->used - pos;
+        p = (uint8_t *)buf->ptr + pos;
+        if(left < HEADER_SIZE){
+            break;
+        }
+        len = p[0] | (p[1] << 8) | (p[2] << 16);
+        if(left < HEADER_SIZE + len){
+            break;
+        }
+
+        if( (len > 0) && (p[HEADER_SIZE] == 0xff) ){//只回第一个失败的
+            log(g_log, "conn:%u pipelined command %d failed\n", c->connid, c->pipe_op[c->pipe_i]);
+            if(!c->pipe_err){
+                memmove(buf->ptr + c->pipe_keep, p, HEADER_SIZE + len);
+                c->pipe_keep += HEADER_SIZE + len;
+                c->pipe_err = 1;
+            }
+        } else if(c->pipe_op[c->pipe_i] == PIPE_OP_USE_DB){
+            strncpy(my->ctx.curdb, c->curdb, sizeof(my->ctx.curdb) - 1);
+            my->ctx.curdb[sizeof(my->ctx.curdb) - 1] = '\0';
+        } else if(c->pipe_op[c->pipe_i] == PIPE_OP_SESS){
+            sess_copy(&(my->ctx.sess), &(c->sess));
+        } else {
+            c->begin = 0;
+            my->status |= SERVER_STATUS_IN_TRANS;
+        }
+
+        pos += HEADER_SIZE + len;
+    }
+
+    memmove(buf->ptr + c->pipe_keep, buf->ptr + pos, buf->used - pos);
+    buf->used = c->pipe_keep + (buf->used - pos);
+    buf->pos = buf->used;
+
+    if(c->pipe_i >= c->pipe_n){
+        c->pipe_n = c->pipe_i = 0;
+    }
+
     return 0;
 }
 
 /*
- * fun: prepare send "use db" command to mysql
+ * fun: prepare send deferred BEGIN to mysql
  * arg: connection
  * ret: success 0, error -1
  *
  */
 
-static int my_use_db_prepare(conn_t *c)
+static int my_begin_prepare(conn_t *c)
 {
-    int fd, len, res = 0;
+    int fd, res = 0;
     buf_t *buf;
     my_conn_t *my;
     cli_com_t com;
@@ -1128,15 +3288,15 @@ static int my_use_db_prepare(conn_t *c)
     buf = &(my->buf);
 
     com.pktno = 0;
-    com.comno = COM_INIT_DB;
-    len = strlen(c->curdb);
-    memcpy(com.arg, c->curdb, len);
-    com.len = len;
+    com.comno = COM_QUERY;
+    strcpy(com.arg, "BEGIN");
+    com.len = strlen(com.arg);
 
     make_com(buf, &com);
-    res = add_handler(fd, EPOLLOUT, my_use_db_req_cb, my);
+    my_conn_req_start(my);
+    res = mod_handler(fd, MY_EPOLLOUT, my_begin_req_cb, my);
     if(res < 0){
-        log(g_log, "conn:%u add_handler error\n", c->connid);
+        log(g_log, "conn:%u mod_handler error\n", c->connid);
     }
 
     buf_rewind(buf);
@@ -1145,13 +3305,13 @@ static int my_use_db_prepare(conn_t *c)
 }
 
 /*
- * fun: send "use db" command to mysql callback
- * arg: fd, mysql connection 
+ * fun: send deferred BEGIN to mysql callback
+ * arg: fd, mysql connection
  * ret: success 0, error -1
  *
  */
 
-static int my_use_db_req_cb(int fd, void *arg)
+static int my_begin_req_cb(int fd, void *arg)
 {
     int res = 0, done;
     my_conn_t *my;
@@ -1168,14 +3328,9 @@ static int my_use_db_req_cb(int fd, void *arg)
     }
 
     if(done){
-        if( (res = del_handler(fd)) < 0 ){
-            log(g_log, "conn:%u del_handler fd[%d] error\n", c->connid, fd);
-            goto end;
-        }
-
-        res = add_handler(fd, EPOLLIN,my_use_db_resp_cb,arg);
+        res = mod_handler(fd, MY_EPOLLIN, my_begin_resp_cb, arg);
         if(res < 0){
-            log(g_log, "conn:%u add_handler fd[%d] error\n", c->connid, fd);
+            log(g_log, "conn:%u mod_handler fd[%d] error\n", c->connid, fd);
             goto end;
         }
 
@@ -1191,14 +3346,14 @@ end:
 }
 
 /*
- * fun: read mysql resp callback after sending "use db"
- * arg: fd, mysql connection 
+ * fun: read mysql resp callback after deferred BEGIN
+ * arg: fd, mysql connection
  * ret: success 0, error -1
  *
  */
 
-static int my_use_db_resp_cb(int fd, void *arg)
-{
+static int my_begin_resp_cb(int fd, void *arg)
+{//客户端以为事务已经开了，BEGIN失败了只能两边一起关掉
     int res = 0, done;
     my_conn_t *my;
     conn_t *c;
@@ -1214,23 +3369,19 @@ static int my_use_db_resp_cb(int fd, void *arg)
     }
 
     if(done){
-        if( (res = del_handler(fd)) < 0 ){
-            log(g_log, "conn:%u del_handler fd[%d] error\n", c->connid, fd);
+        if( (buf->used > HEADER_SIZE) && ((uint8_t)buf->ptr[HEADER_SIZE] == 0xff) ){
+            log_err(g_log, "conn:%u deferred begin failed\n", c->connid);
+            res = -1;
             goto end;
         }
 
-        strncpy(my->ctx.curdb, c->curdb, sizeof(my->ctx.curdb) - 1);
-        my->ctx.curdb[sizeof(my->ctx.curdb) - 1] = '\0';
+        c->begin = 0;
+        my->status |= SERVER_STATUS_IN_TRANS;
+        buf_reset(buf);
 
-        res = add_handler(fd, EPOLLOUT, my_query_cb, arg);
-        if(res < 0){
-            log(g_log, "conn:%u add_handler fd[%d] error\n", c->connid, fd);
+        if( (res = my_ctx_sync_next(c)) < 0 ){
             goto end;
         }
-
-        buf_reset(buf);
-
-        conn_state_set_writing_mysql(c);
     }
 
     return res;
@@ -1262,9 +3413,9 @@ int my_ping_prepare(my_conn_t *my)
     com.len = 0;
 
     make_com(buf, &com);
-    res = add_handler(fd, EPOLLOUT, my_ping_req_cb, my);
+    res = mod_handler(fd, MY_EPOLLOUT, my_ping_req_cb, my);
     if(res < 0){
-        log(g_log, "add_handler error\n");
+        log(g_log, "mod_handler error\n");
     }
 
     buf_rewind(buf);
@@ -1294,14 +3445,9 @@ static int my_ping_req_cb(int fd, void *arg)
     }
 
     if(done){
-        if( (res = del_handler(fd)) < 0 ){
-            log(g_log, "del_handler fd[%d] error\n", fd);
-            goto end;
-        }
-
-        res = add_handler(fd, EPOLLIN,my_ping_resp_cb,arg);
+        res = mod_handler(fd, MY_EPOLLIN,my_ping_resp_cb,arg);
         if(res < 0){
-            log(g_log, "add_handler fd[%d] error\n", fd);
+            log(g_log, "mod_handler fd[%d] error\n", fd);
             goto end;
         }
 
@@ -1355,3 +3501,136 @@ end:
 
     return res;
 }
+
+/*
+ * fun: prepare send replication lag query to slave
+ * arg: mysql connection
+ * ret: success 0, error -1
+ *
+ */
+
+int my_lag_prepare(my_conn_t *my)
+{//配了心跳表就算表里最新的ts离现在多久，否则看SHOW SLAVE STATUS的Seconds_Behind_Master
+    int fd, res = 0;
+    buf_t *buf;
+    cli_com_t com;
+
+    fd = my->fd;
+    buf = &(my->buf);
+
+    com.pktno = 0;
+    com.comno = COM_QUERY;
+    if(g_conf.lag_heartbeat[0] != '\0'){
+        com.len = snprintf(com.arg, sizeof(com.arg), \
+                "SELECT UNIX_TIMESTAMP() - UNIX_TIMESTAMP(MAX(ts))%s FROM %s", \
+                g_conf.read_after_write_gtid ? ", @@global.gtid_executed AS Executed_Gtid_Set" : "", g_conf.lag_heartbeat);
+    } else {
+        com.len = snprintf(com.arg, sizeof(com.arg), "SHOW SLAVE STATUS");
+    }
+
+    make_com(buf, &com);
+    res = mod_handler(fd, MY_EPOLLOUT, my_lag_req_cb, my);
+    if(res < 0){
+        log(g_log, "mod_handler error\n");
+    }
+
+    buf_rewind(buf);
+
+    return res;
+}
+
+/*
+ * fun: send replication lag query callback
+ * arg: fd, mysql connection
+ * ret: success 0, error -1
+ *
+ */
+
+static int my_lag_req_cb(int fd, void *arg)
+{
+    int res = 0, done;
+    my_conn_t *my;
+    buf_t *buf;
+
+    my = (my_conn_t *)arg;
+    buf = &(my->buf);
+
+    if( (res = my_real_write(fd, buf, &done)) < 0 ){
+        log_err(g_log, "my_real_write error\n");
+        goto end;
+    }
+
+    if(done){
+        res = mod_handler(fd, MY_EPOLLIN, my_lag_resp_cb, arg);
+        if(res < 0){
+            log(g_log, "mod_handler fd[%d] error\n", fd);
+            goto end;
+        }
+
+        buf_reset(buf);
+    }
+
+    return res;
+
+end:
+    my_conn_close_on_fail(my);
+
+    return res;
+}
+
+/*
+ * fun: mysql resp for replication lag query callback
+ * arg: fd, mysql connection
+ * ret: success 0, error -1
+ *
+ */
+
+static int my_lag_resp_cb(int fd, void *arg)
+{//查询报错(比如没权限)不改状态；没有行或者是NULL说明复制停了
+    int res = 0;
+    my_conn_t *my;
+    my_node_t *node;
+    buf_t *buf;
+    char val[32];
+
+    my = (my_conn_t *)arg;
+    buf = &(my->buf);
+
+    if( (res = my_real_read_result_set(fd, buf)) < 0 ){
+        log_err(g_log, "my_real_read_result_set error[%d]\n", res);
+        goto end;
+    }
+
+    res = parse_var_result(buf, (g_conf.lag_heartbeat[0] != '\0') ? NULL : "Seconds_Behind_Master", val, sizeof(val));
+    if(res == 0){
+        return 0;
+    }
+
+    if(res < 0){
+        log(g_log, "%s:%s replication lag query error\n", ((my_node_t *)my->node)->host, ((my_node_t *)my->node)->srv);
+    } else {
+        my_conn_node_lag(my, (res == 1) ? atoi(val) : -1);
+        if(g_conf.read_after_write_gtid){//SHOW SLAVE STATUS里有这一列，心跳表的查询里也带上了
+            node = my->node;
+            if(parse_var_result(buf, "Executed_Gtid_Set", node->gtid_executed, sizeof(node->gtid_executed)) != 1){
+                node->gtid_executed[0] = '\0';
+            }
+        }
+    }
+
+    if( (res = del_handler(fd)) < 0 ){
+        log(g_log, "del_handler fd[%d] error\n", fd);
+        goto end;
+    }
+
+    buf_reset(buf);
+
+    my_conn_put(my, 0);//跟ping一样，不算客户端用过
+
+    return 0;
+
+end:
+    my_conn_close_on_fail(my);
+
+    return res;
+}
@@ -4,20 +4,33 @@
 #include "my_buf.h"
 #include "conn_pool.h"
 
+//边缘触发模式下，和mysql、客户端连接相关的事件都带上EPOLLET，监听fd仍然是水平触发
+#define MY_EPOLLIN  (EPOLLIN | (g_conf.epoll_et ? EPOLLET : 0))
+#define MY_EPOLLOUT (EPOLLOUT | (g_conf.epoll_et ? EPOLLET : 0))
+
 int my_hs_stage1_cb(int fd, void *arg);
 int my_hs_stage2_cb(int fd, void *arg);
 int my_hs_stage3_cb(int fd, void *arg);
+int my_hs_stage4_cb(int fd, void *arg);
+int my_hs_stage5_cb(int fd, void *arg);
+int my_hs_stage6_cb(int fd, void *arg);
+int my_hs_stage7_cb(int fd, void *arg);
 
 int cli_hs_stage1_prepare(conn_t *c);
 int cli_hs_stage1_cb(int fd, void *arg);
 int cli_hs_stage2_cb(int fd, void *arg);
 int cli_hs_stage3_cb(int fd, void *arg);
+int cli_wait_done(conn_t *c);
+int cli_wait_fail(conn_t *c);
 
 int cli_query_cb(int fd, void *arg);
 int my_query_cb(int fd, void *arg);
 int my_answer_cb(int fd, void *arg);
 int cli_answer_cb(int fd, void *arg);
 
+int cli_scatter_end(conn_t *c, int close);
+
 int my_ping_prepare(my_conn_t *my);
+int my_lag_prepare(my_conn_t *my);
 
 #endif
@@ -6,21 +6,29 @@
  *
  */                                                           
 
+#define _GNU_SOURCE//getaddrinfo_a
+
 #include <stdio.h>
 #include <list.h>
 #include <time.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <sys/epoll.h>
 #include <errno.h>
+#include <netdb.h>
 #include <genpool.h>
 #include <sock.h>
 #include <log.h>
 #include <timer.h>
+#include <clock.h>
 #include <handler.h>
+#include <hash.h>
 #include "my_pool.h"
 #include "my_buf.h"
 #include "my_ops.h"
+#include "mysql_com.h"
 #include "conn_pool.h"
 #include "my_conf.h"
 #include "def.h"
@@ -28,32 +36,72 @@
 extern log_t *g_log;
 extern struct conf_t g_conf;
 
-static my_pool_t *mypool;
-static genpool_handler_t *handler;//mysql 的连接池，在my_pool_init分配
+static __thread my_pool_t *mypool;
+static __thread genpool_handler_t *handler;//mysql 的连接池，在my_pool_init分配
+
+static my_info_t *myinfo = NULL;//所有线程共用，分到的最小连接数是0的线程也能给客户端发握手包
+static time_t myinfo_time = 0;//上次用mysql握手包更新的时间
+
+//peak-EWMA的衰减时间常数，微秒；一个节点这么久没有新样本，延迟就衰减到原来的一半左右，慢节点恢复以后会被重新试
+#define MY_EWMA_DECAY_US 10000000ULL
+
+//权重换成代价时的放大倍数，权重是1的节点代价不变
+#define MY_WEIGHT_SCALE 64
 
-static my_info_t myinfo;
+static const char *policy_name[] = {"hash", "least", "ewma", "p2c", "wrr"};
+static const char *breaker_name[] = {"closed", "open", "half-open"};
+static const char *role_name[] = {"none", "slave", "master"};
+
+typedef struct{//后台解析一个节点的域名，名字拷一份跟着请求走，节点下线了请求还能安全地结束
+    struct gaicb cb;
+    struct gaicb *list[1];
+    struct addrinfo hints;
+    char host[MAX_HOST_LEN];
+    char srv[MAX_SRV_LEN];
+} my_resolve_t;
 
 static int my_conn_init(my_conn_t *my, my_node_t *n);
 static int my_node_init(my_node_t *n);
 static my_conn_t *my_conn_alloc(my_node_t *n);
 static int make_my_conn(my_conn_t *my);
+static int my_info_save(const char *fname, const my_info_t *info);
 static int _my_reg(my_node_t *node, char *host, char *srv, char *user, char *pass, int mincount, int maxcount);
+static void my_conn_move(my_conn_t *my, int state, int tail);
 static int my_conn_set_used(my_conn_t *my, void *ptr);
 static int my_conn_set_dead(my_conn_t *my);
 static int my_conn_set_raw(my_conn_t *my);
 static int my_conn_set_fail(my_conn_t *my);
 static int my_conn_set_ping(my_conn_t *my);
+static int my_conn_handoff(my_conn_t *my);
+static uint64_t my_ctx_hash(const char *curdb, const sess_state_t *sess);
+static my_conn_t *my_conn_ctx_pick(my_node_t *node, conn_t *c);
+static int my_node_increase_connection(my_node_t *node);
+static int my_node_reconnect(my_node_t *node, struct list_head *head, int max);
+static int my_node_allow_connect(my_node_t *node);
+static int my_connect_token(int take);
+static int my_backoff(int n);
+static my_node_t *my_node_select(int role, int group, const char *gtid, uint32_t ip, uint16_t port, int avail);
+static uint64_t my_node_cost(my_node_t *node, uint64_t now);
 
 static int my_conn_dead_reconnect_timer(unsigned long arg);
 static int my_conn_fail_reconnect_timer(unsigned long arg);
 static int my_conn_pool_status_timer(unsigned long arg);
 static int my_conn_pool_ping_timer(unsigned long arg);
 static int my_conn_pool_ping_timeout_timer(unsigned long arg);
+static int my_conn_pool_lag_timer(unsigned long arg);
+static int my_pool_scale_timer(unsigned long arg);
 
 static int my_node_set_closing(my_node_t *node);
 static int my_node_is_closing(my_node_t *node);
 static int my_node_closing_cleanup_timer(unsigned long arg);
 
+static int my_node_resolve(my_node_t *node);
+static void my_node_set_addr(my_node_t *node, const struct addrinfo *res);
+static int my_node_resolve_start(my_node_t *node);
+static void my_node_resolve_check(my_node_t *node);
+static void my_node_resolve_cancel(my_node_t *node);
+static int my_node_resolve_timer(unsigned long arg);
+
 /*
  * fun: init mysql context
  * arg: mysql context
@@ -66,6 +114,7 @@ static int my_ctx_init(my_ctx_t *ctx)
     ctx->dirty = 0;
 
     bzero(ctx->curdb, sizeof(ctx->curdb));
+    sess_init(&(ctx->sess));
 
     return 0;
 }
@@ -79,34 +128,164 @@ static int my_ctx_init(my_ctx_t *ctx)
 
 int my_info_set(uint8_t prot, uint8_t lang, uint16_t status, \
                             uint32_t cap, char *ver, int ver_len)
-{
+{//发布出去的信息不再改，变了就另填一份换指针；旧的不释放，别的线程可能还在读，只有mysql换版本的时候才会换
     int len;
-    time_t now = time(NULL);
+    time_t now = clock_sec();
+    my_info_t *old, *info;
 
-    if(now - myinfo.update_time < 10){
+    if(now - __atomic_load_n(&myinfo_time, __ATOMIC_RELAXED) < 10){
         return 0;
     }
+    __atomic_store_n(&myinfo_time, now, __ATOMIC_RELAXED);
 
-    myinfo.avail = 1;
-    myinfo.protocol = prot;
-    myinfo.lang = lang;
-    myinfo.status = status;
-    myinfo.cap = cap;
-
-    if(ver_len > (sizeof(myinfo.ver) - 1)){
-        len = sizeof(myinfo.ver) - 1;
+    if(ver_len > (sizeof(info->ver) - 1)){
+        len = sizeof(info->ver) - 1;
     } else {
         len = ver_len;
     }
 
-    memcpy(myinfo.ver, ver, len);
-    myinfo.ver[len] = '\0';
+    old = __atomic_load_n(&myinfo, __ATOMIC_ACQUIRE);
+    if( (old != NULL) && (old->protocol == prot) && (old->lang == lang) && (old->status == status) && \
+            (old->cap == cap) && (strlen(old->ver) == len) && (!strncmp(old->ver, ver, len)) ){
+        return 0;
+    }
+
+    if( (info = calloc(1, sizeof(my_info_t))) == NULL ){
+        log_err(g_log, "calloc my_info_t error\n");
+        return -1;
+    }
+
+    info->protocol = prot;
+    info->lang = lang;
+    info->status = status;
+    info->cap = cap;
+    memcpy(info->ver, ver, len);
+    info->ver[len] = '\0';
+
+    __atomic_store_n(&myinfo, info, __ATOMIC_RELEASE);//别的线程拿到指针的时候字段都写好了
+
+    if( (g_conf.info_file[0] != '\0') && (my_info_save(g_conf.info_file, info) < 0) ){
+        log(g_log, "save mysql info to %s error\n", g_conf.info_file);
+    }
+
+    return 0;
+}
+
+/*
+ * fun: load mysql info saved last time
+ * arg: file name
+ * ret: success 0, error -1
+ *
+ */
+
+int my_info_load(const char *fname)
+{//在fork和起线程之前调用，myinfo_time是0，连上mysql以后马上用真的信息换掉
+    FILE *fp;
+    int n = 0;
+    unsigned long val;
+    char line[256], key[64], ver[64];
+    my_info_t *info;
+
+    if( (fp = fopen(fname, "r")) == NULL ){
+        log(g_log, "open mysql info file %s error\n", fname);
+        return -1;
+    }
+
+    if( (info = calloc(1, sizeof(my_info_t))) == NULL ){
+        log_err(g_log, "calloc my_info_t error\n");
+        fclose(fp);
+        return -1;
+    }
+
+    ver[0] = '\0';
+    while(fgets(line, sizeof(line), fp) != NULL){
+        if(sscanf(line, "%63s", key) != 1){
+            continue;
+        }
+
+        if(!strcmp(key, "ver")){
+            if(sscanf(line, "%*s %63s", ver) == 1){
+                n++;
+            }
+            continue;
+        }
+
+        if(sscanf(line, "%*s %lu", &val) != 1){
+            continue;
+        }
+
+        if(!strcmp(key, "protocol")){
+            info->protocol = val;
+        } else if(!strcmp(key, "lang")){
+            info->lang = val;
+        } else if(!strcmp(key, "status")){
+            info->status = val;
+        } else if(!strcmp(key, "cap")){
+            info->cap = val;
+        } else {
+            continue;
+        }
+        n++;
+    }
+    fclose(fp);
+
+    if( (n != 5) || (info->protocol == 0) || (!(info->cap & CLIENT_PROTOCOL_41)) ){
+        log(g_log, "mysql info file %s is broken\n", fname);
+        free(info);
+        return -1;
+    }
+
+    strcpy(info->ver, ver);
+    __atomic_store_n(&myinfo, info, __ATOMIC_RELEASE);
+
+    log(g_log, "mysql info loaded from %s, version %s\n", fname, info->ver);
+
+    return 0;
+}
+
+/*
+ * fun: save mysql info
+ * arg: file name, mysql info
+ * ret: success 0, error -1
+ *
+ */
+
+static int my_info_save(const char *fname, const my_info_t *info)
+{//先写临时文件再改名，别的进程重启的时候不会读到写了一半的文件
+    FILE *fp;
+    char tmp[1024];
+
+    snprintf(tmp, sizeof(tmp), "%s.%d.%lu", fname, getpid(), (unsigned long)pthread_self());
+
+    if( (fp = fopen(tmp, "w")) == NULL ){
+        return -1;
+    }
+
+    fprintf(fp, "protocol %u\nlang %u\nstatus %u\ncap %u\nver %s\n", \
+            info->protocol, info->lang, info->status, info->cap, info->ver);
+
+    if( (fclose(fp) != 0) || (rename(tmp, fname) < 0) ){
+        unlink(tmp);
+        return -1;
+    }
 
-    myinfo.update_time = now;
+    log(g_log, "mysql info saved to %s, version %s\n", fname, info->ver);
 
     return 0;
 }
 
+/*
+ * fun: get mysql info
+ * arg:
+ * ret: success return mysql info, not ready return NULL
+ *
+ */
+
+my_info_t *my_info_get(void)
+{//还没有连上过任何mysql的时候拿不到；拿到的那份不会再被改
+    return __atomic_load_n(&myinfo, __ATOMIC_ACQUIRE);
+}
+
 /*
  * fun: init mysql connection
  * arg: mysql connection, mysql node
@@ -119,6 +298,9 @@ static int my_conn_init(my_conn_t *my, my_node_t *n)
     my->fd = -1;
     my->node = (void *)n;//我所属的节点
     INIT_LIST_HEAD(&(my->link));
+    INIT_LIST_HEAD(&(my->ctx_link));
+    my->ctx_hash = 0;
+    my->state = MY_CONN_NONE;
     my->conn = NULL;
 
     buf_init(&(my->buf));
@@ -127,7 +309,14 @@ static int my_conn_init(my_conn_t *my, my_node_t *n)
 
     my->state_time = 0;
     my->lastused_time = 0;
-	my->setnamesql[0] = '\0' ;
+    my->alive_time = 0;
+    my->connect_start = 0;
+    my->wait_timeout = MY_WAIT_TIMEOUT_DEF;
+    my->retry_count = 0;
+    my->retry_at = 0;
+    my->status = SERVER_STATUS_AUTOCOMMIT;
+    my->req_start = 0;
+    my->used_start = 0;
 
     return 0;
 }
@@ -141,6 +330,8 @@ static int my_conn_init(my_conn_t *my, my_node_t *n)
 
 static int my_node_init(my_node_t *n)
 {
+    int i;
+
     bzero(n->host, sizeof(n->host));
     bzero(n->srv, sizeof(n->srv));
     bzero(n->user, sizeof(n->user));
@@ -152,16 +343,75 @@ static int my_node_init(my_node_t *n)
     INIT_LIST_HEAD(&(n->raw_head));
     INIT_LIST_HEAD(&(n->fail_head));
     INIT_LIST_HEAD(&(n->ping_head));
+    for(i = 0; i < MY_CTX_BUCKETS; i++){
+        INIT_LIST_HEAD(&(n->ctx_head[i]));
+    }
 
-    n->info = &myinfo;
-    n->avail_count = 0;
-    n->role = 0;
+    bzero(n->count, sizeof(n->count));
+    n->role = MY_ROLE_NONE;
+    n->group = 0;
     n->closing = 0;
     n->closing_time = 0;
 	n->curall_connection = 0 ;
 	n->min_connection = 0 ;
 	n->max_connection = 0 ;
 
+    INIT_LIST_HEAD(&(n->wait_head));
+    n->wait_count = 0;
+    n->wait_peak = 0;
+    n->wait_total = 0;
+    n->wait_served = 0;
+    n->wait_timeout = 0;
+    n->wait_reject = 0;
+    n->wait_ms = 0;
+    n->wait_ms_peak = 0;
+
+    n->outstanding = 0;
+    n->ewma_us = 0;
+    n->ewma_time = 0;
+    n->req_count = 0;
+    n->pick_count = 0;
+
+    n->weight = 1;
+    n->cur_weight = 0;
+
+    n->acquire_count = 0;
+    n->release_count = 0;
+    n->hold_us = 0;
+    n->used_peak = 0;
+    n->demand = 0;
+    n->target = 0;
+    n->scale_time = clock_us();
+    n->below_since = 0;
+
+    n->breaker = BREAKER_CLOSED;
+    n->fail_streak = 0;
+    n->backoff = 0;
+    n->open_until = 0;
+    n->probing = 0;
+    n->breaker_opens = 0;
+
+    n->lag = 0;
+    n->lagging = 0;
+    n->lag_time = 0;
+    n->lag_outs = 0;
+    n->gtid_executed[0] = '\0';
+
+    n->ctx_hit = 0;
+    n->ctx_miss = 0;
+    n->ctx_saved = 0;
+
+    bzero(&(n->addr), sizeof(n->addr));
+    n->addrlen = 0;
+    n->numeric = 0;
+    n->resolve_time = 0;
+    n->resolving = NULL;
+    n->resolve_changes = 0;
+
+    n->connect_count = 0;
+    n->connect_us = 0;
+    n->connect_us_peak = 0;
+
     return 0;
 }
 
@@ -222,8 +472,8 @@ int my_pool_init(int count)
         log_err(g_log, "malloc error\n");
         return -1;
     }
-	for( i = 0 ; i < MAX_SLAVE_NODE; ++i ){// 初始化数据结构
-		my_node_init( &( mypool->slave[i]) ) ;
+	for( i = 0 ; i < MAX_MY_NODE; ++i ){// 初始化数据结构
+		my_node_init( &( mypool->node[i]) ) ;
 	}
 
     if( (handler = genpool_init(sizeof(my_conn_t), count)) == NULL ){
@@ -232,15 +482,23 @@ int my_pool_init(int count)
         return -1;
     }
 
-    mypool->slave_num = 0;
-
-    res = timer_register(my_conn_dead_reconnect_timer, 9, "my_conn_dead_reconnect_timer", 1);
+    mypool->node_num = 0;
+    bzero(mypool->role_count, sizeof(mypool->role_count));
+    mypool->avail_total = 0;
+    mypool->connect_rate = 0;
+    mypool->tokens = 0;
+    mypool->token_time = clock_ms();
+    mypool->connect_throttled = 0;
+    mypool->policy = POLICY_HASH;
+    mypool->rr = 0;
+
+    res = timer_register(my_conn_dead_reconnect_timer, g_conf.max_connecting, "my_conn_dead_reconnect_timer", 1);
     if(res < 0){
         log(g_log, "my_conn_dead_reconnect_timer register error\n");
         return -1;
     }
 
-    res = timer_register(my_conn_fail_reconnect_timer, 1, "my_conn_fail_reconnect_timer", 1);
+    res = timer_register(my_conn_fail_reconnect_timer, g_conf.max_connecting, "my_conn_fail_reconnect_timer", 1);
     if(res < 0){
         log(g_log, "my_conn_fail_reconnect_timer register error\n");
         return -1;
@@ -252,12 +510,26 @@ int my_pool_init(int count)
         return -1;
     }
 
-    res = timer_register(my_conn_pool_ping_timer, 10, "my_conn_pool_ping_timer", 10);
+    res = timer_register(my_conn_pool_ping_timer, 10, "my_conn_pool_ping_timer", 1);
     if(res < 0){
         log(g_log, "my_conn_pool_ping_timer register error\n");
         return -1;
     }
 
+    if(g_conf.lag_check_interval > 0){
+        res = timer_register(my_conn_pool_lag_timer, 0, "my_conn_pool_lag_timer", 1);
+        if(res < 0){
+            log(g_log, "my_conn_pool_lag_timer register error\n");
+            return -1;
+        }
+    }
+
+    res = timer_register(my_pool_scale_timer, 0, "my_pool_scale_timer", 1);
+    if(res < 0){
+        log(g_log, "my_pool_scale_timer register error\n");
+        return -1;
+    }
+
     res = timer_register(my_conn_pool_ping_timeout_timer, 3, "my_conn_pool_ping_timeout_timer", 1);
     if(res < 0){
         log(g_log, "my_conn_pool_ping_timeout_timer register error\n");
@@ -267,6 +539,12 @@ int my_pool_init(int count)
     res = timer_register(my_node_closing_cleanup_timer, 3, "my_node_closing_cleanup_timer", 60);
     if(res < 0){
         log(g_log, "my_node_closing_cleanup_timer register error\n");
+        return res;
+    }
+
+    res = timer_register(my_node_resolve_timer, 0, "my_node_resolve_timer", 1);
+    if(res < 0){
+        log(g_log, "my_node_resolve_timer register error\n");
         return -1;
     }
 
@@ -275,6 +553,12 @@ int my_pool_init(int count)
 
 int my_pool_destroy( )
 {
+    int i;
+
+    for(i = 0; (mypool != NULL) && (i < mypool->node_num); i++){
+        my_node_resolve_cancel(&(mypool->node[i]));
+    }
+
 	if( handler != NULL){
 		genpool_destroy( handler ) ;
 		handler = NULL ;
@@ -292,23 +576,31 @@ int my_pool_destroy( )
 
 static int make_my_conn(my_conn_t *my)
 {
-    int fd, done, res = 0;
+    int fd, done, res = 0, retry;
     my_node_t *node;
 
 	info( g_log, "make_my_conn new a connection.\n");
     node = my->node;
+    retry = my->retry_count;//重连要接着退避
 
     if( (res = my_conn_init(my, node)) < 0 ){
 		my_conn_release(my) ;//这里必须释放结构，因为没法重连
 		log_err(g_log, "my_conn_init failed , my_conn_release release\n") ;
         return res;
     }
+    my->retry_count = retry;
+
+    if(node->addrlen == 0){//域名还没解析出来，不在这里阻塞着查，等后台解析
+        log(g_log, "%s:%s address not resolved yet\n", node->host, node->srv);
+        return my_conn_close_on_fail(my);
+    }
 
 	++ node->cur_connecting_cnt ;
-    fd = connect_nonblock(node->host, node->srv, &done);
+    my->connect_start = clock_us();
+    fd = connect_addr_nonblock((struct sockaddr *)&(node->addr), node->addrlen, &done);
     if(fd >= 0){
         my->fd = fd;
-        res = add_handler(fd, EPOLLIN, my_hs_stage1_cb, my);//my为这个mysql的连接。暂时只记录了fd 和所属node
+        res = add_handler(fd, MY_EPOLLIN, my_hs_stage1_cb, my);//my为这个mysql的连接。暂时只记录了fd 和所属node
         if(res < 0){
             log(g_log, "add_handler error\n");
 			-- node->cur_connecting_cnt ;
@@ -342,11 +634,16 @@ static int _my_reg(my_node_t *node, char *host, char *srv, char *user, char *pas
 
 	node->min_connection = mincount ;
 	node->max_connection = maxcount ;
+    node->target = mincount;
     strncpy(node->host, host, MAX_HOST_LEN - 1);
     strncpy(node->srv, srv, MAX_SRV_LEN - 1);
     strncpy(node->user, user, MAX_USER_LEN - 1);
     strncpy(node->pass, pass, MAX_PASS_LEN - 1);
 
+    if(my_node_resolve(node) < 0){//解析不出来也先注册上，后台接着解析
+        log(g_log, "my_node_resolve %s:%s error\n", host, srv);
+    }
+
     for(i = 0; i < mincount; i++){//一个个建立那么多连接
         if( (my = my_conn_alloc(node)) == NULL ){//申请一个mysql 连接结构，初始化
             log(g_log, "my_conn_alloc error\n");
@@ -362,31 +659,49 @@ static int _my_reg(my_node_t *node, char *host, char *srv, char *user, char *pas
 }
 
 /*
- * fun: register slave mysql
- * arg: host, srv, user, pass, connection number
+ * fun: register master or slave mysql
+ * arg: role, group, host, srv, user, pass, connection number
  * ret: success 0, error -1
  *
  */
 
-int my_slave_reg(char *host, char *srv, char *user, char *pass, int mincount, int maxcount)
-{
-    int i, res = 0;
+int my_node_reg(int role, int group, char *host, char *srv, char *user, char *pass, int mincount, int maxcount, int weight)
+{//master每个组有限制，slave所有组加起来有限制
+    int i, n = 0, res = 0;
     my_node_t *node;
 
-    for(i = 0; i < MAX_SLAVE_NODE; i++){
-        node = &(mypool->slave[i]);//找一个空位置，用来存储IP等信息
-        if(node->role == 0){
+    if( (group < 0) || (group >= MAX_MY_GROUP) ){
+        log(g_log, "group %d exceed limit[%d]\n", group, MAX_MY_GROUP);
+        return -1;
+    }
+
+    for(i = 0; i < mypool->node_num; i++){//正在下线的不算，换master的时候新旧可以同时在
+        node = &(mypool->node[i]);
+        if( (node->role == role) && (!my_node_is_closing(node)) && \
+                ((role != MY_ROLE_MASTER) || (node->group == group)) ){
+            n++;
+        }
+    }
+
+    if(n >= ((role == MY_ROLE_MASTER) ? MAX_MASTER_NODE : MAX_SLAVE_NODE)){
+        log(g_log, "%s number exceed limit[%d]\n", role_name[role], n);
+        return -1;
+    }
+
+    for(i = 0; i < MAX_MY_NODE; i++){
+        node = &(mypool->node[i]);//找一个空位置，用来存储IP等信息
+        if(node->role == MY_ROLE_NONE){
             break;
         }
     }
 
-    if(i == MAX_SLAVE_NODE){
-        log(g_log, "slave number exceed limit[%d]\n", MAX_SLAVE_NODE);
+    if(i == MAX_MY_NODE){
+        log(g_log, "mysql number exceed limit[%d]\n", MAX_MY_NODE);
         return -1;
     }
 
-    if(i == mypool->slave_num){
-        mypool->slave_num++;
+    if(i == mypool->node_num){
+        mypool->node_num++;
     }
 
     res = _my_reg(node, host, srv, user, pass, mincount, maxcount);
@@ -394,9 +709,13 @@ int my_slave_reg(char *host, char *srv, char *user, char *pass, int mincount, in
         log(g_log, "_my_reg error\n");
         return res;
     }
-    node->role = 1;
+    node->role = role;
+    node->group = group;
+    node->weight = weight;
+    mypool->role_count[group][role]++;
 
-    log(g_log, "host: %s, srv: %s, user: %s, cnum: %d\n", host, srv, user, mincount);
+    log(g_log, "%s host: %s, srv: %s, user: %s, cnum: %d, weight: %d, group: %d\n", \
+                role_name[role], host, srv, user, mincount, weight, group);
 
     return res;
 }
@@ -411,7 +730,7 @@ int my_slave_reg(char *host, char *srv, char *user, char *pass, int mincount, in
 static int my_node_set_closing(my_node_t *node)
 {
     node->closing = 1;
-    node->closing_time = time(NULL);
+    node->closing_time = clock_sec();
 
     return 0;
 }
@@ -430,24 +749,24 @@ static int my_node_is_closing(my_node_t *node)
 
 /*
  * fun: unregister mysql
- * arg: host, srv
+ * arg: role, group, host, srv
  * ret: success 0, error -1
  *
  */
 
-int my_unreg(char *host, char *srv)
+int my_unreg(int role, int group, char *host, char *srv)
 {
     int i;
     my_node_t *node;
 
     log(g_log, "%s called\n", __func__);
 
-    for(i = 0; i < mypool->slave_num; i++){
-        node = &(mypool->slave[i]);
-        if((!strcmp(node->host, host)) && (!strcmp(node->srv, srv))){
+    for(i = 0; i < mypool->node_num; i++){
+        node = &(mypool->node[i]);
+        if( (node->role == role) && (node->group == group) && (!strcmp(node->host, host)) && (!strcmp(node->srv, srv)) ){
             my_node_set_closing(node);
 
-            log(g_log, "slave %s:%s unregister\n", host, srv);
+            log(g_log, "%s %s:%s unregister\n", role_name[role], host, srv);
         }
     }
 
@@ -455,236 +774,960 @@ int my_unreg(char *host, char *srv)
 }
 
 /*
- * fun: get a slave connection
- * arg: connection, client ip, client port
- * ret: success return mysql connection, error return NULL 
+ * fun: set weight of mysql node
+ * arg: role, group, host, srv, weight
+ * ret: success 0, error -1
  *
  */
 
-my_conn_t *my_slave_conn_get(void *c, uint32_t ip, uint16_t port)
-{//ip:port  为客户端连接IP,端口
-    int i, index;
+int my_node_set_weight(int role, int group, char *host, char *srv, int weight)
+{//不用重新注册，已有的连接不动，只影响以后怎么分
+    int i;
     my_node_t *node;
-    my_conn_t *my;
-    struct list_head *head;
-    time_t now = time(NULL);
 
-    if(mypool->slave_num == 0){
-        log(g_log, "no slave register\n");
-        return NULL;
-    }
+    for(i = 0; i < mypool->node_num; i++){
+        node = &(mypool->node[i]);
+        if( (node->role == role) && (node->group == group) && (!my_node_is_closing(node)) && \
+                (!strcmp(node->host, host)) && (!strcmp(node->srv, srv)) ){
+            log(g_log, "%s %s:%s weight %d -> %d\n", role_name[role], host, srv, node->weight, weight);
+            node->weight = weight;
+            node->cur_weight = 0;
 
-    for(i = 0; i < mypool->slave_num; i++){
-        index = ((ip + port) + i) % (mypool->slave_num);//用ip和Port做哈希, 从第i个开始找，其实这样就分散了的，
-		//一个个slave找，注意这里是先找第一个mysql,再找第二个
-        node = &(mypool->slave[index]);
-        head = &(node->avail_head);//从avail_head上面找有没有可用连接
-        if( (!my_node_is_closing(node)) && (!list_empty(head)) ){
-            break;
+            return 0;
         }
     }
 
-    if(i == mypool->slave_num){//没找到`````
-        log(g_log, "no slave available, slave_num:%d\n", mypool->slave_num );
-        return NULL;
-    }
+    return -1;
+}
 
-    my = list_first_entry(head, my_conn_t, link);
-    my_conn_set_used(my, c);//将一个mysql连接标记为被使用了。也就是my->conn指向中间结构conn_t
+/*
+ * fun: set connect rate of this thread
+ * arg: new connections per second, 0 no limit
+ * ret: void
+ *
+ */
 
-    return my;
+void my_pool_set_connect_rate(int rate)
+{
+    mypool->connect_rate = rate;
+    mypool->tokens = (long)rate * 1000;
+    mypool->token_time = clock_ms();
 }
 
 /*
- * fun: close mysql connection
- * arg: mysql connection
- * ret: success 0, error -1
+ * fun: take a token to make new mysql connection
+ * arg: take it or only check
+ * ret: have token 1, no 0
  *
  */
 
-int my_conn_close(my_conn_t *my)
-{
-    int res;
+static int my_connect_token(int take)
+{//令牌桶，每秒加connect_rate个，最多攒一秒的
+    uint64_t now = clock_ms();
+    long cap;
 
-    if( (res = del_handler(my->fd)) < 0 ){
-        log(g_log, "del_handler error, ignore it\n");
-    } else {
-        ;//debug(g_log, "del_handler success\n");
+    if(mypool->connect_rate <= 0){
+        return 1;
     }
 
-    if(my->fd >= 0){
-        close(my->fd);
-        my->fd = -1;
+    cap = (long)mypool->connect_rate * 1000;
+    mypool->tokens += (long)(now - mypool->token_time) * mypool->connect_rate;
+    if(mypool->tokens > cap){
+        mypool->tokens = cap;
     }
+    mypool->token_time = now;
 
-    my->conn = NULL;
-    buf_reset(&(my->buf));
+    if(mypool->tokens < 1000){
+        if(!take){
+            mypool->connect_throttled++;
+        }
+        return 0;
+    }
 
-    my_conn_set_dead(my);
+    if(take){
+        mypool->tokens -= 1000;
+    }
 
-    return 0;
+    return 1;
 }
 
 /*
- * fun: close mysql connection and set fail
- * arg: mysql connection
- * ret: success 0, error -1
+ * fun: jittered exponential backoff
+ * arg: times failed
+ * ret: milliseconds
  *
  */
 
-int my_conn_close_on_fail(my_conn_t *my)
-{
-    my_conn_close(my);
-    my_conn_set_fail(my);
+static int my_backoff(int n)
+{//min翻n倍，不超过max，再在一半到全部之间随机，一起死的连接不会一起重连
+    long ms = g_conf.breaker_backoff_min;
 
-    return 0;
+    while( (n-- > 0) && (ms < g_conf.breaker_backoff_max) ){
+        ms <<= 1;
+    }
+    if(ms > g_conf.breaker_backoff_max){
+        ms = g_conf.breaker_backoff_max;
+    }
+
+    return (int)(ms / 2 + rand() % (ms / 2 + 1));
 }
 
 /*
- * fun: close mysql connection and release it
- * arg: mysql connection
- * ret: success 0, error -1
+ * fun: open circuit breaker of node
+ * arg: mysql node
+ * ret: void
  *
  */
 
-static int my_conn_close_and_release(my_conn_t *my)
-{
-    my_conn_close(my);
-    list_del_init(&(my->link));//需要release，所以移除
-    my_conn_release(my);
+static void my_node_open(my_node_t *node)
+{//第一次熔断min，半开试失败了翻倍；排队的客户端直接回错误，不用等超时
+    conn_t *c;
 
-    return 0;
+    if(node->backoff == 0){
+        node->backoff = g_conf.breaker_backoff_min;
+    } else if(node->backoff < g_conf.breaker_backoff_max){
+        node->backoff *= 2;
+        if(node->backoff > g_conf.breaker_backoff_max){
+            node->backoff = g_conf.breaker_backoff_max;
+        }
+    }
+
+    node->breaker = BREAKER_OPEN;
+    node->probing = 0;
+    node->open_until = clock_ms() + node->backoff / 2 + rand() % (node->backoff / 2 + 1);
+    node->breaker_opens++;
+    if(!node->numeric){//连不上可能是域名换了地址
+        node->resolve_time = 0;
+    }
+
+    log(g_log, "%s %s:%s breaker open, %u failures, backoff %dms\n", \
+            role_name[node->role], node->host, node->srv, node->fail_streak, node->backoff);
+
+    while(!list_empty(&(node->wait_head))){
+        c = list_first_entry(&(node->wait_head), conn_t, link);
+        cli_wait_fail(c);
+    }
 }
 
 /*
- * fun: put mysql connection
- * arg: mysql connection
- * ret: success 0, error -1
+ * fun: can node make new mysql connection now
+ * arg: mysql node
+ * ret: yes 1, no 0
  *
  */
 
-int my_conn_put(my_conn_t *my, int isupdatestatustime )
+static int my_node_allow_connect(my_node_t *node)
 {
-    int res = 0;
-    my_node_t *node = my->node;
-
-    if( (res = del_handler(my->fd)) < 0 ){
-        log(g_log, "del_handler error, ignore it\n");
-    } else {
-        ;//debug(g_log, "del_handler success\n");
+    if(node->breaker == BREAKER_CLOSED){
+        return 1;
     }
 
-    if(my_conn_ctx_is_dirty(my)){
-        my_conn_close(my);
+    if(node->breaker == BREAKER_OPEN){
+        if(clock_ms() < node->open_until){
+            return 0;
+        }
+        node->breaker = BREAKER_HALF_OPEN;
+        node->probing = 0;
+        log(g_log, "%s %s:%s breaker half-open\n", role_name[node->role], node->host, node->srv);
+    }
 
+    if(node->probing){
         return 0;
     }
+    node->probing = 1;
 
-    my_conn_set_avail(my, isupdatestatustime);
-
-    return 0;
+    return 1;
 }
 
 /*
- * fun: set mysql connection used
- * arg: mysql connection, connection pointer
- * ret: success 0, error -1
+ * fun: mysql connection failed, connect/auth/ping/io error
+ * arg: mysql connection
+ * ret: void
  *
  */
 
-static int my_conn_set_used(my_conn_t *my, void *ptr)
-{//将一个mysql连接标记为被使用了。也就是my->conn指向中间结构conn_t，
-    int res = 0;
+void my_conn_node_fail(my_conn_t *my)
+{
     my_node_t *node = my->node;
-    my->conn = ptr;//指向中间结构conn_t
-    buf_reset(&(my->buf));
 
-    list_move_tail(&(my->link), &(node->used_head));//将我这个连接从之前的地方移除，然后挂到used_head上面
-    my->state_time = g_cursecond;
+    node->fail_streak++;
 
-    if( (res = del_handler(my->fd)) < 0 ){//清楚，重新再来
-        log(g_log, "del_handler error, ignore it\n");
-    } else {
-        ;//debug(g_log, "del_handler success\n");
+    if(node->breaker == BREAKER_HALF_OPEN){
+        my_node_open(node);
+    } else if( (node->breaker == BREAKER_CLOSED) && (node->fail_streak >= (unsigned int)g_conf.breaker_threshold) ){
+        my_node_open(node);
     }
-
-    node->avail_count--;//减少可用连接数  
-
-    return 0;
 }
 
 /*
- * fun: set mysql connection avail
+ * fun: mysql connection authorized
  * arg: mysql connection
- * ret: success 0, error -1
+ * ret: void
  *
  */
 
-int my_conn_set_avail(my_conn_t *my, int isupdatestatustime )
-{//跟mysql直接的验证成功了，下面标记这个连接为可用的,放入node的avail_head上面
-    int res = 0;
+void my_conn_node_ok(my_conn_t *my)
+{
+    uint64_t dt;
     my_node_t *node = my->node;
 
-    my->conn = NULL;
-    buf_reset(&(my->buf));
-
-	//下面不放到尾部了，否则一个个轮的话，没法删除过期连接了就 
-    //list_move_tail(&(my->link), &(node->avail_head));
-    my->state_time = time(NULL);
-
-	if( 1 == isupdatestatustime){
-		my->lastused_time = g_cursecond ;//更新一下这个值，用来标记这个连接空等了多久 
-		list_move_tail(&(my->link), &(node->avail_head));//放到末尾，以为你这个是ping等操作,避免无法删除闲置连接
-	}
-	else {
-		list_move(&(my->link), &(node->avail_head));
-	}
+    node->fail_streak = 0;
 
-    node->avail_count++;
+    if(my->connect_start){//从connect到验证完能用花了多久
+        dt = clock_us() - my->connect_start;
+        node->connect_count++;
+        node->connect_us += dt;
+        if(dt > node->connect_us_peak){
+            node->connect_us_peak = dt;
+        }
+        my->connect_start = 0;
+    }
 
-    return 0;
+    if(node->breaker != BREAKER_CLOSED){
+        log(g_log, "%s %s:%s breaker closed\n", role_name[node->role], node->host, node->srv);
+        node->breaker = BREAKER_CLOSED;
+        node->probing = 0;
+        node->backoff = 0;
+    }
 }
 
 /*
- * fun: set mysql connection dead 
- * arg: mysql connection
+ * fun: set slave select policy
+ * arg: policy name
  * ret: success 0, error -1
  *
  */
 
-static int my_conn_set_dead(my_conn_t *my)
-{
-    int res = 0;
-    my_node_t *node = my->node;
+int my_pool_set_policy(const char *name)
+{//重新加载mysql配置时也会调，只影响以后的选择，已经在用的连接不动
+    int i;
 
-    my->conn = NULL;
-    buf_reset(&(my->buf));
+    for(i = 0; i < (int)(sizeof(policy_name) / sizeof(policy_name[0])); i++){
+        if(!strcmp(name, policy_name[i])){
+            break;
+        }
+    }
 
-    list_move_tail(&(my->link), &(node->dead_head));
-    my->state_time = time(NULL);
-	node->avail_count--;//减少可用连接数
+    if(i == (int)(sizeof(policy_name) / sizeof(policy_name[0]))){
+        log(g_log, "unknown slave policy %s\n", name);
+        return -1;
+    }
+
+    if(mypool->policy != i){
+        log(g_log, "slave policy %s -> %s\n", policy_name[mypool->policy], policy_name[i]);
+        mypool->policy = i;
+    }
 
     return 0;
 }
 
 /*
- * fun: set mysql connection raw 
- * arg: mysql connection
- * ret: success 0, error -1
+ * fun: peak-EWMA cost of mysql node
+ * arg: mysql node, now in microseconds
+ * ret: cost, smaller is better
  *
  */
 
-static int my_conn_set_raw(my_conn_t *my)
-{
-    int res = 0;
-    my_node_t *node = my->node;
+static uint64_t my_node_cost(my_node_t *node, uint64_t now)
+{//延迟按没有样本的时间衰减，再乘以在途命令数，在途的越多越要排队，权重大的按比例便宜
+    uint64_t ewma = node->ewma_us;
 
-    my->conn = NULL;
+    if(node->weight <= 0){
+        return (uint64_t)-1;
+    }
+
+    if(now > node->ewma_time){
+        ewma = ewma * MY_EWMA_DECAY_US / (MY_EWMA_DECAY_US + (now - node->ewma_time));
+    }
+
+    return (ewma + 1) * (node->outstanding + 1) * MY_WEIGHT_SCALE / node->weight;
+}
+
+/*
+ * fun: select master or slave node by policy
+ * arg: role, group, gtid slave must have executed or NULL, client ip, client port, must have avail connection
+ * ret: success return mysql node, error return NULL
+ *
+ */
+
+static my_node_t *my_node_select(int role, int group, const char *gtid, uint32_t ip, uint16_t port, int avail)
+{//avail为0是给排队用的，节点只要没在下线就行
+    int i, n = 0, a, b;
+    unsigned int start;
+    my_node_t *node, *best, *cand[MAX_MY_NODE];
+    uint64_t cost, best_cost, now = clock_us();
+
+    if(mypool->policy == POLICY_HASH){//用ip和Port做哈希, 从第i个开始找，其实这样就分散了的
+        start = ip + port;
+    } else {
+        start = mypool->rr++;
+    }
+
+    for(i = 0; i < mypool->node_num; i++){
+        node = &(mypool->node[(start + i) % (mypool->node_num)]);
+        if( (node->role != role) || (node->group != group) || my_node_is_closing(node) || (node->weight <= 0) || \
+                (node->breaker != BREAKER_CLOSED) || node->lagging ){//熔断的、延迟太大的节点直接跳过
+            continue;
+        }
+        if( (gtid != NULL) && (!gtid_set_contains(node->gtid_executed, gtid)) ){//还没同步到客户端刚写的
+            continue;
+        }
+        if(avail && list_empty(&(node->avail_head))){
+            continue;
+        }
+        cand[n++] = node;
+    }
+
+    if(n == 0){
+        return NULL;
+    }
+
+    switch(mypool->policy){
+        case POLICY_LEAST:
+        case POLICY_EWMA:
+            best = cand[0];
+            best_cost = (mypool->policy == POLICY_LEAST) ? \
+                    (uint64_t)(best->outstanding + 1) * MY_WEIGHT_SCALE / best->weight : my_node_cost(best, now);
+            for(i = 1; i < n; i++){
+                cost = (mypool->policy == POLICY_LEAST) ? \
+                    (uint64_t)(cand[i]->outstanding + 1) * MY_WEIGHT_SCALE / cand[i]->weight : my_node_cost(cand[i], now);
+                if(cost < best_cost){
+                    best = cand[i];
+                    best_cost = cost;
+                }
+            }
+            break;
+        case POLICY_P2C:
+            if(n == 1){
+                best = cand[0];
+                break;
+            }
+            a = rand() % n;
+            b = rand() % (n - 1);
+            if(b >= a){//两个不能是同一个
+                b++;
+            }
+            best = (my_node_cost(cand[a], now) <= my_node_cost(cand[b], now)) ? cand[a] : cand[b];
+            break;
+        case POLICY_WRR://nginx的平滑加权轮询，每个加上自己的权重，选最大的，再减去总权重
+            best = cand[0];
+            a = 0;
+            for(i = 0; i < n; i++){
+                cand[i]->cur_weight += cand[i]->weight;
+                a += cand[i]->weight;
+                if(cand[i]->cur_weight > best->cur_weight){
+                    best = cand[i];
+                }
+            }
+            best->cur_weight -= a;
+            break;
+        default:
+            best = cand[0];
+            break;
+    }
+
+    best->pick_count++;
+
+    return best;
+}
+
+/*
+ * fun: mysql connection start a command
+ * arg: mysql connection
+ * ret: void
+ *
+ */
+
+void my_conn_req_start(my_conn_t *my)
+{//USE DB、回放SET和真正的命令连着发，算一个命令，从第一个开始计时
+    my_node_t *node = my->node;
+
+    if(my->req_start != 0){
+        return;
+    }
+
+    my->req_start = clock_us();
+    node->outstanding++;
+}
+
+/*
+ * fun: mysql connection command done
+ * arg: mysql connection, take latency sample or not
+ * ret: void
+ *
+ */
+
+void my_conn_req_end(my_conn_t *my, int sample)
+{//比当前值大的样本直接顶上去，小的按离上次更新的时间慢慢拉下来
+    my_node_t *node = my->node;
+    uint64_t now, lat, dt;
+
+    if(my->req_start == 0){
+        return;
+    }
+
+    node->outstanding--;
+
+    if(sample){
+        if(node->breaker == BREAKER_CLOSED){//命令有回复，节点是好的
+            node->fail_streak = 0;
+        }
+
+        now = clock_us();
+        lat = (now > my->req_start) ? (now - my->req_start) : 0;
+        dt = (now > node->ewma_time) ? (now - node->ewma_time) : 0;
+        if(dt < 100){//时钟每轮事件循环才更新，同一轮的样本也要能拉动一点
+            dt = 100;
+        }
+
+        if(lat >= node->ewma_us){
+            node->ewma_us = lat;
+        } else {
+            node->ewma_us = (node->ewma_us * MY_EWMA_DECAY_US + lat * dt) / (MY_EWMA_DECAY_US + dt);
+        }
+        node->ewma_time = now;
+        node->req_count++;
+    }
+
+    my->req_start = 0;
+}
+
+/*
+ * fun: which role to use, fall back to the other if none registered
+ * arg: group, wanted role
+ * ret: role, MY_ROLE_NONE if no mysql registered
+ *
+ */
+
+static int my_pool_role(int group, int role)
+{//没配master写也发slave，跟以前一样；只配了master读也发master
+    if( (group < 0) || (group >= MAX_MY_GROUP) ){
+        return MY_ROLE_NONE;
+    }
+
+    if(mypool->role_count[group][role] > 0){
+        return role;
+    }
+
+    role = (role == MY_ROLE_MASTER) ? MY_ROLE_SLAVE : MY_ROLE_MASTER;
+    if(mypool->role_count[group][role] > 0){
+        return role;
+    }
+
+    return MY_ROLE_NONE;
+}
+
+/*
+ * fun: is any node of role registered in group
+ * arg: group, role
+ * ret: yes 1, no 0
+ *
+ */
+
+int my_pool_has_role(int group, int role)
+{
+    return (my_pool_role(group, role) == role);
+}
+
+/*
+ * fun: are all slaves of group lagging or behind client's write
+ * arg: group, gtid slave must have executed or NULL
+ * ret: yes 1, no 0
+ *
+ */
+
+static int my_pool_slave_lagging(int group, const char *gtid)
+{//都摘掉了读就发master，总比读到很旧的数据或者报错好
+    int i;
+    my_node_t *node;
+
+    for(i = 0; i < mypool->node_num; i++){
+        node = &(mypool->node[i]);
+        if( (node->role == MY_ROLE_SLAVE) && (node->group == group) && (!my_node_is_closing(node)) && (!node->lagging) && \
+                ((gtid == NULL) || gtid_set_contains(node->gtid_executed, gtid)) ){
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * fun: get a master or slave connection
+ * arg: connection, role, client ip, client port
+ * ret: success return mysql connection, error return NULL 
+ *
+ */
+
+my_conn_t *my_conn_get(void *c, int role, uint32_t ip, uint16_t port)
+{//ip:port  为客户端连接IP,端口，只有哈希策略用
+    my_node_t *node;
+    my_conn_t *my;
+    struct list_head *head;
+    int group = ((conn_t *)c)->group;
+    const char *gtid = ((conn_t *)c)->gtid[0] ? ((conn_t *)c)->gtid : NULL;
+
+    if( (role = my_pool_role(group, role)) == MY_ROLE_NONE ){
+        log(g_log, "no mysql register in group %d\n", group);
+        return NULL;
+    }
+    if( (role == MY_ROLE_SLAVE) && (mypool->role_count[group][MY_ROLE_MASTER] > 0) && my_pool_slave_lagging(group, gtid) ){
+        role = MY_ROLE_MASTER;
+    }
+
+    if( (node = my_node_select(role, group, (role == MY_ROLE_SLAVE) ? gtid : NULL, ip, port, 1)) == NULL ){//没找到`````
+        log(g_log, "no %s available in group %d, role_count:%d\n", role_name[role], group, mypool->role_count[group][role]);
+        return NULL;
+    }
+
+    my = my_conn_ctx_pick(node, (conn_t *)c);
+    my_conn_set_used(my, c);//将一个mysql连接标记为被使用了。也就是my->conn指向中间结构conn_t
+
+    return my;
+}
+
+/*
+ * fun: hash of mysql context that costs a round trip to switch
+ * arg: current db, session state
+ * ret: hash
+ *
+ */
+
+static uint64_t my_ctx_hash(const char *curdb, const sess_state_t *sess)
+{//库名和SET NAMES拼起来算，中间隔一个库名里不会有的'\0'
+    char key[64 + SESS_VALUE_LEN + 1];
+    const char *names;
+    int len, nlen = 0;
+
+    len = strnlen(curdb, 63);
+    memcpy(key, curdb, len);
+    key[len++] = '\0';
+
+    if( (names = sess_get(sess, "names")) != NULL ){
+        nlen = strnlen(names, SESS_VALUE_LEN - 1);
+        memcpy(key + len, names, nlen);
+    }
+
+    return mmhash64(key, len + nlen);
+}
+
+/*
+ * fun: pick idle connection of node for client
+ * arg: mysql node, connection
+ * ret: mysql connection
+ *
+ */
+
+static my_conn_t *my_conn_ctx_pick(my_node_t *node, conn_t *c)
+{//桶里库名和SET NAMES都一样的里面，会话变量全一样的最好；都没有就拿最近放回来的
+    uint64_t h;
+    const char *names, *have;
+    struct list_head *pos;
+    my_conn_t *my, *first, *best = NULL;
+
+    first = list_first_entry(&(node->avail_head), my_conn_t, link);
+    names = sess_get(&(c->sess), "names");
+    if( (c->curdb[0] == '\0') && (names == NULL) ){//客户端没选库也没改字符集，哪个连接都一样
+        return first;
+    }
+
+    h = my_ctx_hash(c->curdb, &(c->sess));
+    list_for_each(pos, &(node->ctx_head[h % MY_CTX_BUCKETS])){
+        my = list_entry(pos, my_conn_t, ctx_link);
+        if( (my->ctx_hash != h) || strcmp(my->ctx.curdb, c->curdb) ){
+            continue;
+        }
+        have = sess_get(&(my->ctx.sess), "names");
+        if( (names != NULL) && ((have == NULL) || strcmp(have, names)) ){
+            continue;
+        }
+        if(sess_diff(&(c->sess), &(my->ctx.sess), NULL, 0) == 0){
+            best = my;
+            break;
+        }
+        if(best == NULL){
+            best = my;
+        }
+    }
+
+    if(best == NULL){
+        node->ctx_miss++;
+        return first;
+    }
+
+    node->ctx_hit++;
+    if(first->ctx_hash != h){
+        node->ctx_saved++;
+    }
+
+    return best;
+}
+
+/*
+ * fun: wait for a master or slave connection
+ * arg: connection, role, client ip, client port
+ * ret: success 0, error -1
+ *
+ */
+
+int my_conn_wait(void *ptr, int role, uint32_t ip, uint16_t port)
+{//没有空闲连接时按选节点的策略挑一个节点排队，这个节点有连接放回来就直接交给队头
+    my_node_t *node;
+    conn_t *c = (conn_t *)ptr;
+    const char *gtid = c->gtid[0] ? c->gtid : NULL;
+
+    if( (role = my_pool_role(c->group, role)) == MY_ROLE_NONE ){
+        log(g_log, "no mysql register in group %d\n", c->group);
+        return -1;
+    }
+    if( (role == MY_ROLE_SLAVE) && (mypool->role_count[c->group][MY_ROLE_MASTER] > 0) && my_pool_slave_lagging(c->group, gtid) ){
+        role = MY_ROLE_MASTER;
+    }
+
+    if( (node = my_node_select(role, c->group, (role == MY_ROLE_SLAVE) ? gtid : NULL, ip, port, 0)) == NULL ){
+        log(g_log, "no %s available in group %d to wait, role_count:%d\n", \
+                    role_name[role], c->group, mypool->role_count[c->group][role]);
+        return -1;
+    }
+
+    if(node->wait_count >= g_conf.wait_queue_size){
+        node->wait_reject++;
+        log(g_log, "%s %s:%s wait queue full[%u]\n", role_name[node->role], node->host, node->srv, node->wait_count);
+        return -1;
+    }
+
+    conn_state_set_wait_mysql(c, &(node->wait_head));
+    c->wait_node = node;
+    c->wait_start = clock_ms();
+
+    node->wait_count++;
+    node->wait_total++;
+    if(node->wait_count > node->wait_peak){
+        node->wait_peak = node->wait_count;
+    }
+
+    if(node->wait_count > node->cur_connecting_cnt){//正在建的连接不够分给排队的，再建一个
+        my_node_increase_connection(node);
+    }
+
+    return 0;
+}
+
+/*
+ * fun: remove connection from wait queue
+ * arg: connection, is it timeout
+ * ret: always return 0
+ *
+ */
+
+int my_conn_wait_cancel(void *ptr, int timeout)
+{//没有在排队的直接返回，可以重复调用
+    conn_t *c = (conn_t *)ptr;
+    my_node_t *node = (my_node_t *)(c->wait_node);
+
+    if(node == NULL){
+        return 0;
+    }
+
+    list_del_init(&(c->link));
+    c->wait_node = NULL;
+    node->wait_count--;
+
+    if(timeout){
+        node->wait_timeout++;
+    }
+
+    return 0;
+}
+
+/*
+ * fun: hand avail mysql connection to first waiting connection
+ * arg: mysql connection
+ * ret: success 0, error -1
+ *
+ */
+
+static int my_conn_handoff(my_conn_t *my)
+{
+    uint64_t waited;
+    my_node_t *node = my->node;
+    conn_t *c;
+
+    c = list_first_entry(&(node->wait_head), conn_t, link);
+
+    waited = clock_ms() - c->wait_start;
+    node->wait_served++;
+    node->wait_ms += waited;
+    if(waited > node->wait_ms_peak){
+        node->wait_ms_peak = waited;
+    }
+
+    my_conn_wait_cancel(c, 0);
+    my_conn_set_used(my, c);
+    c->my = my;
+
+    debug(g_log, "conn:%u got mysql conn after wait %lums\n", c->connid, (unsigned long)waited);
+
+    return cli_wait_done(c);
+}
+
+/*
+ * fun: close mysql connection
+ * arg: mysql connection
+ * ret: success 0, error -1
+ *
+ */
+
+int my_conn_close(my_conn_t *my)
+{
+    int res;
+
+    my_conn_req_end(my, 0);
+
+    if(my->fd >= 0){
+        close_handler(my->fd);
+        my->fd = -1;
+    }
+
+    my->conn = NULL;
+    buf_reset(&(my->buf));
+    my_ctx_init(&(my->ctx));//重连上来是新会话，库名和SET过的变量都没了
+
+    my_conn_set_dead(my);
+
+    return 0;
+}
+
+/*
+ * fun: close mysql connection and set fail
+ * arg: mysql connection
+ * ret: success 0, error -1
+ *
+ */
+
+int my_conn_close_on_fail(my_conn_t *my)
+{
+    my_conn_node_fail(my);
+    my_conn_close(my);
+    my_conn_set_fail(my);
+
+    return 0;
+}
+
+/*
+ * fun: close mysql connection and release it
+ * arg: mysql connection
+ * ret: success 0, error -1
+ *
+ */
+
+static int my_conn_close_and_release(my_conn_t *my)
+{
+    my_conn_close(my);
+    my_conn_move(my, MY_CONN_NONE, 0);//需要release，所以移除
+    my_conn_release(my);
+
+    return 0;
+}
+
+/*
+ * fun: put mysql connection
+ * arg: mysql connection
+ * ret: success 0, error -1
+ *
+ */
+
+int my_conn_put(my_conn_t *my, int isupdatestatustime )
+{
+    int res = 0;
+    my_node_t *node = my->node;
+
+    if( (res = del_handler(my->fd)) < 0 ){
+        log(g_log, "del_handler error, ignore it\n");
+    } else {
+        ;//debug(g_log, "del_handler success\n");
+    }
+
+    //命令没回完客户端就走了，剩下的回复会发给下一个客户端；事务没结束的也不能给别人，都只能关掉
+    if( my_conn_ctx_is_dirty(my) || (my->req_start != 0) || \
+            (my->status & SERVER_STATUS_IN_TRANS) || (!(my->status & SERVER_STATUS_AUTOCOMMIT)) ){
+        my_conn_close(my);
+
+        return 0;
+    }
+
+    my_conn_set_avail(my, isupdatestatustime);
+
+    return 0;
+}
+
+/*
+ * fun: move mysql connection to list of state
+ * arg: mysql connection, MY_CONN_*, add to tail or head
+ * ret: void
+ *
+ */
+
+static void my_conn_move(my_conn_t *my, int state, int tail)
+{//换链表都走这里，每个链表的计数和全局可用连接数跟着改，统计的时候就不用数链表了
+    my_node_t *node = my->node;
+    struct list_head *head;
+
+    if(my->state != MY_CONN_NONE){
+        node->count[my->state]--;
+        if(my->state == MY_CONN_AVAIL){
+            mypool->avail_total--;
+            list_del_init(&(my->ctx_link));
+        }
+        if( (my->state == MY_CONN_USED) && (state != MY_CONN_USED) ){//算连接被占了多久
+            node->release_count++;
+            node->hold_us += clock_us() - my->used_start;
+        }
+    }
+
+    switch(state){
+        case MY_CONN_USED: head = &(node->used_head); break;
+        case MY_CONN_AVAIL: head = &(node->avail_head); break;
+        case MY_CONN_DEAD: head = &(node->dead_head); break;
+        case MY_CONN_RAW: head = &(node->raw_head); break;
+        case MY_CONN_FAIL: head = &(node->fail_head); break;
+        case MY_CONN_PING: head = &(node->ping_head); break;
+        default: head = NULL; break;
+    }
+
+    my->state = state;
+    if(head == NULL){
+        my->state = MY_CONN_NONE;
+        list_del_init(&(my->link));
+        return;
+    }
+
+    if(tail){
+        list_move_tail(&(my->link), head);
+    } else {
+        list_move(&(my->link), head);
+    }
+
+    node->count[state]++;
+    if(state == MY_CONN_AVAIL){//空闲的时候上下文不会变，放回来的时候算一次哈希
+        mypool->avail_total++;
+        my->ctx_hash = my_ctx_hash(my->ctx.curdb, &(my->ctx.sess));
+        if(tail){
+            list_add_tail(&(my->ctx_link), &(node->ctx_head[my->ctx_hash % MY_CTX_BUCKETS]));
+        } else {
+            list_add(&(my->ctx_link), &(node->ctx_head[my->ctx_hash % MY_CTX_BUCKETS]));
+        }
+    }
+    if( (state == MY_CONN_USED) && (node->count[state] > node->used_peak) ){
+        node->used_peak = node->count[state];
+    }
+}
+
+/*
+ * fun: set mysql connection used
+ * arg: mysql connection, connection pointer
+ * ret: success 0, error -1
+ *
+ */
+
+static int my_conn_set_used(my_conn_t *my, void *ptr)
+{//将一个mysql连接标记为被使用了。也就是my->conn指向中间结构conn_t，
+    int res = 0;
+    my_node_t *node = my->node;
+    my->conn = ptr;//指向中间结构conn_t
+    buf_reset(&(my->buf));
+
+    if(my->state != MY_CONN_USED){
+        my->used_start = clock_us();
+        node->acquire_count++;
+    }
+    my_conn_move(my, MY_CONN_USED, 1);//将我这个连接从之前的地方移除，然后挂到used_head上面
+    my->state_time = clock_sec();
+
+    if( (res = del_handler(my->fd)) < 0 ){//清楚，重新再来
+        log(g_log, "del_handler error, ignore it\n");
+    } else {
+        ;//debug(g_log, "del_handler success\n");
+    }
+
+    return 0;
+}
+
+/*
+ * fun: set mysql connection avail
+ * arg: mysql connection
+ * ret: success 0, error -1
+ *
+ */
+
+int my_conn_set_avail(my_conn_t *my, int isupdatestatustime )
+{//跟mysql直接的验证成功了，下面标记这个连接为可用的,放入node的avail_head上面
+    int res = 0;
+    my_node_t *node = my->node;
+
+    my->conn = NULL;
+    buf_reset(&(my->buf));
+
+    my->state_time = clock_sec();
+    my->alive_time = clock_sec();
+    my->retry_count = 0;
+
+    //空闲链表按客户端用的时间排：头上是刚用过的，分连接从头上拿(LIFO)，少数热的连接就够用了
+    //ping回来的还是最冷的，放回尾巴上，ping和回收都只从尾巴上看
+	if( 1 == isupdatestatustime){
+		my->lastused_time = clock_sec() ;//更新一下这个值，用来标记这个连接空等了多久 
+		my_conn_move(my, MY_CONN_AVAIL, 0);
+	}
+	else {
+		my_conn_move(my, MY_CONN_AVAIL, 1);
+	}
+
+    if( (!list_empty(&(node->wait_head))) && (!my_node_is_closing(node)) ){//有客户端在排队，直接交给队头
+        my_conn_handoff(my);
+    }
+
+    return 0;
+}
+
+/*
+ * fun: set mysql connection dead 
+ * arg: mysql connection
+ * ret: success 0, error -1
+ *
+ */
+
+static int my_conn_set_dead(my_conn_t *my)
+{
+    int res = 0;
+    my_node_t *node = my->node;
+
+    my->conn = NULL;
+    buf_reset(&(my->buf));
+
+    my_conn_move(my, MY_CONN_DEAD, 1);
+    my->state_time = clock_sec();
+    my->retry_at = clock_ms() + my_backoff(my->retry_count);
+
+    return 0;
+}
+
+/*
+ * fun: set mysql connection raw 
+ * arg: mysql connection
+ * ret: success 0, error -1
+ *
+ */
+
+static int my_conn_set_raw(my_conn_t *my)
+{
+    int res = 0;
+    my_node_t *node = my->node;
+
+    my->conn = NULL;
     buf_reset(&(my->buf));
 
-    list_move_tail(&(my->link), &(node->raw_head));
-    my->state_time = time(NULL);
-	node->avail_count--;//减少可用连接数
+    my_conn_move(my, MY_CONN_RAW, 1);
+    my->state_time = clock_sec();
 
     return 0;
 }
@@ -701,9 +1744,10 @@ static int my_conn_set_fail(my_conn_t *my)
     int res = 0;
     my_node_t *node = my->node;
 
-    list_move_tail(&(my->link), &(node->fail_head));
-    my->state_time = time(NULL);
-	node->avail_count--;//减少可用连接数
+    my_conn_move(my, MY_CONN_FAIL, 1);
+    my->state_time = clock_sec();
+    my->retry_count++;//连续失败的越等越久
+    my->retry_at = clock_ms() + my_backoff(my->retry_count);
 
     return 0;
 }
@@ -723,13 +1767,52 @@ static int my_conn_set_ping(my_conn_t *my)
     my->conn = NULL;
     buf_reset(&(my->buf));
 
-    list_move_tail(&(my->link), &(node->ping_head));
-    my->state_time = time(NULL);
-	node->avail_count--;//减少可用连接数
+    my_conn_move(my, MY_CONN_PING, 1);
+    my->state_time = clock_sec();
 
     return 0;
 }
 
+/*
+ * fun: reconnect dead or fail connections of node
+ * arg: mysql node, list head, max connection to be processed
+ * ret: connections started
+ *
+ */
+
+static int my_node_reconnect(my_node_t *node, struct list_head *head, int max)
+{//只连到了重试时间的，熔断的节点不连，半开的只放一个去试，再受全局限速
+    int count = 0;
+    my_conn_t *my;
+    struct list_head *pos, *n;
+    uint64_t now = clock_ms();
+
+    list_for_each_safe(pos, n, head){
+        my = list_entry(pos, my_conn_t, link);
+        if(my->retry_at > now){
+            continue;
+        }
+        if(count >= max){
+            break;
+        }
+        if(!my_connect_token(0)){
+            break;
+        }
+        if(!my_node_allow_connect(node)){
+            break;
+        }
+        my_connect_token(1);
+
+        my_conn_move(my, MY_CONN_NONE, 0);
+        if( make_my_conn(my) < 0 ){
+            log(g_log, "make_my_conn error\n");
+        }
+        count++;
+    }
+
+    return count;
+}
+
 /*
  * fun: dead reconnect timer
  * arg: max connection to be processed
@@ -739,24 +1822,15 @@ static int my_conn_set_ping(my_conn_t *my)
 
 static int my_conn_dead_reconnect_timer(unsigned long arg)
 {//扫描每一个机器的mysql连接dead_head链表，将里面死掉的连接恢复
-    int i, res = 0;
+    int i;
     my_node_t *node;
-    my_conn_t *my;
-    struct list_head *head, *pos, *n;
 
-    for(i = 0; i < mypool->slave_num; i++){
-        node = &(mypool->slave[i]);
+    for(i = 0; i < mypool->node_num; i++){
+        node = &(mypool->node[i]);
         if(my_node_is_closing(node)){
             continue;
         }
-        head = &(node->dead_head);
-        list_for_each_safe(pos, n, head){
-            my = list_entry(pos, my_conn_t, link);
-            list_del_init(pos);
-            if( (res = make_my_conn(my)) < 0 ){
-                log(g_log, "make_my_conn error\n");
-            }
-        }
+        my_node_reconnect(node, &(node->dead_head), arg);
     }
 
     return 0;
@@ -770,29 +1844,30 @@ static int my_conn_dead_reconnect_timer(unsigned long arg)
  */
 
 static int my_conn_fail_reconnect_timer(unsigned long arg)
-{
-    int i, res = 0, count;
+{//熔断时间到了又没有死连接可以拿来试的，关掉一个最冷的空闲连接让它去试
+    int i;
     my_node_t *node;
     my_conn_t *my;
-    struct list_head *head, *pos, *n;
 
-    for(i = 0; i < mypool->slave_num; i++){
-        count = 0;
-        node = &(mypool->slave[i]);
+    for(i = 0; i < mypool->node_num; i++){
+        node = &(mypool->node[i]);
         if(my_node_is_closing(node)){
             continue;
         }
-        head = &(node->fail_head);
-        list_for_each_safe(pos, n, head){
-            if(count++ >= arg){
-                break;
-            }
-            my = list_entry(pos, my_conn_t, link);
-            list_del_init(pos);
-            if( (res = make_my_conn(my)) < 0 ){
-                log(g_log, "make_my_conn error\n");
+
+        if( (node->breaker == BREAKER_OPEN) && (clock_ms() >= node->open_until) && \
+                (node->count[MY_CONN_DEAD] + node->count[MY_CONN_FAIL] == 0) && \
+                (node->cur_connecting_cnt == 0) ){
+            if(!list_empty(&(node->avail_head))){
+                my = list_last_entry(&(node->avail_head), my_conn_t, link);
+                my_conn_close(my);
+                my->retry_at = 0;
+            } else {
+                my_node_increase_connection(node);
             }
         }
+
+        my_node_reconnect(node, &(node->fail_head), arg);
     }
 
     return 0;
@@ -807,105 +1882,172 @@ static int my_conn_fail_reconnect_timer(unsigned long arg)
 
 static int my_conn_pool_status_timer(unsigned long arg)
 {
-    int i, count1, count2, count3, count4, count5, count6;
+    int i;
+    char addr[INET6_ADDRSTRLEN];
+    my_node_t *node;
+
+    for(i = 0; i < mypool->node_num; i++){
+        node = &(mypool->node[i]);
+        if(my_node_is_closing(node)){
+            continue;
+        }
+
+        log(g_log, \
+            "%s %s:%s used:%u free:%u dead:%u raw:%u fail:%u ping:%u\n", \
+                   role_name[node->role], node->host, node->srv, node->count[MY_CONN_USED], node->count[MY_CONN_AVAIL], \
+                   node->count[MY_CONN_DEAD], node->count[MY_CONN_RAW], node->count[MY_CONN_FAIL], \
+                   node->count[MY_CONN_PING]);
+
+        log(g_log, \
+            "%s %s:%s target:%d actual:%d connecting:%u demand:%lu.%02lu min:%d max:%d\n", \
+                   role_name[node->role], node->host, node->srv, node->target, node->curall_connection, node->cur_connecting_cnt, \
+                   node->demand / 100, node->demand % 100, node->min_connection, node->max_connection);
+
+        log(g_log, \
+            "%s %s:%s wait:%u peak:%u total:%lu served:%lu timeout:%lu reject:%lu avg:%lums max:%lums\n", \
+                   role_name[node->role], node->host, node->srv, node->wait_count, node->wait_peak, node->wait_total, \
+                   node->wait_served, node->wait_timeout, node->wait_reject, \
+                   node->wait_served ? node->wait_ms / node->wait_served : 0, node->wait_ms_peak);
+        node->wait_peak = node->wait_count;
+        node->wait_ms_peak = 0;
+
+        log(g_log, \
+            "%s %s:%s breaker:%s fail:%u opens:%lu backoff:%dms throttled:%lu lag:%d lagging:%d outs:%lu\n", \
+                   role_name[node->role], node->host, node->srv, breaker_name[node->breaker], node->fail_streak, \
+                   node->breaker_opens, node->backoff, mypool->connect_throttled, \
+                   node->lag, node->lagging, node->lag_outs);
+
+        log(g_log, \
+            "%s %s:%s ctx_hit:%lu ctx_miss:%lu hit_rate:%lu%% init_db_saved:%lu\n", \
+                   role_name[node->role], node->host, node->srv, node->ctx_hit, node->ctx_miss, \
+                   (node->ctx_hit + node->ctx_miss) ? node->ctx_hit * 100 / (node->ctx_hit + node->ctx_miss) : 0, \
+                   node->ctx_saved);
+
+        if(node->addr.ss_family == AF_INET6){
+            inet_ntop(AF_INET6, &(((struct sockaddr_in6 *)&(node->addr))->sin6_addr), addr, sizeof(addr));
+        } else {
+            inet_ntop(AF_INET, &(((struct sockaddr_in *)&(node->addr))->sin_addr), addr, sizeof(addr));
+        }
+        log(g_log, \
+            "%s %s:%s addr:%s changes:%lu connect:%lu avg:%luus max:%luus\n", \
+                   role_name[node->role], node->host, node->srv, node->addrlen ? addr : "-", node->resolve_changes, \
+                   node->connect_count, node->connect_count ? (unsigned long)(node->connect_us / node->connect_count) : 0, \
+                   (unsigned long)node->connect_us_peak);
+        node->connect_us_peak = 0;
+
+        log(g_log, \
+            "%s %s:%s group:%d policy:%s weight:%d outstanding:%u ewma:%luus cost:%lu req:%lu pick:%lu\n", \
+                   role_name[node->role], node->host, node->srv, node->group, policy_name[mypool->policy], node->weight, node->outstanding, \
+                   (unsigned long)node->ewma_us, (unsigned long)my_node_cost(node, clock_us()), \
+                   node->req_count, node->pick_count);
+    }
+
+    return 0;
+}
+
+/*
+ * fun: ping timer
+ * arg: max connection to be processed
+ * ret: success 0, error -1
+ *
+ */
+
+static int my_conn_pool_ping_timer(unsigned long arg)
+{//从最冷的一头往回看，只ping空闲快到wait_timeout的；碰到最近用过的就停，后面的更热
+    int i, res = 0, count;
     my_node_t *node;
     my_conn_t *my;
     struct list_head *head, *pos, *n;
-    conn_t *c;
+    time_t now = clock_sec(), keep;
 
-    for(i = 0; i < mypool->slave_num; i++){
-        count1 = count2 = count3 = count4 = count5 = count6 = 0;
-        node = &(mypool->slave[i]);
+    for(i = 0; i < mypool->node_num; i++){
+        count = 0;
+        node = &(mypool->node[i]);
         if(my_node_is_closing(node)){
             continue;
         }
-
-        head = &(node->used_head);
-        list_for_each_safe(pos, n, head){
+        head = &(node->avail_head);
+        list_for_each_prev_safe(pos, n, head){
             my = list_entry(pos, my_conn_t, link);
-            c = my->conn;
-            if(c != NULL){
-                debug(g_log, "connid: %d\n", c->connid);
-            } else {
-                debug(g_log, "no connect attach\n");
+            keep = my->wait_timeout * 3 / 4;
+            if(now - my->lastused_time < keep){
+                break;
+            }
+            if(now - my->alive_time < keep){
+                continue;
+            }
+            if(count++ >= arg){//一次最多允许ping这么多个连接
+                break;
             }
-            count1++;
-        }
 
-        head = &(node->avail_head);
-        list_for_each_safe(pos, n, head){
-            count2++;
-        }
+            if( (res = my_conn_set_ping(my)) < 0 ){
+                log(g_log, "my_conn_set_ping error\n");
+            }
 
-        head = &(node->dead_head);
-        list_for_each_safe(pos, n, head){
-            count3++;
+            my_ping_prepare(my);
         }
+    }
 
-        head = &(node->raw_head);
-        list_for_each_safe(pos, n, head){
-            count4++;
-        }
+    return 0;
+}
 
-        head = &(node->fail_head);
-        list_for_each_safe(pos, n, head){
-            count5++;
-        }
+/*
+ * fun: replication lag check timer
+ * arg: not used
+ * ret: success 0, error -1
+ *
+ */
 
-        head = &(node->ping_head);
-        list_for_each_safe(pos, n, head){
-            count6++;
+static int my_conn_pool_lag_timer(unsigned long arg)
+{//每个slave拿最冷的一个空闲连接去查，走ping的链表，超时也按ping算；没有空闲的下一秒再试
+    int i;
+    my_node_t *node;
+    my_conn_t *my;
+    time_t now = clock_sec();
+
+    for(i = 0; i < mypool->node_num; i++){
+        node = &(mypool->node[i]);
+        if( (node->role != MY_ROLE_SLAVE) || my_node_is_closing(node) || \
+                (now - node->lag_time < g_conf.lag_check_interval) ){
+            continue;
+        }
+        if(list_empty(&(node->avail_head))){
+            continue;
         }
 
-        log(g_log, \
-            "slave %s:%s used:%d free:%d dead:%d raw:%d fail:%d ping:%d\n", \
-                   node->host, node->srv, count1, count2, count3, count4, count5, count6);
+        my = list_last_entry(&(node->avail_head), my_conn_t, link);
+        my_conn_set_ping(my);
+        node->lag_time = now;
+
+        if(my_lag_prepare(my) < 0){
+            my_conn_close_on_fail(my);
+        }
     }
 
     return 0;
 }
 
 /*
- * fun: ping timer
- * arg: max connection to be processed
- * ret: success 0, error -1
+ * fun: got replication lag of slave
+ * arg: mysql connection, lag seconds, -1 replication stopped
+ * ret: void
  *
  */
 
-static int my_conn_pool_ping_timer(unsigned long arg)
-{
-    int i, res = 0, count;
-    my_node_t *node;
-    my_conn_t *my;
-    struct list_head *head, *pos, *n;
-	size_t now = time(NULL);
-    for(i = 0; i < mypool->slave_num; i++){
-        count = 0;
-        node = &(mypool->slave[i]);
-        if(my_node_is_closing(node)){
-            continue;
-        }
-        head = &(node->avail_head);
-        list_for_each_safe(pos, n, head){
-            my = list_entry(pos, my_conn_t, link);
-			if( now - my->lastused_time < 30 || node->curall_connection <= node->min_connection ){
-				if(count++ >= arg){//一次最多允许ping这么多个连接
-					break;
-				}
-				if( (res = my_conn_set_ping(my)) < 0 ){
-					log(g_log, "my_conn_set_ping error\n");
-				}
-
-				my_ping_prepare(my);
-			}else { 
-				//需要释放这个连接,因为他太久没有活动过了
-				my_conn_close_and_release( my) ;
-				info( g_log, "my_conn_pool_ping_timer connection idle for a long time, called my_conn_close_and_release\n") ;
-			}
-		}
-    }
+void my_conn_node_lag(my_conn_t *my, int lag)
+{//超过lag_max摘掉，降到lag_recover以内才加回来，中间不动，免得在阈值附近来回摘
+    my_node_t *node = my->node;
 
-    return 0;
+    node->lag = lag;
+
+    if( (!node->lagging) && ((lag < 0) || (lag > g_conf.lag_max)) ){
+        node->lagging = 1;
+        node->lag_outs++;
+        log(g_log, "%s %s:%s lag %d, stop reading from it\n", role_name[node->role], node->host, node->srv, lag);
+    } else if( node->lagging && (lag >= 0) && (lag <= g_conf.lag_recover) ){
+        node->lagging = 0;
+        log(g_log, "%s %s:%s lag %d, back to reading\n", role_name[node->role], node->host, node->srv, lag);
+    }
 }
 
 /*
@@ -921,11 +2063,11 @@ static int my_conn_pool_ping_timeout_timer(unsigned long arg)
     my_node_t *node;
     my_conn_t *my;
     struct list_head *head, *pos, *n;
-    time_t now = time(NULL);
+    time_t now = clock_sec();
 
-    for(i = 0; i < mypool->slave_num; i++){
+    for(i = 0; i < mypool->node_num; i++){
         count = 0;
-        node = &(mypool->slave[i]);
+        node = &(mypool->node[i]);
         if(my_node_is_closing(node)){
             continue;
         }
@@ -947,6 +2089,90 @@ static int my_conn_pool_ping_timeout_timer(unsigned long arg)
     return 0;
 }
 
+/*
+ * fun: size each node's pool from demand
+ * arg: not used
+ * ret: always return 0
+ *
+ */
+
+static int my_pool_scale_timer(unsigned long arg)
+{//需求=到达率x占用时长(Little定律)，跟这一秒同时在用的峰值取大的，再加上排队的
+ //需求涨了马上跟上，一次最多建max_connecting个；降了要持续pool_shrink_delay才关空闲连接
+    int i, need;
+    unsigned long demand;
+    uint64_t now = clock_us(), dt;
+    my_node_t *node;
+    my_conn_t *my;
+
+    for(i = 0; i < mypool->node_num; i++){
+        node = &(mypool->node[i]);
+        if( (node->role == MY_ROLE_NONE) || my_node_is_closing(node) ){
+            continue;
+        }
+
+        dt = now - node->scale_time;
+        if(dt == 0){
+            continue;
+        }
+
+        demand = 0;
+        if(node->release_count > 0){
+            demand = (unsigned long)(node->acquire_count * (node->hold_us / node->release_count) * 100 / dt);
+        }
+        if(demand < node->used_peak * 100UL){
+            demand = node->used_peak * 100UL;
+        }
+        demand += node->wait_count * 100UL;
+
+        if(demand < node->demand * 3 / 4){//落得慢，流量抖一下不会马上缩
+            demand = node->demand * 3 / 4;
+        }
+        node->demand = demand;
+
+        node->target = (demand * (100 + g_conf.pool_headroom) + 9999) / 10000;
+        if(node->target < node->min_connection){
+            node->target = node->min_connection;
+        }
+        if(node->target > node->max_connection){
+            node->target = node->max_connection;
+        }
+
+        node->acquire_count = 0;
+        node->release_count = 0;
+        node->hold_us = 0;
+        node->used_peak = node->count[MY_CONN_USED];
+        node->scale_time = now;
+
+        if(node->curall_connection < node->target){
+            node->below_since = 0;
+            need = node->target - node->curall_connection - node->cur_connecting_cnt;
+            while( (need-- > 0) && (my_node_increase_connection(node) == 0) ){
+                ;
+            }
+        } else if(node->curall_connection > node->target){
+            if(node->below_since == 0){
+                node->below_since = clock_ms();
+            } else if(clock_ms() - node->below_since >= (uint64_t)g_conf.pool_shrink_delay){
+                need = node->curall_connection - node->target;
+                if(need > g_conf.max_connecting){//关也一批批来
+                    need = g_conf.max_connecting;
+                }
+                while( (need-- > 0) && (!list_empty(&(node->avail_head))) ){//从最冷的关
+                    my = list_last_entry(&(node->avail_head), my_conn_t, link);
+                    my_conn_close_and_release(my);
+                }
+                info(g_log, "%s %s:%s shrink to %d target %d\n", role_name[node->role], node->host, node->srv, \
+                        node->curall_connection, node->target);
+            }
+        } else {
+            node->below_since = 0;
+        }
+    }
+
+    return 0;
+}
+
 /*
  * fun: cleanup closing node
  * arg: mysql node
@@ -999,7 +2225,16 @@ static int my_node_closing_cleanup(my_node_t *node)
         my_conn_close_and_release(my);
     }
 
-    node->role = 0;
+    head = &(node->wait_head);
+    while(!list_empty(head)){//还在排队的客户端回复错误
+        c = list_first_entry(head, conn_t, link);
+        cli_wait_fail(c);
+    }
+
+    my_node_resolve_cancel(node);
+
+    mypool->role_count[node->group][node->role]--;
+    node->role = MY_ROLE_NONE;
 
     return 0;
 }
@@ -1015,23 +2250,221 @@ static int my_node_closing_cleanup_timer(unsigned long arg)
 {
     int i, num;
     my_node_t *node;
-    time_t now = time(NULL);
+    time_t now = clock_sec();
 
-    num = mypool->slave_num;
-    for(i = 0; i < mypool->slave_num; i++){
-        node = &(mypool->slave[i]);
+    num = mypool->node_num;
+    for(i = 0; i < mypool->node_num; i++){
+        node = &(mypool->node[i]);
         if( (my_node_is_closing(node)) && \
-            (node->role != 0) && \
+            (node->role != MY_ROLE_NONE) && \
             (now - node->closing_time > MY_NODE_CLOSING_DELAY) ){
+            log(g_log, "%s %s:%s connection cleanup\n", \
+                                                role_name[node->role], node->host, node->srv);
             my_node_closing_cleanup(node);
-            log(g_log, "slave %s:%s connection cleanup\n", \
-                                                node->host, node->srv);
         }
     }
 
     return 0;
 }
 
+/*
+ * fun: resolve mysql node address when registered
+ * arg: mysql node
+ * ret: success 0, error -1
+ *
+ */
+
+static int my_node_resolve(my_node_t *node)
+{//只在注册的时候查一次，以后建连接都用这个地址；host是IP的不用查DNS，不会阻塞
+    int ret;
+    struct addrinfo hints, *res;
+
+    bzero(&hints, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST;
+
+    if( (ret = getaddrinfo(node->host, node->srv, &hints, &res)) == 0 ){
+        node->numeric = 1;
+    } else {
+        hints.ai_flags = 0;
+        if( (ret = getaddrinfo(node->host, node->srv, &hints, &res)) != 0 ){
+            log(g_log, "%s:%s resolve error: %s\n", node->host, node->srv, gai_strerror(ret));
+            return -1;
+        }
+    }
+
+    my_node_set_addr(node, res);
+    node->resolve_time = clock_sec();
+    freeaddrinfo(res);
+
+    return 0;
+}
+
+/*
+ * fun: set resolved address of mysql node
+ * arg: mysql node, resolve result
+ * ret: void
+ *
+ */
+
+static void my_node_set_addr(my_node_t *node, const struct addrinfo *res)
+{//跟原来一样只用第一个地址，已经建好的连接不动，新连接连新地址
+    if( (node->addrlen > 0) && \
+        ((node->addrlen != res->ai_addrlen) || memcmp(&(node->addr), res->ai_addr, res->ai_addrlen)) ){
+        log(g_log, "%s %s:%s address changed\n", role_name[node->role], node->host, node->srv);
+        node->resolve_changes++;
+    }
+
+    memcpy(&(node->addr), res->ai_addr, res->ai_addrlen);
+    node->addrlen = res->ai_addrlen;
+}
+
+/*
+ * fun: start resolving mysql node address in background
+ * arg: mysql node
+ * ret: success 0, error -1
+ *
+ */
+
+static int my_node_resolve_start(my_node_t *node)
+{
+    int ret;
+    my_resolve_t *r;
+
+    if( (r = calloc(1, sizeof(my_resolve_t))) == NULL ){
+        log_err(g_log, "calloc my_resolve_t error\n");
+        return -1;
+    }
+
+    strncpy(r->host, node->host, sizeof(r->host) - 1);
+    strncpy(r->srv, node->srv, sizeof(r->srv) - 1);
+    r->hints.ai_family = AF_UNSPEC;
+    r->hints.ai_socktype = SOCK_STREAM;
+    r->cb.ar_name = r->host;
+    r->cb.ar_service = r->srv;
+    r->cb.ar_request = &(r->hints);
+    r->list[0] = &(r->cb);
+
+    if( (ret = getaddrinfo_a(GAI_NOWAIT, r->list, 1, NULL)) != 0 ){
+        log(g_log, "%s:%s getaddrinfo_a error: %s\n", node->host, node->srv, gai_strerror(ret));
+        free(r);
+        node->resolve_time = clock_sec();
+        return -1;
+    }
+
+    node->resolving = r;
+
+    return 0;
+}
+
+/*
+ * fun: check background resolving of mysql node
+ * arg: mysql node
+ * ret: void
+ *
+ */
+
+static void my_node_resolve_check(my_node_t *node)
+{//解析失败了接着用原来的地址
+    int ret;
+    my_resolve_t *r = node->resolving;
+
+    if( (ret = gai_error(&(r->cb))) == EAI_INPROGRESS ){
+        return;
+    }
+
+    if( (ret == 0) && (r->cb.ar_result != NULL) ){
+        my_node_set_addr(node, r->cb.ar_result);
+        freeaddrinfo(r->cb.ar_result);
+    } else {
+        log(g_log, "%s %s:%s resolve error: %s\n", role_name[node->role], node->host, node->srv, gai_strerror(ret));
+    }
+
+    free(r);
+    node->resolving = NULL;
+    node->resolve_time = clock_sec();
+}
+
+/*
+ * fun: cancel background resolving of mysql node
+ * arg: mysql node
+ * ret: void
+ *
+ */
+
+static void my_node_resolve_cancel(my_node_t *node)
+{//已经在查的取消不了，只能等它查完再释放，只有节点下线和退出的时候才会走到这里
+    my_resolve_t *r = node->resolving;
+
+    if(r == NULL){
+        return;
+    }
+
+    if(gai_cancel(&(r->cb)) == EAI_NOTCANCELED){
+        while(gai_error(&(r->cb)) == EAI_INPROGRESS){
+            gai_suspend((const struct gaicb * const *)r->list, 1, NULL);
+        }
+    }
+
+    if( (gai_error(&(r->cb)) == 0) && (r->cb.ar_result != NULL) ){
+        freeaddrinfo(r->cb.ar_result);
+    }
+
+    free(r);
+    node->resolving = NULL;
+}
+
+/*
+ * fun: resolve mysql node address again in background timer
+ * arg: not used
+ * ret: always return 0
+ *
+ */
+
+static int my_node_resolve_timer(unsigned long arg)
+{//过了resolve_ttl、reload或者熔断以后重新解析，还没解析出来的每秒试一次
+    int i;
+    my_node_t *node;
+    time_t now = clock_sec();
+
+    for(i = 0; i < mypool->node_num; i++){
+        node = &(mypool->node[i]);
+        if( (node->role == MY_ROLE_NONE) || my_node_is_closing(node) || node->numeric ){
+            continue;
+        }
+
+        if(node->resolving != NULL){
+            my_node_resolve_check(node);
+        } else if( (node->addrlen == 0) || (node->resolve_time == 0) || \
+                    (g_conf.resolve_ttl && (now - node->resolve_time >= g_conf.resolve_ttl)) ){
+            my_node_resolve_start(node);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * fun: resolve all mysql nodes again, called on reload
+ * arg:
+ * ret: void
+ *
+ */
+
+void my_pool_resolve_all(void)
+{
+    int i;
+    my_node_t *node;
+
+    for(i = 0; i < mypool->node_num; i++){
+        node = &(mypool->node[i]);
+        if( (node->role != MY_ROLE_NONE) && (!node->numeric) ){
+            node->resolve_time = 0;
+        }
+    }
+}
+
 /*
  * fun: set mysql connection context dirty
  * arg: mysql connection
@@ -1071,61 +2504,200 @@ int my_conn_ctx_is_dirty(my_conn_t *my)
 
 int my_pool_have_conn(void)
 {//这里其实是说服务器有没有跟mysql直接的可用连接 
+    return mypool->avail_total > 0;
+}
+
+/*
+ * fun: get mysql connection counters of all nodes
+ * arg: total, used, avail and connecting connection number
+ * ret: always return 0
+ *
+ */
+
+int my_pool_stat(unsigned long *total, unsigned long *used, unsigned long *avail, unsigned long *connecting, \
+                        unsigned long *target)
+{
     int i;
     my_node_t *node;
 
-    for(i = 0; i < mypool->slave_num; i++){
-        node = &(mypool->slave[i]);
-        if(node->avail_count > 0){
-            return 1;
+    *total = *used = *avail = *connecting = *target = 0;
+
+    for(i = 0; i < mypool->node_num; i++){
+        node = &(mypool->node[i]);
+        if(node->role == MY_ROLE_NONE){
+            continue;
         }
+
+        *total += node->curall_connection;
+        *avail += node->count[MY_CONN_AVAIL];
+        *connecting += node->cur_connecting_cnt;
+        *used += node->count[MY_CONN_USED];
+        *target += node->target;
     }
 
     return 0;
 }
 
-int my_try_increase_connection( )
-{//ip:port  为客户端连接IP,端口
-    int i, index;
+/*
+ * fun: get wait queue counters of all nodes
+ * arg: waiting now, total waited, served, timeout, rejected, total wait milliseconds
+ * ret: always return 0
+ *
+ */
+
+int my_pool_wait_stat(unsigned long *cur, unsigned long *total, unsigned long *served, \
+                        unsigned long *timeout, unsigned long *reject, unsigned long *ms)
+{
+    int i;
+    my_node_t *node;
+
+    *cur = *total = *served = *timeout = *reject = *ms = 0;
+
+    for(i = 0; i < mypool->node_num; i++){
+        node = &(mypool->node[i]);
+        if(node->role == MY_ROLE_NONE){
+            continue;
+        }
+
+        *cur += node->wait_count;
+        *total += node->wait_total;
+        *served += node->wait_served;
+        *timeout += node->wait_timeout;
+        *reject += node->wait_reject;
+        *ms += node->wait_ms;
+    }
+
+    return 0;
+}
+
+/*
+ * fun: get counters of picking idle connection by context of all nodes
+ * arg: hit, miss, hits that saved a use db or session replay
+ * ret: always return 0
+ *
+ */
+
+int my_pool_ctx_stat(unsigned long *hit, unsigned long *miss, unsigned long *saved)
+{
+    int i;
+    my_node_t *node;
+
+    *hit = *miss = *saved = 0;
+
+    for(i = 0; i < mypool->node_num; i++){
+        node = &(mypool->node[i]);
+        if(node->role == MY_ROLE_NONE){
+            continue;
+        }
+
+        *hit += node->ctx_hit;
+        *miss += node->ctx_miss;
+        *saved += node->ctx_saved;
+    }
+
+    return 0;
+}
+
+/*
+ * fun: get connect latency counters of this thread
+ * arg: connections authorized, total microseconds from connect to authorized
+ * ret: always return 0
+ *
+ */
+
+int my_pool_connect_stat(unsigned long *count, unsigned long *us)
+{
+    int i;
     my_node_t *node;
+
+    *count = *us = 0;
+
+    for(i = 0; i < mypool->node_num; i++){
+        node = &(mypool->node[i]);
+        if(node->role == MY_ROLE_NONE){
+            continue;
+        }
+
+        *count += node->connect_count;
+        *us += node->connect_us;
+    }
+
+    return 0;
+}
+
+/*
+ * fun: start one more connection to mysql node
+ * arg: mysql node
+ * ret: success 0, error -1
+ *
+ */
+
+static int my_node_increase_connection(my_node_t *node)
+{
     my_conn_t *my;
-    struct list_head *head;
-    time_t now = time(NULL);
-	int res ;
 
-    if(mypool->slave_num == 0){
-        log(g_log, "no slave register\n");
+    if( node->cur_connecting_cnt >= g_conf.max_connecting ){
+        info(g_log, "cur_connecting_cnt of %s:%s reach %d, ignore this time.\n", node->host, node->srv, g_conf.max_connecting );
         return -1;
     }
 
-    for(i = 0; i < mypool->slave_num; i++){
-        index = (now + i) % (mypool->slave_num);
-		//一个个slave找，注意这里是先找第一个mysql,再找第二个
-        node = &( mypool->slave[index] );
-		int maxinflightconn = 10 ;
-		if( node->cur_connecting_cnt > maxinflightconn ){//本来就有时间戳进行随机，这里不判断这个了，轮到谁就谁来
-			info(g_log, "cur_connecting_cnt of %s:%s is not %d, ignore this time.\n", node->host, node->srv, maxinflightconn );
-			continue ;
+    if( my_node_is_closing(node) || (node->curall_connection >= node->max_connection) ){
+        return -1;
+    }
 
-		} else if( (!my_node_is_closing(node)) && node->curall_connection < node->max_connection  ){
-			if( (my = my_conn_alloc(node)) == NULL ){//申请一个mysql 连接结构，初始化
-				log(g_log, "my_conn_alloc error\n");
-				continue ;
-			}
+    if( (!my_connect_token(0)) || (!my_node_allow_connect(node)) ){//限速了或者熔断了
+        return -1;
+    }
+    my_connect_token(1);
 
-			if( (res = make_my_conn(my)) < 0 ){
-				log(g_log, "make my conn error in my_try_increase_connection, ignore, continue next.\n");
-				continue ;
-			}
-			break ;//新连接启动了，连接成功后会挂到avaliable连接上面
-        }
+    if( (my = my_conn_alloc(node)) == NULL ){//申请一个mysql 连接结构，初始化
+        log(g_log, "my_conn_alloc error\n");
+        return -1;
     }
 
-    if(i == mypool->slave_num){//没找到`````
-        log(g_log, "my_try_increase_connection failed. no slave available, slave_num:%d\n", mypool->slave_num );
-        return -2;
+    if( make_my_conn(my) < 0 ){
+        log(g_log, "make my conn error in my_node_increase_connection\n");
+        return -1;
     }
 
+    return 0;//新连接启动了，连接成功后会挂到avaliable连接上面
+}
 
-    return 0;
+int my_try_increase_connection( )
+{//按权重分连接，先给连接数除以权重最小的节点加，加不了再试下一个
+    int i, n, tried[MAX_MY_NODE];
+    my_node_t *node, *best;
+
+    if(mypool->node_num == 0){
+        log(g_log, "no mysql register\n");
+        return -1;
+    }
+
+    bzero(tried, sizeof(tried));
+    for(n = 0; n < mypool->node_num; n++){
+        best = NULL;
+        for(i = 0; i < mypool->node_num; i++){
+            node = &( mypool->node[i] );
+            if( tried[i] || (node->role == MY_ROLE_NONE) || (node->weight <= 0) ){
+                continue;
+            }
+            if( (best == NULL) || \
+                    ((long)node->curall_connection * best->weight < (long)best->curall_connection * node->weight) ){
+                best = node;
+            }
+        }
+
+        if(best == NULL){
+            break;
+        }
+
+        if(my_node_increase_connection(best) == 0){
+            return 0;
+        }
+        tried[best - mypool->node] = 1;
+    }
+
+    log(g_log, "my_try_increase_connection failed. no mysql available, node_num:%d\n", mypool->node_num );
+
+    return -2;
 }
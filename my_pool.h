@@ -4,36 +4,58 @@
 #include <time.h>
 #include <list.h>
 #include <stdint.h>
+#include <sys/socket.h>
 #include "my_buf.h"
+#include "my_sess.h"
 #include "def.h"
 
+#define MY_CTX_BUCKETS 64//每个节点的空闲连接按库名和SET NAMES分几个桶
+
+enum{//mysql连接在节点的哪个链表上
+    MY_CONN_NONE = 0,//不在链表上，比如正在重连
+    MY_CONN_USED,
+    MY_CONN_AVAIL,
+    MY_CONN_DEAD,
+    MY_CONN_RAW,
+    MY_CONN_FAIL,
+    MY_CONN_PING,
+    MY_CONN_STATE_MAX,
+};
 
 typedef struct{
     uint8_t dirty;
     char curdb[64];
+    sess_state_t sess;//连接上SET过的会话变量
 } my_ctx_t;
 
 typedef struct{
     int fd;//mysql连接对应的tcp socket fd
     void *node;//这个mysql连接所属的机器节点是哪个
     struct list_head link;
+    struct list_head ctx_link;//空闲的时候挂在节点的ctx_head上
+    uint64_t ctx_hash;//放回空闲链表时库名和SET NAMES的哈希
+    int state;//MY_CONN_*，只能通过my_conn_move改，跟link所在的链表一致
     void *conn;
     buf_t buf;
     my_ctx_t ctx;
     time_t state_time;
     time_t lastused_time;//这个连接的上次交互使用时间，是说被客户端使用哈
-
-    char setnamesql[64];//客户端发送过来的SET NAMES utf8 指令，为了避免多次发送，进行缓存
+    time_t alive_time;//上次跟mysql有交互的时间，客户端用过或者ping过
+    int wait_timeout;//mysql的wait_timeout，秒，建连接的时候查一次
+    int retry_count;//连续重连失败的次数，连上了清零
+    uint64_t retry_at;//死了的连接什么时候再重连，毫秒
+    uint16_t status;//上一次回复里的服务器状态，事务级复用时用
+    uint64_t req_start;//正在执行的命令什么时候发出去的，微秒，0表示空闲
+    uint64_t used_start;//什么时候分给客户端的，微秒，算占用时长
+    uint64_t connect_start;//什么时候开始连的，微秒，验证完了算建连接花了多久
 } my_conn_t;
 
 typedef struct{
-    int avail;
     uint8_t protocol;
     uint8_t lang;
     uint16_t status;
     uint32_t cap;
     char ver[64];
-    time_t update_time;
 } my_info_t;
 
 typedef struct{
@@ -47,10 +69,11 @@ typedef struct{
     struct list_head raw_head;
     struct list_head fail_head;
     struct list_head ping_head;
-    my_info_t *info;
-    unsigned int avail_count;//这个机器的可用mysql连接数目
+    struct list_head ctx_head[MY_CTX_BUCKETS];//空闲连接按库名和SET NAMES分桶，借连接先找不用换库的
+    unsigned int count[MY_CONN_STATE_MAX];//每个链表上的连接数，count[MY_CONN_AVAIL]就是可用连接数
     int closing;
-	int role ;
+	int role ;//MY_ROLE_*
+    int group;//属于第几个组，分片的时候一个组是一套master和slave
     time_t closing_time;
 
 	int curall_connection ;//当前的连接数，包括活的，死的
@@ -58,23 +81,120 @@ typedef struct{
 	int max_connection ;//最大连接数
 
 	unsigned int cur_connecting_cnt ;//当前正在连接这个数据库的连接数，在自动增加连接的时候需要判断这里，保证一次增加一个，避免瞬间错误的建立大量连接
+
+    struct list_head wait_head;//等mysql连接的客户端，先进先出，挂的是conn_t
+    unsigned int wait_count;//当前排队的客户端数
+    unsigned int wait_peak;//上次打日志以来的最大排队数
+    unsigned long wait_total;//累计排队次数
+    unsigned long wait_served;//累计排到连接的次数
+    unsigned long wait_timeout;//累计排队超时的次数
+    unsigned long wait_reject;//队列满了直接拒绝的次数
+    unsigned long wait_ms;//排到连接的客户端累计等了多少毫秒
+    unsigned long wait_ms_peak;//上次打日志以来最长的等待时间
+
+    unsigned int outstanding;//发出去了还没回完的命令数
+    uint64_t ewma_us;//peak-EWMA的延迟，微秒
+    uint64_t ewma_time;//上次更新ewma_us的时间，微秒
+    unsigned long req_count;//累计完成的命令数
+    unsigned long pick_count;//累计被选中的次数
+
+    int weight;//权重，0表示不再分新的客户端，用来摘掉或者慢慢加回一个节点
+    int cur_weight;//平滑加权轮询用的当前值
+
+    //连接池大小控制，每秒算一次
+    unsigned long acquire_count;//这一秒分出去的连接数
+    unsigned long release_count;//这一秒还回来的连接数
+    uint64_t hold_us;//这一秒还回来的连接一共占了多久
+    unsigned int used_peak;//这一秒同时在用的最大连接数
+    unsigned long demand;//估算的需求，乘了100，涨得快落得慢
+    int target;//连接池的目标大小
+    uint64_t scale_time;//上次算的时间，微秒
+    uint64_t below_since;//连接数从什么时候开始一直比目标多，毫秒，0表示没有
+
+    int breaker;//BREAKER_*
+    unsigned int fail_streak;//连续失败次数
+    int backoff;//这次熔断多久，毫秒，再失败就翻倍
+    uint64_t open_until;//熔断到什么时候，毫秒
+    int probing;//半开的时候已经放了一个连接去试
+    unsigned long breaker_opens;//累计熔断次数
+
+    int lag;//slave的复制延迟，秒，-1表示复制停了或者查不到
+    int lagging;//延迟太大摘掉了，不分新的读，降到lag_recover以内才加回来
+    time_t lag_time;//上次查延迟的时间
+    unsigned long lag_outs;//累计因为延迟摘掉的次数
+    char gtid_executed[MY_GTID_SET_LEN];//slave执行过的GTID，查延迟的时候顺便拿，read_after_write_gtid用
+
+    unsigned long ctx_hit;//客户端有库名或者SET NAMES，借到的连接正好一样
+    unsigned long ctx_miss;//没有一样的空闲连接，要先换库或者重放
+    unsigned long ctx_saved;//命中的里面，按原来拿最近放回的连接是要换库或者重放的
+
+    struct sockaddr_storage addr;//解析好的地址，建连接直接用
+    socklen_t addrlen;//0表示还没解析出来
+    int numeric;//host就是IP，不用再解析
+    time_t resolve_time;//上次解析的时间，0表示要马上重新解析
+    void *resolving;//正在后台解析，my_resolve_t
+    unsigned long resolve_changes;//解析出来的地址变了的次数
+
+    unsigned long connect_count;//累计连上并且验证成功的连接数
+    uint64_t connect_us;//这些连接从connect到验证成功一共花了多久，微秒
+    uint64_t connect_us_peak;//上次打日志以来最慢的一次
 } my_node_t;
 
+enum{//节点熔断状态
+    BREAKER_CLOSED = 0,//正常
+    BREAKER_OPEN,//不分客户端，不重连
+    BREAKER_HALF_OPEN,//只放一个连接去试，连上了就恢复
+};
+
+enum{//节点是master还是slave
+    MY_ROLE_NONE = 0,//空位置
+    MY_ROLE_SLAVE,
+    MY_ROLE_MASTER,
+    MY_ROLE_MAX,
+};
+
+enum{//怎么选节点
+    POLICY_HASH = 0,//客户端ip+port哈希，老的做法
+    POLICY_LEAST,//在途命令最少的
+    POLICY_EWMA,//peak-EWMA延迟乘以在途命令数最小的
+    POLICY_P2C,//随机挑两个，取peak-EWMA代价小的
+    POLICY_WRR,//平滑加权轮询
+};
+
 typedef struct{
-    //my_node_t master[MAX_MASTER_NODE];
-    my_node_t slave[MAX_SLAVE_NODE];
-    int slave_num;
-    //int master_num;
+    my_node_t node[MAX_MY_NODE];//master和slave放在一起，用role区分
+    int node_num;
+    int role_count[MAX_MY_GROUP][MY_ROLE_MAX];//每个组每种角色注册了几个节点
+    unsigned long avail_total;//所有节点的可用连接数
+    int connect_rate;//这个线程每秒最多新建多少个连接
+    long tokens;//令牌桶里的令牌，乘了1000
+    uint64_t token_time;//上次加令牌的时间，毫秒
+    unsigned long connect_throttled;//被限速推迟的建连接次数
+    int policy;//POLICY_*
+    unsigned int rr;//非哈希策略的起始位置轮转，代价一样时不总选第一个
 } my_pool_t;
 
 int my_pool_init(int count);
 int my_pool_have_conn(void);
+int my_pool_stat(unsigned long *total, unsigned long *used, unsigned long *avail, unsigned long *connecting, \
+                        unsigned long *target);
+int my_pool_wait_stat(unsigned long *cur, unsigned long *total, unsigned long *served, \
+                        unsigned long *timeout, unsigned long *reject, unsigned long *ms);
+int my_pool_ctx_stat(unsigned long *hit, unsigned long *miss, unsigned long *saved);
+int my_pool_connect_stat(unsigned long *count, unsigned long *us);
+void my_pool_resolve_all(void);
 
-int my_slave_reg(char *host, char *srv, char *user, char *pass, int mincount, int maxcount);
+int my_pool_set_policy(const char *name);
 
-int my_unreg(char *host, char *srv);
+int my_node_reg(int role, int group, char *host, char *srv, char *user, char *pass, int mincount, int maxcount, int weight);
 
-my_conn_t *my_slave_conn_get(void *c, uint32_t ip, uint16_t port);
+int my_unreg(int role, int group, char *host, char *srv);
+int my_node_set_weight(int role, int group, char *host, char *srv, int weight);
+
+int my_pool_has_role(int group, int role);
+my_conn_t *my_conn_get(void *c, int role, uint32_t ip, uint16_t port);
+int my_conn_wait(void *c, int role, uint32_t ip, uint16_t port);
+int my_conn_wait_cancel(void *c, int timeout);
 
 int my_conn_put(my_conn_t *my, int isupdatestatustime);
 int my_conn_close(my_conn_t *my);
@@ -82,10 +202,20 @@ int my_conn_close_on_fail(my_conn_t *my);
 
 int my_conn_set_avail(my_conn_t *my, int isupdatestatustime);
 
+void my_conn_node_fail(my_conn_t *my);
+void my_conn_node_ok(my_conn_t *my);
+void my_conn_node_lag(my_conn_t *my, int lag);
+void my_pool_set_connect_rate(int rate);
+
+void my_conn_req_start(my_conn_t *my);
+void my_conn_req_end(my_conn_t *my, int sample);
+
 int my_conn_ctx_set_dirty(my_conn_t *my);
 int my_conn_ctx_is_dirty(my_conn_t *my);
 
+my_info_t *my_info_get(void);
 int my_info_set(uint8_t prot, uint8_t lang, uint16_t status, uint32_t cap, char *ver, int ver_len);
+int my_info_load(const char *fname);
 
 int my_try_increase_connection( ) ;
 
@@ -9,6 +9,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include <list.h>
 #include <time.h>
 #include <stdint.h>
@@ -528,3 +530,441 @@ int make_result_error(buf_t *buf, my_result_error_t *result)
 
     return total;
 }
+
+/*
+ * fun: length of length encoded integer
+ * arg: first byte
+ * ret: bytes used by the integer
+ *
+ */
+
+static inline int resp_lenenc_len(uint8_t u)
+{
+    if(u < 0xfb){
+        return 1;
+    } else if(u == 0xfc){
+        return 3;
+    } else if(u == 0xfd){
+        return 4;
+    } else if(u == 0xfe){
+        return 9;
+    }
+
+    return 1;
+}
+
+/*
+ * fun: read length encoded integer
+ * arg: data, data length, integer value
+ * ret: bytes used, not enough data -1
+ *
+ */
+
+int resp_lenenc(const uint8_t *p, int len, uint64_t *v)
+{
+    int i, n;
+
+    if(len <= 0){
+        return -1;
+    }
+
+    n = resp_lenenc_len(p[0]);
+    if(n > len){
+        return -1;
+    }
+
+    if(n == 1){
+        *v = p[0];
+        return 1;
+    }
+
+    *v = 0;
+    for(i = n - 1; i > 0; i--){
+        *v = (*v << 8) | p[i];
+    }
+
+    return n;
+}
+
+/*
+ * fun: pick GTID of this connection out of session state changes
+ * arg: response parse state, session state changes, length
+ * ret: void
+ *
+ */
+
+static void resp_gtid(my_resp_t *resp, const uint8_t *ptr, int len)
+{//session_track_gtids=OWN_GTID时提交的事务带一项：编码(0)，后面是变长字符串uuid:序号
+    int n;
+    uint64_t glen;
+    const uint8_t *end = ptr + len, *next;
+
+    while(ptr + 2 <= end){
+        if(ptr[1] >= 0xfb){
+            return;
+        }
+        next = ptr + 2 + ptr[1];
+        if(next > end){
+            return;
+        }
+        if( (ptr[0] == SESS_TRACK_GTIDS) && (ptr + 3 < next) && (ptr[2] == 0) ){
+            if( ((n = resp_lenenc(ptr + 3, next - ptr - 3, &glen)) > 0) && \
+                    (ptr + 3 + n + glen <= next) && \
+                    (glen > 0) && (glen < MY_GTID_LEN) ){
+                memcpy(resp->gtid, ptr + 3 + n, glen);
+                resp->gtid[glen] = '\0';
+            }
+        }
+        ptr = next;
+    }
+}
+
+/*
+ * fun: record session state changes carried by OK packet
+ * arg: response parse state, offset of info string in OK packet
+ * ret: void
+ *
+ */
+
+static void resp_track(my_resp_t *resp, int off)
+{//OK包：状态、warnings后面是info字符串，再后面是会话状态的变化，GTID不管记不记会话状态都要看
+    int n, res;
+    uint64_t len;
+    uint8_t *p = resp->head;
+
+    if( (resp->head_len < resp->pktlen) || \
+        ((n = resp_lenenc(p + off, resp->head_len - off, &len)) < 0) || (off + n + len > resp->head_len) ){
+        goto lost;
+    }
+    off += n + len;
+
+    if( ((n = resp_lenenc(p + off, resp->head_len - off, &len)) < 0) || (off + n + len > resp->head_len) ){
+        goto lost;
+    }
+    off += n;
+
+    resp_gtid(resp, p + off, len);
+
+    if(resp->sess == NULL){
+        return;
+    }
+
+    if( (res = sess_track(resp->sess, p + off, len)) < 0 ){
+        goto lost;
+    }
+
+    resp->track += res;
+    return;
+
+lost:
+    if(resp->sess != NULL){
+        resp->untracked = 1;
+    }
+}
+
+/*
+ * fun: handle one whole packet of mysql response
+ * arg: response parse state
+ * ret: void
+ *
+ */
+
+static void resp_packet(my_resp_t *resp)
+{
+    int cont, off;
+    uint8_t type, *p;
+
+    p = resp->head;
+    type = (resp->head_len > 0) ? p[0] : 0;
+
+    cont = resp->cont;
+    resp->cont = (resp->pktlen == 0xffffff);
+    if(cont){//续包里是上一个包的数据，不看
+        return;
+    }
+
+    switch(resp->state)
+    {
+        case RESP_FIRST:
+            if( (type == 0x00) && (resp->head_len > 0) ){//OK包：affected_rows, insert_id都是变长的，后面是状态
+                off = 1;
+                off += resp_lenenc_len(p[off]);
+                if(off < resp->head_len){
+                    off += resp_lenenc_len(p[off]);
+                }
+                if(off + 2 <= resp->head_len){
+                    resp->status = p[off] | (p[off + 1] << 8);
+                    if(resp->status & SERVER_SESSION_STATE_CHANGED){
+                        resp_track(resp, off + 4);
+                    }
+                }
+                resp->state = (resp->status & SERVER_MORE_RESULTS_EXISTS) ? RESP_FIRST : RESP_DONE;
+            } else if(type == 0xff){
+                resp->err = 1;
+                resp->state = RESP_DONE;
+            } else {
+                resp->state = RESP_FIELDS;
+            }
+            break;
+
+        case RESP_FIELDS:
+            if( (type == 0xfe) && (resp->pktlen < 9) ){
+                resp->state = RESP_ROWS;
+            }
+            break;
+
+        case RESP_ROWS:
+            if( (type == 0xfe) && (resp->pktlen < 9) ){//EOF包：warnings 2个字节，后面是状态
+                if(resp->head_len >= 5){
+                    resp->status = p[3] | (p[4] << 8);
+                }
+                resp->state = (resp->status & SERVER_MORE_RESULTS_EXISTS) ? RESP_FIRST : RESP_DONE;
+            } else if(type == 0xff){
+                resp->err = 1;
+                resp->state = RESP_DONE;
+            }
+            break;
+    }
+}
+
+/*
+ * fun: init response parse state
+ * arg: response parse state, server status before this response, session state to record changes
+ * ret: void
+ *
+ */
+
+void resp_init(my_resp_t *resp, uint16_t status, sess_state_t *sess)
+{
+    resp->state = RESP_FIRST;
+    resp->status = status;
+    resp->err = 0;
+    resp->sess = sess;
+    resp->track = 0;
+    resp->untracked = 0;
+    resp->gtid[0] = '\0';
+    resp->hdr_len = 0;
+    resp->head_len = 0;
+    resp->pktlen = 0;
+    resp->left = 0;
+    resp->cont = 0;
+}
+
+/*
+ * fun: feed response bytes read from mysql
+ * arg: response parse state, data, data length
+ * ret: response done 1, not yet 0, data after response -1
+ *
+ */
+
+int resp_parse(my_resp_t *resp, const char *ptr, size_t len)
+{//只处理不带CLIENT_DEPRECATE_EOF的一问一答，结果集以EOF包结束
+    size_t n, want;
+
+    while(len > 0){
+        if(resp->state == RESP_DONE){
+            return -1;
+        }
+
+        if(resp->hdr_len < HEADER_SIZE){
+            resp->hdr[resp->hdr_len++] = (uint8_t)*ptr;
+            ptr++;
+            len--;
+
+            if(resp->hdr_len == HEADER_SIZE){
+                resp->pktlen = resp->hdr[0] | (resp->hdr[1] << 8) | (resp->hdr[2] << 16);
+                resp->left = resp->pktlen;
+                resp->head_len = 0;
+                if(resp->left == 0){
+                    resp_packet(resp);
+                    resp->hdr_len = 0;
+                }
+            }
+            continue;
+        }
+
+        n = (resp->left < len) ? resp->left : len;
+        want = (resp->state == RESP_FIRST) ? RESP_OK_SIZE : RESP_HEAD_SIZE;
+        want = (resp->pktlen < want ? resp->pktlen : want) - resp->head_len;
+        if(want > n){
+            want = n;
+        }
+        if(want > 0){
+            memcpy(resp->head + resp->head_len, ptr, want);
+            resp->head_len += want;
+        }
+
+        ptr += n;
+        len -= n;
+        resp->left -= n;
+
+        if(resp->left == 0){
+            resp_packet(resp);
+            resp->hdr_len = 0;
+        }
+    }
+
+    return (resp->state == RESP_DONE);
+}
+
+/*
+ * fun: find the index-th length encoded string of a packet
+ * arg: packet body, body length, index, string, string length
+ * ret: found 1, NULL 0, error -1
+ *
+ */
+
+int resp_field(const uint8_t *p, int len, int index, const uint8_t **str, uint64_t *slen)
+{//行里的NULL是一个0xfb
+    int n;
+
+    while(1){
+        if(len <= 0){
+            return -1;
+        }
+        if(p[0] == 0xfb){
+            n = 1;
+            *slen = 0;
+        } else if( ((n = resp_lenenc(p, len, slen)) < 0) || (*slen > (uint64_t)(len - n)) ){
+            return -1;
+        }
+
+        if(index-- == 0){
+            *str = p + n;
+            return (p[0] != 0xfb);
+        }
+
+        p += n + *slen;
+        len -= n + *slen;
+    }
+}
+
+/*
+ * fun: parse one value of result set, like SELECT @@wait_timeout or SHOW SLAVE STATUS
+ * arg: buffer, column name or NULL for first column, value, value size
+ * ret: complete 1, complete but no value or NULL 2, need more data 0, error -1
+ *
+ */
+
+int parse_var_result(buf_t *buf, const char *name, char *val, int size)
+{//列数、列定义、EOF、行、EOF，只取第一行，要等到最后的EOF，不能在连接上留着没读的包
+    int npkt = 0, eof = 0, col = -1, found = 0;
+    uint32_t len;
+    uint64_t ncol = 0, vlen;
+    uint8_t *p = (uint8_t *)(buf->ptr), *end = p + buf->used, *body;
+    const uint8_t *str;
+
+    val[0] = '\0';
+    if(name == NULL){
+        col = 0;
+    }
+
+    while(end - p >= HEADER_SIZE){
+        len = p[0] | (p[1] << 8) | (p[2] << 16);
+        if((uint32_t)(end - p - HEADER_SIZE) < len){
+            return 0;
+        }
+        body = p + HEADER_SIZE;
+
+        if(npkt == 0){//ERR，或者OK(不是结果集)
+            if( (len == 0) || (body[0] == 0xff) || (body[0] == 0x00) ){
+                return -1;
+            }
+            if( resp_lenenc(body, len, &ncol) < 0 ){
+                return -1;
+            }
+        } else if( (len < 9) && (body[0] == 0xfe) ){
+            if(++eof == 2){
+                return found ? 1 : 2;
+            }
+        } else if( (eof == 1) && (body[0] == 0xff) ){
+            return -1;
+        } else if( (eof == 0) && (col < 0) ){//列定义: catalog、schema、table、org_table、name
+            if( (resp_field(body, len, 4, &str, &vlen) == 1) && \
+                    (vlen == strlen(name)) && (!strncasecmp((const char *)str, name, vlen)) ){
+                col = npkt - 1;
+            }
+        } else if( (eof == 1) && ((uint64_t)npkt == ncol + 2) && (col >= 0) ){//第一行
+            if( (found = resp_field(body, len, col, &str, &vlen)) < 0 ){
+                return -1;
+            }
+            if(vlen >= (uint64_t)size){
+                vlen = size - 1;
+            }
+            memcpy(val, str, vlen);
+            val[vlen] = '\0';
+        }
+
+        npkt++;
+        p += HEADER_SIZE + len;
+    }
+
+    return 0;
+}
+
+/*
+ * fun: check whether gtid set contains one gtid
+ * arg: gtid set like gtid_executed, gtid like uuid:N or uuid:tag:N
+ * ret: contains 1, not 0
+ *
+ */
+
+int gtid_set_contains(const char *set, const char *gtid)
+{//集合是逗号分开的uuid:区间:区间...，8.4以后区间前面还可以有tag，tag后面的区间都算这个tag的
+    const char *p, *uuid_end, *num, *tag, *e;
+    int uuid_len, tag_len, len, cur_len;
+    const char *cur;
+    unsigned long long n, a, b;
+    char *q;
+
+    if( ((uuid_end = strchr(gtid, ':')) == NULL) || ((num = strrchr(gtid, ':')) == NULL) ){
+        return 0;
+    }
+    uuid_len = uuid_end - gtid;
+    tag = (num > uuid_end) ? uuid_end + 1 : NULL;
+    tag_len = (tag != NULL) ? num - tag : 0;
+    n = strtoull(num + 1, &q, 10);
+    if( (q == num + 1) || (*q != '\0') ){
+        return 0;
+    }
+
+    p = set;
+    while(*p != '\0'){
+        while( (*p == ',') || isspace((unsigned char)*p) ){
+            p++;
+        }
+        for(e = p; (*e != '\0') && (*e != ':') && (*e != ','); e++);
+        len = e - p;
+        while( (len > 0) && isspace((unsigned char)p[len - 1]) ){
+            len--;
+        }
+        if( (len != uuid_len) || strncasecmp(p, gtid, len) ){//不是这个uuid，跳到下一个
+            for(p = e; (*p != '\0') && (*p != ','); p++);
+            continue;
+        }
+
+        cur = NULL;
+        cur_len = 0;
+        p = e;
+        while(*p == ':'){
+            p++;
+            for(e = p; (*e != '\0') && (*e != ':') && (*e != ','); e++);
+            if(!isdigit((unsigned char)*p)){//tag
+                cur = p;
+                cur_len = e - p;
+                while( (cur_len > 0) && isspace((unsigned char)cur[cur_len - 1]) ){
+                    cur_len--;
+                }
+            } else if( (cur_len == tag_len) && ((tag_len == 0) || !strncasecmp(cur, tag, tag_len)) ){
+                a = strtoull(p, &q, 10);
+                b = (*q == '-') ? strtoull(q + 1, NULL, 10) : a;
+                if( (n >= a) && (n <= b) ){
+                    return 1;
+                }
+            }
+            p = e;
+        }
+    }
+
+    return 0;
+}
@@ -1,7 +1,9 @@
 #ifndef _MY_PROTOCOL_H_
 #define _MY_PROTOCOL_H_
 
+#include "def.h"
 #include "my_buf.h"
+#include "my_sess.h"
 #include <stdint.h>
 
 typedef struct{
@@ -56,6 +58,35 @@ typedef struct{
     char msg[512];
 }my_result_error_t;
 
+//mysql回复的解析状态，回复是一段一段读到的，只看包头和包体开头几个字节
+enum{
+    RESP_FIRST = 0,//等第一个包：OK、ERR或者结果集的列数
+    RESP_FIELDS,//列定义，直到EOF
+    RESP_ROWS,//行数据，直到EOF或者ERR
+    RESP_DONE
+};
+
+#define RESP_HEAD_SIZE 32
+#define RESP_OK_SIZE 512//OK包后面可能带着会话状态的变化，多留一点
+#define SESS_TRACK_GTIDS 3//会话状态变化里GTID那一项
+
+typedef struct{
+    int state;
+    uint16_t status;//最后一个OK或者EOF包里的服务器状态
+    int err;//回复以ERR包结束
+    sess_state_t *sess;//OK包里带的系统变量变化记到这里，NULL不记
+    int track;//记了多少个变化
+    int untracked;//有变化没记下来，比如OK包太长
+    char gtid[MY_GTID_LEN];//OK包里带的这个连接刚提交的GTID，空表示没有
+    uint8_t hdr[4];
+    int hdr_len;
+    uint8_t head[RESP_OK_SIZE];//当前包包体的前面几个字节，OK包尽量读全
+    int head_len;
+    uint32_t pktlen;
+    uint32_t left;//当前包还有多少字节没读到
+    int cont;//上一个包是16M的满包，当前包是它的续包
+}my_resp_t;
+
 int make_init(buf_t *buf, my_auth_init_t *init);
 int make_login(buf_t *buf, cli_auth_login_t *login);
 int make_auth_result(buf_t *buf, my_auth_result_t *result);
@@ -67,6 +98,13 @@ int parse_init(buf_t *buf, my_auth_init_t *init);
 int parse_login(buf_t *buf, cli_auth_login_t *login);
 int parse_auth_result(buf_t *buf, my_auth_result_t *result);
 int parse_com(buf_t *buf, cli_com_t *com);
+int parse_var_result(buf_t *buf, const char *name, char *val, int size);
+int gtid_set_contains(const char *set, const char *gtid);
+
+void resp_init(my_resp_t *resp, uint16_t status, sess_state_t *sess);
+int resp_parse(my_resp_t *resp, const char *ptr, size_t len);
+int resp_lenenc(const uint8_t *p, int len, uint64_t *v);
+int resp_field(const uint8_t *p, int len, int index, const uint8_t **str, uint64_t *slen);
 
 #define PASSWORD_TYPE "mysql_native_password"
 
@@ -0,0 +1,811 @@
+/*
+ * Copyright 2011-2013 Alibaba Group Holding Limited. All rights reserved.
+ * Use and distribution licensed under the GPL license.
+ *
+ * Authors: XiaoJinliang <xiaoshi.xjl@taobao.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdint.h>
+#include "mysql_com.h"
+#include "my_protocol.h"
+#include "my_scatter.h"
+
+#define SCATTER_NUM_LEN 64//数字最多这么长，再长的按字符串比
+
+static void scatter_put(scatter_t *sc, buf_t *out, const uint8_t *body, uint32_t len);
+static void scatter_row(scatter_t *sc, buf_t *out, const uint8_t *body, uint32_t len);
+static void scatter_fail(scatter_t *sc, const uint8_t *pkt, uint32_t len, const char *msg);
+static int scatter_header(scatter_t *sc, scatter_leg_t *leg, size_t end, buf_t *out);
+static void scatter_merge(scatter_t *sc, buf_t *out);
+static void scatter_finish(scatter_t *sc, buf_t *out);
+static void scatter_agg(scatter_t *sc, buf_t *out);
+static int scatter_cmp(scatter_t *sc, int a, int b);
+static int scatter_value_cmp(uint8_t type, uint16_t charset, const uint8_t *a, uint64_t alen, const uint8_t *b, uint64_t blen);
+static void scatter_heap_down(scatter_t *sc, int i);
+static void scatter_heap_up(scatter_t *sc, int i);
+
+/*
+ * fun: new scatter context
+ * arg: plan of statement, number of groups
+ * ret: success return context, error return NULL
+ *
+ */
+
+scatter_t *scatter_new(const scatter_plan_t *plan, int nleg)
+{
+    int i;
+    scatter_t *sc;
+
+    if( (sc = malloc(sizeof(scatter_t))) == NULL ){
+        return NULL;
+    }
+
+    bzero(sc, sizeof(scatter_t));
+    sc->plan = *plan;
+    sc->nleg = nleg;
+    sc->running = nleg;
+    sc->seq = 1;
+    sc->status = SERVER_STATUS_AUTOCOMMIT;
+    buf_init(&(sc->err));
+    buf_init(&(sc->query));
+
+    for(i = 0; i < nleg; i++){
+        sc->leg[i].state = RESP_FIRST;
+    }
+
+    if(plan->nagg > 0){//每路已经按自己的LIMIT算过了，合成的一行不再算
+        sc->mode = SCATTER_MODE_AGG;
+        sc->skip = 0;
+        sc->left = -1;
+    } else {
+        sc->mode = (plan->norder > 0) ? SCATTER_MODE_MERGE : SCATTER_MODE_STREAM;
+        sc->skip = plan->offset;
+        sc->left = plan->limit;
+    }
+
+    return sc;
+}
+
+/*
+ * fun: free scatter context
+ * arg: scatter context
+ * ret: void
+ *
+ */
+
+void scatter_free(scatter_t *sc)
+{
+    buf_reset(&(sc->err));
+    buf_reset(&(sc->query));
+    free(sc);
+}
+
+/*
+ * fun: make COM_QUERY packet sent to every group
+ * arg: scatter context, sql, sql length
+ * ret: success 0, error -1
+ *
+ */
+
+int scatter_query(scatter_t *sc, const char *sql, int len)
+{//有OFFSET的时候每组都要从头取offset+limit行，扔掉前offset行在合并的时候做
+    char limit[64];
+    int n = 0, head = len, tail = len;
+    size_t size;
+    uint8_t *p;
+
+    if( (sc->mode != SCATTER_MODE_AGG) && (sc->plan.offset > 0) && (sc->plan.limit >= 0) ){
+        n = snprintf(limit, sizeof(limit), "LIMIT %lld", sc->plan.offset + sc->plan.limit);
+        head = sc->plan.limit_start;
+        tail = sc->plan.limit_end;
+    }
+
+    size = HEADER_SIZE + 1 + head + n + (len - tail);
+    if(size - HEADER_SIZE >= 0xffffff){
+        return -1;
+    }
+
+    if(buf_realloc(&(sc->query), size) == NULL){
+        return -1;
+    }
+
+    p = (uint8_t *)sc->query.ptr;
+    p[0] = (size - HEADER_SIZE) & 0xff;
+    p[1] = ((size - HEADER_SIZE) >> 8) & 0xff;
+    p[2] = ((size - HEADER_SIZE) >> 16) & 0xff;
+    p[3] = 0;
+    p[HEADER_SIZE] = COM_QUERY;
+    p += HEADER_SIZE + 1;
+
+    memcpy(p, sql, head);
+    memcpy(p + head, limit, n);
+    memcpy(p + head + n, sql + tail, len - tail);
+    sc->query.used = size;
+
+    return 0;
+}
+
+/*
+ * fun: too many rows queued on one group
+ * arg: scatter context, group index
+ * ret: yes 1, no 0
+ *
+ */
+
+int scatter_leg_full(scatter_t *sc, int index)
+{
+    scatter_leg_t *leg = &(sc->leg[index]);
+
+    return (leg->qend - leg->head) > SCATTER_LEG_BUF;
+}
+
+/*
+ * fun: parse data read from one group, put what can be sent into client buffer
+ * arg: scatter context, group index, client buffer
+ * ret: success 0, error -1
+ *
+ */
+
+int scatter_input(scatter_t *sc, int index, buf_t *out)
+{//列定义只发先到齐的那一路的；不排序的行直接发，排序和聚合的行留在这一路的缓冲里
+    uint32_t len;
+    uint8_t *p, *body;
+    buf_t *buf;
+    scatter_leg_t *leg = &(sc->leg[index]);
+
+    buf = leg->buf;
+
+    if( (leg->head > 0) && ((leg->head == buf->used) || (leg->head >= buf->size / 2)) ){//前面发掉的挪走
+        memmove(buf->ptr, buf->ptr + leg->head, buf->used - leg->head);
+        buf->used -= leg->head;
+        buf->pos = buf->used;
+        leg->qend -= leg->head;
+        leg->tail -= leg->head;
+        leg->head = 0;
+    }
+
+    while( (leg->state != RESP_DONE) && (buf->used - leg->tail >= HEADER_SIZE) ){
+        p = (uint8_t *)(buf->ptr + leg->tail);
+        len = p[0] | (p[1] << 8) | (p[2] << 16);
+        if(len == 0xffffff){//16M以上的包不拆
+            return -1;
+        }
+        if(buf->used - leg->tail - HEADER_SIZE < len){
+            if( (leg->tail + HEADER_SIZE + len > buf->size) && (buf_realloc(buf, leg->tail + HEADER_SIZE + len) == NULL) ){
+                return -1;
+            }
+            break;
+        }
+        body = p + HEADER_SIZE;
+
+        switch(leg->state){
+            case RESP_FIRST:
+                if( (len > 0) && (body[0] == 0xff) ){
+                    scatter_fail(sc, body, len, NULL);
+                    leg->state = RESP_DONE;
+                } else if( (len == 0) || (body[0] == 0x00) || (resp_lenenc(body, len, &(leg->ncol)) < 0) ){
+                    scatter_fail(sc, NULL, 0, "myrelay: scatter statement returned no result set");
+                    leg->state = RESP_DONE;
+                } else {
+                    leg->state = RESP_FIELDS;
+                }
+                break;
+
+            case RESP_FIELDS:
+                if( (len < 9) && (body[0] == 0xfe) ){
+                    if(!sc->header){
+                        if(scatter_header(sc, leg, leg->tail + HEADER_SIZE + len, out) < 0){
+                            return -1;
+                        }
+                    } else if(leg->ncol != sc->ncol){
+                        scatter_fail(sc, NULL, 0, "myrelay: column count differs between shard groups");
+                    }
+                    leg->head = leg->qend = leg->tail + HEADER_SIZE + len;
+                    leg->state = RESP_ROWS;
+                }
+                break;
+
+            case RESP_ROWS:
+                if( (len < 9) && (body[0] == 0xfe) ){
+                    if(len >= 5){
+                        sc->status = body[3] | (body[4] << 8);
+                    }
+                    leg->state = RESP_DONE;
+                } else if( (len > 0) && (body[0] == 0xff) ){
+                    scatter_fail(sc, body, len, NULL);
+                    leg->state = RESP_DONE;
+                } else if(sc->mode == SCATTER_MODE_STREAM){
+                    scatter_row(sc, out, body, len);
+                    leg->head = leg->qend = leg->tail + HEADER_SIZE + len;
+                } else {
+                    leg->qend = leg->tail + HEADER_SIZE + len;
+                    if( (leg->nrow++ == 0) && (sc->mode == SCATTER_MODE_MERGE) ){
+                        sc->heap[sc->nheap] = index;
+                        scatter_heap_up(sc, sc->nheap++);
+                    }
+                }
+                break;
+        }
+
+        leg->tail += HEADER_SIZE + len;
+    }
+
+    if( (leg->nrow == 0) && (leg->state != RESP_FIELDS) ){
+        leg->head = leg->qend = leg->tail;
+    }
+
+    if( (leg->state == RESP_DONE) && (leg->step != SCATTER_STEP_DONE) ){
+        leg->step = SCATTER_STEP_DONE;
+        sc->running--;
+    }
+
+    if(sc->mode == SCATTER_MODE_MERGE){
+        scatter_merge(sc, out);
+    }
+
+    if(sc->running == 0){
+        scatter_finish(sc, out);
+    }
+
+    return 0;
+}
+
+/*
+ * fun: append packet to client buffer with next sequence number
+ * arg: scatter context, client buffer, packet body, body length
+ * ret: void
+ *
+ */
+
+static void scatter_put(scatter_t *sc, buf_t *out, const uint8_t *body, uint32_t len)
+{
+    uint8_t *p;
+    size_t size;
+
+    if(out->used + HEADER_SIZE + len > out->size){
+        for(size = out->size * 2; size < out->used + HEADER_SIZE + len; size *= 2);
+        if(buf_realloc(out, size) == NULL){//内存不够，这个包丢了，客户端会收到乱序的包自己断开
+            return;
+        }
+    }
+
+    p = (uint8_t *)(out->ptr + out->used);
+    p[0] = len & 0xff;
+    p[1] = (len >> 8) & 0xff;
+    p[2] = (len >> 16) & 0xff;
+    p[3] = sc->seq++;
+    memcpy(p + HEADER_SIZE, body, len);
+    out->used += HEADER_SIZE + len;
+}
+
+/*
+ * fun: send one row to client if it is within LIMIT
+ * arg: scatter context, client buffer, row body, body length
+ * ret: void
+ *
+ */
+
+static void scatter_row(scatter_t *sc, buf_t *out, const uint8_t *body, uint32_t len)
+{
+    if( sc->failed || (sc->left == 0) ){
+        return;
+    }
+
+    if(sc->skip > 0){
+        sc->skip--;
+        return;
+    }
+
+    if(sc->left > 0){
+        sc->left--;
+    }
+
+    scatter_put(sc, out, body, len);
+}
+
+/*
+ * fun: remember first error, answer it when all groups are over
+ * arg: scatter context, ERR packet body from mysql or NULL, body length, message of proxy error
+ * ret: void
+ *
+ */
+
+static void scatter_fail(scatter_t *sc, const uint8_t *body, uint32_t len, const char *msg)
+{
+    my_result_error_t error;
+
+    if(sc->failed){
+        return;
+    }
+    sc->failed = 1;
+
+    if(body != NULL){
+        if( (HEADER_SIZE + len > sc->err.size) && (buf_realloc(&(sc->err), HEADER_SIZE + len) == NULL) ){
+            len = sc->err.size - HEADER_SIZE;
+        }
+        memcpy(sc->err.ptr + HEADER_SIZE, body, len);
+        sc->err.used = HEADER_SIZE + len;
+        return;
+    }
+
+    error.pktno = 1;
+    error.field_count = 0xff;
+    error.err = 1105;
+    error.marker = '#';
+    memcpy(error.sqlstate, "HY000", 5);
+    strncpy(error.msg, msg, sizeof(error.msg) - 1);
+    error.msg[sizeof(error.msg) - 1] = '\0';
+    make_result_error(&(sc->err), &error);
+}
+
+/*
+ * fun: send column definitions of first group, find columns of ORDER BY
+ * arg: scatter context, group, end of EOF packet after column definitions, client buffer
+ * ret: success 0, error -1
+ *
+ */
+
+static int scatter_header(scatter_t *sc, scatter_leg_t *leg, size_t end, buf_t *out)
+{//列定义: catalog、schema、table、org_table、name、org_name、0x0c、charset(2)、length(4)、type(1)...
+    int i, k;
+    uint32_t len;
+    uint64_t slen;
+    size_t off;
+    uint8_t *p, *body;
+    const uint8_t *str;
+    const scatter_plan_t *plan = &(sc->plan);
+
+    for(i = 0; i < plan->norder; i++){
+        sc->key[i] = plan->order_pos[i] - 1;
+    }
+
+    if( (sc->mode != SCATTER_MODE_STREAM) && (leg->ncol > SCATTER_COL_MAX) ){
+        scatter_fail(sc, NULL, 0, "myrelay: too many columns to merge");
+        return 0;
+    }
+    if( (sc->mode == SCATTER_MODE_AGG) && (leg->ncol != (uint64_t)plan->ncol) ){
+        scatter_fail(sc, NULL, 0, "myrelay: aggregate columns do not match select list");
+        return 0;
+    }
+
+    for(off = leg->head, k = -1; off < end; off += HEADER_SIZE + len, k++){
+        p = (uint8_t *)(leg->buf->ptr + off);
+        len = p[0] | (p[1] << 8) | (p[2] << 16);
+        body = p + HEADER_SIZE;
+
+        if( (k < 0) || ((uint64_t)k >= leg->ncol) || (k >= SCATTER_COL_MAX) ){
+            continue;
+        }
+
+        if( (resp_field(body, len, 6, &str, &slen) == 1) && (slen >= 7) ){
+            sc->charset[k] = str[0] | (str[1] << 8);
+            sc->type[k] = str[6];
+        }
+
+        for(i = 0; i < plan->norder; i++){
+            if( (sc->key[i] >= 0) || ( \
+                    ((resp_field(body, len, 4, &str, &slen) != 1) || (slen != strlen(plan->order_name[i])) || \
+                        strncasecmp((const char *)str, plan->order_name[i], slen)) && \
+                    ((resp_field(body, len, 5, &str, &slen) != 1) || (slen != strlen(plan->order_name[i])) || \
+                        strncasecmp((const char *)str, plan->order_name[i], slen)) ) ){
+                continue;
+            }
+            sc->key[i] = k;
+        }
+    }
+
+    for(i = 0; i < plan->norder; i++){//按名字排序的列要在结果里
+        if( (sc->key[i] < 0) || ((uint64_t)sc->key[i] >= leg->ncol) ){
+            scatter_fail(sc, NULL, 0, "myrelay: ORDER BY column of scatter statement must be in select list");
+            return 0;
+        }
+    }
+
+    for(off = leg->head; off < end; off += HEADER_SIZE + len){
+        p = (uint8_t *)(leg->buf->ptr + off);
+        len = p[0] | (p[1] << 8) | (p[2] << 16);
+        scatter_put(sc, out, p + HEADER_SIZE, len);
+    }
+
+    sc->ncol = leg->ncol;
+    sc->header = 1;
+
+    return 0;
+}
+
+/*
+ * fun: send rows in order while every running group has a row queued
+ * arg: scatter context, client buffer
+ * ret: void
+ *
+ */
+
+static void scatter_merge(scatter_t *sc, buf_t *out)
+{//还没回完又没有排队的行的路，下一行可能更小，要等它
+    int i;
+    uint32_t len;
+    uint8_t *p;
+    scatter_leg_t *leg;
+
+    if( sc->failed || (sc->left == 0) ){//后面的行都不要了
+        for(i = 0; i < sc->nleg; i++){
+            sc->leg[i].head = sc->leg[i].qend;
+            sc->leg[i].nrow = 0;
+        }
+        sc->nheap = 0;
+        return;
+    }
+
+    while(sc->nheap > 0){
+        for(i = 0; i < sc->nleg; i++){
+            if( (sc->leg[i].state != RESP_DONE) && (sc->leg[i].nrow == 0) ){
+                return;
+            }
+        }
+
+        leg = &(sc->leg[sc->heap[0]]);
+        p = (uint8_t *)(leg->buf->ptr + leg->head);
+        len = p[0] | (p[1] << 8) | (p[2] << 16);
+        scatter_row(sc, out, p + HEADER_SIZE, len);
+        leg->head += HEADER_SIZE + len;
+
+        if(--leg->nrow == 0){
+            sc->heap[0] = sc->heap[--sc->nheap];
+        }
+        scatter_heap_down(sc, 0);
+
+        if(sc->left == 0){
+            scatter_merge(sc, out);
+            return;
+        }
+    }
+}
+
+/*
+ * fun: all groups are over, send aggregate row and EOF, or first error
+ * arg: scatter context, client buffer
+ * ret: void
+ *
+ */
+
+static void scatter_finish(scatter_t *sc, buf_t *out)
+{
+    uint8_t eof[5];
+    uint16_t status;
+
+    if( (sc->mode == SCATTER_MODE_AGG) && (!sc->failed) ){
+        scatter_agg(sc, out);
+    }
+
+    if(sc->failed){
+        scatter_put(sc, out, (uint8_t *)(sc->err.ptr + HEADER_SIZE), sc->err.used - HEADER_SIZE);
+        return;
+    }
+
+    status = sc->status & ~SERVER_MORE_RESULTS_EXISTS;
+    eof[0] = 0xfe;
+    eof[1] = 0;
+    eof[2] = 0;
+    eof[3] = status & 0xff;
+    eof[4] = (status >> 8) & 0xff;
+    scatter_put(sc, out, eof, sizeof(eof));
+}
+
+/*
+ * fun: merge one row of every group into one row
+ * arg: scatter context, client buffer
+ * ret: void
+ *
+ */
+
+static void scatter_agg(scatter_t *sc, buf_t *out)
+{//COUNT、SUM加起来，都是整数就按整数加，有小数按long double加，保留最多的小数位；MIN、MAX跟ORDER BY一样比
+    int i, j, n, nrows = 0, isint, scale, valid, found, best;
+    uint32_t len[MAX_MY_GROUP], size = 0;
+    uint64_t slen, blen = 0;
+    long long iv, isum;
+    long double dsum;
+    char num[SCATTER_NUM_LEN], *end;
+    const char *dot;
+    const uint8_t *str, *bstr = NULL;
+    uint8_t *row[MAX_MY_GROUP], *body, *p;
+    scatter_leg_t *leg;
+
+    for(i = 0; i < sc->nleg; i++){
+        leg = &(sc->leg[i]);
+        if(leg->nrow == 0){//这一路没有行，比如带了LIMIT 0
+            continue;
+        }
+        if(leg->nrow > 1){
+            scatter_fail(sc, NULL, 0, "myrelay: aggregate statement returned more than one row");
+            return;
+        }
+        p = (uint8_t *)(leg->buf->ptr + leg->head);
+        len[nrows] = p[0] | (p[1] << 8) | (p[2] << 16);
+        row[nrows] = p + HEADER_SIZE;
+        size += len[nrows];
+        nrows++;
+        leg->head = leg->qend;
+        leg->nrow = 0;
+    }
+
+    if(nrows == 0){
+        return;
+    }
+
+    if( (body = malloc(size + sc->ncol * SCATTER_NUM_LEN)) == NULL ){
+        scatter_fail(sc, NULL, 0, "myrelay: out of memory");
+        return;
+    }
+
+    for(p = body, i = 0; (uint64_t)i < sc->ncol; i++){
+        valid = 0;
+        isint = 1;
+        isum = 0;
+        dsum = 0;
+        scale = 0;
+        best = -1;
+
+        for(j = 0; j < nrows; j++){
+            if( (found = resp_field(row[j], len[j], i, &str, &slen)) < 0 ){
+                free(body);
+                scatter_fail(sc, NULL, 0, "myrelay: bad aggregate row");
+                return;
+            } else if(found == 0){//NULL不算
+                continue;
+            }
+
+            if( (sc->plan.agg[i] == SCATTER_AGG_MIN) || (sc->plan.agg[i] == SCATTER_AGG_MAX) ){
+                if( (best < 0) || \
+                        ((scatter_value_cmp(sc->type[i], sc->charset[i], str, slen, bstr, blen) < 0) == \
+                            (sc->plan.agg[i] == SCATTER_AGG_MIN)) ){
+                    best = j;
+                    bstr = str;
+                    blen = slen;
+                }
+                valid = 1;
+                continue;
+            }
+
+            if(slen >= sizeof(num)){
+                free(body);
+                scatter_fail(sc, NULL, 0, "myrelay: aggregate value too long");
+                return;
+            }
+            memcpy(num, str, slen);
+            num[slen] = '\0';
+
+            iv = strtoll(num, &end, 10);
+            if( isint && (*end == '\0') && (!__builtin_add_overflow(isum, iv, &isum)) ){
+                dsum += iv;
+            } else {
+                isint = 0;
+                dsum += strtold(num, NULL);
+                if( ((dot = strchr(num, '.')) != NULL) && ((int)strlen(dot + 1) > scale) ){
+                    scale = strlen(dot + 1);
+                }
+            }
+            valid = 1;
+        }
+
+        if(best >= 0){
+            str = bstr;
+            slen = blen;
+        } else if(valid || (sc->plan.agg[i] == SCATTER_AGG_COUNT)){
+            if(isint){
+                n = snprintf(num, sizeof(num), "%lld", isum);
+            } else {
+                n = snprintf(num, sizeof(num), "%.*Lf", scale, dsum);
+            }
+            str = (const uint8_t *)num;
+            slen = (n < (int)sizeof(num)) ? n : sizeof(num) - 1;
+        } else {
+            *p++ = 0xfb;
+            continue;
+        }
+
+        if(slen < 251){
+            *p++ = slen;
+        } else if(slen < 65536){
+            *p++ = 0xfc;
+            *p++ = slen & 0xff;
+            *p++ = (slen >> 8) & 0xff;
+        } else {
+            *p++ = 0xfd;
+            *p++ = slen & 0xff;
+            *p++ = (slen >> 8) & 0xff;
+            *p++ = (slen >> 16) & 0xff;
+        }
+        memcpy(p, str, slen);
+        p += slen;
+    }
+
+    scatter_row(sc, out, body, p - body);
+    free(body);
+}
+
+/*
+ * fun: compare first queued rows of two groups by ORDER BY
+ * arg: scatter context, two group index
+ * ret: less <0, equal 0, greater >0
+ *
+ */
+
+static int scatter_cmp(scatter_t *sc, int a, int b)
+{//NULL最小，跟mysql一样
+    int i, col, fa, fb, res;
+    uint32_t alen, blen;
+    uint64_t sa_len, sb_len;
+    const uint8_t *sa, *sb;
+    uint8_t *pa, *pb;
+
+    pa = (uint8_t *)(sc->leg[a].buf->ptr + sc->leg[a].head);
+    pb = (uint8_t *)(sc->leg[b].buf->ptr + sc->leg[b].head);
+    alen = pa[0] | (pa[1] << 8) | (pa[2] << 16);
+    blen = pb[0] | (pb[1] << 8) | (pb[2] << 16);
+
+    for(i = 0; i < sc->plan.norder; i++){
+        col = sc->key[i];
+        fa = resp_field(pa + HEADER_SIZE, alen, col, &sa, &sa_len);
+        fb = resp_field(pb + HEADER_SIZE, blen, col, &sb, &sb_len);
+
+        if( (fa <= 0) && (fb <= 0) ){
+            continue;
+        } else if(fa <= 0){
+            res = -1;
+        } else if(fb <= 0){
+            res = 1;
+        } else {
+            res = scatter_value_cmp(sc->type[col], sc->charset[col], sa, sa_len, sb, sb_len);
+        }
+
+        if(res != 0){
+            return sc->plan.order_desc[i] ? -res : res;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * fun: is value integer in text
+ * arg: value, length
+ * ret: yes 1, no 0
+ *
+ */
+
+static int scatter_is_int(const uint8_t *s, uint64_t len)
+{
+    uint64_t i = (len > 0) && (s[0] == '-');
+
+    if(i >= len){
+        return 0;
+    }
+
+    for(; i < len; i++){
+        if(!isdigit(s[i])){
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * fun: compare two values of column
+ * arg: column type, column charset, two values and length
+ * ret: less <0, equal 0, greater >0
+ *
+ */
+
+static int scatter_value_cmp(uint8_t type, uint16_t charset, const uint8_t *a, uint64_t alen, const uint8_t *b, uint64_t blen)
+{//数字按数值比，整数按位比不会丢精度；二进制的按字节比，其他的不区分大小写，不管排序规则
+    int res, neg;
+    uint64_t n;
+    char na[SCATTER_NUM_LEN], nb[SCATTER_NUM_LEN];
+    long double da, db;
+
+    switch(type){
+        case MYSQL_TYPE_DECIMAL:
+        case MYSQL_TYPE_NEWDECIMAL:
+        case MYSQL_TYPE_TINY:
+        case MYSQL_TYPE_SHORT:
+        case MYSQL_TYPE_LONG:
+        case MYSQL_TYPE_INT24:
+        case MYSQL_TYPE_LONGLONG:
+        case MYSQL_TYPE_FLOAT:
+        case MYSQL_TYPE_DOUBLE:
+        case MYSQL_TYPE_YEAR:
+            if(scatter_is_int(a, alen) && scatter_is_int(b, blen)){
+                if( (a[0] == '-') != (b[0] == '-') ){
+                    return (a[0] == '-') ? -1 : 1;
+                }
+                neg = (a[0] == '-');
+                a += neg;
+                alen -= neg;
+                b += neg;
+                blen -= neg;
+                for(; (alen > 1) && (a[0] == '0'); a++, alen--);
+                for(; (blen > 1) && (b[0] == '0'); b++, blen--);
+                res = (alen != blen) ? ((alen < blen) ? -1 : 1) : memcmp(a, b, alen);
+                return neg ? -res : res;
+            }
+            if( (alen < sizeof(na)) && (blen < sizeof(nb)) ){
+                memcpy(na, a, alen);
+                na[alen] = '\0';
+                memcpy(nb, b, blen);
+                nb[blen] = '\0';
+                da = strtold(na, NULL);
+                db = strtold(nb, NULL);
+                return (da < db) ? -1 : (da > db);
+            }
+            break;
+    }
+
+    n = (alen < blen) ? alen : blen;
+    if(charset == 63){//binary
+        res = memcmp(a, b, n);
+    } else {
+        res = strncasecmp((const char *)a, (const char *)b, n);
+    }
+
+    if(res == 0){
+        res = (alen < blen) ? -1 : (alen > blen);
+    }
+
+    return res;
+}
+
+/*
+ * fun: move heap node down to its place
+ * arg: scatter context, node index
+ * ret: void
+ *
+ */
+
+static void scatter_heap_down(scatter_t *sc, int i)
+{
+    int child, tmp;
+
+    while( (child = i * 2 + 1) < sc->nheap ){
+        if( (child + 1 < sc->nheap) && (scatter_cmp(sc, sc->heap[child + 1], sc->heap[child]) < 0) ){
+            child++;
+        }
+        if(scatter_cmp(sc, sc->heap[child], sc->heap[i]) >= 0){
+            break;
+        }
+        tmp = sc->heap[i];
+        sc->heap[i] = sc->heap[child];
+        sc->heap[child] = tmp;
+        i = child;
+    }
+}
+
+/*
+ * fun: move heap node up to its place
+ * arg: scatter context, node index
+ * ret: void
+ *
+ */
+
+static void scatter_heap_up(scatter_t *sc, int i)
+{
+    int parent, tmp;
+
+    while(i > 0){
+        parent = (i - 1) / 2;
+        if(scatter_cmp(sc, sc->heap[i], sc->heap[parent]) >= 0){
+            break;
+        }
+        tmp = sc->heap[i];
+        sc->heap[i] = sc->heap[parent];
+        sc->heap[parent] = tmp;
+        i = parent;
+    }
+}
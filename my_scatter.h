@@ -0,0 +1,95 @@
+#ifndef _MY_SCATTER_H_
+#define _MY_SCATTER_H_
+
+#include <stdint.h>
+#include "def.h"
+#include "my_buf.h"
+
+#define SCATTER_COL_MAX 256//结果最多几列，合并的时候要记每列的类型
+#define SCATTER_ORDER_MAX 8//ORDER BY最多几列
+#define SCATTER_NAME_LEN 64
+#define SCATTER_LEG_BUF (4 * 1024 * 1024)//一路排队的行超过这么多先不读这一路
+#define SCATTER_CLI_BUF (1024 * 1024)//给客户端攒的数据超过这么多先不读mysql
+
+//选择列表里的聚合函数，都是这几种的才能合并
+enum{
+    SCATTER_AGG_NONE = 0,
+    SCATTER_AGG_COUNT,
+    SCATTER_AGG_SUM,
+    SCATTER_AGG_MIN,
+    SCATTER_AGG_MAX
+};
+
+//合并方式
+enum{
+    SCATTER_MODE_STREAM = 0,//没有ORDER BY，哪一路的行先到先发
+    SCATTER_MODE_MERGE,//ORDER BY，每路都是排好序的，多路归并
+    SCATTER_MODE_AGG//聚合函数，每路一行，合成一行
+};
+
+//一路的进度
+enum{
+    SCATTER_STEP_USE_DB = 0,
+    SCATTER_STEP_SESS,
+    SCATTER_STEP_QUERY,
+    SCATTER_STEP_DONE
+};
+
+//从语句里看出来的合并方法
+typedef struct{
+    int ncol;//选择列表有几项
+    int nagg;//几项是聚合函数
+    int agg[SCATTER_COL_MAX];//每项的聚合函数，SCATTER_AGG_*
+    int norder;
+    int order_pos[SCATTER_ORDER_MAX];//ORDER BY第几列，从1开始，0表示按名字
+    char order_name[SCATTER_ORDER_MAX][SCATTER_NAME_LEN];
+    int order_desc[SCATTER_ORDER_MAX];
+    long long offset;
+    long long limit;//-1表示没有LIMIT
+    int limit_start;//LIMIT子句在语句里的开始和结束，有OFFSET的时候改写成LIMIT offset+limit
+    int limit_end;
+} scatter_plan_t;
+
+typedef struct{
+    buf_t *buf;//这一路mysql连接的缓冲，回复读到这里，排队的行也留在这里
+    void *my;
+    int step;//SCATTER_STEP_*
+    int state;//RESP_FIRST、RESP_FIELDS、RESP_ROWS、RESP_DONE
+    uint64_t ncol;//这一路结果的列数
+    size_t head;//排队的第一行
+    size_t qend;//排队的最后一行的结尾
+    size_t tail;//解析到哪了
+    int nrow;//排队的行数
+    int paused;//排队太多或者客户端写不动，先不读
+} scatter_leg_t;
+
+typedef struct{
+    scatter_plan_t plan;
+    int mode;//SCATTER_MODE_*
+    int nleg;
+    scatter_leg_t leg[MAX_MY_GROUP];
+    int running;//还没回完的路数
+    int header;//列定义已经发给客户端了
+    int failed;//有一路报错了，后面的行都不要了
+    uint64_t ncol;
+    uint8_t type[SCATTER_COL_MAX];
+    uint16_t charset[SCATTER_COL_MAX];
+    int key[SCATTER_ORDER_MAX];//ORDER BY是结果的第几列，从0开始
+    int heap[MAX_MY_GROUP];//有行排队的路，按第一行排成小顶堆
+    int nheap;
+    uint8_t seq;//发给客户端的下一个包序号
+    long long skip;//还要扔掉几行(OFFSET)
+    long long left;//还能发几行，-1不限
+    uint16_t status;//最后的EOF包带的服务器状态
+    buf_t err;//第一个ERR包，最后发给客户端
+    buf_t query;//发给每一组的COM_QUERY包
+    int writing;//给客户端的数据没写完，等着EPOLLOUT
+} scatter_t;
+
+scatter_t *scatter_new(const scatter_plan_t *plan, int nleg);
+void scatter_free(scatter_t *sc);
+int scatter_query(scatter_t *sc, const char *sql, int len);
+int scatter_input(scatter_t *sc, int index, buf_t *out);
+int scatter_leg_full(scatter_t *sc, int index);
+
+#endif
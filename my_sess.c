@@ -0,0 +1,601 @@
+/*
+ * Copyright 2011-2013 Alibaba Group Holding Limited. All rights reserved.
+ * Use and distribution licensed under the GPL license.
+ *
+ * Authors: XiaoJinliang <xiaoshi.xjl@taobao.com>
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdint.h>
+#include "my_sess.h"
+
+#define SESS_TRACK_SYSTEM_VARIABLES 0
+
+//SET语句里的一个赋值
+typedef struct{
+    int global;//改的是全局变量，不算会话状态，但是要发给mysql
+    int reset;//系统变量设成DEFAULT、用户变量设成NULL，跟没设过一样
+    char name[SESS_NAME_LEN];
+    char value[SESS_VALUE_LEN];
+} sess_item_t;
+
+//这些看起来像变量名，其实是别的SET语句，没法记下来
+static char *sess_reject_name[] = {"transaction", "password", "character", "charset", "role", "default", "resource", NULL};
+
+static const char *sess_skip_space(const char *p);
+static int sess_keyword(const char **pp, const char *kw);
+static int sess_ident(const char **pp, char *out, int size);
+static int sess_literal(const char **pp, char *out, int size);
+static int sess_item(const char **pp, sess_item_t *item);
+static int sess_find(const sess_state_t *s, const char *name);
+static int sess_append(char *sql, int size, int len, const char *name, const char *value);
+
+/*
+ * fun: init session state
+ * arg: session state
+ * ret: void
+ *
+ */
+
+void sess_init(sess_state_t *s)
+{
+    s->count = 0;
+}
+
+/*
+ * fun: copy session state
+ * arg: destination, source
+ * ret: void
+ *
+ */
+
+void sess_copy(sess_state_t *dst, const sess_state_t *src)
+{//只拷贝用到的部分
+    dst->count = src->count;
+    memcpy(dst->var, src->var, sizeof(sess_var_t) * src->count);
+}
+
+/*
+ * fun: set or remove one session variable
+ * arg: session state, variable name, literal value or NULL to remove
+ * ret: success 0, no room -1
+ *
+ */
+
+int sess_set(sess_state_t *s, const char *name, const char *value)
+{//改了值的变量挪到最后，重放的时候跟客户端设置的顺序一样
+    int i;
+
+    if( (strlen(name) >= SESS_NAME_LEN) || ((value != NULL) && (strlen(value) >= SESS_VALUE_LEN)) ){
+        return -1;
+    }
+
+    if( (i = sess_find(s, name)) >= 0 ){
+        if( (value != NULL) && (strcmp(s->var[i].value, value) == 0) ){
+            return 0;
+        }
+        s->count--;
+        memmove(&(s->var[i]), &(s->var[i + 1]), sizeof(sess_var_t) * (s->count - i));
+    }
+
+    if(value == NULL){
+        return 0;
+    }
+
+    if(s->count >= SESS_VAR_MAX){
+        return -1;
+    }
+
+    strcpy(s->var[s->count].name, name);
+    strcpy(s->var[s->count].value, value);
+    s->count++;
+
+    return 0;
+}
+
+/*
+ * fun: get value of one session variable
+ * arg: session state, variable name
+ * ret: value, not set NULL
+ *
+ */
+
+const char *sess_get(const sess_state_t *s, const char *name)
+{
+    int i;
+
+    if( (i = sess_find(s, name)) < 0 ){
+        return NULL;
+    }
+
+    return s->var[i].value;
+}
+
+/*
+ * fun: record session variables changed by SET statement
+ * arg: session state, sql, really change state or just check, assignments must be sent to mysql
+ * ret: tracked SET 1, not SET 0, SET can not be tracked -1
+ *
+ */
+
+int sess_set_sql(sess_state_t *s, const char *sql, int apply, int *nsend)
+{//整条语句都能认出来才算，值只认常量，表达式和函数重放出来的结果可能不一样
+    int i, n = 0, cur;
+    const char *p;
+    sess_item_t item[SESS_VAR_MAX];
+
+    *nsend = 0;
+
+    p = sess_skip_space(sql);
+    if(!sess_keyword(&p, "SET")){
+        return 0;
+    }
+
+    while(1){
+        if(n >= SESS_VAR_MAX){
+            return -1;
+        }
+        if(sess_item(&p, &(item[n])) < 0){
+            return -1;
+        }
+        n++;
+
+        p = sess_skip_space(p);
+        if(*p == ','){
+            p++;
+            continue;
+        }
+        if(*p == ';'){
+            p = sess_skip_space(p + 1);
+        }
+        if(*p != '\0'){
+            return -1;
+        }
+        break;
+    }
+
+    for(i = 0; i < n; i++){
+        if(item[i].global){
+            (*nsend)++;
+            continue;
+        }
+
+        cur = sess_find(s, item[i].name);
+        if(item[i].reset ? (cur < 0) : ((cur >= 0) && !strcmp(s->var[cur].value, item[i].value))){
+            continue;
+        }
+
+        (*nsend)++;
+        if(apply && (sess_set(s, item[i].name, item[i].reset ? NULL : item[i].value) < 0)){
+            return -1;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * fun: record system variables from session state info of OK packet
+ * arg: session state, state info, state info length
+ * ret: number of variables recorded, error -1
+ *
+ */
+
+int sess_track(sess_state_t *s, const uint8_t *ptr, int len)
+{//CLIENT_SESSION_TRACK时mysql在OK包里告诉我们哪些系统变量变了，变成了什么
+    int i, n = 0, num;
+    uint8_t type;
+    uint32_t dlen, nlen, vlen;
+    const uint8_t *end = ptr + len, *next;
+    char name[SESS_NAME_LEN], value[SESS_VALUE_LEN];
+
+    while(ptr < end){
+        type = *ptr++;
+        if( (ptr >= end) || (*ptr >= 0xfb) ){//每一项都很短，长度只认1个字节的
+            return -1;
+        }
+        dlen = *ptr++;
+        if(ptr + dlen > end){
+            return -1;
+        }
+        next = ptr + dlen;
+
+        if(type == SESS_TRACK_SYSTEM_VARIABLES){
+            if( (ptr >= next) || ((nlen = *ptr++) >= 0xfb) || (ptr + nlen >= next) || (nlen >= SESS_NAME_LEN) ){
+                return -1;
+            }
+            for(i = 0; i < (int)nlen; i++){
+                name[i] = tolower(ptr[i]);
+            }
+            name[nlen] = '\0';
+            ptr += nlen;
+
+            if( ((vlen = *ptr++) >= 0xfb) || (ptr + vlen > next) || (vlen + 3 > SESS_VALUE_LEN) ){
+                return -1;
+            }
+
+            num = (vlen > 0);
+            for(i = 0; i < (int)vlen; i++){
+                if( (ptr[i] == '\\') || (ptr[i] == '\'') ){//sql_mode可能不认反斜杠转义，这种值不记
+                    return -1;
+                }
+                if( !isdigit(ptr[i]) && !((i == 0) && (ptr[i] == '-') && (vlen > 1)) ){
+                    num = 0;
+                }
+            }
+
+            if(num){
+                memcpy(value, ptr, vlen);
+                value[vlen] = '\0';
+            } else {
+                snprintf(value, sizeof(value), "'%.*s'", (int)vlen, ptr);
+            }
+
+            if(sess_set(s, name, value) < 0){
+                return -1;
+            }
+            n++;
+        }
+
+        ptr = next;
+    }
+
+    return n;
+}
+
+/*
+ * fun: build SET statement turning mysql connection state into client state
+ * arg: client state, mysql connection state, sql buffer or NULL to count only, buffer size
+ * ret: number of assignments, 0 means same state, no room in buffer -1
+ *
+ */
+
+int sess_diff(const sess_state_t *want, const sess_state_t *have, char *sql, int size)
+{//先把连接上多出来的变量恢复默认，再按顺序设客户端的变量
+    int i, j, n = 0, len = 0;
+    const char *value;
+
+    if(sql != NULL){
+        if( (len = snprintf(sql, size, "SET ")) >= size ){
+            return -1;
+        }
+    }
+
+    for(i = 0; i < have->count; i++){
+        if(sess_find(want, have->var[i].name) >= 0){
+            continue;
+        }
+        if(sql != NULL){
+            if(have->var[i].name[0] == '@'){
+                value = "NULL";
+            } else {
+                value = "DEFAULT";
+            }
+            if( (len = sess_append(sql, size, len, have->var[i].name, value)) < 0 ){
+                return -1;
+            }
+        }
+        n++;
+    }
+
+    for(i = 0; i < want->count; i++){
+        j = sess_find(have, want->var[i].name);
+        if( (j >= 0) && !strcmp(have->var[j].value, want->var[i].value) ){
+            continue;
+        }
+        if(sql != NULL){
+            if( (len = sess_append(sql, size, len, want->var[i].name, want->var[i].value)) < 0 ){
+                return -1;
+            }
+        }
+        n++;
+    }
+
+    return n;
+}
+
+/*
+ * fun: skip white space
+ * arg: string
+ * ret: first non space char
+ *
+ */
+
+static const char *sess_skip_space(const char *p)
+{
+    while(isspace((unsigned char)*p)){
+        p++;
+    }
+
+    return p;
+}
+
+/*
+ * fun: match keyword, case insensitive
+ * arg: string pointer, keyword
+ * ret: matched 1 and skip it, not matched 0
+ *
+ */
+
+static int sess_keyword(const char **pp, const char *kw)
+{
+    int len = strlen(kw);
+    const char *p = *pp;
+
+    if(strncasecmp(p, kw, len) != 0){
+        return 0;
+    }
+
+    if( isalnum((unsigned char)p[len]) || (p[len] == '_') || (p[len] == '$') ){
+        return 0;
+    }
+
+    *pp = sess_skip_space(p + len);
+
+    return 1;
+}
+
+/*
+ * fun: read identifier in lower case
+ * arg: string pointer, output buffer, buffer size
+ * ret: identifier length, none or too long -1
+ *
+ */
+
+static int sess_ident(const char **pp, char *out, int size)
+{
+    int len = 0;
+    const char *p = *pp;
+
+    while( isalnum((unsigned char)*p) || (*p == '_') || (*p == '$') ){
+        if(len + 1 >= size){
+            return -1;
+        }
+        out[len++] = tolower((unsigned char)*p);
+        p++;
+    }
+    out[len] = '\0';
+
+    if(len == 0){
+        return -1;
+    }
+
+    *pp = p;
+
+    return len;
+}
+
+/*
+ * fun: read constant value as it is written
+ * arg: string pointer, output buffer, buffer size
+ * ret: success 0, not constant -1
+ *
+ */
+
+static int sess_literal(const char **pp, char *out, int size)
+{//字符串、数字或者ON、utf8这种单词
+    int len;
+    char q;
+    const char *p = *pp, *end;
+
+    if( (*p == '\'') || (*p == '"') ){
+        q = *p;
+        end = p + 1;
+        while(*end != '\0'){
+            if( (*end == '\\') && (end[1] != '\0') ){
+                end += 2;
+                continue;
+            }
+            if(*end == q){
+                if(end[1] != q){
+                    break;
+                }
+                end++;
+            }
+            end++;
+        }
+        if(*end != q){
+            return -1;
+        }
+        end++;
+    } else if( isdigit((unsigned char)*p) || \
+               (((*p == '-') || (*p == '+') || (*p == '.')) && isdigit((unsigned char)p[1])) ){
+        end = p + 1;
+        while( isalnum((unsigned char)*end) || (*end == '.') || \
+               (((*end == '-') || (*end == '+')) && ((end[-1] | 0x20) == 'e')) ){
+            end++;
+        }
+    } else if( isalpha((unsigned char)*p) || (*p == '_') ){
+        end = p;
+        while( isalnum((unsigned char)*end) || (*end == '_') ){
+            end++;
+        }
+    } else {
+        return -1;
+    }
+
+    q = *sess_skip_space(end);
+    if( (q != '\0') && (q != ',') && (q != ';') ){//后面还有东西就是表达式
+        return -1;
+    }
+
+    len = end - p;
+    if(len >= size){
+        return -1;
+    }
+    memcpy(out, p, len);
+    out[len] = '\0';
+
+    *pp = end;
+
+    return 0;
+}
+
+/*
+ * fun: parse one assignment of SET statement
+ * arg: string pointer, assignment
+ * ret: success 0, can not be tracked -1
+ *
+ */
+
+static int sess_item(const char **pp, sess_item_t *item)
+{
+    int i, len;
+    const char *p = sess_skip_space(*pp);
+    char charset[SESS_NAME_LEN], collate[SESS_NAME_LEN];
+
+    item->global = 0;
+    item->reset = 0;
+
+    if( sess_keyword(&p, "GLOBAL") || sess_keyword(&p, "PERSIST") || sess_keyword(&p, "PERSIST_ONLY") ){
+        item->global = 1;
+    } else if( sess_keyword(&p, "SESSION") || sess_keyword(&p, "LOCAL") ){
+        ;
+    } else if( (p[0] == '@') && (p[1] == '@') ){
+        p += 2;
+        if(!strncasecmp(p, "global.", 7)){
+            item->global = 1;
+            p += 7;
+        } else if(!strncasecmp(p, "session.", 8)){
+            p += 8;
+        } else if(!strncasecmp(p, "local.", 6)){
+            p += 6;
+        }
+    } else if(p[0] == '@'){//用户变量，名字不区分大小写
+        item->name[0] = '@';
+        p++;
+        if(sess_ident(&p, item->name + 1, SESS_NAME_LEN - 1) < 0){
+            return -1;
+        }
+        goto value;
+    }
+
+    if(sess_ident(&p, item->name, SESS_NAME_LEN) < 0){
+        return -1;
+    }
+
+    for(i = 0; sess_reject_name[i] != NULL; i++){
+        if(!strcmp(item->name, sess_reject_name[i])){
+            return -1;
+        }
+    }
+
+    if( (!item->global) && !strcmp(item->name, "names") ){//SET NAMES utf8 [COLLATE utf8_bin]，记成names=utf8 COLLATE utf8_bin
+        p = sess_skip_space(p);
+        if(sess_keyword(&p, "DEFAULT")){
+            item->reset = 1;
+            *pp = p;
+            return 0;
+        }
+
+        if( (*p == '\'') || (*p == '"') ){
+            p++;
+        }
+        if(sess_ident(&p, charset, sizeof(charset)) < 0){
+            return -1;
+        }
+        if( (*p == '\'') || (*p == '"') ){
+            p++;
+        }
+        p = sess_skip_space(p);
+
+        collate[0] = '\0';
+        if(sess_keyword(&p, "COLLATE")){
+            if( (*p == '\'') || (*p == '"') ){
+                p++;
+            }
+            if(sess_ident(&p, collate, sizeof(collate)) < 0){
+                return -1;
+            }
+            if( (*p == '\'') || (*p == '"') ){
+                p++;
+            }
+        }
+
+        if(collate[0] != '\0'){
+            len = snprintf(item->value, sizeof(item->value), "%s COLLATE %s", charset, collate);
+        } else {
+            len = snprintf(item->value, sizeof(item->value), "%s", charset);
+        }
+        if(len >= (int)sizeof(item->value)){
+            return -1;
+        }
+
+        *pp = p;
+        return 0;
+    }
+
+value:
+    p = sess_skip_space(p);
+    if(*p == '='){
+        p++;
+    } else if( (p[0] == ':') && (p[1] == '=') ){
+        p += 2;
+    } else {
+        return -1;
+    }
+    p = sess_skip_space(p);
+
+    if(sess_literal(&p, item->value, sizeof(item->value)) < 0){
+        return -1;
+    }
+
+    if(item->name[0] == '@'){
+        item->reset = !strcasecmp(item->value, "NULL");
+    } else {
+        item->reset = !strcasecmp(item->value, "DEFAULT");
+    }
+
+    *pp = p;
+
+    return 0;
+}
+
+/*
+ * fun: find session variable
+ * arg: session state, variable name
+ * ret: index, not found -1
+ *
+ */
+
+static int sess_find(const sess_state_t *s, const char *name)
+{
+    int i;
+
+    for(i = 0; i < s->count; i++){
+        if(!strcmp(s->var[i].name, name)){
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * fun: append one assignment to SET statement
+ * arg: sql buffer, buffer size, used length, variable name, value
+ * ret: new length, no room -1
+ *
+ */
+
+static int sess_append(char *sql, int size, int len, const char *name, const char *value)
+{
+    int n;
+    const char *sep = (len > 4) ? ", " : "";
+
+    if(!strcmp(name, "names")){
+        n = snprintf(sql + len, size - len, "%sNAMES %s", sep, value);
+    } else {
+        n = snprintf(sql + len, size - len, "%s%s = %s", sep, name, value);
+    }
+
+    if(n >= size - len){
+        return -1;
+    }
+
+    return len + n;
+}
@@ -0,0 +1,30 @@
+#ifndef _MY_SESS_H_
+#define _MY_SESS_H_
+
+#include <stdint.h>
+
+#define SESS_VAR_MAX 16
+#define SESS_NAME_LEN 64
+#define SESS_VALUE_LEN 128
+
+//会话里改过的一个变量：系统变量名字小写，用户变量带@，SET NAMES记成names
+typedef struct{
+    char name[SESS_NAME_LEN];
+    char value[SESS_VALUE_LEN];//能直接拼到SET语句里的值，字符串带着引号
+} sess_var_t;
+
+//会话状态，客户端一份，mysql连接一份，两份一样才能在这个连接上执行客户端的命令
+typedef struct{
+    int count;
+    sess_var_t var[SESS_VAR_MAX];
+} sess_state_t;
+
+void sess_init(sess_state_t *s);
+void sess_copy(sess_state_t *dst, const sess_state_t *src);
+int sess_set(sess_state_t *s, const char *name, const char *value);
+const char *sess_get(const sess_state_t *s, const char *name);
+int sess_set_sql(sess_state_t *s, const char *sql, int apply, int *nsend);
+int sess_track(sess_state_t *s, const uint8_t *ptr, int len);
+int sess_diff(const sess_state_t *want, const sess_state_t *have, char *sql, int size);
+
+#endif
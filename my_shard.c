@@ -0,0 +1,835 @@
+/*
+ * Copyright 2011-2013 Alibaba Group Holding Limited. All rights reserved.
+ * Use and distribution licensed under the GPL license.
+ *
+ * Authors: XiaoJinliang <xiaoshi.xjl@taobao.com>
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <hash.h>
+#include "my_conf.h"
+#include "my_scatter.h"
+#include "my_shard.h"
+
+#define SHARD_ROUTE_TABLE 8//一条语句里最多认几个分片表，再多就不管了
+#define SHARD_KEY_DIGITS 18//整数分片键最多几位，再长算字符串
+
+#define IS_SHARD_WORD(ch) (isalnum((unsigned char)(ch)) || ((ch) == '_') || ((ch) == '$'))
+
+//语句里的一个词，只记位置，不拷贝
+enum{
+    TOKEN_END = 0,
+    TOKEN_WORD,//关键字或者名字，反引号里的也算
+    TOKEN_NUM,
+    TOKEN_STR,
+    TOKEN_PUNCT,//其他单个字符
+};
+
+typedef struct{
+    int type;//TOKEN_*
+    const char *ptr;
+    int len;
+    int esc;//字符串里有转义、数字不是纯整数，拿不到原样的值
+} shard_token_t;
+
+//路由一条语句的状态，整条语句只扫一遍
+typedef struct{
+    const my_conf_t *conf;
+    const char *p;
+    const char *end;
+    const my_shard_conf_t *rule[SHARD_ROUTE_TABLE];//语句里用到的按列分片的表
+    int hit[SHARD_ROUTE_TABLE];//这个表的分片键找到了没有
+    int nrule;
+    int sharded;//用到了分片表
+    int group;//算出来的组，-1还没算出来
+    int bad;//算不出来，或者算出来不止一个组
+} shard_route_t;
+
+static __thread const my_conf_t *shard_conf;//这个线程的mysql配置，reload时内容会变，指针不变
+
+static void shard_next(shard_route_t *r, shard_token_t *t);
+static void shard_peek(shard_route_t *r, shard_token_t *t);
+static int shard_word_is(const shard_token_t *t, const char *kw);
+static void shard_hit(shard_route_t *r, int group);
+static void shard_table(shard_route_t *r, const shard_token_t *t);
+static int shard_token_int(const shard_token_t *t, long long *v);
+static int shard_key_group(const my_shard_conf_t *rule, const shard_token_t *t, int neg);
+static int shard_literal(shard_route_t *r, shard_token_t *t, int *neg);
+static void shard_key(shard_route_t *r, const shard_token_t *col, const shard_token_t *val, int neg);
+static int shard_is_key(shard_route_t *r, const shard_token_t *t);
+
+/*
+ * fun: set mysql config used by router of this thread
+ * arg: mysql config
+ * ret: void
+ *
+ */
+
+void shard_set(const my_conf_t *myconf)
+{
+    shard_conf = myconf;
+}
+
+/*
+ * fun: any shard rule configured
+ * arg: void
+ * ret: yes 1, no 0
+ *
+ */
+
+int shard_enabled(void)
+{
+    return (shard_conf != NULL) && (shard_conf->shard_count > 0);
+}
+
+/*
+ * fun: group for statement of shard table without shard key
+ * arg: void
+ * ret: group, -1 means error
+ *
+ */
+
+int shard_fallback(void)
+{
+    return shard_conf->shard_fallback;
+}
+
+/*
+ * fun: number of groups
+ * arg: void
+ * ret: number of groups
+ *
+ */
+
+int shard_groups(void)
+{
+    return shard_conf->gcount;
+}
+
+/*
+ * fun: find group of statement by shard rules
+ * arg: sql, sql length, group found
+ * ret: statement uses shard table 1, group <0 is SHARD_FALLBACK_*; not 0 and group is 0
+ *
+ */
+
+int shard_route(const char *sql, int len, int *group)
+{//只认简单的语句：FROM/JOIN/UPDATE/INTO后面的表，WHERE里的 键=常量、键 IN (常量, ...)，INSERT的列和VALUES
+    int i, first = 1, depth = 0, where = 0, expect = 0, in_from = 0, selects = 0, neg;
+    int ins = 0, ins_state = 0, ins_col = -1, ins_idx = 0, assign = 0;
+    shard_route_t r;
+    shard_token_t t, col, next, ins_key;
+
+    *group = 0;
+    if(!shard_enabled()){
+        return 0;
+    }
+
+    r.conf = shard_conf;
+    r.p = sql;
+    r.end = sql + len;
+    r.nrule = 0;
+    r.sharded = 0;
+    r.group = -1;
+    r.bad = 0;
+
+    for(shard_next(&r, &t); t.type != TOKEN_END; shard_next(&r, &t)){
+        if(t.type == TOKEN_PUNCT){
+            expect = (expect == 2) && (t.ptr[0] == '.');//库名.表名，后面的才是表名
+            switch(t.ptr[0]){
+                case '(':
+                    if( (++depth == 1) && ((ins_state == 1) || (ins_state == 3)) ){//INSERT的列名或者一行值开始
+                        ins_idx = 0;
+                    }
+                    break;
+                case ')':
+                    if( (--depth == 0) && (ins_state == 1) ){
+                        ins_state = 2;
+                    }
+                    break;
+                case ',':
+                    if( (depth == 1) && ((ins_state == 1) || (ins_state == 3)) ){
+                        ins_idx++;
+                    } else if( in_from && (depth == 0) ){//FROM a, b
+                        expect = 1;
+                    }
+                    break;
+                case ';':
+                    shard_peek(&r, &next);
+                    if(next.type != TOKEN_END){//多条语句
+                        r.bad = 1;
+                    }
+                    break;
+                case '|':
+                    if(where){//||也是OR
+                        r.bad = 1;
+                    }
+                    break;
+            }
+
+            if( (ins_state == 3) && (depth == 1) && (ins_idx == ins_col) && ((t.ptr[0] == '(') || (t.ptr[0] == ',')) ){
+                if(shard_literal(&r, &t, &neg) == 0){//这一行分片键的值
+                    shard_key(&r, &ins_key, &t, neg);
+                } else {
+                    r.bad = 1;
+                }
+            }
+            continue;
+        }
+
+        if(t.type != TOKEN_WORD){
+            expect = 0;
+            continue;
+        }
+
+        if(first){
+            first = 0;
+            if( shard_word_is(&t, "INSERT") || shard_word_is(&t, "REPLACE") ){
+                ins = 1;
+                expect = 1;
+                continue;
+            } else if(shard_word_is(&t, "UPDATE")){//只认开头的，ON DUPLICATE KEY UPDATE后面的不是表
+                expect = 1;
+                continue;
+            }
+        }
+
+        if( expect && (shard_word_is(&t, "INTO") || shard_word_is(&t, "IGNORE") || shard_word_is(&t, "LOW_PRIORITY") || \
+                shard_word_is(&t, "DELAYED") || shard_word_is(&t, "HIGH_PRIORITY") || shard_word_is(&t, "QUICK")) ){
+            continue;
+        }
+
+        if(expect == 1){
+            shard_table(&r, &t);
+            expect = 2;
+            if(ins && (ins_state == 0)){
+                ins_state = 1;
+            }
+            continue;
+        }
+        expect = 0;
+
+        if( shard_word_is(&t, "FROM") || shard_word_is(&t, "JOIN") ){
+            expect = 1;
+            in_from = shard_word_is(&t, "FROM");
+        } else if(shard_word_is(&t, "WHERE")){
+            where = 1;
+            in_from = 0;
+        } else if( shard_word_is(&t, "SELECT") || shard_word_is(&t, "UNION") ){//子查询、UNION里可能是别的表别的条件
+            if(++selects > 1){
+                r.bad = 1;
+            }
+        } else if( shard_word_is(&t, "OR") || shard_word_is(&t, "XOR") ){
+            if(where){
+                r.bad = 1;
+            }
+        } else if(shard_word_is(&t, "NOT")){
+            shard_peek(&r, &next);
+            if( where && ((next.type == TOKEN_PUNCT) || shard_is_key(&r, &next)) ){//NOT (键 = 1)、NOT 键 = 1
+                r.bad = 1;
+            }
+        } else if( ins && (ins_state < 3) && shard_word_is(&t, "SET") ){//INSERT ... SET 键 = 值
+            assign = 1;
+            ins_state = 0;
+        } else if(shard_word_is(&t, "ON")){
+            assign = 0;
+            in_from = 0;
+        } else if( ins && (shard_word_is(&t, "VALUES") || shard_word_is(&t, "VALUE")) ){
+            if( (ins_state != 2) && r.sharded ){//没写列名不知道第几个是分片键
+                r.bad = 1;
+            }
+            ins_state = 3;
+        } else if( (ins_state == 1) && (depth == 1) ){
+            if(shard_is_key(&r, &t)){
+                ins_col = ins_idx;
+                ins_key = t;
+            }
+        } else if( (where || assign) && (depth >= 0) && shard_is_key(&r, &t) ){
+            col = t;
+            shard_peek(&r, &next);
+            if( (next.type == TOKEN_PUNCT) && (next.ptr[0] == '=') ){
+                shard_next(&r, &next);
+                if(shard_literal(&r, &t, &neg) == 0){
+                    shard_key(&r, &col, &t, neg);
+                } else {
+                    r.bad = 1;
+                }
+            } else if(shard_word_is(&next, "IN")){
+                shard_next(&r, &next);
+                shard_next(&r, &next);
+                if( (next.type != TOKEN_PUNCT) || (next.ptr[0] != '(') ){//IN后面是子查询以外的东西
+                    r.bad = 1;
+                    continue;
+                }
+                do{
+                    if(shard_literal(&r, &t, &neg) < 0){
+                        r.bad = 1;
+                        break;
+                    }
+                    shard_key(&r, &col, &t, neg);
+                    shard_next(&r, &next);
+                } while( (next.type == TOKEN_PUNCT) && (next.ptr[0] == ',') );
+                if( (next.type != TOKEN_PUNCT) || (next.ptr[0] != ')') ){
+                    r.bad = 1;
+                }
+            }
+        }
+    }
+
+    if(!r.sharded){
+        return 0;
+    }
+
+    for(i = 0; i < r.nrule; i++){//每个按列分片的表都要找到分片键
+        if(!r.hit[i]){
+            r.bad = 1;
+        }
+    }
+
+    *group = (r.bad || (r.group < 0)) ? r.conf->shard_fallback : r.group;
+
+    return 1;
+}
+
+/*
+ * fun: find out how to merge results of SELECT sent to all groups
+ * arg: sql, sql length, plan
+ * ret: can be merged 0, can not -1
+ *
+ */
+
+int shard_plan(const char *sql, int len, scatter_plan_t *plan)
+{//选择列表要么都是COUNT/SUM/MIN/MAX，要么一个都没有；ORDER BY只能是列名或者序号；LIMIT只能是常量
+    int depth = 0, item = 1, agg, clause = 0, neg;
+    long long v[2];
+    shard_route_t r;
+    shard_token_t t, next;
+
+    bzero(plan, sizeof(*plan));
+    plan->limit = -1;
+
+    r.conf = shard_conf;
+    r.p = sql;
+    r.end = sql + len;
+
+    shard_next(&r, &t);
+    if(!shard_word_is(&t, "SELECT")){
+        return -1;
+    }
+
+    for(shard_next(&r, &t); t.type != TOKEN_END; shard_next(&r, &t)){
+        if( shard_word_is(&t, "ALL") || shard_word_is(&t, "SQL_NO_CACHE") || shard_word_is(&t, "SQL_CACHE") || \
+                shard_word_is(&t, "STRAIGHT_JOIN") || shard_word_is(&t, "HIGH_PRIORITY") || \
+                shard_word_is(&t, "SQL_SMALL_RESULT") || shard_word_is(&t, "SQL_BIG_RESULT") || \
+                shard_word_is(&t, "SQL_BUFFER_RESULT") ){
+            continue;
+        } else if( shard_word_is(&t, "DISTINCT") || shard_word_is(&t, "DISTINCTROW") ){//各组去重了合起来还会重复
+            return -1;
+        }
+        break;
+    }
+
+    for(; t.type != TOKEN_END; shard_next(&r, &t)){//选择列表，到FROM为止
+        if( (t.type == TOKEN_PUNCT) && (t.ptr[0] == '(') ){
+            depth++;
+        } else if( (t.type == TOKEN_PUNCT) && (t.ptr[0] == ')') ){
+            depth--;
+        } else if( (t.type == TOKEN_PUNCT) && (t.ptr[0] == ',') && (depth == 0) ){
+            item = 1;
+            continue;
+        } else if( (depth == 0) && shard_word_is(&t, "FROM") ){
+            break;
+        }
+
+        shard_peek(&r, &next);
+        agg = SCATTER_AGG_NONE;
+        if( (next.type == TOKEN_PUNCT) && (next.ptr[0] == '(') ){
+            if(shard_word_is(&t, "COUNT")){
+                agg = SCATTER_AGG_COUNT;
+            } else if(shard_word_is(&t, "SUM")){
+                agg = SCATTER_AGG_SUM;
+            } else if(shard_word_is(&t, "MIN")){
+                agg = SCATTER_AGG_MIN;
+            } else if(shard_word_is(&t, "MAX")){
+                agg = SCATTER_AGG_MAX;
+            } else if( shard_word_is(&t, "AVG") || shard_word_is(&t, "GROUP_CONCAT") || shard_word_is(&t, "STD") || \
+                    shard_word_is(&t, "STDDEV") || shard_word_is(&t, "VARIANCE") || shard_word_is(&t, "BIT_AND") || \
+                    shard_word_is(&t, "BIT_OR") || shard_word_is(&t, "BIT_XOR") ){
+                return -1;
+            }
+        }
+
+        if(item){//一项开始
+            if(plan->ncol >= SCATTER_COL_MAX){
+                return -1;
+            }
+            item = 0;
+            plan->agg[plan->ncol++] = agg;
+            if(agg == SCATTER_AGG_NONE){
+                continue;
+            }
+
+            shard_next(&r, &t);//(
+            shard_peek(&r, &next);
+            if( shard_word_is(&next, "DISTINCT") ){
+                return -1;
+            }
+            for(depth = 1; (depth > 0) && (t.type != TOKEN_END); ){
+                shard_next(&r, &t);
+                if(t.type == TOKEN_PUNCT){
+                    depth += (t.ptr[0] == '(') - (t.ptr[0] == ')');
+                }
+            }
+            shard_peek(&r, &next);
+            if( (next.type == TOKEN_END) || ((next.type == TOKEN_PUNCT) && (next.ptr[0] == ',')) || \
+                    (next.type == TOKEN_WORD) || ((next.type == TOKEN_PUNCT) && (next.ptr[0] == ';')) ){//后面是别名或者下一项
+                plan->nagg++;
+                continue;
+            }
+            plan->agg[plan->ncol - 1] = SCATTER_AGG_NONE;//COUNT(*) + 1这种
+            return -1;
+        } else if(agg != SCATTER_AGG_NONE){//表达式里的聚合函数
+            return -1;
+        }
+    }
+
+    if( (plan->nagg > 0) && (plan->nagg != plan->ncol) ){//聚合的和不聚合的混在一起要GROUP BY，合并不了
+        return -1;
+    }
+
+    for(; t.type != TOKEN_END; shard_next(&r, &t)){
+        if(t.type == TOKEN_PUNCT){
+            depth += (t.ptr[0] == '(') - (t.ptr[0] == ')');
+            if( (t.ptr[0] == ';') || (depth < 0) ){
+                break;
+            }
+            continue;
+        }
+        if( (depth > 0) || (t.type != TOKEN_WORD) ){
+            continue;
+        }
+
+        if( shard_word_is(&t, "GROUP") || shard_word_is(&t, "HAVING") || shard_word_is(&t, "UNION") || \
+                shard_word_is(&t, "WINDOW") || shard_word_is(&t, "FOR") || shard_word_is(&t, "LOCK") || \
+                shard_word_is(&t, "INTO") || shard_word_is(&t, "PROCEDURE") ){
+            return -1;
+        }
+
+        if( shard_word_is(&t, "ORDER") && (clause == 0) ){
+            shard_next(&r, &t);
+            if(!shard_word_is(&t, "BY")){
+                return -1;
+            }
+            clause = 1;
+            do{
+                if(plan->norder >= SCATTER_ORDER_MAX){
+                    return -1;
+                }
+                shard_next(&r, &t);
+                if( (t.type == TOKEN_NUM) && (!t.esc) ){
+                    if( (t.len >= 6) || (shard_token_int(&t, &v[0]) < 0) || (v[0] <= 0) ){
+                        return -1;
+                    }
+                    plan->order_pos[plan->norder] = v[0];
+                } else if(t.type == TOKEN_WORD){
+                    for(shard_peek(&r, &next); (next.type == TOKEN_PUNCT) && (next.ptr[0] == '.'); shard_peek(&r, &next)){//表名.列名
+                        shard_next(&r, &next);
+                        shard_next(&r, &t);
+                        if(t.type != TOKEN_WORD){
+                            return -1;
+                        }
+                    }
+                    if(t.len >= SCATTER_NAME_LEN){
+                        return -1;
+                    }
+                    memcpy(plan->order_name[plan->norder], t.ptr, t.len);
+                    plan->order_name[plan->norder][t.len] = '\0';
+                } else {
+                    return -1;
+                }
+
+                shard_next(&r, &t);
+                if( shard_word_is(&t, "ASC") || shard_word_is(&t, "DESC") ){
+                    plan->order_desc[plan->norder] = shard_word_is(&t, "DESC");
+                    shard_next(&r, &t);
+                }
+                plan->norder++;
+            } while( (t.type == TOKEN_PUNCT) && (t.ptr[0] == ',') );
+
+            if( (t.type == TOKEN_END) || ((t.type == TOKEN_PUNCT) && (t.ptr[0] == ';')) ){
+                break;
+            }
+            if(!shard_word_is(&t, "LIMIT")){//ORDER BY表达式
+                return -1;
+            }
+        }
+
+        if(shard_word_is(&t, "LIMIT")){
+            plan->limit_start = t.ptr - sql;
+            if( (shard_literal(&r, &t, &neg) < 0) || neg || (shard_token_int(&t, &v[0]) < 0) ){
+                return -1;
+            }
+            shard_next(&r, &next);
+            if( (next.type == TOKEN_PUNCT) && (next.ptr[0] == ',') ){
+                if( (shard_literal(&r, &t, &neg) < 0) || neg || (shard_token_int(&t, &v[1]) < 0) ){
+                    return -1;
+                }
+                plan->offset = v[0];
+                plan->limit = v[1];
+                shard_next(&r, &next);
+            } else if(shard_word_is(&next, "OFFSET")){
+                if( (shard_literal(&r, &t, &neg) < 0) || neg || (shard_token_int(&t, &v[1]) < 0) ){
+                    return -1;
+                }
+                plan->limit = v[0];
+                plan->offset = v[1];
+                shard_next(&r, &next);
+            } else {
+                plan->limit = v[0];
+            }
+            plan->limit_end = t.ptr + t.len - sql;
+
+            if( (next.type != TOKEN_END) && ((next.type != TOKEN_PUNCT) || (next.ptr[0] != ';')) ){
+                return -1;
+            }
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * fun: read next token, skip space and comment
+ * arg: route state, token
+ * ret: void
+ *
+ */
+
+static void shard_next(shard_route_t *r, shard_token_t *t)
+{//字符串里的转义不还原，有转义就标出来
+    const char *p = r->p, *end = r->end;
+    char quote;
+
+    for(;;){
+        while( (p < end) && isspace((unsigned char)*p) ){
+            p++;
+        }
+        if( (p + 1 < end) && (p[0] == '/') && (p[1] == '*') ){
+            for(p += 2; (p + 1 < end) && ((p[0] != '*') || (p[1] != '/')); p++);
+            p = (p + 1 < end) ? p + 2 : end;
+        } else if( (p < end) && ((*p == '#') || \
+                ((p + 1 < end) && (p[0] == '-') && (p[1] == '-') && ((p + 2 == end) || isspace((unsigned char)p[2])))) ){
+            while( (p < end) && (*p != '\n') ){
+                p++;
+            }
+        } else {
+            break;
+        }
+    }
+
+    t->ptr = p;
+    t->len = 0;
+    t->esc = 0;
+
+    if(p >= end){
+        t->type = TOKEN_END;
+    } else if(isdigit((unsigned char)*p)){
+        t->type = TOKEN_NUM;
+        while( (p < end) && (IS_SHARD_WORD(*p) || (*p == '.')) ){//1.5、1e3、0x1f都不是纯整数
+            if(!isdigit((unsigned char)*p)){
+                t->esc = 1;
+            }
+            p++;
+        }
+    } else if(IS_SHARD_WORD(*p)){
+        t->type = TOKEN_WORD;
+        while( (p < end) && IS_SHARD_WORD(*p) ){
+            p++;
+        }
+    } else if( (*p == '`') || (*p == '\'') || (*p == '"') ){
+        quote = *p++;
+        t->type = (quote == '`') ? TOKEN_WORD : TOKEN_STR;
+        t->ptr = p;
+        for(; p < end; p++){
+            if( (*p == '\\') && (quote != '`') ){
+                t->esc = 1;
+                if(++p >= end){
+                    break;
+                }
+            } else if(*p == quote){
+                if( (p + 1 < end) && (p[1] == quote) ){//两个引号是一个引号
+                    t->esc = 1;
+                    p++;
+                } else {
+                    break;
+                }
+            }
+        }
+        if(p >= end){//引号没配对，后面的不认了
+            t->type = TOKEN_END;
+            r->p = end;
+            return;
+        }
+        t->len = p - t->ptr;
+        r->p = p + 1;
+        return;
+    } else {
+        t->type = TOKEN_PUNCT;
+        p++;
+    }
+
+    t->len = p - t->ptr;
+    r->p = p;
+}
+
+/*
+ * fun: look at next token without reading it
+ * arg: route state, token
+ * ret: void
+ *
+ */
+
+static void shard_peek(shard_route_t *r, shard_token_t *t)
+{
+    const char *p = r->p;
+
+    shard_next(r, t);
+    r->p = p;
+}
+
+/*
+ * fun: is token the keyword
+ * arg: token, keyword in upper case
+ * ret: yes 1, no 0
+ *
+ */
+
+static int shard_word_is(const shard_token_t *t, const char *kw)
+{
+    return (t->type == TOKEN_WORD) && (t->len == (int)strlen(kw)) && (!strncasecmp(t->ptr, kw, t->len));
+}
+
+/*
+ * fun: merge group of one shard key or table
+ * arg: route state, group, -1 unknown
+ * ret: void
+ *
+ */
+
+static void shard_hit(shard_route_t *r, int group)
+{//一条语句只能发到一个组
+    if(group < 0){
+        r->bad = 1;
+    } else if(r->group < 0){
+        r->group = group;
+    } else if(r->group != group){
+        r->bad = 1;
+    }
+}
+
+/*
+ * fun: record table used by statement
+ * arg: route state, table name token
+ * ret: void
+ *
+ */
+
+static void shard_table(shard_route_t *r, const shard_token_t *t)
+{//按后缀分的表名字里就有组；按列分的记下来，后面找分片键
+    int i, j, tlen;
+    unsigned long n;
+    const my_shard_conf_t *rule;
+
+    for(i = 0; i < r->conf->shard_count; i++){
+        rule = &(r->conf->shard[i]);
+        tlen = strlen(rule->table);
+
+        if(rule->type == SHARD_SUFFIX){
+            if( (t->len <= tlen + 1) || strncasecmp(t->ptr, rule->table, tlen) || (t->ptr[tlen] != '_') ){
+                continue;
+            }
+            for(j = tlen + 1, n = 0; (j < t->len) && isdigit((unsigned char)t->ptr[j]) && (j - tlen <= SHARD_KEY_DIGITS); j++){
+                n = n * 10 + (t->ptr[j] - '0');
+            }
+            if(j < t->len){
+                continue;
+            }
+            r->sharded = 1;
+            shard_hit(r, rule->group[n % rule->count]);
+            return;
+        }
+
+        if( (t->len != tlen) || strncasecmp(t->ptr, rule->table, tlen) ){
+            continue;
+        }
+
+        r->sharded = 1;
+        for(j = 0; j < r->nrule; j++){
+            if(r->rule[j] == rule){
+                return;
+            }
+        }
+        if(r->nrule >= SHARD_ROUTE_TABLE){
+            r->bad = 1;
+            return;
+        }
+        r->rule[r->nrule] = rule;
+        r->hit[r->nrule] = 0;
+        r->nrule++;
+        return;
+    }
+}
+
+/*
+ * fun: is token shard key column of tables used
+ * arg: route state, token
+ * ret: yes 1, no 0
+ *
+ */
+
+static int shard_is_key(shard_route_t *r, const shard_token_t *t)
+{
+    int i;
+
+    if(t->type != TOKEN_WORD){
+        return 0;
+    }
+
+    for(i = 0; i < r->nrule; i++){
+        if( (t->len == (int)strlen(r->rule[i]->column)) && (!strncasecmp(t->ptr, r->rule[i]->column, t->len)) ){
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * fun: read constant value of shard key
+ * arg: route state, token, value is negative
+ * ret: success 0, not a plain constant -1
+ *
+ */
+
+static int shard_literal(shard_route_t *r, shard_token_t *t, int *neg)
+{//值后面只能是逗号、右括号、分号、结束或者AND这种词，键 = 1 + 2这种不认
+    shard_token_t next;
+
+    *neg = 0;
+    shard_next(r, t);
+    if( (t->type == TOKEN_PUNCT) && (t->ptr[0] == '-') ){
+        *neg = 1;
+        shard_next(r, t);
+        if(t->type != TOKEN_NUM){
+            return -1;
+        }
+    }
+
+    if( ((t->type != TOKEN_NUM) && (t->type != TOKEN_STR)) || t->esc ){
+        return -1;
+    }
+
+    shard_peek(r, &next);
+    if( (next.type == TOKEN_END) || \
+            ((next.type == TOKEN_PUNCT) && ((next.ptr[0] == ',') || (next.ptr[0] == ')') || (next.ptr[0] == ';'))) || \
+            ((next.type == TOKEN_WORD) && (!shard_word_is(&next, "DIV")) && (!shard_word_is(&next, "MOD")) && \
+                (!shard_word_is(&next, "COLLATE"))) ){
+        return 0;
+    }
+
+    return -1;
+}
+
+/*
+ * fun: route by one shard key value
+ * arg: route state, key column token, value token, value is negative
+ * ret: void
+ *
+ */
+
+static void shard_key(shard_route_t *r, const shard_token_t *col, const shard_token_t *val, int neg)
+{//几个表用同一个列名的，都算找到了
+    int i;
+
+    for(i = 0; i < r->nrule; i++){
+        if( (col->len == (int)strlen(r->rule[i]->column)) && (!strncasecmp(col->ptr, r->rule[i]->column, col->len)) ){
+            r->hit[i] = 1;
+            shard_hit(r, shard_key_group(r->rule[i], val, neg));
+        }
+    }
+}
+
+/*
+ * fun: value of integer token
+ * arg: token, value
+ * ret: success 0, not an integer -1
+ *
+ */
+
+static int shard_token_int(const shard_token_t *t, long long *v)
+{//语句不是'\0'结尾的，不能用atoll
+    int i;
+
+    if( (t->type != TOKEN_NUM) || (t->len <= 0) || (t->len > SHARD_KEY_DIGITS) ){
+        return -1;
+    }
+
+    for(*v = 0, i = 0; i < t->len; i++){
+        if(!isdigit((unsigned char)t->ptr[i])){
+            return -1;
+        }
+        *v = *v * 10 + (t->ptr[i] - '0');
+    }
+
+    return 0;
+}
+
+/*
+ * fun: group of shard key value
+ * arg: shard rule, value token, value is negative
+ * ret: group, not found -1
+ *
+ */
+
+static int shard_key_group(const my_shard_conf_t *rule, const shard_token_t *t, int neg)
+{//纯数字的字符串按整数算，跟应用里'123'和123落到同一片
+    int i, num;
+    long long v = 0;
+
+    num = (t->len > 0) && (t->len <= SHARD_KEY_DIGITS);
+    for(i = 0; num && (i < t->len); i++){
+        if(!isdigit((unsigned char)t->ptr[i])){
+            num = 0;
+            break;
+        }
+        v = v * 10 + (t->ptr[i] - '0');
+    }
+    if(neg){
+        v = -v;
+    }
+
+    if(rule->type == SHARD_RANGE){
+        if(!num){
+            return -1;
+        }
+        for(i = 0; i < rule->count; i++){
+            if(v < rule->bound[i]){
+                return rule->group[i];
+            }
+        }
+        return -1;
+    }
+
+    if(num){
+        return rule->group[((v % rule->count) + rule->count) % rule->count];
+    }
+
+    return rule->group[mmhash64(t->ptr, t->len) % rule->count];
+}
@@ -0,0 +1,14 @@
+#ifndef _MY_SHARD_H_
+#define _MY_SHARD_H_
+
+#include "my_conf.h"
+#include "my_scatter.h"
+
+void shard_set(const my_conf_t *myconf);
+int shard_enabled(void);
+int shard_fallback(void);
+int shard_groups(void);
+int shard_route(const char *sql, int len, int *group);
+int shard_plan(const char *sql, int len, scatter_plan_t *plan);
+
+#endif
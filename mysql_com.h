@@ -144,6 +144,8 @@ enum enum_server_command
 #define CLIENT_SECURE_CONNECTION 32768  /* New 4.1 authentication */
 #define CLIENT_MULTI_STATEMENTS (1UL << 16) /* Enable/disable multi-stmt support */
 #define CLIENT_MULTI_RESULTS    (1UL << 17) /* Enable/disable multi-results */
+#define CLIENT_SESSION_TRACK    (1UL << 23) /* Capable of handling server state change information */
+#define CLIENT_DEPRECATE_EOF    (1UL << 24) /* Client no longer needs EOF packet */
 
 #define CLIENT_SSL_VERIFY_SERVER_CERT (1UL << 30)
 #define CLIENT_REMEMBER_OPTIONS (1UL << 31)
@@ -210,6 +212,7 @@ enum enum_server_command
   number of result set columns.
 */
 #define SERVER_STATUS_METADATA_CHANGED 1024
+#define SERVER_SESSION_STATE_CHANGED (1UL << 14) /* Session state info follows in OK packet */
 
 /**
   Server status flags that must be cleared when starting
@@ -0,0 +1,22 @@
+#ifndef _CLOCK_H_
+#define _CLOCK_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int clock_init(void);
+void clock_update(void);
+time_t clock_sec(void);
+uint64_t clock_ms(void);
+uint64_t clock_us(void);
+const char *clock_str(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -7,6 +7,7 @@ extern "C" {
 
 int conf_init(const char *conf);
 int get_conf_int(const char *str, int def);
+int get_conf_msec(const char *str, int def);
 char *get_conf_str(const char *str, const char *def);
 
 #ifdef __cplusplus
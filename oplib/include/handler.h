@@ -2,6 +2,9 @@
 #define _HANDLER_H_
 
 #include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -11,13 +14,22 @@ int init_handler(int count);
 int add_handler(int fd, uint32_t event, void *cb, void *arg);
 int del_handler(int fd);
 int in_handler(int fd);
-/*
 int mod_handler(int fd, uint32_t event, void *cb, void *arg);
-*/
+int close_handler(int fd);
+int handler_pend(int fd);
 int epoll_handler(int timeout);
+int handler_stat(unsigned long *wait, unsigned long *ctl);
+int handler_set_backend(const char *name);
+const char *handler_backend_name(void);
+ssize_t handler_read(int fd, void *buf, size_t count);
+ssize_t handler_write(int fd, const void *buf, size_t count);
+int handler_accept(int fd, struct sockaddr_in *cliaddr, socklen_t *len);
 
 #define MAX_EVENT 100000
 
+#define HANDLER_EPOLL 0
+#define HANDLER_URING 1
+
 #define fd_is_legal(fd)  (fd >= 0) && (fd < hccount)
 
 #ifdef __cplusplus
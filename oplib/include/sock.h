@@ -11,7 +11,9 @@ extern "C" {
 #endif
 
 inline int make_listen_nonblock(const char *host, const char *serv);
+int make_listen_nonblock_reuseport(const char *host, const char *serv);
 inline int connect_nonblock(const char *host, const char *serv, int *flag);
+int connect_addr_nonblock(const struct sockaddr *addr, socklen_t addrlen, int *flag);
 inline int setnonblock(int fd);
 
 inline int accept_client(int sockfd, struct sockaddr_in *cliaddr, socklen_t *len);
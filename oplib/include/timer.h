@@ -1,15 +1,35 @@
 #ifndef _TIMER_H_
 #define _TIMER_H_
 
+#include <stdint.h>
+#include "list.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 typedef int (*timer_func_t)(unsigned long arg);
+
+//时间轮上的一个定时器，一般嵌在连接结构里面，加入和删除都是O(1)
+typedef struct{
+    struct list_head link;
+    uint64_t expire;//到期时间，毫秒
+    timer_func_t func;
+    unsigned long arg;
+} timer_node_t;
+
 int timer_init(void);
 int timer_register(timer_func_t func, unsigned long arg, char *info, int interval);
 int timer(void);
 
+void timer_node_init(timer_node_t *node, timer_func_t func, unsigned long arg);
+int timer_add(timer_node_t *node, int msec);
+int timer_del(timer_node_t *node);
+int timer_pending(timer_node_t *node);
+int timer_next(int max);
+uint64_t timer_now(void);
+void timer_stat(unsigned long *nadd, unsigned long *nfire, unsigned long *ncascade);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,125 @@
+/*
+ * Copyright 2011-2013 Alibaba Group Holding Limited. All rights reserved.
+ * Use and distribution licensed under the GPL license.
+ *
+ * Authors: XiaoJinliang <xiaoshi.xjl@taobao.com>
+ *
+ */
+
+#include <time.h>
+#include <stdint.h>
+#include "clock.h"
+
+//每个线程一份缓存的时间，事件循环每轮更新一次，回调里读的都是缓存
+//没有调用clock_init的线程(比如主进程)每次读都重新取时间
+static __thread int clock_cached;
+static __thread time_t clock_wall;//墙上时间，秒
+static __thread uint64_t clock_mono_ms;//单调时间，毫秒，用来算超时
+static __thread uint64_t clock_mono_us;//单调时间，微秒，用来算耗时
+static __thread time_t clock_str_sec = -1;
+static __thread char clock_strbuf[32];
+
+/*
+ * fun: cache clock in this thread, refreshed by clock_update
+ * arg: void
+ * ret: success=0, error=-1
+ *
+ */
+
+int clock_init(void)
+{//事件循环线程调用，之后由epoll_handler每轮调用clock_update
+    clock_update();
+    clock_cached = 1;
+
+    return 0;
+}
+
+/*
+ * fun: refresh cached clock
+ * arg: void
+ * ret: void
+ *
+ */
+
+void clock_update(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    clock_wall = ts.tv_sec;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    clock_mono_ms = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    clock_mono_us = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * fun: wall clock seconds
+ * arg: void
+ * ret: seconds since epoch
+ *
+ */
+
+time_t clock_sec(void)
+{
+    if(!clock_cached){
+        clock_update();
+    }
+
+    return clock_wall;
+}
+
+/*
+ * fun: monotonic clock in milliseconds, coarse
+ * arg: void
+ * ret: milliseconds
+ *
+ */
+
+uint64_t clock_ms(void)
+{
+    if(!clock_cached){
+        clock_update();
+    }
+
+    return clock_mono_ms;
+}
+
+/*
+ * fun: monotonic clock in microseconds
+ * arg: void
+ * ret: microseconds
+ *
+ */
+
+uint64_t clock_us(void)
+{
+    if(!clock_cached){
+        clock_update();
+    }
+
+    return clock_mono_us;
+}
+
+/*
+ * fun: wall clock string, "%F %T" format
+ * arg: void
+ * ret: time string
+ *
+ */
+
+const char *clock_str(void)
+{//秒数变了才重新格式化
+    struct tm tm;
+    time_t t = clock_sec();
+
+    if(t != clock_str_sec){
+        localtime_r(&t, &tm);
+        strftime(clock_strbuf, sizeof(clock_strbuf), "%F %T", &tm);
+        clock_str_sec = t;
+    }
+
+    return clock_strbuf;
+}
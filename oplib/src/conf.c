@@ -164,6 +164,47 @@ int get_conf_int(const char *str, int def)
     return var;
 }
 
+/*
+ * fun: get time variable in milliseconds
+ * arg: string & default milliseconds
+ * ret: milliseconds
+ *
+ */
+
+int get_conf_msec(const char *str, int def)
+{//"30"或者"30s"是秒，"500ms"是毫秒
+    long int var = 0;
+    char *endptr, *ptr;
+
+    if(str == NULL){
+        log(g_log, "argument null, return default[%d]\n", def);
+        return def;
+    }
+
+    ptr = conf_get(str);
+    if(ptr == NULL){
+        log(g_log, "argument[%s] not exist, return default[%d]\n", str, def);
+        return def;
+    }
+
+    errno = 0;
+    var = strtol(ptr, &endptr, 10);
+
+    if( (errno != 0) || (endptr == ptr) || (var < 0) ){
+        log(g_log, "argument[%s] value[%s] error, return default[%d]\n", str, ptr, def);
+        return def;
+    }
+
+    if(!strcmp(endptr, "ms")){
+        return (var > INT_MAX) ? INT_MAX : var;
+    } else if( (*endptr == '\0') || !strcmp(endptr, "s") ){
+        return (var > INT_MAX / 1000) ? INT_MAX : var * 1000;
+    }
+
+    log(g_log, "argument[%s] unit[%s] error, return default[%d]\n", str, endptr, def);
+    return def;
+}
+
 /*
  * fun: get string variable
  * arg: string and default string
@@ -9,13 +9,31 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <sys/epoll.h>
+#include <sys/socket.h>
 #include <errno.h>
+#include <unistd.h>
 #include <log.h>
+#include <list.h>
+#include <clock.h>
+#include <sock.h>
 #include "handler.h"
 
+#ifdef __has_include
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#ifdef IORING_SETUP_DEFER_TASKRUN//6.1以后的头文件才有，多次recv、多次accept、缓冲区环这些6.0就都有了
+#define HAVE_IO_URING 1
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
 extern log_t *g_log;
-extern unsigned long  g_logid;
+extern __thread unsigned long  g_logid;
 
 typedef int (cb_func)(int fd, void *arg);
 
@@ -23,11 +41,108 @@ typedef struct{
     cb_func *callback;
     void *arg;
     int fd;
+    uint32_t events;//当前在epoll里注册的事件，0表示没有注册
+    struct list_head pending;//边缘触发时，没处理完的fd挂在这里，下一轮直接再调一次
 } handler_callback_t;
 
-static int epfd;
-static handler_callback_t *hcptr = NULL;
-static int hccount = 0;
+//每个线程一套自己的handler，fd的回调只在注册它的线程里调用
+static __thread int epfd;
+static __thread handler_callback_t *hcptr = NULL;
+static __thread struct epoll_event *evptr = NULL;
+static __thread int hccount = 0;
+static __thread unsigned long nwait = 0;
+static __thread unsigned long nctl = 0;
+static __thread struct list_head pending_head;
+static __thread int backend = HANDLER_EPOLL;
+
+static int handler_ctl(int fd, uint32_t event, int rearm);
+
+#ifdef HAVE_IO_URING
+#define URING_ENTRIES 4096
+#define URING_BUF_COUNT 256//多次recv用的缓冲区个数，必须是2的幂，收到的数据马上拷走，缓冲区马上还回去
+#define URING_BUF_SIZE 16384
+#define URING_STASH_MAX (1 << 20)//一个fd收到还没读走的数据到这么多就停止收，读走一半再收
+#define URING_STASH_KEEP 65536//暂存区读空以后比这大的释放掉
+#define URING_SEND_MAX (1 << 20)//没发完的数据到这么多handler_write就返回EAGAIN
+#define URING_LINGER 5//关闭时还有数据没发完最多再等几秒
+
+#define URING_OP_POLL 1
+#define URING_OP_RECV 2
+#define URING_OP_SEND 3
+#define URING_OP_ACCEPT 4
+
+//user_data: 高8位操作，再8位poll或recv的序号，再16位fd的代数，低32位fd；0是取消和关闭请求，完成事件不用处理
+#define URING_DATA(op, seq, gen, fd) (((uint64_t)(op) << 56) | ((uint64_t)(uint8_t)(seq) << 48) | \
+                                        ((uint64_t)(uint16_t)(gen) << 32) | (uint32_t)(fd))
+
+#define URING_RAW 0//还没读写过的fd，就绪靠一次性poll
+#define URING_STREAM 1//读写都走io_uring: 多次recv收进暂存区，send攒到这一轮结束一起提交
+#define URING_LISTEN 2//多次accept收下的fd排队，handler_accept取
+
+typedef struct{
+    int kind;
+    uint16_t gen;//fd真正关闭一次加一，旧请求的完成事件都丢掉
+    uint8_t pseq;//poll和recv请求的序号，取消以后旧请求的完成事件不再改状态
+    uint8_t rseq;
+    uint32_t polled;//在途poll请求的事件，0表示没有
+    uint32_t pready;//poll报上来的就绪事件，回调跑过一次以后清掉
+    int recving;
+    int accepting;
+    int sending;
+    int eof;
+    int rerr;
+    int werr;
+    char *rbuf;//收到还没读走的数据是[roff, rlen)
+    uint32_t rsize, roff, rlen;
+    char *sbuf;//在途send的数据是[soff, slen)，完成之前不能动
+    uint32_t ssize, soff, slen;
+    char *wbuf;//send在途时新写的数据先攒在这里，发完一起换过去
+    uint32_t wsize, wlen;
+    int *aq;//accept收下还没取走的fd，[ahead, ahead + alen)环形
+    uint32_t acap, ahead, alen;
+    int closing;//关闭时数据还没发完，发完再真正关
+    time_t close_time;
+    struct list_head closing_link;
+} uring_fd_t;
+
+typedef struct{
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    unsigned sq_local;//本地的tail，进内核时才写回sq_tail
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *map;
+    size_t map_size;
+    size_t sqes_size;
+    struct io_uring_buf_ring *br;//注册给内核的缓冲区环，多次recv从这里挑缓冲区
+    char *bufs;
+    uint16_t buf_tail;
+} uring_t;
+
+static __thread uring_t ring;
+static __thread uring_fd_t *ufptr = NULL;
+static __thread struct list_head closing_head;//关闭时还在发数据的fd，按关闭时间排
+
+static int uring_init(int count);
+static int uring_update(int fd);
+static int uring_close(int fd);
+static int uring_stream(int fd);
+static int uring_recv_arm(int fd);
+static int uring_accept_arm(int fd);
+static int uring_send(int fd);
+static char *uring_grow(char *buf, uint32_t *size, uint32_t need);
+static void uring_buf_put(unsigned bid);
+static uint32_t uring_ready(int fd);
+static int uring_handler(int timeout);
+static void uring_call(int fd);
+#endif
 
 /*
  * fun: init handler
@@ -41,15 +156,31 @@ int init_handler(int count)
     int i;
     handler_callback_t *ptr;
 
-    if( (epfd = epoll_create(MAX_EVENT)) < 0 ){
+#ifdef HAVE_IO_URING
+    if( (backend == HANDLER_URING) && (uring_init(count) < 0) ){//内核不支持或者被禁用了，退回到epoll
+        log(g_log, "io_uring init fail, fall back to epoll\n");
+        backend = HANDLER_EPOLL;
+    }
+#else
+    backend = HANDLER_EPOLL;
+#endif
+
+    if( (backend == HANDLER_EPOLL) && ((epfd = epoll_create(MAX_EVENT)) < 0) ){
         log_err(g_log, "epoll_create error\n");
         return -1;
     }
 
     hcptr = (handler_callback_t *)malloc(sizeof(handler_callback_t) * count);
-    if(hcptr == NULL){
+    evptr = (struct epoll_event *)malloc(sizeof(struct epoll_event) * MAX_EVENT);//线程栈上放不下
+    if( (hcptr == NULL) || (evptr == NULL) ){
         log_err(g_log, "malloc error\n");
-        close(epfd);
+        free(hcptr);
+        free(evptr);
+        hcptr = NULL;
+        evptr = NULL;
+        if(backend == HANDLER_EPOLL){
+            close(epfd);
+        }
         return -1;
     }
 
@@ -58,13 +189,105 @@ int init_handler(int count)
         ptr->callback = NULL;
         ptr->fd = -1;
         ptr->arg = NULL;
+        ptr->events = 0;
+        INIT_LIST_HEAD(&(ptr->pending));
     }
 
+    INIT_LIST_HEAD(&pending_head);
     hccount = count;
 
     return 0;
 }
 
+/*
+ * fun: select event backend of this thread, must be called before init_handler
+ * arg: backend name, "epoll" or "io_uring"
+ * ret: success=0, error=-1
+ *
+ */
+
+int handler_set_backend(const char *name)
+{
+    if(!strcmp(name, "epoll")){
+        backend = HANDLER_EPOLL;
+    } else if(!strcmp(name, "io_uring")){
+        backend = HANDLER_URING;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * fun: get event backend in use
+ * arg:
+ * ret: backend name
+ *
+ */
+
+const char *handler_backend_name(void)
+{
+    return (backend == HANDLER_URING) ? "io_uring" : "epoll";
+}
+
+/*
+ * fun: make epoll registration of fd match event
+ * arg: handler fd, handler event, rearm edge triggered fd
+ * ret: success=0, error=-1
+ *
+ */
+
+static int handler_ctl(int fd, uint32_t event, int rearm)
+{//fd在整个生命周期里只注册一次，事件不变时不调用epoll_ctl，变化时只MOD一次
+ //边缘触发的fd换了回调也要MOD一次，让内核重新检查一下是否已经就绪，否则新回调可能永远等不到事件
+    int res, op;
+    struct epoll_event ev;
+    handler_callback_t *ptr;
+
+    ptr = hcptr + fd;
+
+#ifdef HAVE_IO_URING
+    if(backend == HANDLER_URING){//就绪由io_uring的完成事件算出来，都按水平触发
+        ptr->events = event & ~EPOLLET;
+        return uring_update(fd);
+    }
+#endif
+
+    if( (ptr->events == event) && !(rearm && (event & EPOLLET)) ){
+        return 0;
+    }
+
+    ev.data.u64 = 0;
+    ev.data.fd = fd;
+    ev.events = event;
+
+    op = ptr->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    nctl++;
+    if( (res = epoll_ctl(epfd, op, fd, &ev)) < 0 ){
+        //注册状态跟内核不一致时，换一种方式再试一次
+        if( (op == EPOLL_CTL_MOD) && (errno == ENOENT) ){
+            op = EPOLL_CTL_ADD;
+        } else if( (op == EPOLL_CTL_ADD) && (errno == EEXIST) ){
+            op = EPOLL_CTL_MOD;
+        } else {
+            log_err(g_log, "epoll_ctl error, fd[%d] op[%d]\n", fd, op);
+            ptr->events = 0;
+            return res;
+        }
+
+        nctl++;
+        if( (res = epoll_ctl(epfd, op, fd, &ev)) < 0 ){
+            log_err(g_log, "epoll_ctl error, fd[%d] op[%d]\n", fd, op);
+            ptr->events = 0;
+            return res;
+        }
+    }
+
+    ptr->events = event;
+
+    return 0;
+}
 
 /*
  * fun: add handler into handler pool
@@ -75,8 +298,7 @@ int init_handler(int count)
 
 int add_handler(int fd, uint32_t event, void *cb, void *arg)
 {
-    int res = 0;
-    struct epoll_event ev;
+    int res = 0, rearm;
     handler_callback_t *ptr;
 
     if(!fd_is_legal(fd)){
@@ -85,23 +307,17 @@ int add_handler(int fd, uint32_t event, void *cb, void *arg)
     }
 
     if(in_handler(fd)){
-        debug(g_log, "warning: in handler when add handler, ignore it\n");
-
-        if( (res = epoll_ctl(epfd, EPOLL_CTL_DEL, fd, &ev)) < 0 ){
-            log_err(g_log, "epoll_ctl error, ignore it\n");
-        }
+        debug(g_log, "warning: in handler when add handler, replace it\n");
     }
 
     ptr = hcptr + fd;
+    rearm = (ptr->callback != cb) || (ptr->arg != arg);
 
     ptr->callback = cb;
     ptr->arg = arg;
     ptr->fd = fd;
 
-    ev.data.ptr = ptr;
-    ev.events = event;
-    if( (res = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) < 0 ){
-        log_err(g_log, "epoll_ctl error\n");
+    if( (res = handler_ctl(fd, event, rearm)) < 0 ){
         ptr->callback = NULL;
         ptr->arg = NULL;
         ptr->fd = -1;
@@ -120,9 +336,8 @@ int add_handler(int fd, uint32_t event, void *cb, void *arg)
  */
 
 int del_handler(int fd)
-{
-    int res = 0;
-    struct epoll_event ev;
+{//只摘掉回调，fd仍留在epoll里，下次add/mod时只需要改事件;
+ //如果在这期间fd上来了事件，epoll_handler再真正从epoll里删除
     handler_callback_t *ptr;
 
     if(!fd_is_legal(fd)){
@@ -130,11 +345,7 @@ int del_handler(int fd)
         return -1;
     }
 
-    if(in_handler(fd)){
-        if( (res = epoll_ctl(epfd, EPOLL_CTL_DEL, fd, &ev)) < 0 ){
-            log_err(g_log, "epoll_ctl error\n");
-        }
-    } else {
+    if(!in_handler(fd)){
         debug(g_log, "warning: not in handler when del handler, fd:%d ignore it.\n", fd);
     }
 
@@ -142,8 +353,15 @@ int del_handler(int fd)
     ptr->callback = NULL;
     ptr->arg = NULL;
     ptr->fd = -1;
+    list_del_init(&(ptr->pending));
 
-    return res;
+#ifdef HAVE_IO_URING
+    if(backend == HANDLER_URING){//多次recv留着，数据先收进暂存区；poll没用了取消掉
+        uring_update(fd);
+    }
+#endif
+
+    return 0;
 }
 
 /*
@@ -154,9 +372,8 @@ int del_handler(int fd)
  */
 
 int mod_handler(int fd, uint32_t event, void *cb, void *arg)
-{
-    int res = 0;
-    struct epoll_event ev;
+{//状态切换用，只替换回调和参数，事件有变化时才调用一次EPOLL_CTL_MOD
+    int res = 0, rearm = 0;
     handler_callback_t *ptr;
 
     if(!fd_is_legal(fd)){
@@ -164,28 +381,98 @@ int mod_handler(int fd, uint32_t event, void *cb, void *arg)
         return -1;
     }
 
-    if(! in_handler(fd)){
+    if( (cb == NULL) && (!in_handler(fd)) ){
         log(g_log, "not in handler when mod handler\n");
         return -1;
     }
 
     ptr = hcptr + fd;
     if(cb){
+        rearm = (ptr->callback != cb) || (ptr->arg != arg);
         ptr->callback = cb;
         ptr->arg = arg;
         ptr->fd = fd;
     }
 
-    ev.data.ptr = ptr;
-    ev.events = event;
-    if( (res = epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev)) < 0 ){
-        log_err(g_log, "epoll_ctl error\n");
+    if( (res = handler_ctl(fd, event, rearm)) < 0 ){
+        ptr->callback = NULL;
+        ptr->arg = NULL;
+        ptr->fd = -1;
+
         return res;
     }
 
     return res;
 }
 
+/*
+ * fun: del handler and close fd
+ * arg: handler fd
+ * ret: success=0, error=-1
+ *
+ */
+
+int close_handler(int fd)
+{//close会把fd从epoll里删掉，这里只需要把注册状态清掉，不用再调用epoll_ctl
+ //io_uring下还有没发完的数据就等发完再关，在途的请求持有socket的引用，关之前都要取消
+    handler_callback_t *ptr;
+
+    if(fd_is_legal(fd)){
+        ptr = hcptr + fd;
+        ptr->callback = NULL;
+        ptr->arg = NULL;
+        ptr->fd = -1;
+        ptr->events = 0;
+        list_del_init(&(ptr->pending));
+
+#ifdef HAVE_IO_URING
+        if(backend == HANDLER_URING){
+            return uring_close(fd);
+        }
+#endif
+    }
+
+    return close(fd);
+}
+
+/*
+ * fun: call handler again in next loop without waiting for event
+ * arg: handler fd
+ * ret: success=0, error=-1
+ *
+ */
+
+int handler_pend(int fd)
+{//边缘触发下，回调因为预算用完没读写到EAGAIN时调用，不然不会再有事件通知
+    handler_callback_t *ptr;
+
+    if(!fd_is_legal(fd)){
+        return -1;
+    }
+
+    ptr = hcptr + fd;
+    if(list_empty(&(ptr->pending))){
+        list_add_tail(&(ptr->pending), &pending_head);
+    }
+
+    return 0;
+}
+
+/*
+ * fun: get handler syscall statistics
+ * arg: epoll_wait count, epoll_ctl count
+ * ret: always return 0
+ *
+ */
+
+int handler_stat(unsigned long *wait, unsigned long *ctl)
+{
+    *wait = nwait;
+    *ctl = nctl;
+
+    return 0;
+}
+
 /*
  * fun: check if handler in pool
  * arg: handler fd
@@ -220,19 +507,1027 @@ int in_handler(int fd)
 int epoll_handler(int timeout)
 {
     int i, nfds, res = 0;
-    struct epoll_event events[MAX_EVENT];
+    struct epoll_event *events = evptr;
+    struct list_head head;
     handler_callback_t *ptr;
 
+    if(!list_empty(&pending_head)){//还有没处理完的fd，不能阻塞
+        timeout = 0;
+    }
+
+#ifdef HAVE_IO_URING
+    if(backend == HANDLER_URING){//完成事件只更新fd的状态，就绪的fd都挂在pending上，下面统一调回调
+        nfds = uring_handler(timeout);
+        goto pending;
+    }
+#endif
+
     nfds = epoll_wait(epfd, events, MAX_EVENT, timeout);
+    clock_update();//这一轮回调里用的时间都从这里取
     //debug(g_log, "nfds: %d ready\n", nfds);
 
+    nwait++;
+
     for(i = 0; i < nfds; i++){
-        ptr = events[i].data.ptr;
+        ptr = hcptr + events[i].data.fd;
+        list_del_init(&(ptr->pending));
         if(ptr->callback){//调用其callback,不管读写都调用这个函数，原因是mysql是一来一回的protocal
 			++ g_logid ;
             res = ptr->callback(ptr->fd, ptr->arg);
+        } else if(ptr->events){//回调已经摘掉了但还有事件，这时才真正从epoll里删除
+            nctl++;
+            if(epoll_ctl(epfd, EPOLL_CTL_DEL, events[i].data.fd, &(events[i])) < 0){
+                log_err(g_log, "epoll_ctl del error, fd[%d]\n", events[i].data.fd);
+            }
+            ptr->events = 0;
+        }
+    }
+
+#ifdef HAVE_IO_URING
+pending:
+#endif
+    //上一轮预算用完的fd，每个再调一次，回调里还没处理完会再挂回来
+    INIT_LIST_HEAD(&head);
+    list_splice_init(&pending_head, &head);
+    while(!list_empty(&head)){
+        ptr = list_first_entry(&head, handler_callback_t, pending);
+        list_del_init(&(ptr->pending));
+#ifdef HAVE_IO_URING
+        if(backend == HANDLER_URING){
+            uring_call(ptr - hcptr);
+            continue;
+        }
+#endif
+        if(ptr->callback){
+			++ g_logid ;
+            res = ptr->callback(ptr->fd, ptr->arg);
         }
     }
 
     return nfds;
 }
+
+/*
+ * fun: read from fd registered in handler
+ * arg: handler fd, buffer, buffer size
+ * ret: same as read
+ *
+ */
+
+ssize_t handler_read(int fd, void *buf, size_t count)
+{//io_uring下从多次recv收下的暂存区里拷，空了返回EAGAIN；第一次读直接read，读完再交给多次recv
+#ifdef HAVE_IO_URING
+    ssize_t n;
+    uring_fd_t *uf;
+
+    if( (backend == HANDLER_URING) && fd_is_legal(fd) ){
+        uf = ufptr + fd;
+        if(uf->kind == URING_RAW){
+            if( ((n = read(fd, buf, count)) > 0) || ((n < 0) && (errno == EAGAIN)) ){
+                uring_stream(fd);
+            }
+            return n;
+        }
+
+        if(uf->rlen > uf->roff){
+            n = uf->rlen - uf->roff;
+            if((size_t)n > count){
+                n = count;
+            }
+            memcpy(buf, uf->rbuf + uf->roff, n);
+            uf->roff += n;
+            if(uf->roff == uf->rlen){
+                uf->roff = uf->rlen = 0;
+                if(uf->rsize > URING_STASH_KEEP){
+                    free(uf->rbuf);
+                    uf->rbuf = NULL;
+                    uf->rsize = 0;
+                }
+            }
+            if( (!uf->recving) && (uf->rlen - uf->roff < URING_STASH_MAX / 2) ){//满了停下来的，读走一半再收
+                uring_recv_arm(fd);
+            }
+            return n;
+        }
+
+        if(uf->rerr){
+            errno = uf->rerr;
+            return -1;
+        }
+        if(uf->eof){
+            return 0;
+        }
+
+        errno = EAGAIN;
+        return -1;
+    }
+#endif
+
+    return read(fd, buf, count);
+}
+
+/*
+ * fun: write to fd registered in handler
+ * arg: handler fd, data, data length
+ * ret: same as write
+ *
+ */
+
+ssize_t handler_write(int fd, const void *buf, size_t count)
+{//io_uring下拷进发送缓冲区就算写完了，send在这一轮结束进内核的时候一起提交；积压太多返回EAGAIN
+#ifdef HAVE_IO_URING
+    char *ptr;
+    uint32_t size;
+    uring_fd_t *uf;
+
+    if( (backend == HANDLER_URING) && fd_is_legal(fd) ){
+        uf = ufptr + fd;
+        if(uf->kind == URING_RAW){
+            uring_stream(fd);
+        }
+
+        if(uf->werr){
+            errno = uf->werr;
+            return -1;
+        }
+        if(uf->slen - uf->soff + uf->wlen >= URING_SEND_MAX){
+            errno = EAGAIN;
+            return -1;
+        }
+
+        if(!uf->sending){//没有在途的send，直接放进sbuf提交
+            if( (uf->ssize < count) && ((ptr = uring_grow(uf->sbuf, &(uf->ssize), count)) != NULL) ){
+                uf->sbuf = ptr;
+            }
+            if(uf->ssize < count){
+                errno = ENOMEM;
+                return -1;
+            }
+            memcpy(uf->sbuf, buf, count);
+            uf->soff = 0;
+            uf->slen = count;
+            if(uring_send(fd) < 0){
+                return -1;
+            }
+            return count;
+        }
+
+        size = uf->wlen + count;
+        if( (uf->wsize < size) && ((ptr = uring_grow(uf->wbuf, &(uf->wsize), size)) != NULL) ){
+            uf->wbuf = ptr;
+        }
+        if(uf->wsize < size){
+            errno = ENOMEM;
+            return -1;
+        }
+        memcpy(uf->wbuf + uf->wlen, buf, count);
+        uf->wlen = size;
+
+        return count;
+    }
+#endif
+
+    return write(fd, buf, count);
+}
+
+/*
+ * fun: accept client on listen fd registered in handler
+ * arg: listen fd, remote address, address length
+ * ret: client fd, error=-1
+ *
+ */
+
+int handler_accept(int fd, struct sockaddr_in *cliaddr, socklen_t *len)
+{//io_uring下从多次accept收下的队列里取，地址用getpeername补上；队列空了而且没有在途的accept就直接accept一次
+#ifdef HAVE_IO_URING
+    int clientfd;
+    socklen_t size = *len;
+    uring_fd_t *uf;
+
+    if( (backend == HANDLER_URING) && fd_is_legal(fd) ){
+        uf = ufptr + fd;
+        uf->kind = URING_LISTEN;
+
+        while(uf->alen > 0){
+            clientfd = uf->aq[uf->ahead];
+            uf->ahead = (uf->ahead + 1) % uf->acap;
+            uf->alen--;
+
+            *len = size;
+            if(getpeername(clientfd, (struct sockaddr *)cliaddr, len) < 0){//排队的时候对端已经断了
+                close(clientfd);
+                continue;
+            }
+            if(fd_is_legal(clientfd)){
+                uring_stream(clientfd);
+            }
+            return clientfd;
+        }
+
+        if(uf->accepting){
+            errno = EAGAIN;
+            return -1;
+        }
+
+        if( (clientfd = accept_client(fd, cliaddr, len)) >= 0 ){
+            if(fd_is_legal(clientfd)){
+                uring_stream(clientfd);
+            }
+            return clientfd;
+        }
+        if(errno == EAGAIN){
+            uring_accept_arm(fd);
+            errno = EAGAIN;
+        }
+        return -1;
+    }
+#endif
+
+    return accept_client(fd, cliaddr, len);
+}
+
+#ifdef HAVE_IO_URING
+
+/*
+ * fun: setup io_uring, map its rings and register recv buffers
+ * arg: max handler num
+ * ret: success=0, error=-1
+ *
+ */
+
+static int uring_init(int count)
+{//SINGLE_ISSUER和DEFER_TASKRUN要6.1以后的内核，不支持就退回epoll
+    unsigned i;
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    char *sq;
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP | IORING_SETUP_SUBMIT_ALL | \
+              IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    p.cq_entries = count;
+
+    if( (ring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p)) < 0 ){
+        log_err(g_log, "io_uring_setup error\n");
+        return -1;
+    }
+
+    if( !(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG) || \
+            !(p.features & IORING_FEAT_NODROP) ){
+        log(g_log, "io_uring features[%x] not enough\n", p.features);
+        close(ring.fd);
+        return -1;
+    }
+
+    ring.map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    if(ring.map_size < p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe)){
+        ring.map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    }
+
+    ring.map = mmap(NULL, ring.map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    if(ring.map == MAP_FAILED){
+        log_err(g_log, "mmap io_uring ring error\n");
+        close(ring.fd);
+        return -1;
+    }
+
+    ring.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if(ring.sqes == MAP_FAILED){
+        log_err(g_log, "mmap io_uring sqes error\n");
+        goto unmap_ring;
+    }
+
+    ring.br = mmap(NULL, URING_BUF_COUNT * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, \
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ring.bufs = malloc(URING_BUF_COUNT * URING_BUF_SIZE);
+    ufptr = (uring_fd_t *)calloc(count, sizeof(uring_fd_t));
+    if( (ring.br == MAP_FAILED) || (ring.bufs == NULL) || (ufptr == NULL) ){
+        log_err(g_log, "alloc io_uring buffers error\n");
+        goto free_bufs;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring.br;
+    reg.ring_entries = URING_BUF_COUNT;
+    reg.bgid = 0;
+    if(syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0){
+        log_err(g_log, "io_uring register buffer ring error\n");
+        goto free_bufs;
+    }
+
+    sq = (char *)ring.map;
+    ring.sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring.sq_entries = p.sq_entries;
+    ring.sq_local = *(ring.sq_tail);
+    ring.cq_head = (unsigned *)(sq + p.cq_off.head);
+    ring.cq_tail = (unsigned *)(sq + p.cq_off.tail);
+    ring.cq_mask = (unsigned *)(sq + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(sq + p.cq_off.cqes);
+
+    for(i = 0; i < ring.sq_entries; i++){//sqe和数组下标一一对应
+        ring.sq_array[i] = i;
+    }
+
+    ring.buf_tail = 0;
+    for(i = 0; i < URING_BUF_COUNT; i++){
+        uring_buf_put(i);
+    }
+
+    INIT_LIST_HEAD(&closing_head);//closing_link只在closing时有效，ufptr不用挨个初始化，没用到的fd不占内存
+
+    log(g_log, "io_uring init success, sq[%u] cq[%u]\n", p.sq_entries, p.cq_entries);
+
+    return 0;
+
+free_bufs:
+    if(ring.br != MAP_FAILED){
+        munmap(ring.br, URING_BUF_COUNT * sizeof(struct io_uring_buf));
+    }
+    free(ring.bufs);
+    free(ufptr);
+    ring.bufs = NULL;
+    ufptr = NULL;
+    munmap(ring.sqes, ring.sqes_size);
+unmap_ring:
+    munmap(ring.map, ring.map_size);
+    close(ring.fd);
+
+    return -1;
+}
+
+/*
+ * fun: submit queued sqes and run completions
+ * arg: number to wait, wait timeout in ms, -1 means forever
+ * ret: success>=0, error=-1
+ *
+ */
+
+static int uring_enter(unsigned wait, int timeout)
+{//DEFER_TASKRUN下完成事件只在带GETEVENTS进内核的时候才会跑，所以每轮都要进一次
+    unsigned submit;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+
+    __atomic_store_n(ring.sq_tail, ring.sq_local, __ATOMIC_RELEASE);
+    submit = ring.sq_local - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+
+    memset(&arg, 0, sizeof(arg));
+    if( wait && (timeout >= 0) ){
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000LL;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+
+    nwait++;
+
+    return syscall(__NR_io_uring_enter, ring.fd, submit, wait, \
+                    IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+/*
+ * fun: get a free sqe, flush the queue if it is full
+ * arg:
+ * ret: sqe, NULL when error
+ *
+ */
+
+static struct io_uring_sqe *uring_get_sqe(void)
+{
+    struct io_uring_sqe *sqe;
+
+    if(ring.sq_local - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) >= ring.sq_entries){
+        if( (uring_enter(0, 0) < 0) && (errno != EINTR) ){
+            log_err(g_log, "io_uring_enter submit error\n");
+            return NULL;
+        }
+        if(ring.sq_local - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) >= ring.sq_entries){
+            return NULL;
+        }
+    }
+
+    sqe = ring.sqes + (ring.sq_local & *(ring.sq_mask));
+    memset(sqe, 0, sizeof(*sqe));
+    ring.sq_local++;
+    nctl++;
+
+    return sqe;
+}
+
+/*
+ * fun: give a recv buffer back to the kernel
+ * arg: buffer id
+ * ret: void
+ *
+ */
+
+static void uring_buf_put(unsigned bid)
+{
+    struct io_uring_buf *buf;
+
+    buf = &(ring.br->bufs[ring.buf_tail & (URING_BUF_COUNT - 1)]);
+    buf->addr = (uint64_t)(uintptr_t)(ring.bufs + bid * URING_BUF_SIZE);
+    buf->len = URING_BUF_SIZE;
+    buf->bid = bid;
+    ring.buf_tail++;
+
+    __atomic_store_n(&(ring.br->tail), ring.buf_tail, __ATOMIC_RELEASE);
+}
+
+/*
+ * fun: grow buffer to hold need bytes
+ * arg: buffer, buffer size, bytes needed
+ * ret: new buffer and size updated, NULL when error
+ *
+ */
+
+static char *uring_grow(char *buf, uint32_t *size, uint32_t need)
+{
+    char *ptr;
+    uint32_t n;
+
+    for(n = (*size > 0) ? *size : URING_BUF_SIZE; n < need; n <<= 1);
+
+    if( (ptr = realloc(buf, n)) == NULL ){
+        log_err(g_log, "realloc %u error\n", n);
+        return NULL;
+    }
+    *size = n;
+
+    return ptr;
+}
+
+/*
+ * fun: cancel request in flight
+ * arg: user_data of request
+ * ret: success=0, error=-1
+ *
+ */
+
+static int uring_cancel(uint64_t data)
+{
+    struct io_uring_sqe *sqe;
+
+    if( (sqe = uring_get_sqe()) == NULL ){
+        log(g_log, "no sqe for cancel\n");
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = data;
+    sqe->user_data = 0;
+
+    return 0;
+}
+
+/*
+ * fun: start multishot recv on fd
+ * arg: handler fd
+ * ret: success=0, error=-1
+ *
+ */
+
+static int uring_recv_arm(int fd)
+{//收到的数据挑缓冲区环里的缓冲区，一个请求一直收到出错、对端关闭或者缓冲区用完
+    uring_fd_t *uf;
+    struct io_uring_sqe *sqe;
+
+    uf = ufptr + fd;
+    if( uf->recving || uf->eof || uf->rerr || (uf->kind != URING_STREAM) ){
+        return 0;
+    }
+
+    if( (sqe = uring_get_sqe()) == NULL ){
+        log(g_log, "no sqe for recv, fd[%d]\n", fd);
+        uf->rerr = ENOMEM;
+        return -1;
+    }
+
+    uf->rseq++;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = URING_DATA(URING_OP_RECV, uf->rseq, uf->gen, fd);
+    uf->recving = 1;
+
+    return 0;
+}
+
+/*
+ * fun: stop multishot recv on fd
+ * arg: handler fd
+ * ret: success=0, error=-1
+ *
+ */
+
+static int uring_recv_stop(int fd)
+{//序号加一，取消之前已经收到的数据照样进暂存区，但不会再改recving
+    uring_fd_t *uf;
+
+    uf = ufptr + fd;
+    if(!uf->recving){
+        return 0;
+    }
+
+    uf->recving = 0;
+    uf->rseq++;
+
+    return uring_cancel(URING_DATA(URING_OP_RECV, uf->rseq - 1, uf->gen, fd));
+}
+
+/*
+ * fun: start multishot accept on listen fd
+ * arg: listen fd
+ * ret: success=0, error=-1
+ *
+ */
+
+static int uring_accept_arm(int fd)
+{
+    uring_fd_t *uf;
+    struct io_uring_sqe *sqe;
+
+    uf = ufptr + fd;
+    if(uf->accepting){
+        return 0;
+    }
+
+    if( (sqe = uring_get_sqe()) == NULL ){
+        log(g_log, "no sqe for accept, fd[%d]\n", fd);
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK;
+    sqe->user_data = URING_DATA(URING_OP_ACCEPT, 0, uf->gen, fd);
+    uf->accepting = 1;
+
+    return 0;
+}
+
+/*
+ * fun: submit send of data in sbuf
+ * arg: handler fd
+ * ret: success=0, error=-1
+ *
+ */
+
+static int uring_send(int fd)
+{
+    uring_fd_t *uf;
+    struct io_uring_sqe *sqe;
+
+    uf = ufptr + fd;
+    if( (sqe = uring_get_sqe()) == NULL ){
+        log(g_log, "no sqe for send, fd[%d]\n", fd);
+        uf->werr = ENOMEM;
+        uf->soff = uf->slen = uf->wlen = 0;
+        errno = ENOMEM;
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)(uf->sbuf + uf->soff);
+    sqe->len = uf->slen - uf->soff;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = URING_DATA(URING_OP_SEND, 0, uf->gen, fd);
+    uf->sending = 1;
+
+    return 0;
+}
+
+/*
+ * fun: start io through io_uring on connected fd
+ * arg: handler fd
+ * ret: success=0, error=-1
+ *
+ */
+
+static int uring_stream(int fd)
+{
+    uring_fd_t *uf;
+
+    uf = ufptr + fd;
+    uf->kind = URING_STREAM;
+
+    return uring_recv_arm(fd);
+}
+
+/*
+ * fun: events fd is ready for
+ * arg: handler fd
+ * ret: EPOLLIN and/or EPOLLOUT
+ *
+ */
+
+static uint32_t uring_ready(int fd)
+{//暂存区有数据、对端关了、出错了算可读；积压没到上限或者出错了算可写
+    uint32_t ready;
+    uring_fd_t *uf;
+
+    uf = ufptr + fd;
+    ready = uf->pready;
+    if(ready & (EPOLLERR | EPOLLHUP)){
+        ready |= EPOLLIN | EPOLLOUT;
+    }
+
+    if(uf->kind == URING_STREAM){
+        if( (uf->rlen > uf->roff) || uf->eof || uf->rerr ){
+            ready |= EPOLLIN;
+        }
+        if( (uf->slen - uf->soff + uf->wlen < URING_SEND_MAX) || uf->werr ){
+            ready |= EPOLLOUT;
+        }
+    } else if(uf->kind == URING_LISTEN){
+        if(uf->alen > 0){
+            ready |= EPOLLIN;
+        }
+    }
+
+    return ready & (EPOLLIN | EPOLLOUT);
+}
+
+/*
+ * fun: pend fd if ready, make poll request match events not covered by io_uring io
+ * arg: handler fd
+ * ret: success=0, error=-1
+ *
+ */
+
+static int uring_update(int fd)
+{
+    uint32_t want, covered, pollev;
+    handler_callback_t *ptr;
+    uring_fd_t *uf;
+    struct io_uring_sqe *sqe;
+
+    ptr = hcptr + fd;
+    uf = ufptr + fd;
+
+    want = ptr->callback ? (ptr->events & (EPOLLIN | EPOLLOUT)) : 0;
+    if(uring_ready(fd) & want){
+        handler_pend(fd);
+    }
+
+    covered = 0;
+    if(uf->kind == URING_STREAM){
+        covered = EPOLLIN | EPOLLOUT;
+    } else if( (uf->kind == URING_LISTEN) && uf->accepting ){
+        covered = EPOLLIN;
+    }
+    pollev = want & ~covered;
+
+    if(uf->polled == pollev){
+        return 0;
+    }
+
+    if(uf->polled){
+        uring_cancel(URING_DATA(URING_OP_POLL, uf->pseq, uf->gen, fd));
+        uf->polled = 0;
+    }
+    if(pollev == 0){
+        return 0;
+    }
+
+    if( (sqe = uring_get_sqe()) == NULL ){
+        log(g_log, "no sqe for poll add, fd[%d]\n", fd);
+        return -1;
+    }
+
+    uf->pseq++;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = pollev;
+    sqe->user_data = URING_DATA(URING_OP_POLL, uf->pseq, uf->gen, fd);
+    uf->polled = pollev;
+
+    return 0;
+}
+
+/*
+ * fun: call handler of ready fd
+ * arg: handler fd
+ * ret: void
+ *
+ */
+
+static void uring_call(int fd)
+{//挂上pending以后状态可能又变了，调之前再看一次；回调以后还就绪就再挂上，相当于水平触发
+    handler_callback_t *ptr;
+
+    ptr = hcptr + fd;
+    if( ptr->callback && (uring_ready(fd) & ptr->events) ){
+        ++ g_logid ;
+        ptr->callback(fd, ptr->arg);
+    }
+
+    ufptr[fd].pready = 0;
+    uring_update(fd);
+}
+
+/*
+ * fun: really close fd, cancel requests in flight
+ * arg: handler fd
+ * ret: success=0, error=-1
+ *
+ */
+
+static int uring_close(int fd)
+{//还在发就等发完；取消和关闭一起在下次进内核时提交，取消必须在关闭前执行，fd号在那之前不会被复用
+    int res = 0;
+    uint16_t gen;
+    uring_fd_t *uf;
+    struct io_uring_sqe *cancel, *sqe;
+
+    uf = ufptr + fd;
+    if(uf->sending){
+        if(!uf->closing){
+            uf->closing = 1;
+            uf->close_time = clock_sec();
+            list_add_tail(&(uf->closing_link), &closing_head);
+            uring_recv_stop(fd);
+        }
+        return 0;
+    }
+
+    if( uf->polled || uf->recving || uf->accepting ){
+        if( ((cancel = uring_get_sqe()) != NULL) && ((sqe = uring_get_sqe()) != NULL) ){
+            cancel->opcode = IORING_OP_ASYNC_CANCEL;
+            cancel->fd = fd;
+            cancel->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+            cancel->flags = IOSQE_IO_HARDLINK;
+            cancel->user_data = 0;
+
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = fd;
+            sqe->user_data = 0;
+        } else {
+            log(g_log, "no sqe for close, fd[%d]\n", fd);
+            res = close(fd);
+        }
+    } else {
+        res = close(fd);
+    }
+
+    while(uf->alen > 0){//监听fd上收下还没取走的连接
+        close(uf->aq[uf->ahead]);
+        uf->ahead = (uf->ahead + 1) % uf->acap;
+        uf->alen--;
+    }
+
+    if(uf->closing){
+        list_del_init(&(uf->closing_link));
+    }
+    free(uf->rbuf);
+    free(uf->sbuf);
+    free(uf->wbuf);
+    free(uf->aq);
+
+    gen = uf->gen + 1;
+    memset(uf, 0, sizeof(uring_fd_t));
+    uf->gen = gen;
+
+    return res;
+}
+
+/*
+ * fun: append received data to stash of fd
+ * arg: handler fd, data, data length
+ * ret: success=0, error=-1
+ *
+ */
+
+static int uring_stash(int fd, const char *data, uint32_t len)
+{
+    char *ptr;
+    uring_fd_t *uf;
+
+    uf = ufptr + fd;
+    if( (uf->roff > 0) && (uf->rlen + len > uf->rsize) ){//前面读走的挪掉
+        memmove(uf->rbuf, uf->rbuf + uf->roff, uf->rlen - uf->roff);
+        uf->rlen -= uf->roff;
+        uf->roff = 0;
+    }
+
+    if(uf->rlen + len > uf->rsize){
+        if( (ptr = uring_grow(uf->rbuf, &(uf->rsize), uf->rlen + len)) == NULL ){
+            uf->rerr = ENOMEM;
+            return -1;
+        }
+        uf->rbuf = ptr;
+    }
+
+    memcpy(uf->rbuf + uf->rlen, data, len);
+    uf->rlen += len;
+
+    if(uf->rlen - uf->roff >= URING_STASH_MAX){//对端发得比读得快，先停下来
+        uring_recv_stop(fd);
+    }
+
+    return 0;
+}
+
+/*
+ * fun: handle send completion
+ * arg: handler fd, result
+ * ret: void
+ *
+ */
+
+static void uring_sent(int fd, int res)
+{//发了一部分就接着发剩下的，发完了换上攒着的数据再发
+    char *ptr;
+    uint32_t size;
+    uring_fd_t *uf;
+
+    uf = ufptr + fd;
+    uf->sending = 0;
+
+    if(res < 0){
+        uf->werr = -res;
+        uf->soff = uf->slen = uf->wlen = 0;
+    } else {
+        uf->soff += res;
+        if(uf->soff < uf->slen){
+            uring_send(fd);
+        } else if(uf->wlen > 0){
+            ptr = uf->sbuf;
+            size = uf->ssize;
+            uf->sbuf = uf->wbuf;
+            uf->ssize = uf->wsize;
+            uf->wbuf = ptr;
+            uf->wsize = size;
+            uf->soff = 0;
+            uf->slen = uf->wlen;
+            uf->wlen = 0;
+            uring_send(fd);
+        } else {
+            uf->soff = uf->slen = 0;
+        }
+    }
+
+    if( uf->closing && (!uf->sending) ){
+        uring_close(fd);
+    }
+}
+
+/*
+ * fun: handle one completion event
+ * arg: completion event
+ * ret: void
+ *
+ */
+
+static void uring_complete(struct io_uring_cqe *cqe)
+{
+    int fd, op, res, *aq;
+    unsigned bid = 0;
+    uint8_t seq;
+    uint16_t gen;
+    uint32_t acap;
+    char *data = NULL;
+    uring_fd_t *uf;
+
+    op = (int)(cqe->user_data >> 56);
+    seq = (uint8_t)(cqe->user_data >> 48);
+    gen = (uint16_t)(cqe->user_data >> 32);
+    fd = (int)(uint32_t)cqe->user_data;
+    res = cqe->res;
+
+    if( (op == URING_OP_RECV) && (cqe->flags & IORING_CQE_F_BUFFER) ){
+        bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        data = ring.bufs + bid * URING_BUF_SIZE;
+    }
+
+    if( (op == 0) || (!fd_is_legal(fd)) || (ufptr[fd].gen != gen) ){//fd已经关了，收到的缓冲区还是要还
+        if(data){
+            uring_buf_put(bid);
+        }
+        if( (op == URING_OP_ACCEPT) && (res >= 0) ){
+            close(res);
+        }
+        return;
+    }
+
+    uf = ufptr + fd;
+    switch(op){
+    case URING_OP_POLL:
+        if( (seq != uf->pseq) || (uf->polled == 0) ){
+            break;
+        }
+        uf->polled = 0;
+        if(res > 0){
+            uf->pready |= res;
+        } else if(res != -ECANCELED){
+            uf->pready |= EPOLLERR;
+        }
+        break;
+
+    case URING_OP_RECV:
+        if(res > 0){
+            uring_stash(fd, data, res);
+        }
+        if(data){
+            uring_buf_put(bid);
+        }
+        if( (cqe->flags & IORING_CQE_F_MORE) || (seq != uf->rseq) || (!uf->recving) ){
+            break;
+        }
+        uf->recving = 0;
+        if(res == 0){
+            uf->eof = 1;
+        } else if( (res > 0) || (res == -ENOBUFS) ){//缓冲区用完了，这一批完成事件处理完就都还回去了
+            if(uf->rlen - uf->roff < URING_STASH_MAX){
+                uring_recv_arm(fd);
+            }
+        } else if(res != -ECANCELED){
+            uf->rerr = -res;
+        }
+        break;
+
+    case URING_OP_SEND:
+        uring_sent(fd, res);
+        break;
+
+    case URING_OP_ACCEPT:
+        if(res >= 0){
+            if(uf->alen == uf->acap){
+                acap = uf->acap ? uf->acap * 2 : 64;
+                if( (aq = (int *)malloc(acap * sizeof(int))) == NULL ){
+                    log_err(g_log, "malloc accept queue error\n");
+                    close(res);
+                    break;
+                }
+                for(bid = 0; bid < uf->alen; bid++){
+                    aq[bid] = uf->aq[(uf->ahead + bid) % uf->acap];
+                }
+                free(uf->aq);
+                uf->aq = aq;
+                uf->acap = acap;
+                uf->ahead = 0;
+            }
+            uf->aq[(uf->ahead + uf->alen) % uf->acap] = res;
+            uf->alen++;
+        } else if(res != -ECANCELED){
+            log(g_log, "multishot accept error %d, fd[%d]\n", -res, fd);
+        }
+        if(!(cqe->flags & IORING_CQE_F_MORE)){//停了就靠poll等下一个连接，handler_accept再重新提交
+            uf->accepting = 0;
+        }
+        break;
+    }
+
+    uring_update(fd);
+}
+
+/*
+ * fun: io_uring handler poll
+ * arg: wait timeout
+ * ret: number of completion events
+ *
+ */
+
+static int uring_handler(int timeout)
+{
+    int nfds = 0;
+    unsigned head;
+    time_t now;
+    uring_fd_t *uf;
+
+    if( (uring_enter(timeout ? 1 : 0, timeout) < 0) && (errno != EINTR) && (errno != ETIME) ){
+        log_err(g_log, "io_uring_enter error\n");
+    }
+    clock_update();//这一轮回调里用的时间都从这里取
+
+    head = *(ring.cq_head);
+    while(head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)){
+        uring_complete(ring.cqes + (head & *(ring.cq_mask)));
+        head++;
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+        nfds++;
+    }
+
+    //关闭以后一直发不完的，对端可能不读了，shutdown让在途的send出错返回
+    now = clock_sec();
+    while(!list_empty(&closing_head)){
+        uf = list_first_entry(&closing_head, uring_fd_t, closing_link);
+        if(now - uf->close_time < URING_LINGER){
+            break;
+        }
+        list_del_init(&(uf->closing_link));
+        shutdown(uf - ufptr, SHUT_RDWR);
+    }
+
+    return nfds;
+}
+
+#endif
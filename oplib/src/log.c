@@ -16,12 +16,13 @@
 #include <stdarg.h>
 #include <unistd.h>
 #include <errno.h>
+#include "clock.h"
 #include "log.h"
 
 #define BUFFSIZE 8192
 
 static int log_inited = 0;
-unsigned long g_logid = 0 ;
+__thread unsigned long g_logid = 0 ;
 
 static int log_doit(log_t *log, int level, int flag, const char *file, \
                     int line, const char *func, const char *fmt, va_list ap);
@@ -131,9 +132,8 @@ static int log_doit(log_t *log, int level, int flag, const char *file, int line,
                             const char *func, const char *fmt, va_list ap)
 {
     int n = 0, len = 0, errno_res, ret, fd;
-    char buf[BUFFSIZE], timebuf[64], strerr[2048] = "";
+    char buf[BUFFSIZE], strerr[2048] = "";
     time_t t;
-    struct tm tm;
     static time_t last = 0;
 
     struct stat statbuf;
@@ -153,11 +153,7 @@ static int log_doit(log_t *log, int level, int flag, const char *file, int line,
 
     pid_t pid = getpid();
 
-    t = time(NULL);
-    localtime_r(&t, &tm);
-    strftime(timebuf, sizeof(timebuf), "%F %T", &tm);
-
-    n = snprintf(buf + len, BUFFSIZE - len - 1, "%s pid[%d] logid[%d] %s[%d] %s() - ", timebuf, pid, g_logid, file, line, func);
+    n = snprintf(buf + len, BUFFSIZE - len - 1, "%s pid[%d] logid[%d] %s[%d] %s() - ", clock_str(), pid, g_logid, file, line, func);
 
     if(n > BUFFSIZE - len - 1){
         n = BUFFSIZE - len - 1;
@@ -25,6 +25,8 @@ extern log_t *g_log;
 
 #define RESERVE_FOR_HEADER 64
 
+static int make_listen(const char *host, const char *serv, int reuseport);
+
 /*
  * fun: make listen socket and set nonblock
  * arg: listen address string, listen port string
@@ -33,6 +35,23 @@ extern log_t *g_log;
  */
 
 inline int make_listen_nonblock(const char *host, const char *serv)
+{
+    return make_listen(host, serv, 0);
+}
+
+/*
+ * fun: make SO_REUSEPORT listen socket and set nonblock
+ * arg: listen address string, listen port string
+ * ret: success=0, error=-1
+ *
+ */
+
+int make_listen_nonblock_reuseport(const char *host, const char *serv)
+{//多个线程各自listen同一个端口，由内核把连接分散到各个socket上
+    return make_listen(host, serv, 1);
+}
+
+static int make_listen(const char *host, const char *serv, int reuseport)
 {
     int                 fd;
     const int           on = 1;
@@ -59,6 +78,11 @@ inline int make_listen_nonblock(const char *host, const char *serv)
         debug(g_log, "socket success\n");
         // set socket reusable
         setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if(reuseport && (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)){
+            log_strerr(g_log, "setsockopt SO_REUSEPORT error\n");
+            close(fd);
+            continue;
+        }
         // disable nagle
         setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
 
@@ -150,6 +174,47 @@ inline int connect_nonblock(const char *host, const char *serv, int *flag)
     return(sockfd);
 }
 
+/*
+ * fun: connect to resolved address nonblock
+ * arg: address, address length, connected flag
+ * ret: success=sockfd, error=-1
+ *
+ */
+
+int connect_addr_nonblock(const struct sockaddr *addr, socklen_t addrlen, int *flag)
+{
+    const int on = 1;
+    int sockfd;
+
+    if( (sockfd = socket(addr->sa_family, SOCK_STREAM, 0)) < 0 ){
+        log_strerr(g_log, "socket error\n");
+        return -1;
+    }
+
+    // set socket reusable
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    // disable nagle
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    if(setnonblock(sockfd) != 0){
+        close(sockfd);
+        return -1;
+    }
+
+    if(connect(sockfd, addr, addrlen) < 0){
+        if(errno != EINPROGRESS){
+            log_strerr(g_log, "connect error\n");
+            close(sockfd);
+            return -1;
+        }
+        *flag = 0;
+    } else {
+        *flag = 1;
+    }
+
+    return sockfd;
+}
+
 /*
  * fun: set fd nonblock
  * arg: fd
@@ -196,7 +261,7 @@ inline int accept_client(int sockfd, struct sockaddr_in *cliaddr, socklen_t *len
 
 char* ip_to_string(uint32_t ip)
 {
-	static char result[32];
+	static __thread char result[32];
 
 	sprintf(result, "%d.%d.%d.%d",
 			(ip >> 24) & 0xFF,
@@ -1,29 +1,56 @@
 /*
  * Copyright 2011-2013 Alibaba Group Holding Limited. All rights reserved.
- * Use and distribution licensed under the GPL license.                   
+ * Use and distribution licensed under the GPL license.
  *
- * Authors: XiaoJinliang <xiaoshi.xjl@taobao.com>                          
+ * Authors: XiaoJinliang <xiaoshi.xjl@taobao.com>
  *
  */
 
 #include <time.h>
+#include <stdint.h>
 #include "log.h"
+#include "list.h"
+#include "clock.h"
 #include "timer.h"
 
 extern log_t *g_log;
 
+//分层时间轮，精度1毫秒，跟linux内核老的timer wheel一样
+//第0层256个槽，每槽1毫秒；后面4层每层64个槽，每槽是上一层一圈的时间
+//最多可以放2^32毫秒(49天)以后的定时器，再远的按最远的算
+#define TVR_BITS 8
+#define TVN_BITS 6
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_MASK (TVR_SIZE - 1)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVN_LEVEL 4
+#define TV_SHIFT(n) (TVR_BITS + (n) * TVN_BITS)
+#define TV_INDEX(j, n) (((j) >> TV_SHIFT(n)) & TVN_MASK)
+#define TV_MAX ((1ULL << TV_SHIFT(TVN_LEVEL)) - 1)
+
 struct timer_func_map{
     timer_func_t func;
     char *info;
     unsigned long arg;
-    time_t lasttime;
     int interval;
+    timer_node_t node;
 };
 
 #define MAX_FUNC_MAP 1024
 
-static struct timer_func_map func_map[MAX_FUNC_MAP];
-static int func_map_index;
+static __thread struct timer_func_map func_map[MAX_FUNC_MAP];
+static __thread int func_map_index;
+
+static __thread struct list_head tv1[TVR_SIZE];
+static __thread struct list_head tvn[TVN_LEVEL][TVN_SIZE];
+static __thread uint64_t timer_jiffies;//下一个要处理的毫秒
+static __thread int timer_count;//轮子上的定时器个数
+static __thread unsigned long timer_nadd, timer_nfire, timer_ncascade;
+
+static void timer_internal_add(timer_node_t *node);
+static int timer_cascade(int n, int index);
+static int timer_periodic(unsigned long arg);
 
 /*
  * fun: init timer
@@ -34,17 +61,27 @@ static int func_map_index;
 
 int timer_init(void)
 {//初始化func_map， 最多MAX_FUNC_MAP隔定时器事件
-    int i;
+    int i, n;
 
     for(i = 0; i < MAX_FUNC_MAP; i++){
         func_map[i].func = NULL;
         func_map[i].info = NULL;
         func_map[i].arg = 0;
-        func_map[i].lasttime= 0;
         func_map[i].interval = 0;
     }
     func_map_index = 0;
 
+    for(i = 0; i < TVR_SIZE; i++){
+        INIT_LIST_HEAD(&(tv1[i]));
+    }
+    for(n = 0; n < TVN_LEVEL; n++){
+        for(i = 0; i < TVN_SIZE; i++){
+            INIT_LIST_HEAD(&(tvn[n][i]));
+        }
+    }
+    timer_jiffies = timer_now();
+    timer_count = 0;
+
     return 0;
 }
 
@@ -56,7 +93,9 @@ int timer_init(void)
  */
 
 int timer_register(timer_func_t func, unsigned long arg, char *info, int interval)
-{
+{//周期定时器也挂在时间轮上，每次到期后重新加进去，第一次马上执行
+    struct timer_func_map *fmap;
+
     if(func_map_index >= MAX_FUNC_MAP){
         return -1;
     }
@@ -69,11 +108,14 @@ int timer_register(timer_func_t func, unsigned long arg, char *info, int interva
         info = "";
     }
 
-    func_map[func_map_index].func = func;
-    func_map[func_map_index].info = info;
-    func_map[func_map_index].arg  = arg;
-    func_map[func_map_index].lasttime = 0;
-    func_map[func_map_index].interval= interval;
+    fmap = &(func_map[func_map_index]);
+    fmap->func = func;
+    fmap->info = info;
+    fmap->arg  = arg;
+    fmap->interval= interval;
+
+    timer_node_init(&(fmap->node), timer_periodic, (unsigned long)fmap);
+    timer_add(&(fmap->node), 0);
 
     func_map_index++;
 
@@ -81,34 +123,283 @@ int timer_register(timer_func_t func, unsigned long arg, char *info, int interva
 }
 
 /*
- * fun: run timer loop
+ * fun: run expired timers
  * arg: void
  * ret: always return 0
  *
  */
 
 int timer(void)
-{//循环遍历，处理定时器
-    int i, ret;
-    time_t now = time(NULL);
-    struct timer_func_map *fmap;
+{//从上次处理到的毫秒一直走到现在，每走到第0层一圈的开头就把上层的一个槽往下拆
+    int n, index;
+    uint64_t now = timer_now();
+    struct list_head work;
+    timer_node_t *node;
+
+    if(timer_count == 0){
+        timer_jiffies = now + 1;
+        return 0;
+    }
+
+    while(timer_jiffies <= now){
+        index = timer_jiffies & TVR_MASK;
+        if(index == 0){
+            for(n = 0; n < TVN_LEVEL; n++){
+                if(timer_cascade(n, TV_INDEX(timer_jiffies, n)) != 0){
+                    break;
+                }
+            }
+        }
+        timer_jiffies++;
+
+        INIT_LIST_HEAD(&work);
+        list_splice_init(&(tv1[index]), &work);
+        while(!list_empty(&work)){//回调里可能删除或者重新加入别的定时器，所以每次都取第一个
+            node = list_entry(work.next, timer_node_t, link);
+            list_del_init(&(node->link));
+            timer_count--;
+            timer_nfire++;
+            node->func(node->arg);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * fun: init timer node
+ * arg: timer node, callback function, argument
+ * ret: void
+ *
+ */
+
+void timer_node_init(timer_node_t *node, timer_func_t func, unsigned long arg)
+{
+    INIT_LIST_HEAD(&(node->link));
+    node->expire = 0;
+    node->func = func;
+    node->arg = arg;
+}
+
+/*
+ * fun: add or re-arm timer node
+ * arg: timer node, milliseconds from now
+ * ret: success=0, error=-1
+ *
+ */
+
+int timer_add(timer_node_t *node, int msec)
+{
+    if( (node == NULL) || (node->func == NULL) ){
+        return -1;
+    }
+
+    if(!list_empty(&(node->link))){
+        list_del_init(&(node->link));
+        timer_count--;
+    }
+
+    if(msec < 0){
+        msec = 0;
+    }
+
+    node->expire = timer_now() + msec;
+    timer_internal_add(node);
+    timer_count++;
+    timer_nadd++;
+
+    return 0;
+}
+
+/*
+ * fun: cancel timer node
+ * arg: timer node
+ * ret: success=0, error=-1
+ *
+ */
+
+int timer_del(timer_node_t *node)
+{
+    if(node == NULL){
+        return -1;
+    }
+
+    if(!list_empty(&(node->link))){
+        list_del_init(&(node->link));
+        timer_count--;
+    }
+
+    return 0;
+}
+
+/*
+ * fun: is timer node on the wheel
+ * arg: timer node
+ * ret: pending 1, not pending 0
+ *
+ */
+
+int timer_pending(timer_node_t *node)
+{
+    return !list_empty(&(node->link));
+}
+
+/*
+ * fun: milliseconds until next timer may expire
+ * arg: max milliseconds to return
+ * ret: milliseconds, 0 means timer is already expired
+ *
+ */
+
+int timer_next(int max)
+{//第0层算出来的是准确时间，上层只能算出它被拆下来的时间，这个时间不会晚于到期时间
+    int i, n;
+    uint64_t now, next, base, index;
+
+    if(timer_count == 0){
+        return max;
+    }
+
+    next = timer_jiffies + TV_MAX;
 
-    for(i = 0; i < func_map_index; i++){//这里最好能够优化一下，记录下次的最近一个定时器还要多久触发。类似redis,来确定epoll的超时
-        fmap = &(func_map[i]);
-        if(fmap->func == NULL){
+    for(i = 0; i < TVR_SIZE; i++){
+        if(!list_empty(&(tv1[(timer_jiffies + i) & TVR_MASK]))){
+            next = timer_jiffies + i;
             break;
+        }
+    }
+
+    for(n = 0; n < TVN_LEVEL; n++){
+        base = ((timer_jiffies + (1ULL << TV_SHIFT(n)) - 1) >> TV_SHIFT(n)) << TV_SHIFT(n);
+        if(base >= next){
+            break;
+        }
+        index = TV_INDEX(base, n);
+        for(i = 0; i < TVN_SIZE; i++){
+            if(!list_empty(&(tvn[n][(index + i) & TVN_MASK]))){
+                if(base + ((uint64_t)i << TV_SHIFT(n)) < next){
+                    next = base + ((uint64_t)i << TV_SHIFT(n));
+                }
+                break;
+            }
+        }
+    }
+
+    now = timer_now();
+    if(next <= now){
+        return 0;
+    }
+
+    return (next - now > (uint64_t)max) ? max : (int)(next - now);
+}
+
+/*
+ * fun: monotonic clock in milliseconds, cached per event loop
+ * arg: void
+ * ret: milliseconds
+ *
+ */
+
+uint64_t timer_now(void)
+{
+    return clock_ms();
+}
+
+/*
+ * fun: get timer wheel counters of this thread
+ * arg: added, fired and cascaded count
+ * ret: void
+ *
+ */
+
+void timer_stat(unsigned long *nadd, unsigned long *nfire, unsigned long *ncascade)
+{
+    *nadd = timer_nadd;
+    *nfire = timer_nfire;
+    *ncascade = timer_ncascade;
+}
+
+/*
+ * fun: put node into wheel slot by expire time
+ * arg: timer node
+ * ret: void
+ *
+ */
+
+static void timer_internal_add(timer_node_t *node)
+{
+    int n;
+    uint64_t idx;
+    struct list_head *vec;
+
+    if((int64_t)(node->expire - timer_jiffies) < 0){//已经过期的放到下一个要处理的槽里
+        vec = &(tv1[timer_jiffies & TVR_MASK]);
+    } else {
+        idx = node->expire - timer_jiffies;
+        if(idx < TVR_SIZE){
+            vec = &(tv1[node->expire & TVR_MASK]);
         } else {
-            if(now - fmap->lasttime >= fmap->interval){
-                fmap->lasttime = now;
-                ret = fmap->func(fmap->arg);
-                if(ret > 0){
-                    debug(g_log, "%s, ret[%d]\n", fmap->info, ret);
-                } else if(ret < 0) {
-                    log(g_log, "%s error, ret[%d]\n", fmap->info, ret);
+            if(idx > TV_MAX){
+                node->expire = timer_jiffies + TV_MAX;
+                idx = TV_MAX;
+            }
+            for(n = 0; n < TVN_LEVEL - 1; n++){
+                if(idx < (1ULL << TV_SHIFT(n + 1))){
+                    break;
                 }
             }
+            vec = &(tvn[n][TV_INDEX(node->expire, n)]);
         }
     }
 
+    list_add_tail(&(node->link), vec);
+}
+
+/*
+ * fun: move one slot of upper level down to lower levels
+ * arg: level, slot index
+ * ret: slot index, 0 means upper level should cascade too
+ *
+ */
+
+static int timer_cascade(int n, int index)
+{
+    struct list_head list;
+    timer_node_t *node;
+
+    INIT_LIST_HEAD(&list);
+    list_splice_init(&(tvn[n][index]), &list);
+
+    while(!list_empty(&list)){
+        node = list_entry(list.next, timer_node_t, link);
+        list_del(&(node->link));
+        timer_internal_add(node);
+        timer_ncascade++;
+    }
+
+    return index;
+}
+
+/*
+ * fun: periodic timer callback, re-arm and call registered func
+ * arg: timer_func_map pointer
+ * ret: always return 0
+ *
+ */
+
+static int timer_periodic(unsigned long arg)
+{
+    int ret;
+    struct timer_func_map *fmap = (struct timer_func_map *)arg;
+
+    timer_add(&(fmap->node), fmap->interval * 1000);
+
+    ret = fmap->func(fmap->arg);
+    if(ret > 0){
+        debug(g_log, "%s, ret[%d]\n", fmap->info, ret);
+    } else if(ret < 0) {
+        log(g_log, "%s error, ret[%d]\n", fmap->info, ret);
+    }
+
     return 0;
 }
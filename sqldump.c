@@ -14,15 +14,16 @@
 #include <string.h>
 #include <stdio.h>
 #include <common.h>
+#include <clock.h>
 #include <sock.h>
 #include "conn_pool.h"
 #include "cli_pool.h"
 #include "my_pool.h"
 #include "mysql_com.h"
 
-static int sql_fd = -1;
-static int sql_count = 0;
-static char sqldump_fname[1024] = "./sql.log";
+static __thread int sql_fd = -1;
+static __thread int sql_count = 0;
+static __thread char sqldump_fname[1024] = "./sql.log";
 
 static int parse_req_sql(conn_t *c, char *buf, int len);
 
@@ -60,19 +61,12 @@ int sqldump(conn_t *c)
 {
     int res = 0, n, msec;
     char buf[8192], tmp[4096];
-    char timebuf[64];
     char ipstr[64];
-    time_t t;
-    struct tm tm;
 
     cli_conn_t *cli = c->cli;
     my_conn_t *my = c->my;
     my_node_t *node = my->node;
 
-    t = time(NULL);
-    localtime_r(&t, &tm);
-    strftime(timebuf, sizeof(timebuf), "%F %T", &tm);
-
     if((++sql_count % 1024) == 0){
         if(sql_fd >= 0){
             close(sql_fd);
@@ -83,13 +77,12 @@ int sqldump(conn_t *c)
     }
 
     ipint2str(ipstr, sizeof(ipstr), cli->ip);
-    msec = (c->tv_end.tv_sec - c->tv_start.tv_sec) * 1000 + \
-                        (c->tv_end.tv_usec - c->tv_start.tv_usec) / 1000;
+    msec = (int64_t)(c->us_end - c->us_start) / 1000;
 
     parse_req_sql(c, tmp, sizeof(tmp));
 
     n = snprintf(buf, sizeof(buf), "%s conn:%u %s:%d %s:%s %ums - %s\n", \
-                timebuf, c->connid, ipstr, cli->port, node->host, node->srv, msec, tmp);
+                clock_str(), c->connid, ipstr, cli->port, node->host, node->srv, msec, tmp);
     res = write(sql_fd, buf, n);
 
     return res;
@@ -0,0 +1,178 @@
+/*
+ * Copyright 2011-2013 Alibaba Group Holding Limited. All rights reserved.
+ * Use and distribution licensed under the GPL license.
+ *
+ * Authors: XiaoJinliang <xiaoshi.xjl@taobao.com>
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <log.h>
+#include <timer.h>
+#include <clock.h>
+#include "stats.h"
+#include "cli_pool.h"
+#include "my_pool.h"
+
+extern log_t *g_log;
+
+static stats_head_t *head = NULL;//fork之前映射好，所有子进程共享同一块内存
+static __thread stats_slot_t *slot = NULL;
+
+static int stats_update_timer(unsigned long arg);
+
+/*
+ * fun: create and map shared stats file
+ * arg: stats file path, empty means anonymous memory, worker number, thread number per worker
+ * ret: success 0, error -1
+ *
+ */
+
+int stats_init(const char *fname, int nworker, int nthread)
+{//必须在fork之前调用
+    int fd = -1, flags;
+    size_t size;
+    void *ptr;
+
+    size = sizeof(stats_head_t) + sizeof(stats_slot_t) * nworker * nthread;
+    flags = MAP_SHARED;
+
+    if( (fname == NULL) || (*fname == '\0') ){
+        flags |= MAP_ANONYMOUS;
+    } else {
+        if( (fd = open(fname, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0 ){
+            log_err(g_log, "open stats file %s error\n", fname);
+            return -1;
+        }
+
+        if(ftruncate(fd, size) < 0){
+            log_err(g_log, "ftruncate stats file %s error\n", fname);
+            close(fd);
+            return -1;
+        }
+    }
+
+    ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if(fd >= 0){
+        close(fd);
+    }
+    if(ptr == MAP_FAILED){
+        log_err(g_log, "mmap stats error\n");
+        return -1;
+    }
+
+    memset(ptr, 0, size);
+    head = (stats_head_t *)ptr;
+    head->magic = STATS_MAGIC;
+    head->version = STATS_VERSION;
+    head->nworker = nworker;
+    head->nthread = nthread;
+    head->nslot = nworker * nthread;
+    head->master_pid = getpid();
+    head->start_time = clock_sec();
+
+    return 0;
+}
+
+/*
+ * fun: record worker process start
+ * arg: worker index, worker pid
+ * ret: success 0, error -1
+ *
+ */
+
+int stats_worker_start(int worker, int pid)
+{//由父进程在fork之后调用，slot里原来有pid说明是重启
+    uint32_t i;
+    stats_slot_t *s;
+
+    if( (head == NULL) || (worker < 0) || ((uint32_t)worker >= head->nworker) ){
+        return -1;
+    }
+
+    for(i = 0; i < head->nthread; i++){
+        s = (stats_slot_t *)(head + 1) + worker * head->nthread + i;
+        if(s->pid != 0){
+            s->restarts++;
+        }
+        s->pid = pid;
+    }
+
+    return 0;
+}
+
+/*
+ * fun: bind this thread to its stats slot and register update timer
+ * arg: slot index, worker * nthread + thread
+ * ret: success 0, error -1
+ *
+ */
+
+int stats_thread_init(int idx)
+{//timer_init之后调用
+    if( (head == NULL) || (idx < 0) || ((uint32_t)idx >= head->nslot) ){
+        return -1;
+    }
+
+    slot = (stats_slot_t *)(head + 1) + idx;
+
+    if(timer_register(stats_update_timer, 0, "stats_update_timer", 1) < 0){
+        log(g_log, "stats_update_timer register error\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * fun: publish pool and connection counters of this thread
+ * arg: not used
+ * ret: always return 0
+ *
+ */
+
+static int stats_update_timer(unsigned long arg)
+{
+    unsigned long cli_cur, cli_total, my_total, my_used, my_avail, my_connecting, my_target;
+    unsigned long wait_cur, wait_total, wait_served, wait_timeout, wait_reject, wait_ms;
+    unsigned long ctx_hit, ctx_miss, ctx_saved;
+    unsigned long connect_count, connect_us;
+
+    cli_pool_stat(&cli_cur, &cli_total);
+    my_pool_stat(&my_total, &my_used, &my_avail, &my_connecting, &my_target);
+    my_pool_wait_stat(&wait_cur, &wait_total, &wait_served, &wait_timeout, &wait_reject, &wait_ms);
+    my_pool_ctx_stat(&ctx_hit, &ctx_miss, &ctx_saved);
+    my_pool_connect_stat(&connect_count, &connect_us);
+
+    __atomic_store_n(&(slot->seq), slot->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->update_time = clock_sec();
+    slot->cli_cur = cli_cur;
+    slot->cli_total = cli_total;
+    slot->my_total = my_total;
+    slot->my_used = my_used;
+    slot->my_avail = my_avail;
+    slot->my_connecting = my_connecting;
+    slot->wait_cur = wait_cur;
+    slot->wait_total = wait_total;
+    slot->wait_served = wait_served;
+    slot->wait_timeout = wait_timeout;
+    slot->wait_reject = wait_reject;
+    slot->wait_ms = wait_ms;
+    slot->my_target = my_target;
+    slot->ctx_hit = ctx_hit;
+    slot->ctx_miss = ctx_miss;
+    slot->ctx_saved = ctx_saved;
+    slot->connect_count = connect_count;
+    slot->connect_us = connect_us;
+    __atomic_store_n(&(slot->seq), slot->seq + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdint.h>
+
+#define STATS_MAGIC 0x5352594d //"MYRS"
+#define STATS_VERSION 5
+
+//共享内存统计文件的格式: stats_head_t后面跟着nslot个stats_slot_t
+//每个slot对应一个进程里的一个线程，只有这个线程自己写
+typedef struct{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nworker;//进程数
+    uint32_t nthread;//每个进程的线程数
+    uint32_t nslot;//nworker * nthread
+    int32_t  master_pid;
+    uint64_t start_time;
+} stats_head_t;
+
+typedef struct{
+    uint32_t seq;//写的时候是奇数，读的人看到奇数或者前后不一致要重读
+    int32_t  pid;
+    uint32_t restarts;//这个进程被重启的次数
+    uint32_t pad;
+    uint64_t update_time;
+    uint64_t cli_cur;//当前客户端连接数
+    uint64_t cli_total;//累计接受的客户端连接数
+    uint64_t my_total;//mysql连接数，包括死的
+    uint64_t my_used;
+    uint64_t my_avail;
+    uint64_t my_connecting;
+    uint64_t wait_cur;//当前排队等mysql连接的客户端数
+    uint64_t wait_total;//累计排队次数
+    uint64_t wait_served;//累计排到连接的次数
+    uint64_t wait_timeout;//累计排队超时次数
+    uint64_t wait_reject;//累计队列满拒绝次数
+    uint64_t wait_ms;//排到连接的累计等待毫秒数
+    uint64_t my_target;//连接池控制算出来的目标连接数
+    uint64_t ctx_hit;//借到的连接库名和SET NAMES跟客户端一样的次数
+    uint64_t ctx_miss;//借到的连接要先换库或者重放SET NAMES的次数
+    uint64_t ctx_saved;//按库名挑连接省掉的换库或者重放次数
+    uint64_t connect_count;//累计连上并验证成功的mysql连接数
+    uint64_t connect_us;//这些连接从connect到验证成功的累计微秒数
+} stats_slot_t;
+
+int stats_init(const char *fname, int nworker, int nthread);
+int stats_worker_start(int worker, int pid);
+int stats_thread_init(int slot);
+
+#endif
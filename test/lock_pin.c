@@ -0,0 +1,284 @@
+/*
+ * lock_pin: check that statements leaving state on a mysql connection pin it
+ *
+ * usage: lock_pin host port user passwd
+ *
+ * Run it against myrelay with pool_mode transaction. Between the two
+ * statements of each pair the other client opens a transaction, which
+ * takes the connection just given back to the pool, so without pinning the
+ * second statement runs on a different connection.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "../passwd.h"
+#include "../mysql_com.h"
+
+#define LOCK_NAME "myrelay_lock_pin"
+
+typedef struct{
+    int fd;
+    uint8_t pkt[65536];
+    uint32_t len;
+} client_t;
+
+static int fails = 0;
+
+/*
+ * fun: read exactly n bytes
+ * arg: fd, buffer, bytes
+ * ret: success 0, error -1
+ *
+ */
+
+static int read_n(int fd, uint8_t *ptr, size_t n)
+{
+    ssize_t r;
+
+    while(n > 0){
+        if( (r = read(fd, ptr, n)) <= 0 ){
+            return -1;
+        }
+        ptr += r;
+        n -= r;
+    }
+
+    return 0;
+}
+
+/*
+ * fun: read one mysql packet into cl->pkt
+ * arg: client
+ * ret: success 0, error -1
+ *
+ */
+
+static int read_pkt(client_t *cl)
+{
+    uint8_t hdr[4];
+
+    if(read_n(cl->fd, hdr, 4) < 0){
+        return -1;
+    }
+
+    cl->len = hdr[0] | (hdr[1] << 8) | (hdr[2] << 16);
+    if(cl->len > sizeof(cl->pkt)){
+        return -1;
+    }
+
+    return read_n(cl->fd, cl->pkt, cl->len);
+}
+
+/*
+ * fun: send one mysql packet
+ * arg: client, sequence number, payload, payload length
+ * ret: success 0, error -1
+ *
+ */
+
+static int send_pkt(client_t *cl, int seq, const uint8_t *ptr, uint32_t len)
+{
+    uint8_t out[1024];
+
+    if(len + 4 > sizeof(out)){
+        return -1;
+    }
+
+    out[0] = len & 0xff;
+    out[1] = (len >> 8) & 0xff;
+    out[2] = (len >> 16) & 0xff;
+    out[3] = seq;
+    memcpy(out + 4, ptr, len);
+
+    return (write(cl->fd, out, len + 4) == (ssize_t)(len + 4)) ? 0 : -1;
+}
+
+/*
+ * fun: connect and log in with mysql_native_password
+ * arg: client, host, port, user, password
+ * ret: success 0, error -1
+ *
+ */
+
+static int client_open(client_t *cl, const char *host, const char *port, const char *user, const char *pass)
+{
+    int on = 1, m;
+    uint32_t cap, maxpkt = 1 << 24;
+    uint8_t *p, out[512];
+    char salt[21], token[20];
+    struct addrinfo hints, *res;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host, port, &hints, &res) != 0){
+        return -1;
+    }
+
+    cl->fd = socket(res->ai_family, SOCK_STREAM, 0);
+    if( (cl->fd < 0) || connect(cl->fd, res->ai_addr, res->ai_addrlen) < 0 ){
+        freeaddrinfo(res);
+        return -1;
+    }
+    freeaddrinfo(res);
+    setsockopt(cl->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    //握手包: 协议版本、版本字符串、线程id、盐的前8字节、...、盐的后12字节
+    if(read_pkt(cl) < 0){
+        return -1;
+    }
+    p = cl->pkt + 1;
+    p += strlen((char *)p) + 1;
+    memcpy(salt, p + 4, 8);
+    memcpy(salt + 8, p + 4 + 8 + 1 + 2 + 1 + 2 + 2 + 1 + 10, 12);
+    salt[20] = '\0';
+
+    cap = CLIENT_LONG_PASSWORD | CLIENT_PROTOCOL_41 | CLIENT_TRANSACTIONS | CLIENT_SECURE_CONNECTION;
+    memcpy(out, &cap, 4);
+    memcpy(out + 4, &maxpkt, 4);
+    out[8] = 33;
+    memset(out + 9, 0, 23);
+    m = 32;
+    strcpy((char *)out + m, user);
+    m += strlen(user) + 1;
+    if(pass[0] != '\0'){
+        scramble(token, salt, pass);
+        out[m++] = 20;
+        memcpy(out + m, token, 20);
+        m += 20;
+    } else {
+        out[m++] = 0;
+    }
+
+    if( (send_pkt(cl, 1, out, m) < 0) || (read_pkt(cl) < 0) ){
+        return -1;
+    }
+
+    return (cl->pkt[0] == 0) ? 0 : -1;
+}
+
+/*
+ * fun: run query, keep first column of first row
+ * arg: client, sql, value buffer, buffer size
+ * ret: row 1, ok without rows 0, error -1
+ *
+ */
+
+static int client_query(client_t *cl, const char *sql, char *val, size_t size)
+{
+    int rows = 0, res = 0;
+    uint8_t out[1024];
+    uint32_t len;
+
+    out[0] = COM_QUERY;
+    len = strlen(sql);
+    memcpy(out + 1, sql, len);
+    strcpy(val, "NULL");
+
+    if( (send_pkt(cl, 0, out, len + 1) < 0) || (read_pkt(cl) < 0) ){
+        return -1;
+    }
+    if(cl->pkt[0] == 0xff){
+        fprintf(stderr, "%s: error %.*s\n", sql, (int)cl->len - 9, cl->pkt + 9);
+        return -1;
+    }
+    if(cl->pkt[0] == 0){
+        return 0;
+    }
+
+    //列定义一直读到EOF，再读行到EOF
+    do{
+        if(read_pkt(cl) < 0){
+            return -1;
+        }
+    } while( !((cl->pkt[0] == 0xfe) && (cl->len < 9)) );
+
+    while(1){
+        if(read_pkt(cl) < 0){
+            return -1;
+        }
+        if( (cl->pkt[0] == 0xfe) && (cl->len < 9) ){
+            break;
+        }
+        if( (rows++ == 0) && (cl->pkt[0] != 0xfb) && (cl->pkt[0] < size) ){
+            memcpy(val, cl->pkt + 1, cl->pkt[0]);
+            val[cl->pkt[0]] = '\0';
+            res = 1;
+        }
+    }
+
+    return res;
+}
+
+/*
+ * fun: run query and compare first value
+ * arg: client, sql, expected value
+ * ret: void
+ *
+ */
+
+static void expect(client_t *cl, const char *sql, const char *want)
+{
+    char val[256];
+
+    if( (client_query(cl, sql, val, sizeof(val)) < 0) || strcmp(val, want) ){
+        printf("FAIL %s: got %s, want %s\n", sql, val, want);
+        fails++;
+    } else {
+        printf("ok   %s -> %s\n", sql, val);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    char val[256];
+    client_t a, b;
+
+    if(argc < 5){
+        fprintf(stderr, "usage: %s host port user passwd\n", argv[0]);
+        return 2;
+    }
+
+    if( (client_open(&a, argv[1], argv[2], argv[3], argv[4]) < 0) || \
+            (client_open(&b, argv[1], argv[2], argv[3], argv[4]) < 0) ){
+        fprintf(stderr, "connect or login error\n");
+        return 2;
+    }
+
+    //另一个客户端在两条语句中间开事务，占住刚还回去的连接，没绑定的话第二条语句只能借别的连接
+    expect(&a, "SELECT GET_LOCK('" LOCK_NAME "', 0)", "1");
+    client_query(&b, "BEGIN", val, sizeof(val));
+    expect(&b, "SELECT IS_FREE_LOCK('" LOCK_NAME "')", "0");
+    expect(&a, "SELECT RELEASE_LOCK('" LOCK_NAME "')", "1");
+    client_query(&b, "COMMIT", val, sizeof(val));
+
+    expect(&a, "SELECT @lock_pin := 42", "42");
+    client_query(&b, "BEGIN", val, sizeof(val));
+    expect(&a, "SELECT @lock_pin", "42");
+    client_query(&b, "COMMIT", val, sizeof(val));
+
+    client_query(&b, "SELECT 7 INTO @lock_pin", val, sizeof(val));
+    client_query(&a, "BEGIN", val, sizeof(val));
+    expect(&b, "SELECT @lock_pin", "7");
+    client_query(&a, "COMMIT", val, sizeof(val));
+
+    expect(&b, "SELECT SQL_CALC_FOUND_ROWS 1 LIMIT 1", "1");
+    client_query(&a, "BEGIN", val, sizeof(val));
+    expect(&b, "SELECT FOUND_ROWS()", "1");
+    client_query(&a, "COMMIT", val, sizeof(val));
+
+    close(a.fd);
+    close(b.fd);
+
+    printf("%s\n", fails ? "FAIL" : "PASS");
+
+    return fails ? 1 : 0;
+}
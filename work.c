@@ -18,57 +18,56 @@
 #include <log.h>
 #include <sock.h>
 #include <handler.h>
+#include <clock.h>
 #include "my_ops.h"
 #include "conn_pool.h"
 #include "my_pool.h"
 #include "my_conf.h"
+#include "my_shard.h"
+#include "stats.h"
 
 extern log_t *g_log;
 extern struct conf_t g_conf;
-extern int g_usr1_reload;
-extern int g_cursecond ;
-extern int g_run ;
+extern volatile int g_usr1_reload;
+extern volatile int g_run ;
+extern int g_worker_index;
 
-static my_conf_t myconf_cur, myconf_new;
+static __thread my_conf_t myconf_cur, myconf_new;
+static __thread int thread_index;//线程序号，用来计算分到的连接数
+static __thread int usr1_gen;//已经处理过的USR1次数
 
 static int accept_client_cb(int listenfd, void *arg);
 static int usr1_reload(void);
+static int usr1_reload_nodes(int role, my_node_conf_t *curs, int ccount, my_node_conf_t *news, int ncount);
+static int handler_status_timer(unsigned long arg);
+static int thread_share(int num, int least);
 
 /*
- * fun: real work process
- * arg: listen fd
+ * fun: real work process, one per event loop thread
+ * arg: listen fd, thread index
  * ret: it should not return
  *
  */
 
-int work(int fd)
-{
-    int i, res = 0, level;
+int work(int fd, int index)
+{//每个线程有自己的handler、定时器和各个连接池，线程之间不共享任何连接
+    int i, res = 0;
     my_node_conf_t *mynode;
 
-    // log init
-    if(!strcmp(g_conf.loglevel, "none")){
-        level = LOG_NONE;
-    } else if(!strcmp(g_conf.loglevel, "log")) {
-        level = LOG_LEVEL_LOG;
-    } else if(!strcmp(g_conf.loglevel, "debug")) {
-        level = LOG_LEVEL_DEBUG;
-    } else if(!strcmp(g_conf.loglevel, "info")) {
-        level = LOG_LEVEL_INFO;
-    } else {
-        level = LOG_LEVEL_LOG;
-    }
+    thread_index = index;
+    usr1_gen = g_usr1_reload;
 
-    if( (g_log = log_init(g_conf.log, level)) == NULL ){
-        fprintf(stderr, "log init error\n");
-        exit(-1);
+    clock_init();//这个线程的时间由epoll_handler每轮刷新
+
+    if(handler_set_backend(g_conf.event_backend) < 0){
+        log(g_log, "unknown event_backend %s, use epoll\n", g_conf.event_backend);
     }
 
     if(init_handler( MAX_EVENT ) < 0){
         log(g_log, "handler init error\n");
         exit(-1);
     } else {
-        log(g_log, "handler init success\n");
+        log(g_log, "handler init success, backend %s\n", handler_backend_name());
     }
 
     // timer init must before cli_pool_init conn_pool_init my_pool_init
@@ -79,8 +78,17 @@ int work(int fd)
         log(g_log, "timer_init success\n");
     }
 
+    if(timer_register(handler_status_timer, 0, "handler_status_timer", 10) < 0){
+        log(g_log, "handler_status_timer register error\n");
+        exit(-1);
+    }
+
+    if(stats_thread_init(g_worker_index * g_conf.threads + thread_index) < 0){
+        log(g_log, "stats_thread_init error, stats disabled\n");
+    }
+
     // client connection pool init
-    if(cli_pool_init(g_conf.max_connections) < 0){
+    if(cli_pool_init(thread_share(g_conf.max_connections, 1)) < 0){
         log(g_log, "client pool init error\n");
         exit(-1);
     } else {
@@ -88,7 +96,7 @@ int work(int fd)
     }
 
     // connection pool init
-    if(conn_pool_init(g_conf.max_connections) < 0){
+    if(conn_pool_init(thread_share(g_conf.max_connections, 1)) < 0){
         log(g_log, "conn pool init error\n");
         exit(-1);
     } else {
@@ -96,7 +104,7 @@ int work(int fd)
     }
 
     // mysql connection pool init
-    if(my_pool_init(g_conf.max_connections) < 0){//设置mysql连接的初始化结构，各种定时器等
+    if(my_pool_init(thread_share(g_conf.max_connections, 1)) < 0){//设置mysql连接的初始化结构，各种定时器等
         log(g_log, "mysql pool init error\n");
         exit(-1);
     } else {
@@ -118,17 +126,34 @@ int work(int fd)
     if(res < 0){
         log(g_log, "mysql_conf_parse %s error\n", g_conf.mysql_conf);
     }
+    shard_set(&myconf_cur);//reload时拷贝到myconf_cur，分片规则跟着换
 
     res = mysql_conf_parse(g_conf.mysql_conf, &myconf_new);
     if(res < 0){
         log(g_log, "mysql_conf_parse %s error\n", g_conf.mysql_conf);
     }
 
+    my_pool_set_connect_rate(g_conf.connect_rate ? thread_share(g_conf.connect_rate, 1) : 0);//0不限速
+
+    if( (res = my_pool_set_policy(myconf_cur.policy)) < 0 ){
+        log(g_log, "my_pool_set_policy %s error\n", myconf_cur.policy);
+    }
+
+    for(i = 0; i < myconf_cur.mcount; i++){//提前连接master
+        mynode = &(myconf_cur.master[i]);
+        res = my_node_reg(MY_ROLE_MASTER, mynode->group, mynode->host, mynode->port, mynode->user, mynode->pass, \
+                            thread_share(mynode->cnum, 0), thread_share(mynode->maxnum, 1), mynode->weight);
+        if(res < 0){
+            log(g_log, "my_node_reg master error\n");
+        }
+    }
+
     for(i = 0; i < myconf_cur.scount; i++){//提前连接slave
         mynode = &(myconf_cur.slave[i]);
-        res = my_slave_reg(mynode->host, mynode->port, mynode->user, mynode->pass, mynode->cnum, mynode->maxnum );
+        res = my_node_reg(MY_ROLE_SLAVE, mynode->group, mynode->host, mynode->port, mynode->user, mynode->pass, \
+                            thread_share(mynode->cnum, 0), thread_share(mynode->maxnum, 1), mynode->weight);
         if(res < 0){
-            log(g_log, "my_slave_reg error\n");
+            log(g_log, "my_node_reg slave error\n");
         }
     }
 
@@ -141,12 +166,11 @@ int work(int fd)
     }
 
     while( g_run ){
-        res = epoll_handler(1000);
-		g_cursecond = time(NULL);
+        res = epoll_handler(timer_next(1000));//最近一个定时器到期就醒来
         // timer
         timer();
         // catch usr1 signal
-        if(g_usr1_reload){
+        if(g_usr1_reload != usr1_gen){
             usr1_reload();
         }
     }
@@ -177,16 +201,9 @@ static int accept_client_cb(int listenfd, void *arg)
     conn_t *c;
 
 
-    while(1){//一次接收完所有客户端
-        if(!my_pool_have_conn()){//如果没有足够的mysql连接了，不接受这个accept，也就不会接收accept这个客户端连接。
-			//其实这个完全可以在验证成功后再做，不然容易被攻击。
-			//尝试创建新的连接。
-			int tmpres = my_try_increase_connection() ;//由于这里实惠预先分配的机制，也就是，就算待会没有新人了，也会创建一个连接
-            log(g_log, "mysql pool is empty, my_try_increase_connection res[%d], waiting\n", tmpres);
-            break;
-        }
+    while(1){//一次接收完所有客户端，mysql连接不够的时候验证成功后再排队
         clen = sizeof(cliaddr);
-        clientfd = accept_client(listenfd, &cliaddr, &clen);
+        clientfd = handler_accept(listenfd, &cliaddr, &clen);
         if(clientfd < 0){
             if(errno != EAGAIN){
                 log_err(g_log, "accept client error\n");
@@ -196,7 +213,7 @@ static int accept_client_cb(int listenfd, void *arg)
 
         if( (res = setnonblock(clientfd)) < 0 ){
             log(g_log, "fd[%d] setnonblock error\n", clientfd);
-            close(clientfd);
+            close_handler(clientfd);
         }
 
         clientip = ntohl(cliaddr.sin_addr.s_addr);
@@ -204,13 +221,15 @@ static int accept_client_cb(int listenfd, void *arg)
 
         if( (c = conn_open(clientfd, clientip, clientport)) == NULL ){//分配conn_t和cli_conn_t， 并挂接起来
             log(g_log, "connection alloc fail, close connection\n");
-            close(clientfd);
+            close_handler(clientfd);
+            continue;
         }
 
 
         if( (res = cli_hs_stage1_prepare(c)) < 0 ){
             log(g_log, "conn:%d cli_hs_sate1_prepare error, close connection\n", c->connid);
             conn_close(c);
+            continue;
         }
         info(g_log, "conn:%d client[%s:%d] connection accept\n", c->connid, inet_ntoa(cliaddr.sin_addr), ntohs(cliaddr.sin_port));
     }
@@ -218,6 +237,35 @@ static int accept_client_cb(int listenfd, void *arg)
     return 0;
 }
 
+/*
+ * fun: log epoll syscall and timer wheel count of last interval
+ * arg: not used
+ * ret: always return 0
+ *
+ */
+
+static int handler_status_timer(unsigned long arg)
+{
+    static __thread unsigned long lastwait = 0, lastctl = 0;
+    static __thread unsigned long lastadd = 0, lastfire = 0, lastcascade = 0;
+    unsigned long nwait, nctl, nadd, nfire, ncascade;
+
+    handler_stat(&nwait, &nctl);
+    timer_stat(&nadd, &nfire, &ncascade);
+
+    log(g_log, "%s wait:%lu ctl:%lu timer add:%lu fire:%lu cascade:%lu\n", \
+                handler_backend_name(), nwait - lastwait, nctl - lastctl, \
+                nadd - lastadd, nfire - lastfire, ncascade - lastcascade);
+
+    lastwait = nwait;
+    lastctl = nctl;
+    lastadd = nadd;
+    lastfire = nfire;
+    lastcascade = ncascade;
+
+    return 0;
+}
+
 /*
  * fun: reload mysql config
  * arg:
@@ -227,16 +275,15 @@ static int accept_client_cb(int listenfd, void *arg)
 
 static int usr1_reload(void)
 {
-    int i, j, res;
-    my_node_conf_t *cur, *new;
+    int res;
 
-    if(!g_usr1_reload){
+    if(g_usr1_reload == usr1_gen){
         return 0;
     } else {
-        log(g_log, "catch usr1 signal\n");
+        log(g_log, "worker %d thread %d catch usr1 signal\n", g_worker_index, thread_index);
     }
 
-    g_usr1_reload = 0;
+    usr1_gen = g_usr1_reload;
 
     res = mysql_conf_parse(g_conf.mysql_conf, &myconf_new);
     if(res < 0){
@@ -244,37 +291,85 @@ static int usr1_reload(void)
         return -1;
     }
 
-    for(i = 0; i < myconf_cur.scount; i++){
-        cur = &(myconf_cur.slave[i]);
-        for(j = 0; j < myconf_new.scount; j++){
-            new = &(myconf_new.slave[j]);
+    usr1_reload_nodes(MY_ROLE_MASTER, myconf_cur.master, myconf_cur.mcount, myconf_new.master, myconf_new.mcount);
+    usr1_reload_nodes(MY_ROLE_SLAVE, myconf_cur.slave, myconf_cur.scount, myconf_new.slave, myconf_new.scount);
+
+    my_pool_set_policy(myconf_new.policy);
+    my_pool_resolve_all();//留下的节点也在后台重新解析一次
+
+    myconf_cur = myconf_new;
+
+    return 0;
+}
+
+/*
+ * fun: reload master or slave nodes
+ * arg: role, current nodes and number, new nodes and number
+ * ret: always return 0
+ *
+ */
+
+static int usr1_reload_nodes(int role, my_node_conf_t *curs, int ccount, my_node_conf_t *news, int ncount)
+{//新配置里没有的下线，新加的注册，都有的只改权重；换了组的算先下线再注册
+    int i, j;
+    my_node_conf_t *cur, *new;
+
+    for(i = 0; i < ccount; i++){
+        cur = &(curs[i]);
+        for(j = 0; j < ncount; j++){
+            new = &(news[j]);
             if((!strcmp(new->host, cur->host)) && \
-                                (!strcmp(new->port, cur->port))){
+                                (!strcmp(new->port, cur->port)) && (new->group == cur->group)){
                 break;
             }
         }
 
-        if(j == myconf_new.scount){
-            my_unreg(cur->host, cur->port);
+        if(j == ncount){
+            my_unreg(role, cur->group, cur->host, cur->port);
         }
     }
 
-    for(i = 0; i < myconf_new.scount; i++){
-        new = &(myconf_new.slave[i]);
-        for(j = 0; j < myconf_cur.scount; j++){
-            cur = &(myconf_cur.slave[j]);
+    for(i = 0; i < ncount; i++){
+        new = &(news[i]);
+        for(j = 0; j < ccount; j++){
+            cur = &(curs[j]);
             if((!strcmp(new->host, cur->host)) && \
-                                (!strcmp(new->port, cur->port))){
+                                (!strcmp(new->port, cur->port)) && (new->group == cur->group)){
                 break;
             }
         }
 
-        if(j == myconf_cur.scount){
-            my_slave_reg(new->host, new->port, new->user, new->pass, new->cnum, new->maxnum);
+        if(j < ccount){//已经有的节点只改权重，连接不动
+            if(new->weight != cur->weight){
+                my_node_set_weight(role, new->group, new->host, new->port, new->weight);
+            }
+        } else {
+            my_node_reg(role, new->group, new->host, new->port, new->user, new->pass, \
+                        thread_share(new->cnum, 0), thread_share(new->maxnum, 1), new->weight);
         }
     }
 
-    myconf_cur = myconf_new;
-
     return 0;
 }
+
+/*
+ * fun: share of num for this thread
+ * arg: total number, least share
+ * ret: share of this thread
+ *
+ */
+
+static int thread_share(int num, int least)
+{//所有进程的所有线程一起分，余数分给序号小的线程
+    int share, parts, index;
+
+    parts = g_conf.worker * g_conf.threads;
+    index = g_worker_index * g_conf.threads + thread_index;
+
+    share = num / parts;
+    if(index < (num % parts)){
+        share++;
+    }
+
+    return (share < least) ? least : share;
+}